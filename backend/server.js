@@ -3,10 +3,13 @@ const multer = require('multer');
 const cors = require('cors');
 const fs = require('fs');
 const path = require('path');
+const net = require('net');
 const { exec } = require('child_process');
 
 const app = express();
 const PORT = 3001;
+// Socket of a running fp16-demote-server; without it every request runs clang
+const SERVER_SOCKET = process.env.FP16_SERVER_SOCKET;
 
 // Middleware
 app.use(cors());
@@ -19,14 +22,12 @@ const storage = multer.diskStorage({
         if (!fs.existsSync(uploadsDir)) {
             fs.mkdirSync(uploadsDir, { recursive: true });
         }
-        cb(null, uploadsDir);
+        // Every upload gets its own directory, so uploads never overwrite
+        // each other and can keep their original names
+        cb(null, fs.mkdtempSync(path.join(uploadsDir, 'upload-')));
     },
     filename: (req, file, cb) => {
-        // Keep original filename with timestamp to avoid conflicts
-        const timestamp = Date.now();
-        const ext = path.extname(file.originalname);
-        const name = path.basename(file.originalname, ext);
-        cb(null, `${name}_${timestamp}${ext}`);
+        cb(null, path.basename(file.originalname));
     }
 });
 
@@ -47,17 +48,32 @@ const upload = multer({
     }
 });
 
-// Function to run the FP16 demotion plugin
+// Function to run the FP16 demotion plugin. Every run writes into its own
+// output directory, so concurrent analyses never see each other's results.
 function runFp16Plugin(filePath) {
     return new Promise((resolve, reject) => {
         const workingDir = path.dirname(filePath);
         const fileName = path.basename(filePath);
+        const outputDir = fs.mkdtempSync(path.join(workingDir, `${path.parse(fileName).name}.out-`));
         
         // Path to your plugin
         const pluginPath = path.resolve(__dirname, '../build/libfp16DemotionPlugin.dylib');
         const clangPath = '/opt/homebrew/opt/llvm/bin/clang'; // Use homebrew clang that matches plugin build
+        // The file is compiled by its original name from inside its upload
+        // directory, so an identical upload under the same name reuses the
+        // plugin's cached analysis instead of re-running it
+        const cacheDir = path.join(__dirname, '.fp16-cache');
         
-        const command = `cd "${workingDir}" && "${clangPath}" -fplugin="${pluginPath}" "${fileName}" -Xclang -plugin-arg-fp16-demotion -Xclang -fprecision-demote=fp16 -c 2>&1`;
+        const pluginArgs = [
+            '-fprecision-demote=fp16',
+            `-fprecision-demote-cache=${cacheDir}`,
+            `-fprecision-demote-output-dir=${outputDir}`,
+            // One fp16_report.json instead of three files
+            '-fprecision-demote-combined'
+        ].map(arg => `-Xclang -plugin-arg-fp16-demotion -Xclang "${arg}"`).join(' ');
+        const objectPath = path.join(outputDir, 'out.o');
+
+        const command = `cd "${workingDir}" && "${clangPath}" -fplugin="${pluginPath}" "${fileName}" ${pluginArgs} -c -o "${objectPath}" 2>&1`;
         
         console.log('Executing command:', command);
         
@@ -66,7 +82,7 @@ function runFp16Plugin(filePath) {
                 success: !error,
                 stdout: stdout,
                 stderr: stderr,
-                workingDir: workingDir
+                outputDir: outputDir
             };
             
             if (error) {
@@ -79,39 +95,55 @@ function runFp16Plugin(filePath) {
     });
 }
 
-// Function to read generated files
-function readGeneratedFiles(workingDir) {
+// Function to analyze source text on the fp16-demote-server. The server
+// answers one JSON request per connection once we end our side.
+function runFp16Server(source, fileName) {
+    return new Promise((resolve) => {
+        const socket = net.createConnection(SERVER_SOCKET);
+        const chunks = [];
+        socket.on('data', chunk => chunks.push(chunk));
+        socket.on('end', () => {
+            try {
+                const response = JSON.parse(Buffer.concat(chunks).toString('utf8'));
+                const report = response.report || {};
+                resolve({
+                    success: response.success,
+                    stdout: '',
+                    stderr: response.diagnostics || '',
+                    error: response.error,
+                    files: {
+                        demotedCode: report.demoted_code,
+                        memoryAnalysis: report.memory_analysis,
+                        jsonAnalysis: report.float_map
+                    }
+                });
+            } catch (parseError) {
+                resolve({ success: false, stdout: '', stderr: '', error: parseError.message, files: {} });
+            }
+        });
+        socket.on('error', (error) => {
+            console.error('Analysis server error:', error);
+            resolve({ success: false, stdout: '', stderr: '', error: error.message, files: {} });
+        });
+        socket.end(JSON.stringify({ source: source, file: fileName }));
+    });
+}
+
+// Function to read the combined report of one run and remove its output
+// directory. The plugin renames the report into place once complete, so it
+// is either missing or whole.
+function readGeneratedFiles(outputDir) {
     const files = {};
     
     try {
-        // Read demoted code
-        const demotedPath = path.join(workingDir, 'demoted.c');
-        if (fs.existsSync(demotedPath)) {
-            files.demotedCode = fs.readFileSync(demotedPath, 'utf8');
-        }
-        
-        // Read memory analysis
-        const memoryAnalysisPath = path.join(workingDir, 'memory_analysis.txt');
-        if (fs.existsSync(memoryAnalysisPath)) {
-            files.memoryAnalysis = fs.readFileSync(memoryAnalysisPath, 'utf8');
-        }
-        
-        // Read JSON analysis
-        const jsonPath = path.join(workingDir, 'float_map.json');
-        if (fs.existsSync(jsonPath)) {
+        const reportPath = path.join(outputDir, 'fp16_report.json');
+        if (fs.existsSync(reportPath)) {
             try {
-                let jsonData = fs.readFileSync(jsonPath, 'utf8');
-                
-                // Fix JSON issues:
-                // 1. Replace non-breaking spaces with regular spaces
-                jsonData = jsonData.replace(/\u00A0/g, ' ');
-                // 2. Fix unquoted inf values
-                jsonData = jsonData
-                    .replace(/:\s*inf\s*,/g, ': "Infinity",')
-                    .replace(/:\s*inf\s*}/g, ': "Infinity"}')
-                    .replace(/:\s*inf\s*$/gm, ': "Infinity"');
-                
-                files.jsonAnalysis = JSON.parse(jsonData);
+                // The plugin emits strict JSON (non-finite numbers as "Infinity"/"NaN")
+                const report = JSON.parse(fs.readFileSync(reportPath, 'utf8'));
+                files.demotedCode = report.demoted_code;
+                files.memoryAnalysis = report.memory_analysis;
+                files.jsonAnalysis = report.float_map;
                 console.log('Successfully parsed JSON with', files.jsonAnalysis.length, 'items');
             } catch (jsonError) {
                 console.error('JSON parsing error:', jsonError);
@@ -120,6 +152,8 @@ function readGeneratedFiles(workingDir) {
         }
     } catch (error) {
         console.error('Error reading generated files:', error);
+    } finally {
+        fs.rmSync(outputDir, { recursive: true, force: true });
     }
     
     return files;
@@ -144,11 +178,15 @@ app.post('/analyze', upload.single('codeFile'), async (req, res) => {
         // Read original file content
         const originalContent = fs.readFileSync(req.file.path, 'utf8');
         
-        // Run the plugin
-        const pluginResult = await runFp16Plugin(req.file.path);
-        
-        // Read generated files
-        const generatedFiles = readGeneratedFiles(path.dirname(req.file.path));
+        // Run the analysis on the server if there is one, else the plugin
+        let pluginResult, generatedFiles;
+        if (SERVER_SOCKET) {
+            pluginResult = await runFp16Server(originalContent, req.file.originalname);
+            generatedFiles = pluginResult.files;
+        } else {
+            pluginResult = await runFp16Plugin(req.file.path);
+            generatedFiles = readGeneratedFiles(pluginResult.outputDir);
+        }
         
         // Clean up the uploaded file (optional)
         // fs.unlinkSync(req.file.path);
@@ -0,0 +1,73 @@
+//===- Fp16ConvertBench.cpp - Throughput of the fp16_runtime.h kernels ----===//
+//
+// Usage: fp16-convert-bench [ELEMENTS...]
+//
+// Times every supported kernel in both directions and reports GB/s, counting
+// the bytes read and written. The default sizes fit in L1, fit in L2 and
+// come from memory. Each measurement is the best of several runs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "fp16_runtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+template <typename Fn> static double bestSeconds(Fn Run, size_t Elements) {
+    // Repeat small sizes so each sample takes long enough to time.
+    size_t Repeats = std::max<size_t>(1, (size_t(1) << 24) / std::max<size_t>(Elements, 1));
+    double Best = 1e30;
+    for (int Sample = 0; Sample < 5; ++Sample) {
+        auto Start = std::chrono::steady_clock::now();
+        for (size_t I = 0; I < Repeats; ++I)
+            Run();
+        std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+        Best = std::min(Best, Elapsed.count() / Repeats);
+    }
+    return Best;
+}
+
+static void benchmark(size_t Elements) {
+    std::vector<float> Floats(Elements);
+    std::vector<fp16_storage_t> Halves(Elements);
+    for (size_t I = 0; I < Elements; ++I)
+        Floats[I] = float(I % 2048) / 64.0f - 16.0f;
+    double Bytes = double(Elements) * (sizeof(float) + sizeof(fp16_storage_t));
+
+    std::printf("%zu elements (%.1f KiB of float):\n", Elements,
+                Elements * sizeof(float) / 1024.0);
+    for (int I = FP16_ISA_SCALAR; I < FP16_ISA_COUNT; ++I) {
+        fp16_isa Isa = fp16_isa(I);
+        if (!fp16_isa_supported(Isa))
+            continue;
+        double ToHalf = bestSeconds(
+            [&] { fp16_from_float_array_isa(Isa, Halves.data(), Floats.data(), Elements); },
+            Elements);
+        double ToFloat = bestSeconds(
+            [&] { fp16_to_float_array_isa(Isa, Floats.data(), Halves.data(), Elements); },
+            Elements);
+        std::printf("  %-8s float->half %8.2f GB/s   half->float %8.2f GB/s%s\n",
+                    fp16_isa_name(Isa), Bytes / ToHalf / 1e9, Bytes / ToFloat / 1e9,
+                    Isa == fp16_best_isa() ? "   (selected)" : "");
+    }
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> Sizes;
+    for (int I = 1; I < argc; ++I) {
+        char *End;
+        unsigned long long N = std::strtoull(argv[I], &End, 10);
+        if (*End || !N) {
+            std::fprintf(stderr, "usage: %s [ELEMENTS...]\n", argv[0]);
+            return 1;
+        }
+        Sizes.push_back(size_t(N));
+    }
+    if (Sizes.empty())
+        Sizes = {4096, 65536, 16 << 20};
+    for (size_t Elements : Sizes)
+        benchmark(Elements);
+    return 0;
+}
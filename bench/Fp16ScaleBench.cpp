@@ -0,0 +1,442 @@
+//===- Fp16ScaleBench.cpp - Scalability benchmark of the plugin -----------===//
+//
+// Usage: fp16-scale-bench [--sweep=DIM] [--scales=1,2,4,8] [--baseline=FILE]
+//
+// Generates synthetic C translation units, runs clang with the plugin over
+// each and reports wall time, CPU time, peak RSS and KLOC per second. The
+// shape of a unit is set by --functions, --locals, --tables, --table-size,
+// --expr-depth and --structs; the dimension named by --sweep is multiplied
+// by each of --scales in turn, the others stay fixed.
+//
+// A sweep fails if the time of a step grows faster than
+// (size ratio)^--max-exponent, or if a case is slower or larger than the
+// same case in the baseline by more than --tolerance percent. Without a
+// baseline file, or with --update-baseline, the results become the baseline.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+static llvm::cl::OptionCategory BenchCategory("fp16-scale-bench options");
+
+static llvm::cl::opt<unsigned> Functions("functions", llvm::cl::desc("Functions per unit"),
+                                         llvm::cl::init(200), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<unsigned> Locals("locals", llvm::cl::desc("Float locals per function"),
+                                      llvm::cl::init(8), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<unsigned> Tables("tables", llvm::cl::desc("Float literal tables"),
+                                      llvm::cl::init(4), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<unsigned> TableSize("table-size",
+                                         llvm::cl::desc("Literals per table"),
+                                         llvm::cl::init(256), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<unsigned> ExprDepth("expr-depth",
+                                         llvm::cl::desc("Operators per initializer"),
+                                         llvm::cl::init(4), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<unsigned> Structs("structs", llvm::cl::desc("Structs with float fields"),
+                                       llvm::cl::init(16), llvm::cl::cat(BenchCategory));
+
+static llvm::cl::opt<std::string> Sweep(
+    "sweep",
+    llvm::cl::desc("Dimension to scale: functions, locals, tables, table-size, expr-depth "
+                   "or structs"),
+    llvm::cl::init("functions"), llvm::cl::cat(BenchCategory));
+static llvm::cl::list<unsigned> Scales("scales", llvm::cl::CommaSeparated,
+                                       llvm::cl::desc("Multipliers of the swept dimension"),
+                                       llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<unsigned> Runs("runs", llvm::cl::desc("Runs per case; the fastest counts"),
+                                    llvm::cl::init(3), llvm::cl::cat(BenchCategory));
+
+static llvm::cl::opt<std::string> Clang("clang", llvm::cl::desc("clang to run"),
+                                        llvm::cl::init(FP16_BENCH_CLANG),
+                                        llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<std::string> Plugin("plugin", llvm::cl::desc("Plugin to load"),
+                                         llvm::cl::init(FP16_BENCH_PLUGIN),
+                                         llvm::cl::cat(BenchCategory));
+static llvm::cl::list<std::string> PluginArgs(
+    "plugin-arg", llvm::cl::desc("Extra argument passed with -plugin-arg-fp16-demotion"),
+    llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<std::string> WorkDir(
+    "work-dir", llvm::cl::desc("Where the units, logs and plugin outputs go"),
+    llvm::cl::init("fp16-scale-bench"), llvm::cl::cat(BenchCategory));
+
+static llvm::cl::opt<std::string> Baseline("baseline",
+                                           llvm::cl::desc("Baseline results (JSON)"),
+                                           llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<bool> UpdateBaseline(
+    "update-baseline", llvm::cl::desc("Replace the baseline by this run's results"),
+    llvm::cl::init(false), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<double> Tolerance(
+    "tolerance", llvm::cl::desc("Allowed slowdown and growth against the baseline, in percent"),
+    llvm::cl::init(25), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<double> MaxExponent(
+    "max-exponent",
+    llvm::cl::desc("Largest allowed exponent of time over size between sweep steps"),
+    llvm::cl::init(1.5), llvm::cl::cat(BenchCategory));
+static llvm::cl::opt<double> MinSeconds(
+    "min-seconds", llvm::cl::desc("Steps faster than this are too noisy to judge the exponent"),
+    llvm::cl::init(0.2), llvm::cl::cat(BenchCategory));
+
+namespace {
+
+struct Shape {
+    unsigned Functions, Locals, Tables, TableSize, ExprDepth, Structs;
+};
+
+struct Measurement {
+    std::string Name;
+    uint64_t Lines = 0;
+    uint64_t Bytes = 0;
+    double WallSeconds = 0;
+    double CPUSeconds = 0;
+    uint64_t PeakRSSKiB = 0;
+
+    double klocPerSecond() const { return WallSeconds > 0 ? Lines / 1000.0 / WallSeconds : 0; }
+};
+
+// A fixed-seed generator, so the same shape always gives the same unit.
+class Random {
+public:
+    uint32_t next() {
+        State = State * 6364136223846793005ull + 1442695040888963407ull;
+        return uint32_t(State >> 33);
+    }
+    unsigned below(unsigned N) { return N ? next() % N : 0; }
+
+    // Mostly values that fit __fp16, some that do not, so both verdicts
+    // occur.
+    std::string literal() {
+        switch (below(8)) {
+        case 0:
+            return llvm::formatv("{0}.5e5f", 1 + below(9)).str();
+        case 1:
+            return llvm::formatv("{0}.0e-7f", 1 + below(9)).str();
+        default:
+            return llvm::formatv("{0}.{1}f", below(100), below(1000)).str();
+        }
+    }
+
+private:
+    uint64_t State = 0x853c49e6748fea9bull;
+};
+
+// Writes one translation unit: structs with float fields and instances of
+// them, float literal tables, a chain of functions in which every function
+// calls the previous one, and main.
+uint64_t generate(const Shape &S, llvm::raw_ostream &OS) {
+    Random R;
+    uint64_t Lines = 0;
+    auto Line = [&](const llvm::Twine &Text) {
+        OS << Text << "\n";
+        ++Lines;
+    };
+
+    Line("// Generated by fp16-scale-bench");
+    unsigned NumStructs = std::max(1u, S.Structs);
+    for (unsigned I = 0; I < NumStructs; ++I) {
+        Line("struct S" + llvm::Twine(I) + " {");
+        Line("    float a, b, c;");
+        Line("    double d;");
+        Line("    int n;");
+        Line("};");
+        Line("static struct S" + llvm::Twine(I) + " s" + llvm::Twine(I) + ";");
+    }
+    for (unsigned I = 0; I < S.Tables; ++I) {
+        Line("static const float table" + llvm::Twine(I) + "[" +
+             llvm::Twine(std::max(1u, S.TableSize)) + "] = {");
+        std::string Row;
+        for (unsigned J = 0; J < std::max(1u, S.TableSize); ++J) {
+            Row += R.literal() + ", ";
+            if (J % 8 == 7) {
+                Line("    " + Row);
+                Row.clear();
+            }
+        }
+        if (!Row.empty())
+            Line("    " + Row);
+        Line("};");
+    }
+
+    for (unsigned F = 0; F < S.Functions; ++F) {
+        unsigned Struct = F % NumStructs;
+        Line("float f" + llvm::Twine(F) + "(float x, int i) {");
+        std::vector<std::string> Operands = {"x"};
+        if (F > 0)
+            Operands.push_back("f" + std::to_string(F - 1) + "(x * 0.5f, i)");
+        for (unsigned L = 0; L < S.Locals; ++L) {
+            // A left-deep chain of ExprDepth operators over earlier values
+            std::string Expr = Operands[R.below(Operands.size())];
+            for (unsigned D = 0; D < S.ExprDepth; ++D) {
+                static const char *const Ops[] = {" + ", " - ", " * "};
+                std::string Operand = R.below(2) ? R.literal() : Operands[R.below(Operands.size())];
+                Expr = "(" + Expr + Ops[R.below(3)] + Operand + ")";
+            }
+            std::string Name = "v" + std::to_string(L);
+            Line("    float " + Name + " = " + Expr + ";");
+            Operands.push_back(Name);
+        }
+        if (S.Tables) {
+            unsigned Table = F % S.Tables;
+            Line("    for (int k = 0; k < " + llvm::Twine(std::max(1u, S.TableSize)) + "; ++k)");
+            Line("        x += table" + llvm::Twine(Table) + "[k] * 0.25f;");
+        }
+        Line("    s" + llvm::Twine(Struct) + ".a = x * 0.5f;");
+        Line("    s" + llvm::Twine(Struct) + ".b += " + Operands.back() + ";");
+        Line("    return " + Operands.back() + " + s" + llvm::Twine(Struct) + ".c;");
+        Line("}");
+    }
+
+    Line("int main(void) {");
+    Line("    float sum = 0.0f;");
+    if (S.Functions)
+        Line("    sum += f" + llvm::Twine(S.Functions - 1) + "(1.0f, 3);");
+    Line("    return (int)sum;");
+    Line("}");
+    return Lines;
+}
+
+unsigned *dimension(Shape &S, llvm::StringRef Name) {
+    return llvm::StringSwitch<unsigned *>(Name)
+        .Case("functions", &S.Functions)
+        .Case("locals", &S.Locals)
+        .Case("tables", &S.Tables)
+        .Case("table-size", &S.TableSize)
+        .Case("expr-depth", &S.ExprDepth)
+        .Case("structs", &S.Structs)
+        .Default(nullptr);
+}
+
+// Runs clang with the plugin over Source, Runs times. Returns false if
+// clang cannot be run or fails.
+bool measure(llvm::StringRef Source, Measurement &M) {
+    llvm::SmallString<256> OutputDir(WorkDir), Log(WorkDir);
+    llvm::sys::path::append(OutputDir, "out");
+    llvm::sys::path::append(Log, M.Name + ".log");
+    std::vector<std::string> Args = {Clang,
+                                     "-fsyntax-only",
+                                     "-fplugin=" + Plugin,
+                                     "-Xclang",
+                                     "-plugin-arg-fp16-demotion",
+                                     "-Xclang",
+                                     "-fprecision-demote=fp16",
+                                     "-Xclang",
+                                     "-plugin-arg-fp16-demotion",
+                                     "-Xclang",
+                                     "-fprecision-demote-output-dir=" + OutputDir.str().str()};
+    for (const std::string &Arg : PluginArgs) {
+        Args.insert(Args.end(), {"-Xclang", "-plugin-arg-fp16-demotion", "-Xclang", Arg});
+    }
+    Args.push_back(Source.str());
+    std::vector<llvm::StringRef> ArgRefs(Args.begin(), Args.end());
+    std::optional<llvm::StringRef> Redirects[] = {std::nullopt, llvm::StringRef(Log),
+                                                  llvm::StringRef(Log)};
+
+    for (unsigned Run = 0; Run < std::max(1u, unsigned(Runs)); ++Run) {
+        std::string Error;
+        std::optional<llvm::sys::ProcessStatistics> Stats;
+        auto Start = std::chrono::steady_clock::now();
+        int Status = llvm::sys::ExecuteAndWait(Clang, ArgRefs, std::nullopt, Redirects,
+                                               /*SecondsToWait=*/0, /*MemoryLimit=*/0, &Error,
+                                               /*ExecutionFailed=*/nullptr, &Stats);
+        std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+        if (Status != 0) {
+            llvm::errs() << "fp16-scale-bench: " << M.Name << " failed"
+                         << (Error.empty() ? "" : ": " + Error) << "; see " << Log << "\n";
+            return false;
+        }
+        if (Run == 0 || Elapsed.count() < M.WallSeconds) {
+            M.WallSeconds = Elapsed.count();
+            if (Stats) {
+                M.CPUSeconds = std::chrono::duration<double>(Stats->TotalTime).count();
+                M.PeakRSSKiB = Stats->PeakMemory;
+            }
+        }
+    }
+    return true;
+}
+
+llvm::json::Value toJSON(const Measurement &M) {
+    return llvm::json::Object{
+        {"name", M.Name},
+        {"lines", int64_t(M.Lines)},
+        {"bytes", int64_t(M.Bytes)},
+        {"wall_seconds", M.WallSeconds},
+        {"cpu_seconds", M.CPUSeconds},
+        {"peak_rss_kib", int64_t(M.PeakRSSKiB)},
+        {"kloc_per_second", M.klocPerSecond()},
+    };
+}
+
+bool writeResults(llvm::StringRef Path, const std::vector<Measurement> &Results) {
+    llvm::json::Array Cases;
+    for (const Measurement &M : Results)
+        Cases.push_back(toJSON(M));
+    llvm::json::Object Root{{"clang", Clang}, {"cases", std::move(Cases)}};
+    llvm::Error Err = llvm::writeToOutput(Path, [&](llvm::raw_ostream &OS) {
+        OS << llvm::formatv("{0:2}", llvm::json::Value(std::move(Root))) << "\n";
+        return llvm::Error::success();
+    });
+    if (Err) {
+        llvm::errs() << "fp16-scale-bench: cannot write " << Path << ": "
+                     << llvm::toString(std::move(Err)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Compares against the baseline's cases of the same name. Returns the
+// number of regressions.
+unsigned compareToBaseline(const llvm::json::Value &Base,
+                           const std::vector<Measurement> &Results) {
+    const llvm::json::Object *Root = Base.getAsObject();
+    const llvm::json::Array *Cases = Root ? Root->getArray("cases") : nullptr;
+    if (!Cases) {
+        llvm::errs() << "fp16-scale-bench: baseline has no \"cases\"\n";
+        return 1;
+    }
+    double Limit = 1 + Tolerance / 100;
+    unsigned Regressions = 0;
+    for (const Measurement &M : Results) {
+        const llvm::json::Object *Old = nullptr;
+        for (const llvm::json::Value &Case : *Cases) {
+            const llvm::json::Object *O = Case.getAsObject();
+            if (O && O->getString("name") == llvm::StringRef(M.Name))
+                Old = O;
+        }
+        if (!Old) {
+            llvm::outs() << "  " << M.Name << ": not in the baseline\n";
+            continue;
+        }
+        double OldWall = Old->getNumber("wall_seconds").value_or(0);
+        double OldRSS = Old->getNumber("peak_rss_kib").value_or(0);
+        if (OldWall > 0 && M.WallSeconds > OldWall * Limit) {
+            llvm::outs() << "  REGRESSION " << M.Name << ": "
+                         << llvm::format("%.3f s, baseline %.3f s (+%.0f%%)\n", M.WallSeconds,
+                                         OldWall, (M.WallSeconds / OldWall - 1) * 100);
+            ++Regressions;
+        }
+        if (OldRSS > 0 && M.PeakRSSKiB > OldRSS * Limit) {
+            llvm::outs() << "  REGRESSION " << M.Name << ": "
+                         << llvm::format("%.1f MiB peak RSS, baseline %.1f MiB (+%.0f%%)\n",
+                                         M.PeakRSSKiB / 1024.0, OldRSS / 1024.0,
+                                         (M.PeakRSSKiB / OldRSS - 1) * 100);
+            ++Regressions;
+        }
+    }
+    return Regressions;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    llvm::cl::HideUnrelatedOptions(BenchCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "Scalability benchmark of the FP16 plugin\n");
+
+    Shape Base{Functions, Locals, Tables, TableSize, ExprDepth, Structs};
+    if (!dimension(Base, Sweep)) {
+        llvm::errs() << "fp16-scale-bench: unknown --sweep dimension '" << Sweep << "'\n";
+        return 1;
+    }
+    std::vector<unsigned> Multipliers(Scales.begin(), Scales.end());
+    if (Multipliers.empty())
+        Multipliers = {1, 2, 4, 8};
+    if (std::error_code EC = llvm::sys::fs::create_directories(WorkDir)) {
+        llvm::errs() << "fp16-scale-bench: cannot create " << WorkDir << ": " << EC.message()
+                     << "\n";
+        return 1;
+    }
+
+    std::vector<Measurement> Results;
+    unsigned Failures = 0;
+    for (unsigned Multiplier : Multipliers) {
+        Shape S = Base;
+        unsigned &Dim = *dimension(S, Sweep);
+        Dim *= Multiplier;
+
+        Measurement M;
+        M.Name = Sweep + "-" + std::to_string(Dim);
+        llvm::SmallString<256> Source(WorkDir);
+        llvm::sys::path::append(Source, M.Name + ".c");
+        llvm::Error Err = llvm::writeToOutput(Source, [&](llvm::raw_ostream &OS) {
+            M.Lines = generate(S, OS);
+            return llvm::Error::success();
+        });
+        if (Err) {
+            llvm::errs() << "fp16-scale-bench: cannot write " << Source << ": "
+                         << llvm::toString(std::move(Err)) << "\n";
+            return 1;
+        }
+        llvm::sys::fs::file_size(Source, M.Bytes);
+        if (!measure(Source, M)) {
+            ++Failures;
+            continue;
+        }
+        llvm::outs() << llvm::format("%-24s %8llu lines %9.3f s wall %9.3f s cpu %9.1f MiB "
+                                     "%8.2f KLOC/s\n",
+                                     M.Name.c_str(), (unsigned long long)M.Lines,
+                                     M.WallSeconds, M.CPUSeconds, M.PeakRSSKiB / 1024.0,
+                                     M.klocPerSecond());
+        Results.push_back(std::move(M));
+    }
+
+    // Time should grow about linearly with the size of the unit, in bytes:
+    // deeper expressions make lines longer, not more.
+    unsigned Superlinear = 0;
+    for (size_t I = 1; I < Results.size(); ++I) {
+        const Measurement &Prev = Results[I - 1], &Cur = Results[I];
+        if (Prev.WallSeconds < MinSeconds || Cur.Bytes <= Prev.Bytes)
+            continue;
+        double Exponent = std::log(Cur.WallSeconds / Prev.WallSeconds) /
+                          std::log(double(Cur.Bytes) / double(Prev.Bytes));
+        if (Exponent > MaxExponent) {
+            llvm::outs() << "  SUPERLINEAR " << Prev.Name << " -> " << Cur.Name
+                         << llvm::format(": time grows with size^%.2f\n", Exponent);
+            ++Superlinear;
+        }
+    }
+
+    unsigned Regressions = 0;
+    bool HaveBaseline = !Baseline.empty() && llvm::sys::fs::exists(Baseline);
+    if (HaveBaseline && !UpdateBaseline) {
+        auto Buffer = llvm::MemoryBuffer::getFile(Baseline);
+        llvm::Expected<llvm::json::Value> Parsed =
+            Buffer ? llvm::json::parse((*Buffer)->getBuffer())
+                   : llvm::Expected<llvm::json::Value>(
+                         llvm::errorCodeToError(Buffer.getError()));
+        if (!Parsed) {
+            llvm::errs() << "fp16-scale-bench: cannot read " << Baseline << ": "
+                         << llvm::toString(Parsed.takeError()) << "\n";
+            return 1;
+        }
+        Regressions = compareToBaseline(*Parsed, Results);
+    } else if (!Baseline.empty() && !Failures) {
+        if (!writeResults(Baseline, Results))
+            return 1;
+        llvm::outs() << "Baseline written to " << Baseline << "\n";
+    }
+
+    llvm::SmallString<256> ResultsPath(WorkDir);
+    llvm::sys::path::append(ResultsPath, "results.json");
+    writeResults(ResultsPath, Results);
+
+    llvm::outs() << Results.size() << " cases, " << Failures << " failed, " << Superlinear
+                 << " superlinear steps, " << Regressions << " regressions\n";
+    return Failures || Superlinear || Regressions ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+/*===- fp16_profile.h - Value range recorder for profiling -----*- C -*-===*
+ *
+ * Runtime of the copies written by -fprecision-demote-instrument, usable
+ * from C99 and C++ with GCC or Clang. Every recorded float variable is a
+ * site; each thread counts its own samples per site (count, NaNs,
+ * infinities, values below the __fp16 normal range, min and max of the
+ * finite values) in a block it allocates on first use, so recording takes
+ * no locks and no atomic operations. Blocks are linked into their unit with
+ * compare-and-swap and never freed, and at exit the blocks are merged and
+ * one NDJSON line per site is appended to $FP16_PROFILE_FILE (default
+ * fp16_profile.ndjson):
+ *
+ *   {"site":"a.c:12:11:gain","count":N,"nan":N,"inf":N,"subnormal":N,
+ *    "min":V,"max":V}
+ *
+ * min and max are left out if no finite value was seen. Runs append, and
+ * -fprecision-demote-profile=FILE merges all lines of a site. Samples that
+ * threads still running at exit record during the flush may be lost.
+ *
+ *===------------------------------------------------------------------===*/
+
+#ifndef FP16_PROFILE_H
+#define FP16_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fp16_prof_counters {
+    uint64_t count, nan, inf, subnormal;
+    float min, max; /* Of the finite values, if count > nan + inf */
+};
+
+/* The counters of one thread for every site of a unit */
+struct fp16_prof_block {
+    struct fp16_prof_block *next;
+    struct fp16_prof_counters *counters;
+};
+
+/* The sites of one instrumented translation unit */
+struct fp16_prof_unit {
+    const char *const *sites;
+    unsigned nsites;
+    struct fp16_prof_block *blocks;
+    int flush_registered;
+};
+
+static inline void fp16_prof_add(struct fp16_prof_counters *c, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    bits &= 0x7fffffffu;
+    ++c->count;
+    if (bits >= 0x7f800000u) {
+        if (bits > 0x7f800000u)
+            ++c->nan;
+        else
+            ++c->inf;
+        return;
+    }
+    if (bits != 0 && bits < 0x38800000u) /* Below 2^-14 */
+        ++c->subnormal;
+    if (c->count - c->nan - c->inf == 1) {
+        c->min = c->max = value;
+        return;
+    }
+    if (value < c->min)
+        c->min = value;
+    if (value > c->max)
+        c->max = value;
+}
+
+/* Allocates the calling thread's block of unit; registers flush to run at
+ * exit the first time. Returns null if out of memory. */
+static inline struct fp16_prof_counters *
+fp16_prof_thread_counters(struct fp16_prof_unit *unit, void (*flush)(void)) {
+    struct fp16_prof_block *block = (struct fp16_prof_block *)calloc(
+        1, sizeof *block + unit->nsites * sizeof(struct fp16_prof_counters));
+    if (!block)
+        return NULL;
+    block->counters = (struct fp16_prof_counters *)(block + 1);
+    block->next = __atomic_load_n(&unit->blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&unit->blocks, &block->next, block, /*weak=*/1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    if (!__atomic_exchange_n(&unit->flush_registered, 1, __ATOMIC_ACQ_REL))
+        atexit(flush);
+    return block->counters;
+}
+
+static inline void fp16_prof_write_site(FILE *out, const char *site,
+                                        const struct fp16_prof_counters *c) {
+    const char *p;
+    fputs("{\"site\":\"", out);
+    for (p = site; *p; ++p) {
+        if (*p == '"' || *p == '\\')
+            fputc('\\', out);
+        fputc(*p, out);
+    }
+    fprintf(out, "\",\"count\":%llu,\"nan\":%llu,\"inf\":%llu,\"subnormal\":%llu",
+            (unsigned long long)c->count, (unsigned long long)c->nan,
+            (unsigned long long)c->inf, (unsigned long long)c->subnormal);
+    if (c->count > c->nan + c->inf)
+        fprintf(out, ",\"min\":%.9g,\"max\":%.9g", (double)c->min, (double)c->max);
+    fputs("}\n", out);
+}
+
+/* Merges the blocks of unit and appends its sites to the profile file. */
+static inline void fp16_prof_flush(struct fp16_prof_unit *unit) {
+    const char *path = getenv("FP16_PROFILE_FILE");
+    struct fp16_prof_block *block;
+    struct fp16_prof_counters total;
+    unsigned site;
+    FILE *out;
+
+    block = __atomic_load_n(&unit->blocks, __ATOMIC_ACQUIRE);
+    if (!block)
+        return;
+    out = fopen(path && *path ? path : "fp16_profile.ndjson", "a");
+    if (!out) {
+        perror("fp16_profile");
+        return;
+    }
+    /* One write per line, so processes sharing the file do not interleave */
+    setvbuf(out, NULL, _IOLBF, BUFSIZ);
+    for (site = 0; site < unit->nsites; ++site) {
+        memset(&total, 0, sizeof total);
+        for (block = unit->blocks; block; block = block->next) {
+            const struct fp16_prof_counters *c = &block->counters[site];
+            uint64_t finite = c->count - c->nan - c->inf;
+            if (finite) {
+                uint64_t total_finite = total.count - total.nan - total.inf;
+                if (!total_finite || c->min < total.min)
+                    total.min = c->min;
+                if (!total_finite || c->max > total.max)
+                    total.max = c->max;
+            }
+            total.count += c->count;
+            total.nan += c->nan;
+            total.inf += c->inf;
+            total.subnormal += c->subnormal;
+        }
+        if (total.count)
+            fp16_prof_write_site(out, unit->sites[site], &total);
+    }
+    fclose(out);
+}
+
+#if defined(__cplusplus)
+#define FP16_PROF_THREAD_LOCAL thread_local
+#else
+#define FP16_PROF_THREAD_LOCAL __thread
+#endif
+
+/* Defines the unit of the including translation unit over SITES, an array
+ * of site names, and its recording functions:
+ *   fp16_prof_value_(site, value)        records value and returns it
+ *   fp16_prof_after_(site, &var, result) records var and returns result,
+ *                                        for postfix ++ and -- */
+#define FP16_PROFILE_UNIT(SITES)                                                        \
+    static struct fp16_prof_unit fp16_prof_unit_ = {                                    \
+        SITES, (unsigned)(sizeof(SITES) / sizeof((SITES)[0])), NULL, 0};                 \
+    static FP16_PROF_THREAD_LOCAL struct fp16_prof_counters *fp16_prof_tls_;           \
+    static void fp16_prof_flush_(void) { fp16_prof_flush(&fp16_prof_unit_); }          \
+    static inline __attribute__((unused)) float fp16_prof_value_(unsigned site,         \
+                                                                 float value) {         \
+        if (!fp16_prof_tls_)                                                            \
+            fp16_prof_tls_ = fp16_prof_thread_counters(&fp16_prof_unit_, fp16_prof_flush_); \
+        if (fp16_prof_tls_)                                                             \
+            fp16_prof_add(&fp16_prof_tls_[site], value);                                \
+        return value;                                                                   \
+    }                                                                                   \
+    static inline __attribute__((unused)) float fp16_prof_after_(                       \
+        unsigned site, const float *var, float result) {                                \
+        fp16_prof_value_(site, *var);                                                   \
+        return result;                                                                  \
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FP16_PROFILE_H */
@@ -0,0 +1,316 @@
+/*===- fp16_runtime.h - binary16 conversion runtime ------------*- C -*-===*
+ *
+ * Header-only conversions between float and IEEE binary16 for demoted code,
+ * usable from C99 and C++. Values are stored as fp16_storage_t bit patterns,
+ * the element type of arrays converted with -fprecision-demote-arrays.
+ *
+ * The scalar conversions are portable integer code that rounds to nearest,
+ * ties to even, keeps subnormals and quiets NaNs, bit for bit like the
+ * hardware instructions. The array conversions pick the widest kernel the
+ * CPU supports on first use: AVX-512F, F16C with AVX2, NEON on AArch64, or
+ * the scalar loop. Every kernel produces the same bits.
+ *
+ *===------------------------------------------------------------------===*/
+
+#ifndef FP16_RUNTIME_H
+#define FP16_RUNTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define FP16_RUNTIME_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define FP16_RUNTIME_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FP16_STORAGE_T_DEFINED
+#define FP16_STORAGE_T_DEFINED
+typedef unsigned short fp16_storage_t;
+#endif
+
+/* Conversion kernels, narrowest first */
+enum fp16_isa {
+    FP16_ISA_SCALAR,
+    FP16_ISA_NEON,
+    FP16_ISA_F16C,   /* F16C with AVX2, 8 values per instruction */
+    FP16_ISA_AVX512, /* AVX-512F, 16 values per instruction */
+    FP16_ISA_COUNT
+};
+
+static inline const char *fp16_isa_name(enum fp16_isa isa) {
+    switch (isa) {
+    case FP16_ISA_SCALAR: return "scalar";
+    case FP16_ISA_NEON: return "neon";
+    case FP16_ISA_F16C: return "f16c";
+    case FP16_ISA_AVX512: return "avx512";
+    default: return "unknown";
+    }
+}
+
+/*===------------------------------------------------------------------===*
+ * Scalar conversions
+ *===------------------------------------------------------------------===*/
+
+static inline fp16_storage_t fp16_from_float(float value) {
+    uint32_t bits, abs;
+    uint16_t sign;
+    memcpy(&bits, &value, sizeof bits);
+    sign = (uint16_t)((bits >> 16) & 0x8000u);
+    abs = bits & 0x7fffffffu;
+
+    if (abs > 0x7f800000u) /* NaN: quieted, top payload bits kept */
+        return (fp16_storage_t)(sign | 0x7e00u | ((abs >> 13) & 0x3ffu));
+    if (abs >= 0x477ff000u) /* 65520 and up round to infinity */
+        return (fp16_storage_t)(sign | 0x7c00u);
+    if (abs >= 0x38800000u) { /* Normal: rebias the exponent, round the mantissa */
+        abs += 0xc8000fffu + ((abs >> 13) & 1u);
+        return (fp16_storage_t)(sign | (abs >> 13));
+    }
+    if (abs < 0x33000000u) /* Below half the smallest subnormal */
+        return sign;
+    {
+        /* Subnormal: the mantissa with its implicit bit, shifted to units of
+         * 2^-24 */
+        unsigned shift = 126u - (abs >> 23);
+        uint32_t mantissa = (abs & 0x7fffffu) | 0x800000u;
+        uint32_t result = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1u);
+        uint32_t halfway = 1u << (shift - 1u);
+        if (rest > halfway || (rest == halfway && (result & 1u)))
+            ++result;
+        return (fp16_storage_t)(sign | result);
+    }
+}
+
+static inline float fp16_to_float(fp16_storage_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1fu;
+    uint32_t mantissa = half & 0x3ffu;
+    uint32_t bits;
+    float value;
+
+    if (exponent == 0x1f) { /* Infinity, or a NaN made quiet */
+        bits = sign | 0x7f800000u | (mantissa << 13) | (mantissa ? 0x400000u : 0u);
+    } else if (exponent) {
+        bits = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+    } else if (!mantissa) {
+        bits = sign;
+    } else { /* Subnormal halves are normal floats */
+        exponent = 113;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+/*===------------------------------------------------------------------===*
+ * Array kernels
+ *===------------------------------------------------------------------===*/
+
+static inline void fp16_from_float_scalar(fp16_storage_t *dst, const float *src, size_t n) {
+    size_t i;
+    for (i = 0; i < n; ++i)
+        dst[i] = fp16_from_float(src[i]);
+}
+
+static inline void fp16_to_float_scalar(float *dst, const fp16_storage_t *src, size_t n) {
+    size_t i;
+    for (i = 0; i < n; ++i)
+        dst[i] = fp16_to_float(src[i]);
+}
+
+#ifdef FP16_RUNTIME_X86
+__attribute__((target("avx2,f16c"))) static inline void
+fp16_from_float_f16c(fp16_storage_t *dst, const float *src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(dst + i), half);
+    }
+    fp16_from_float_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2,f16c"))) static inline void
+fp16_to_float_f16c(float *dst, const fp16_storage_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    fp16_to_float_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static inline void
+fp16_from_float_avx512(fp16_storage_t *dst, const float *src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i half = _mm512_cvtps_ph(_mm512_loadu_ps(src + i),
+                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256((__m256i *)(dst + i), half);
+    }
+    fp16_from_float_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static inline void
+fp16_to_float_avx512(float *dst, const fp16_storage_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(dst + i,
+                         _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(src + i))));
+    fp16_to_float_scalar(dst + i, src + i, n - i);
+}
+
+/* The extended registers must be enabled by the OS (XCR0), not just be
+ * present in the CPU. */
+static inline uint64_t fp16_xgetbv(void) {
+    uint32_t eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+}
+#endif /* FP16_RUNTIME_X86 */
+
+#ifdef FP16_RUNTIME_NEON
+static inline void fp16_from_float_neon(fp16_storage_t *dst, const float *src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+    fp16_from_float_scalar(dst + i, src + i, n - i);
+}
+
+static inline void fp16_to_float_neon(float *dst, const fp16_storage_t *src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+    fp16_to_float_scalar(dst + i, src + i, n - i);
+}
+#endif /* FP16_RUNTIME_NEON */
+
+static inline int fp16_detect_isa(enum fp16_isa isa) {
+    switch (isa) {
+    case FP16_ISA_SCALAR:
+        return 1;
+#ifdef FP16_RUNTIME_NEON
+    case FP16_ISA_NEON:
+        return 1;
+#endif
+#ifdef FP16_RUNTIME_X86
+    case FP16_ISA_F16C:
+    case FP16_ISA_AVX512: {
+        unsigned eax, ebx, ecx, edx;
+        uint64_t xcr0;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) ||
+            !(ecx & bit_AVX) || !(ecx & bit_F16C))
+            return 0;
+        xcr0 = fp16_xgetbv();
+        if ((xcr0 & 0x6) != 0x6) /* XMM and YMM state */
+            return 0;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return 0;
+        if (isa == FP16_ISA_F16C)
+            return (ebx & bit_AVX2) != 0;
+        return (ebx & bit_AVX512F) && (xcr0 & 0xe6) == 0xe6; /* Opmask and ZMM state */
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Relaxed atomic access to the cached detection result. */
+#if defined(__GNUC__) || defined(__clang__)
+#define FP16_RUNTIME_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define FP16_RUNTIME_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define FP16_RUNTIME_LOAD(p) (*(volatile int *)(p))
+#define FP16_RUNTIME_STORE(p, v) (*(volatile int *)(p) = (v))
+#endif
+
+/* Bit i set if kernel i runs on this CPU. Detection runs once per
+ * translation unit; threads racing on the first call all store the same
+ * value. */
+static inline unsigned fp16_supported_isas(void) {
+    static int supported = -1;
+    int cached = FP16_RUNTIME_LOAD(&supported);
+    if (cached < 0) {
+        unsigned mask = 0;
+        int isa;
+        for (isa = 0; isa < FP16_ISA_COUNT; ++isa)
+            if (fp16_detect_isa((enum fp16_isa)isa))
+                mask |= 1u << isa;
+        cached = (int)mask;
+        FP16_RUNTIME_STORE(&supported, cached);
+    }
+    return (unsigned)cached;
+}
+
+static inline int fp16_isa_supported(enum fp16_isa isa) {
+    return isa < FP16_ISA_COUNT && (fp16_supported_isas() >> isa & 1u);
+}
+
+/* The widest supported kernel */
+static inline enum fp16_isa fp16_best_isa(void) {
+    int isa = FP16_ISA_COUNT - 1;
+    while (isa > FP16_ISA_SCALAR && !fp16_isa_supported((enum fp16_isa)isa))
+        --isa;
+    return (enum fp16_isa)isa;
+}
+
+/* Conversions with a given kernel; unsupported ones fall back to scalar. */
+static inline void fp16_from_float_array_isa(enum fp16_isa isa, fp16_storage_t *dst,
+                                             const float *src, size_t n) {
+    if (isa != FP16_ISA_SCALAR && !fp16_isa_supported(isa))
+        isa = FP16_ISA_SCALAR;
+    switch (isa) {
+#ifdef FP16_RUNTIME_X86
+    case FP16_ISA_AVX512: fp16_from_float_avx512(dst, src, n); return;
+    case FP16_ISA_F16C: fp16_from_float_f16c(dst, src, n); return;
+#endif
+#ifdef FP16_RUNTIME_NEON
+    case FP16_ISA_NEON: fp16_from_float_neon(dst, src, n); return;
+#endif
+    default: fp16_from_float_scalar(dst, src, n); return;
+    }
+}
+
+static inline void fp16_to_float_array_isa(enum fp16_isa isa, float *dst,
+                                           const fp16_storage_t *src, size_t n) {
+    if (isa != FP16_ISA_SCALAR && !fp16_isa_supported(isa))
+        isa = FP16_ISA_SCALAR;
+    switch (isa) {
+#ifdef FP16_RUNTIME_X86
+    case FP16_ISA_AVX512: fp16_to_float_avx512(dst, src, n); return;
+    case FP16_ISA_F16C: fp16_to_float_f16c(dst, src, n); return;
+#endif
+#ifdef FP16_RUNTIME_NEON
+    case FP16_ISA_NEON: fp16_to_float_neon(dst, src, n); return;
+#endif
+    default: fp16_to_float_scalar(dst, src, n); return;
+    }
+}
+
+/* Converts n values with the widest supported kernel. */
+static inline void fp16_from_float_array(fp16_storage_t *dst, const float *src, size_t n) {
+    fp16_from_float_array_isa(fp16_best_isa(), dst, src, n);
+}
+
+static inline void fp16_to_float_array(float *dst, const fp16_storage_t *src, size_t n) {
+    fp16_to_float_array_isa(fp16_best_isa(), dst, src, n);
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* FP16_RUNTIME_H */
@@ -0,0 +1,846 @@
+#include "Fp16AnalysisCache.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Lex/Token.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+//===----------------------------------------------------------------------===//
+// CacheKeyBuilder
+//===----------------------------------------------------------------------===//
+
+CacheKeyBuilder::CacheKeyBuilder(const DemotionOptions &Opts) {
+    addBytes(FP16_DEMOTION_VERSION);
+    addBytes(getClangFullVersion());
+    for (const std::string &Arg : Opts.AnalysisArgs)
+        addBytes(Arg);
+}
+
+void CacheKeyBuilder::addBytes(llvm::StringRef Bytes) {
+    // Length-prefix every field so adjacent fields cannot alias.
+    uint32_t Length = Bytes.size();
+    Hasher.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&Length),
+                                          sizeof(Length)));
+    Hasher.update(Bytes);
+}
+
+void CacheKeyBuilder::addToken(const Preprocessor &PP, const Token &Tok) {
+    // Annotation tokens are produced by the parser, not the preprocessor, and
+    // carry no spelling of their own.
+    if (Tok.isAnnotation())
+        return;
+
+    uint16_t Kind = Tok.getKind();
+    Hasher.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&Kind),
+                                          sizeof(Kind)));
+    llvm::SmallString<64> Buffer;
+    bool Invalid = false;
+    llvm::StringRef Spelling = PP.getSpelling(Tok, Buffer, &Invalid);
+    if (!Invalid)
+        addBytes(Spelling);
+
+    // Which file the token is spelled in and where, so a header found in
+    // another directory, or moved within its file, is not mistaken for the
+    // one analyzed. A file's name and real path are hashed with its first
+    // token, an index into the files seen so far with every token.
+    const SourceManager &SM = PP.getSourceManager();
+    std::pair<FileID, unsigned> Spelled = SM.getDecomposedSpellingLoc(Tok.getLocation());
+    auto Inserted = FileIndices.try_emplace(Spelled.first, uint32_t(FileIndices.size()));
+    if (Inserted.second) {
+        OptionalFileEntryRef FE = SM.getFileEntryRefForID(Spelled.first);
+        addBytes(FE ? FE->getName() : llvm::StringRef());
+        addBytes(FE ? FE->getFileEntry().tryGetRealPathName() : llvm::StringRef());
+    }
+    uint32_t Location[2] = {Inserted.first->second, Spelled.second};
+    Hasher.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(Location),
+                                          sizeof(Location)));
+}
+
+std::string CacheKeyBuilder::finish(const SourceManager &SM) {
+    // The result names the main file, so a copy under another name must not
+    // share its entry.
+    FileID Main = SM.getMainFileID();
+    if (OptionalFileEntryRef FE = SM.getFileEntryRefForID(Main))
+        addBytes(FE->getName());
+    addBytes(SM.getBufferData(Main));
+    return llvm::toHex(Hasher.final(), /*LowerCase=*/true);
+}
+
+//===----------------------------------------------------------------------===//
+// Entry (de)serialization
+//===----------------------------------------------------------------------===//
+
+llvm::json::Value encodeDouble(double V) {
+    if (std::isfinite(V))
+        return V;
+    if (std::isnan(V))
+        return "nan";
+    return V > 0 ? "inf" : "-inf";
+}
+
+bool decodeDouble(const llvm::json::Value *V, double &Out) {
+    if (!V)
+        return false;
+    if (auto D = V->getAsNumber()) {
+        Out = *D;
+        return true;
+    }
+    if (auto S = V->getAsString()) {
+        if (*S == "nan")
+            Out = std::numeric_limits<double>::quiet_NaN();
+        else if (*S == "inf")
+            Out = std::numeric_limits<double>::infinity();
+        else if (*S == "-inf")
+            Out = -std::numeric_limits<double>::infinity();
+        else
+            return false;
+        return true;
+    }
+    return false;
+}
+
+static llvm::json::Value encodeStorage(const StorageUsage &S) {
+    return llvm::json::Object{
+        {"variables", int64_t(S.variableCount)},
+        {"original_bytes", int64_t(S.originalBytes)},
+        {"demoted_bytes", int64_t(S.demotedBytes)},
+        {"float_bytes", int64_t(S.floatBytes)},
+    };
+}
+
+// The enabled formats, by name
+static llvm::json::Array encodeFormats(const MemoryUsage &M) {
+    llvm::json::Array A;
+    for (const FloatFormat &F : floatFormats()) {
+        const FormatUsage &U = M.formats[formatIndex(F)];
+        if (!U.enabled)
+            continue;
+        A.push_back(llvm::json::Object{
+            {"name", F.Name},
+            {"variables", int64_t(U.varCount)},
+            {"fields", int64_t(U.fieldCount)},
+            {"arrays", int64_t(U.arrayCount)},
+            {"literals", int64_t(U.literalCount)},
+            {"float_bytes", int64_t(U.floatBytes)},
+        });
+    }
+    return A;
+}
+
+static llvm::json::Array encodeStrings(const std::vector<std::string> &Strings) {
+    llvm::json::Array A;
+    for (const std::string &S : Strings)
+        A.push_back(S);
+    return A;
+}
+
+static llvm::json::Value encodeStructLayout(const StructLayoutRecord &S) {
+    return llvm::json::Object{
+        {"name", S.Name},
+        {"file", S.File},
+        {"line", int64_t(S.Line)},
+        {"old_size", int64_t(S.OldSize)},
+        {"new_size", int64_t(S.NewSize)},
+        {"reordered_size", int64_t(S.ReorderedSize)},
+        {"old_lines", int64_t(S.OldLines)},
+        {"new_lines", int64_t(S.NewLines)},
+        {"demoted_fields", encodeStrings(S.DemotedFields)},
+        {"hot_fields", encodeStrings(S.HotFields)},
+        {"suggested_order", encodeStrings(S.SuggestedOrder)},
+        {"rewritten", S.Rewritten},
+    };
+}
+
+static llvm::json::Value encodeArray(const ArrayStorageRecord &A) {
+    return llvm::json::Object{
+        {"name", A.Name},
+        {"file", A.File},
+        {"line", int64_t(A.Line)},
+        {"elements", int64_t(A.Elements)},
+        {"old_bytes", int64_t(A.OldBytes)},
+        {"new_bytes", int64_t(A.NewBytes)},
+        {"safe", A.Safe},
+        {"converted", A.Converted},
+        {"reason", A.Reason},
+        {"reads", int64_t(A.Reads)},
+        {"writes", int64_t(A.Writes)},
+        {"traffic_bytes", encodeDouble(A.TrafficBytes)},
+        {"traffic_exact", A.TrafficExact},
+    };
+}
+
+static llvm::json::Value encodeLoop(const LoopVectorRecord &L) {
+    llvm::json::Array Lanes;
+    for (const LaneEstimate &E : L.Lanes)
+        Lanes.push_back(llvm::json::Array{int64_t(E.VectorBits), int64_t(E.Before),
+                                          int64_t(E.After)});
+    return llvm::json::Object{
+        {"function", L.Function},
+        {"file", L.File},
+        {"line", int64_t(L.Line)},
+        {"kind", L.Kind},
+        {"demoted", encodeStrings(L.Demoted)},
+        {"kept", encodeStrings(L.Kept)},
+        {"accumulators", encodeStrings(L.Accumulators)},
+        {"carried", L.Carried},
+        {"old_bits", int64_t(L.OldBits)},
+        {"new_bits", int64_t(L.NewBits)},
+        {"lanes", std::move(Lanes)},
+        {"trip_count", encodeDouble(L.TripCount)},
+        {"trip_exact", L.TripExact},
+    };
+}
+
+static llvm::json::Value encodeConversionCost(const ConversionCostRecord &C) {
+    const ConversionCost &K = C.Cost;
+    return llvm::json::Object{
+        {"name", C.Name},
+        {"file", C.File},
+        {"line", int64_t(C.Line)},
+        {"column", int64_t(C.Column)},
+        {"mode", C.Mode},
+        {"target", C.Target},
+        {"decision", C.Decision},
+        {"reads", encodeDouble(K.Reads)},
+        {"writes", encodeDouble(K.Writes)},
+        {"updates", encodeDouble(K.Updates)},
+        {"to_float", encodeDouble(K.ToFloat)},
+        {"from_float", encodeDouble(K.FromFloat)},
+        {"conversion_cycles", encodeDouble(K.ConversionCycles)},
+        {"bytes_saved", encodeDouble(K.BytesSaved)},
+        {"benefit_cycles", encodeDouble(K.BenefitCycles)},
+        {"memory_resident", K.MemoryResident},
+        {"exact", K.Exact},
+    };
+}
+
+static llvm::json::Value encodeResult(const DemotionResult &R) {
+    llvm::json::Array Literals;
+    for (const LiteralRecord &L : R.Literals) {
+        Literals.push_back(llvm::json::Object{
+            {"value", encodeDouble(L.Value)},
+            {"downcast", encodeDouble(L.Downcast)},
+            {"error", encodeDouble(L.Error)},
+            {"mode", L.Mode},
+            {"safe", L.Safe},
+            {"reason", L.Reason},
+            {"file", L.File},
+            {"line", int64_t(L.Line)},
+            {"column", int64_t(L.Column)},
+        });
+    }
+
+    llvm::json::Array Variables;
+    for (const VariableRecord &V : R.Variables) {
+        Variables.push_back(llvm::json::Object{
+            {"name", V.Name},
+            {"mode", V.Mode},
+            {"safe", V.Safe},
+            {"reason", V.Reason},
+            {"file", V.File},
+            {"line", int64_t(V.Line)},
+            {"column", int64_t(V.Column)},
+        });
+    }
+
+    llvm::json::Array Transformations;
+    for (const TransformationRecord &T : R.Transformations) {
+        Transformations.push_back(llvm::json::Object{
+            {"file", T.File},
+            {"offset", int64_t(T.Offset)},
+            {"length", int64_t(T.Length)},
+            {"replacement", T.ReplacementText},
+        });
+    }
+
+    llvm::json::Array StructLayouts;
+    for (const StructLayoutRecord &S : R.StructLayouts)
+        StructLayouts.push_back(encodeStructLayout(S));
+    llvm::json::Array Arrays;
+    for (const ArrayStorageRecord &A : R.Arrays)
+        Arrays.push_back(encodeArray(A));
+    llvm::json::Array Loops;
+    for (const LoopVectorRecord &L : R.Loops)
+        Loops.push_back(encodeLoop(L));
+    llvm::json::Array ConversionCosts;
+    for (const ConversionCostRecord &C : R.ConversionCosts)
+        ConversionCosts.push_back(encodeConversionCost(C));
+
+    // Summaries in their textual form, as [key, summary] pairs
+    llvm::json::Array Exported;
+    for (const NamedSummary &S : R.ExportedSummaries)
+        Exported.push_back(llvm::json::Array{S.first, S.second.str()});
+    llvm::json::Array Deps;
+    for (const auto &D : R.SummaryDeps)
+        Deps.push_back(llvm::json::Array{D.first, D.second});
+
+    const MemoryUsage &M = R.Memory;
+    return llvm::json::Object{
+        {"version", FP16_DEMOTION_VERSION},
+        {"main_file", R.MainFile},
+        {"literals", std::move(Literals)},
+        {"variables", std::move(Variables)},
+        {"transformations", std::move(Transformations)},
+        {"struct_layouts", std::move(StructLayouts)},
+        {"arrays", std::move(Arrays)},
+        {"loops", std::move(Loops)},
+        {"conversion_costs", std::move(ConversionCosts)},
+        {"exported_summaries", std::move(Exported)},
+        {"summary_deps", std::move(Deps)},
+        {"memory", llvm::json::Object{
+            {"original_bytes", int64_t(M.originalBytes)},
+            {"demoted_bytes", int64_t(M.demotedBytes)},
+            {"float_vars", int64_t(M.floatVarCount)},
+            {"demoted_vars", int64_t(M.demotedVarCount)},
+            {"float_literals", int64_t(M.floatLiteralCount)},
+            {"demoted_literals", int64_t(M.demotedLiteralCount)},
+            {"float_fields", int64_t(M.floatFieldCount)},
+            {"demoted_fields", int64_t(M.demotedFieldCount)},
+            {"float_arrays", int64_t(M.floatArrayCount)},
+            {"demoted_arrays", int64_t(M.demotedArrayCount)},
+            {"double_vars", int64_t(M.doubleVarCount)},
+            {"demoted_double_vars", int64_t(M.demotedDoubleVarCount)},
+            {"double_literals", int64_t(M.doubleLiteralCount)},
+            {"demoted_double_literals", int64_t(M.demotedDoubleLiteralCount)},
+            {"double_bytes", int64_t(M.doubleBytes)},
+            {"demoted_double_bytes", int64_t(M.demotedDoubleBytes)},
+            {"float_math_calls", int64_t(M.floatMathCalls)},
+            {"global", encodeStorage(M.global)},
+            {"static", encodeStorage(M.staticLocal)},
+            {"stack", encodeStorage(M.stack)},
+            {"largest_frame_bytes", int64_t(M.largestFrameBytes)},
+            {"largest_frame_demoted_bytes", int64_t(M.largestFrameDemotedBytes)},
+            {"formats", encodeFormats(M)},
+        }},
+        {"demoted_code", R.DemotedCode},
+        {"instrumented_code", R.InstrumentedCode},
+    };
+}
+
+static bool decodeCount(const llvm::json::Object &O, llvm::StringRef Name, size_t &Out) {
+    auto V = O.getInteger(Name);
+    if (!V || *V < 0)
+        return false;
+    Out = size_t(*V);
+    return true;
+}
+
+static bool decodeStorage(const llvm::json::Object *O, StorageUsage &Out) {
+    return O && decodeCount(*O, "variables", Out.variableCount) &&
+           decodeCount(*O, "original_bytes", Out.originalBytes) &&
+           decodeCount(*O, "demoted_bytes", Out.demotedBytes) &&
+           decodeCount(*O, "float_bytes", Out.floatBytes);
+}
+
+static bool decodeFormats(const llvm::json::Array *A, MemoryUsage &M) {
+    if (!A)
+        return false;
+    for (const llvm::json::Value &FV : *A) {
+        const llvm::json::Object *O = FV.getAsObject();
+        if (!O)
+            return false;
+        auto Name = O->getString("name");
+        const FloatFormat *F = Name ? findFloatFormat(*Name) : nullptr;
+        if (!F)
+            return false;
+        FormatUsage &U = M.formats[formatIndex(*F)];
+        U.enabled = true;
+        if (!decodeCount(*O, "variables", U.varCount) || !decodeCount(*O, "fields", U.fieldCount) ||
+            !decodeCount(*O, "arrays", U.arrayCount) ||
+            !decodeCount(*O, "literals", U.literalCount) ||
+            !decodeCount(*O, "float_bytes", U.floatBytes))
+            return false;
+    }
+    return true;
+}
+
+static bool decodeStrings(const llvm::json::Array *A, std::vector<std::string> &Out) {
+    if (!A)
+        return false;
+    for (const llvm::json::Value &SV : *A) {
+        auto S = SV.getAsString();
+        if (!S)
+            return false;
+        Out.push_back(S->str());
+    }
+    return true;
+}
+
+static bool decodeStructLayout(const llvm::json::Value &V, StructLayoutRecord &Out) {
+    const llvm::json::Object *O = V.getAsObject();
+    if (!O)
+        return false;
+    auto Name = O->getString("name");
+    auto File = O->getString("file");
+    auto Line = O->getInteger("line");
+    auto OldSize = O->getInteger("old_size");
+    auto NewSize = O->getInteger("new_size");
+    auto ReorderedSize = O->getInteger("reordered_size");
+    auto OldLines = O->getInteger("old_lines");
+    auto NewLines = O->getInteger("new_lines");
+    auto Rewritten = O->getBoolean("rewritten");
+    if (!Name || !File || !Line || !OldSize || !NewSize || !ReorderedSize || !OldLines ||
+        !NewLines || !Rewritten)
+        return false;
+    Out.Name = Name->str();
+    Out.File = File->str();
+    Out.Line = unsigned(*Line);
+    Out.OldSize = uint64_t(*OldSize);
+    Out.NewSize = uint64_t(*NewSize);
+    Out.ReorderedSize = uint64_t(*ReorderedSize);
+    Out.OldLines = unsigned(*OldLines);
+    Out.NewLines = unsigned(*NewLines);
+    Out.Rewritten = *Rewritten;
+    return decodeStrings(O->getArray("demoted_fields"), Out.DemotedFields) &&
+           decodeStrings(O->getArray("hot_fields"), Out.HotFields) &&
+           decodeStrings(O->getArray("suggested_order"), Out.SuggestedOrder);
+}
+
+static bool decodeArray(const llvm::json::Value &V, ArrayStorageRecord &Out) {
+    const llvm::json::Object *O = V.getAsObject();
+    if (!O)
+        return false;
+    auto Name = O->getString("name");
+    auto File = O->getString("file");
+    auto Line = O->getInteger("line");
+    auto Elements = O->getInteger("elements");
+    auto OldBytes = O->getInteger("old_bytes");
+    auto NewBytes = O->getInteger("new_bytes");
+    auto Safe = O->getBoolean("safe");
+    auto Converted = O->getBoolean("converted");
+    auto Reason = O->getString("reason");
+    auto Reads = O->getInteger("reads");
+    auto Writes = O->getInteger("writes");
+    auto TrafficExact = O->getBoolean("traffic_exact");
+    if (!Name || !File || !Line || !Elements || !OldBytes || !NewBytes || !Safe ||
+        !Converted || !Reason || !Reads || !Writes || !TrafficExact ||
+        !decodeDouble(O->get("traffic_bytes"), Out.TrafficBytes))
+        return false;
+    Out.Name = Name->str();
+    Out.File = File->str();
+    Out.Line = unsigned(*Line);
+    Out.Elements = uint64_t(*Elements);
+    Out.OldBytes = uint64_t(*OldBytes);
+    Out.NewBytes = uint64_t(*NewBytes);
+    Out.Safe = *Safe;
+    Out.Converted = *Converted;
+    Out.Reason = Reason->str();
+    Out.Reads = unsigned(*Reads);
+    Out.Writes = unsigned(*Writes);
+    Out.TrafficExact = *TrafficExact;
+    return true;
+}
+
+static bool decodeLoop(const llvm::json::Value &V, LoopVectorRecord &Out) {
+    const llvm::json::Object *O = V.getAsObject();
+    if (!O)
+        return false;
+    auto Function = O->getString("function");
+    auto File = O->getString("file");
+    auto Line = O->getInteger("line");
+    auto Kind = O->getString("kind");
+    auto Carried = O->getString("carried");
+    auto OldBits = O->getInteger("old_bits");
+    auto NewBits = O->getInteger("new_bits");
+    auto TripExact = O->getBoolean("trip_exact");
+    const llvm::json::Array *Lanes = O->getArray("lanes");
+    if (!Function || !File || !Line || !Kind || !Carried || !OldBits || !NewBits ||
+        !TripExact || !Lanes || !decodeDouble(O->get("trip_count"), Out.TripCount))
+        return false;
+    Out.Function = Function->str();
+    Out.File = File->str();
+    Out.Line = unsigned(*Line);
+    Out.Kind = Kind->str();
+    Out.Carried = Carried->str();
+    Out.OldBits = unsigned(*OldBits);
+    Out.NewBits = unsigned(*NewBits);
+    Out.TripExact = *TripExact;
+    for (const llvm::json::Value &LV : *Lanes) {
+        const llvm::json::Array *Lane = LV.getAsArray();
+        if (!Lane || Lane->size() != 3)
+            return false;
+        auto Bits = (*Lane)[0].getAsInteger();
+        auto Before = (*Lane)[1].getAsInteger();
+        auto After = (*Lane)[2].getAsInteger();
+        if (!Bits || !Before || !After)
+            return false;
+        Out.Lanes.push_back({unsigned(*Bits), unsigned(*Before), unsigned(*After)});
+    }
+    return decodeStrings(O->getArray("demoted"), Out.Demoted) &&
+           decodeStrings(O->getArray("kept"), Out.Kept) &&
+           decodeStrings(O->getArray("accumulators"), Out.Accumulators);
+}
+
+static bool decodeConversionCost(const llvm::json::Value &V, ConversionCostRecord &Out) {
+    const llvm::json::Object *O = V.getAsObject();
+    if (!O)
+        return false;
+    auto Name = O->getString("name");
+    auto File = O->getString("file");
+    auto Line = O->getInteger("line");
+    auto Column = O->getInteger("column");
+    auto Mode = O->getString("mode");
+    auto Target = O->getString("target");
+    auto Decision = O->getString("decision");
+    auto MemoryResident = O->getBoolean("memory_resident");
+    auto Exact = O->getBoolean("exact");
+    ConversionCost &K = Out.Cost;
+    if (!Name || !File || !Line || !Column || !Mode || !Target || !Decision ||
+        !MemoryResident || !Exact || !decodeDouble(O->get("reads"), K.Reads) ||
+        !decodeDouble(O->get("writes"), K.Writes) ||
+        !decodeDouble(O->get("updates"), K.Updates) ||
+        !decodeDouble(O->get("to_float"), K.ToFloat) ||
+        !decodeDouble(O->get("from_float"), K.FromFloat) ||
+        !decodeDouble(O->get("conversion_cycles"), K.ConversionCycles) ||
+        !decodeDouble(O->get("bytes_saved"), K.BytesSaved) ||
+        !decodeDouble(O->get("benefit_cycles"), K.BenefitCycles))
+        return false;
+    Out.Name = Name->str();
+    Out.File = File->str();
+    Out.Line = unsigned(*Line);
+    Out.Column = unsigned(*Column);
+    Out.Mode = Mode->str();
+    Out.Target = Target->str();
+    Out.Decision = Decision->str();
+    K.MemoryResident = *MemoryResident;
+    K.Exact = *Exact;
+    return true;
+}
+
+static bool decodePairs(const llvm::json::Array *A,
+                        std::vector<std::pair<std::string, std::string>> &Out) {
+    if (!A)
+        return false;
+    for (const llvm::json::Value &PV : *A) {
+        const llvm::json::Array *Pair = PV.getAsArray();
+        if (!Pair || Pair->size() != 2)
+            return false;
+        auto First = (*Pair)[0].getAsString();
+        auto Second = (*Pair)[1].getAsString();
+        if (!First || !Second)
+            return false;
+        Out.emplace_back(First->str(), Second->str());
+    }
+    return true;
+}
+
+static bool decodeResult(const llvm::json::Value &V, DemotionResult &Out) {
+    const llvm::json::Object *O = V.getAsObject();
+    if (!O || O->getString("version") != llvm::StringRef(FP16_DEMOTION_VERSION))
+        return false;
+
+    DemotionResult R;
+    if (auto MainFile = O->getString("main_file"))
+        R.MainFile = MainFile->str();
+    if (auto Code = O->getString("demoted_code"))
+        R.DemotedCode = Code->str();
+    else
+        return false;
+    if (auto Code = O->getString("instrumented_code"))
+        R.InstrumentedCode = Code->str();
+    else
+        return false;
+
+    const llvm::json::Array *Literals = O->getArray("literals");
+    const llvm::json::Array *Variables = O->getArray("variables");
+    const llvm::json::Array *Transformations = O->getArray("transformations");
+    const llvm::json::Object *Memory = O->getObject("memory");
+    if (!Literals || !Variables || !Transformations || !Memory)
+        return false;
+
+    for (const llvm::json::Value &LV : *Literals) {
+        const llvm::json::Object *LO = LV.getAsObject();
+        if (!LO)
+            return false;
+        LiteralRecord L;
+        double Downcast;
+        auto Mode = LO->getString("mode");
+        auto Safe = LO->getBoolean("safe");
+        auto Reason = LO->getString("reason");
+        auto File = LO->getString("file");
+        auto Line = LO->getInteger("line");
+        auto Column = LO->getInteger("column");
+        if (!decodeDouble(LO->get("value"), L.Value) ||
+            !decodeDouble(LO->get("downcast"), Downcast) ||
+            !decodeDouble(LO->get("error"), L.Error) ||
+            !Mode || !Safe || !Reason || !File || !Line || !Column)
+            return false;
+        L.Downcast = float(Downcast);
+        L.Mode = Mode->str();
+        L.Safe = *Safe;
+        L.Reason = Reason->str();
+        L.File = File->str();
+        L.Line = unsigned(*Line);
+        L.Column = unsigned(*Column);
+        R.Literals.push_back(std::move(L));
+    }
+
+    for (const llvm::json::Value &VV : *Variables) {
+        const llvm::json::Object *VO = VV.getAsObject();
+        if (!VO)
+            return false;
+        auto Name = VO->getString("name");
+        auto Mode = VO->getString("mode");
+        auto Safe = VO->getBoolean("safe");
+        auto Reason = VO->getString("reason");
+        auto File = VO->getString("file");
+        auto Line = VO->getInteger("line");
+        auto Column = VO->getInteger("column");
+        if (!Name || !Mode || !Safe || !Reason || !File || !Line || !Column)
+            return false;
+        VariableRecord V;
+        V.Name = Name->str();
+        V.Mode = Mode->str();
+        V.Safe = *Safe;
+        V.Reason = Reason->str();
+        V.File = File->str();
+        V.Line = unsigned(*Line);
+        V.Column = unsigned(*Column);
+        R.Variables.push_back(std::move(V));
+    }
+
+    for (const llvm::json::Value &TV : *Transformations) {
+        const llvm::json::Object *TO = TV.getAsObject();
+        if (!TO)
+            return false;
+        auto File = TO->getString("file");
+        auto Offset = TO->getInteger("offset");
+        auto Length = TO->getInteger("length");
+        auto Text = TO->getString("replacement");
+        if (!File || !Offset || !Length || !Text)
+            return false;
+        R.Transformations.push_back(
+            {File->str(), unsigned(*Offset), unsigned(*Length), Text->str()});
+    }
+
+    const llvm::json::Array *StructLayouts = O->getArray("struct_layouts");
+    if (!StructLayouts)
+        return false;
+    for (const llvm::json::Value &SV : *StructLayouts) {
+        StructLayoutRecord S;
+        if (!decodeStructLayout(SV, S))
+            return false;
+        R.StructLayouts.push_back(std::move(S));
+    }
+
+    const llvm::json::Array *Arrays = O->getArray("arrays");
+    if (!Arrays)
+        return false;
+    for (const llvm::json::Value &AV : *Arrays) {
+        ArrayStorageRecord A;
+        if (!decodeArray(AV, A))
+            return false;
+        R.Arrays.push_back(std::move(A));
+    }
+
+    const llvm::json::Array *Loops = O->getArray("loops");
+    if (!Loops)
+        return false;
+    for (const llvm::json::Value &LV : *Loops) {
+        LoopVectorRecord L;
+        if (!decodeLoop(LV, L))
+            return false;
+        R.Loops.push_back(std::move(L));
+    }
+
+    const llvm::json::Array *ConversionCosts = O->getArray("conversion_costs");
+    if (!ConversionCosts)
+        return false;
+    for (const llvm::json::Value &CV : *ConversionCosts) {
+        ConversionCostRecord C;
+        if (!decodeConversionCost(CV, C))
+            return false;
+        R.ConversionCosts.push_back(std::move(C));
+    }
+
+    std::vector<std::pair<std::string, std::string>> Exported;
+    if (!decodePairs(O->getArray("exported_summaries"), Exported) ||
+        !decodePairs(O->getArray("summary_deps"), R.SummaryDeps))
+        return false;
+    for (auto &E : Exported) {
+        FunctionSummary Summary;
+        if (!FunctionSummary::parse(E.second, Summary))
+            return false;
+        R.ExportedSummaries.emplace_back(std::move(E.first), std::move(Summary));
+    }
+
+    MemoryUsage &M = R.Memory;
+    if (!decodeCount(*Memory, "original_bytes", M.originalBytes) ||
+        !decodeCount(*Memory, "demoted_bytes", M.demotedBytes) ||
+        !decodeCount(*Memory, "float_vars", M.floatVarCount) ||
+        !decodeCount(*Memory, "demoted_vars", M.demotedVarCount) ||
+        !decodeCount(*Memory, "float_literals", M.floatLiteralCount) ||
+        !decodeCount(*Memory, "demoted_literals", M.demotedLiteralCount) ||
+        !decodeCount(*Memory, "float_fields", M.floatFieldCount) ||
+        !decodeCount(*Memory, "demoted_fields", M.demotedFieldCount) ||
+        !decodeCount(*Memory, "float_arrays", M.floatArrayCount) ||
+        !decodeCount(*Memory, "demoted_arrays", M.demotedArrayCount) ||
+        !decodeCount(*Memory, "double_vars", M.doubleVarCount) ||
+        !decodeCount(*Memory, "demoted_double_vars", M.demotedDoubleVarCount) ||
+        !decodeCount(*Memory, "double_literals", M.doubleLiteralCount) ||
+        !decodeCount(*Memory, "demoted_double_literals", M.demotedDoubleLiteralCount) ||
+        !decodeCount(*Memory, "double_bytes", M.doubleBytes) ||
+        !decodeCount(*Memory, "demoted_double_bytes", M.demotedDoubleBytes) ||
+        !decodeCount(*Memory, "float_math_calls", M.floatMathCalls) ||
+        !decodeStorage(Memory->getObject("global"), M.global) ||
+        !decodeStorage(Memory->getObject("static"), M.staticLocal) ||
+        !decodeStorage(Memory->getObject("stack"), M.stack) ||
+        !decodeCount(*Memory, "largest_frame_bytes", M.largestFrameBytes) ||
+        !decodeCount(*Memory, "largest_frame_demoted_bytes", M.largestFrameDemotedBytes) ||
+        !decodeFormats(Memory->getArray("formats"), M))
+        return false;
+
+    Out = std::move(R);
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// AnalysisCache
+//===----------------------------------------------------------------------===//
+
+AnalysisCache::AnalysisCache(std::string Dir, uint64_t MaxBytes)
+    : Dir(std::move(Dir)), MaxBytes(MaxBytes) {
+    llvm::sys::fs::create_directories(this->Dir);
+}
+
+std::string AnalysisCache::entryPath(llvm::StringRef Key) const {
+    llvm::SmallString<256> Path(Dir);
+    llvm::sys::path::append(Path, Key + ".json");
+    return std::string(Path);
+}
+
+bool AnalysisCache::lookup(llvm::StringRef Key, DemotionResult &Out) {
+    std::string Path = entryPath(Key);
+    auto Buffer = llvm::MemoryBuffer::getFile(Path);
+    if (!Buffer) {
+        ++Stats.Misses;
+        return false;
+    }
+
+    llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse((*Buffer)->getBuffer());
+    if (!Parsed || !decodeResult(*Parsed, Out)) {
+        if (!Parsed)
+            llvm::consumeError(Parsed.takeError());
+        // Stale or truncated entry: drop it so the next store replaces it.
+        llvm::sys::fs::remove(Path);
+        ++Stats.Misses;
+        return false;
+    }
+
+    // Refresh the modification time; eviction removes the oldest entries.
+    int FD;
+    if (!llvm::sys::fs::openFileForReadWrite(Path, FD, llvm::sys::fs::CD_OpenExisting,
+                                             llvm::sys::fs::OF_None)) {
+        llvm::sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now());
+        llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+    }
+
+    ++Stats.Hits;
+    return true;
+}
+
+void AnalysisCache::store(llvm::StringRef Key, const DemotionResult &Result) {
+    std::string Path = entryPath(Key);
+    std::string Serialized;
+    llvm::raw_string_ostream OS(Serialized);
+    OS << encodeResult(Result);
+    OS.flush();
+
+    // writeToOutput writes a temporary file and renames it into place, so
+    // concurrent readers never observe a partial entry.
+    llvm::Error Err = llvm::writeToOutput(Path, [&](llvm::raw_ostream &Out) {
+        Out << Serialized;
+        return llvm::Error::success();
+    });
+    if (Err) {
+        llvm::errs() << "Warning: cannot write cache entry " << Path << ": "
+                     << llvm::toString(std::move(Err)) << "\n";
+        return;
+    }
+    ++Stats.Stores;
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (!Scanned)
+        scanDirectory();
+    else
+        TotalBytes += Serialized.size();
+    if (TotalBytes > MaxBytes)
+        evictIfNeeded();
+}
+
+void AnalysisCache::scanDirectory() {
+    TotalBytes = 0;
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC;
+         It.increment(EC)) {
+        if (llvm::sys::path::extension(It->path()) != ".json")
+            continue;
+        if (auto Status = It->status())
+            TotalBytes += Status->getSize();
+    }
+    Scanned = true;
+}
+
+void AnalysisCache::evictIfNeeded() {
+    struct Entry {
+        std::string Path;
+        uint64_t Size;
+        llvm::sys::TimePoint<> MTime;
+    };
+    std::vector<Entry> Entries;
+    uint64_t Total = 0;
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC;
+         It.increment(EC)) {
+        if (llvm::sys::path::extension(It->path()) != ".json")
+            continue;
+        auto Status = It->status();
+        if (!Status)
+            continue;
+        Entries.push_back({It->path(), Status->getSize(), Status->getLastModificationTime()});
+        Total += Status->getSize();
+    }
+
+    // Evict least recently used entries down to 90% of the limit so that
+    // every store near the limit does not trigger another directory scan.
+    std::sort(Entries.begin(), Entries.end(),
+              [](const Entry &A, const Entry &B) { return A.MTime < B.MTime; });
+    uint64_t Target = MaxBytes - MaxBytes / 10;
+    for (const Entry &E : Entries) {
+        if (Total <= Target)
+            break;
+        if (!llvm::sys::fs::remove(E.Path)) {
+            Total -= E.Size;
+            ++Stats.Evictions;
+        }
+    }
+    TotalBytes = Total;
+}
+
+void AnalysisCache::printStats(llvm::raw_ostream &OS) const {
+    uint64_t Hits = Stats.Hits, Misses = Stats.Misses;
+    uint64_t Lookups = Hits + Misses;
+    OS << "Analysis cache: " << Hits << " hits, " << Misses << " misses";
+    if (Lookups)
+        OS << " (" << (Hits * 100 / Lookups) << "% hit rate)";
+    OS << ", " << Stats.Stores << " stores, " << Stats.Evictions << " evictions\n";
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,99 @@
+//===- Fp16AnalysisCache.h - On-disk analysis result cache -----*- C++ -*-===//
+//
+// Content-addressed cache of DemotionResults. The key hashes the expanded
+// token stream of the translation unit and the file and offset each token is
+// spelled at (so edits to included headers, or another header found in
+// their place, invalidate it), the name and raw contents of the main file
+// (so recorded paths, offsets and locations stay valid), the
+// analysis-relevant plugin arguments and the plugin/clang version. Entries
+// are single JSON files written atomically, so several compiler processes may
+// share one cache directory. When the directory grows past its size limit the
+// least recently used entries are evicted.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_ANALYSIS_CACHE_H
+#define FP16_ANALYSIS_CACHE_H
+
+#include "Fp16Demotion.h"
+#include "clang/Basic/SourceLocation.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace clang {
+class Preprocessor;
+class SourceManager;
+class Token;
+} // namespace clang
+
+namespace fp16demotion {
+
+// Accumulates the cache key for one translation unit.
+class CacheKeyBuilder {
+public:
+    explicit CacheKeyBuilder(const DemotionOptions &Opts);
+
+    // Feed one token of the expanded token stream.
+    void addToken(const clang::Preprocessor &PP, const clang::Token &Tok);
+
+    // Mixes in the name and raw contents of the main file and returns the
+    // hex key.
+    std::string finish(const clang::SourceManager &SM);
+
+private:
+    void addBytes(llvm::StringRef Bytes);
+
+    llvm::SHA256 Hasher;
+    // Files that spelled a token so far, in order of their first token
+    llvm::DenseMap<clang::FileID, uint32_t> FileIndices;
+};
+
+// JSON has no encoding for non-finite numbers, so they are stored as the
+// strings "inf", "-inf" and "nan".
+llvm::json::Value encodeDouble(double V);
+bool decodeDouble(const llvm::json::Value *V, double &Out);
+
+struct CacheStats {
+    std::atomic<uint64_t> Hits{0};
+    std::atomic<uint64_t> Misses{0};
+    std::atomic<uint64_t> Stores{0};
+    std::atomic<uint64_t> Evictions{0};
+};
+
+class AnalysisCache {
+public:
+    AnalysisCache(std::string Dir, uint64_t MaxBytes);
+
+    // Fills Out and returns true if Key is cached.
+    bool lookup(llvm::StringRef Key, DemotionResult &Out);
+
+    void store(llvm::StringRef Key, const DemotionResult &Result);
+
+    const CacheStats &stats() const { return Stats; }
+
+    void printStats(llvm::raw_ostream &OS) const;
+
+private:
+    std::string entryPath(llvm::StringRef Key) const;
+    void scanDirectory();
+    void evictIfNeeded();
+
+    std::string Dir;
+    uint64_t MaxBytes;
+    CacheStats Stats;
+
+    std::mutex Mutex; // Guards the fields below
+    bool Scanned = false;
+    uint64_t TotalBytes = 0;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_ANALYSIS_CACHE_H
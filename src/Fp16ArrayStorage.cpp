@@ -0,0 +1,337 @@
+#include "Fp16ArrayStorage.h"
+#include "Fp16RangeAnalysis.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/ParentMapContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+const char *const HalfStorageType = "fp16_storage_t";
+
+const char *const HalfStoragePrelude =
+    "/* binary16 array storage, added by FP16 demotion */\n"
+    "#ifndef FP16_STORAGE_T_DEFINED\n"
+    "#define FP16_STORAGE_T_DEFINED\n"
+    "typedef unsigned short fp16_storage_t;\n"
+    "#endif\n"
+    "static inline float fp16_load(fp16_storage_t bits) {\n"
+    "    __fp16 h;\n"
+    "    __builtin_memcpy(&h, &bits, sizeof h);\n"
+    "    return h;\n"
+    "}\n"
+    "static inline fp16_storage_t fp16_store(float value) {\n"
+    "    __fp16 h = value;\n"
+    "    fp16_storage_t bits;\n"
+    "    __builtin_memcpy(&bits, &h, sizeof bits);\n"
+    "    return bits;\n"
+    "}\n\n";
+
+std::string halfBitsLiteral(const llvm::APFloat &V) {
+    llvm::APFloat Half = V;
+    bool LosesInfo;
+    Half.convert(llvm::APFloat::IEEEhalf(), llvm::APFloat::rmNearestTiesToEven, &LosesInfo);
+    char Buffer[8];
+    snprintf(Buffer, sizeof Buffer, "0x%04x", unsigned(Half.bitcastToAPInt().getZExtValue()));
+    return Buffer;
+}
+
+bool isFloatArray(ASTContext &Context, QualType T) {
+    if (!T->isConstantArrayType() || T->isVariablyModifiedType())
+        return false;
+    QualType Element = Context.getBaseElementType(T);
+    return Element->isSpecificBuiltinType(BuiltinType::Float) && !Element.isVolatileQualified();
+}
+
+static const VarDecl *referencedVar(const Expr *E) {
+    if (const auto *DRE = dyn_cast_or_null<DeclRefExpr>(E ? E->IgnoreParenImpCasts() : nullptr))
+        return dyn_cast<VarDecl>(DRE->getDecl());
+    return nullptr;
+}
+
+static bool constantInt(ASTContext &Context, const Expr *E, int64_t &Value) {
+    Expr::EvalResult Result;
+    if (!E || E->isValueDependent() || !E->EvaluateAsInt(Result, Context))
+        return false;
+    Value = Result.Val.getInt().getExtValue();
+    return true;
+}
+
+bool tripCount(ASTContext &Context, const ForStmt *FS, double &Count) {
+    const VarDecl *Var = nullptr;
+    int64_t Start, Bound, Step;
+    if (const auto *DS = dyn_cast_or_null<DeclStmt>(FS->getInit())) {
+        Var = DS->isSingleDecl() ? dyn_cast<VarDecl>(DS->getSingleDecl()) : nullptr;
+        if (!Var || !constantInt(Context, Var->getInit(), Start))
+            return false;
+    } else if (const auto *BO = dyn_cast_or_null<BinaryOperator>(FS->getInit())) {
+        Var = BO->getOpcode() == BO_Assign ? referencedVar(BO->getLHS()) : nullptr;
+        if (!Var || !constantInt(Context, BO->getRHS(), Start))
+            return false;
+    }
+    if (!Var || !Var->getType()->isIntegerType() || !FS->getInc() || !FS->getCond())
+        return false;
+
+    const Expr *Inc = FS->getInc()->IgnoreParens();
+    if (const auto *UO = dyn_cast<UnaryOperator>(Inc)) {
+        if (!UO->isIncrementDecrementOp() || referencedVar(UO->getSubExpr()) != Var)
+            return false;
+        Step = UO->isIncrementOp() ? 1 : -1;
+    } else if (const auto *CAO = dyn_cast<CompoundAssignOperator>(Inc)) {
+        if (referencedVar(CAO->getLHS()) != Var || !constantInt(Context, CAO->getRHS(), Step))
+            return false;
+        if (CAO->getOpcode() == BO_SubAssign)
+            Step = -Step;
+        else if (CAO->getOpcode() != BO_AddAssign)
+            return false;
+    } else {
+        return false;
+    }
+    if (Step == 0)
+        return false;
+
+    const auto *Cond = dyn_cast<BinaryOperator>(FS->getCond()->IgnoreParenImpCasts());
+    if (!Cond || referencedVar(Cond->getLHS()) != Var ||
+        !constantInt(Context, Cond->getRHS(), Bound))
+        return false;
+    double Distance;
+    switch (Cond->getOpcode()) {
+    case BO_LT: Distance = double(Bound) - double(Start); break;
+    case BO_LE: Distance = double(Bound) - double(Start) + 1; break;
+    case BO_GT: Distance = double(Start) - double(Bound); break;
+    case BO_GE: Distance = double(Start) - double(Bound) + 1; break;
+    case BO_NE: Distance = std::fabs(double(Bound) - double(Start)); break;
+    default: return false;
+    }
+    bool Upward = Cond->getOpcode() == BO_LT || Cond->getOpcode() == BO_LE;
+    bool Downward = Cond->getOpcode() == BO_GT || Cond->getOpcode() == BO_GE;
+    if ((Upward && Step < 0) || (Downward && Step > 0))
+        return false;
+    Count = std::max(0.0, std::ceil(Distance / std::fabs(double(Step))));
+    return true;
+}
+
+class ArrayUseVisitor : public RecursiveASTVisitor<ArrayUseVisitor> {
+public:
+    explicit ArrayUseVisitor(ArrayUseCollector &Collector) : Collector(Collector) {}
+
+    bool VisitArraySubscriptExpr(ArraySubscriptExpr *ASE);
+
+    // Field arrays are initialized through the initializer of their record.
+    bool VisitInitListExpr(InitListExpr *ILE) {
+        Collector.scanRecordInit(ILE->isSemanticForm() ? ILE : ILE->getSemanticForm());
+        return true;
+    }
+
+    bool TraverseForStmt(ForStmt *S) {
+        double Count;
+        bool Known = tripCount(Collector.Context, S, Count);
+        return traverseLoop(Known ? Count : 1, Known, [&] { return Base::TraverseForStmt(S); });
+    }
+    bool TraverseWhileStmt(WhileStmt *S) {
+        return traverseLoop(1, false, [&] { return Base::TraverseWhileStmt(S); });
+    }
+    bool TraverseDoStmt(DoStmt *S) {
+        return traverseLoop(1, false, [&] { return Base::TraverseDoStmt(S); });
+    }
+    bool TraverseCXXForRangeStmt(CXXForRangeStmt *S) {
+        return traverseLoop(1, false, [&] { return Base::TraverseCXXForRangeStmt(S); });
+    }
+
+private:
+    using Base = RecursiveASTVisitor<ArrayUseVisitor>;
+
+    template <typename Fn> bool traverseLoop(double Count, bool Known, Fn Traverse) {
+        double OldWeight = Weight;
+        bool OldExact = Exact;
+        Weight *= Count;
+        Exact &= Known;
+        bool Continue = Traverse();
+        Weight = OldWeight;
+        Exact = OldExact;
+        return Continue;
+    }
+
+    const Stmt *parentOf(const Expr *&E);
+    bool isValueUnused(const Expr *E);
+
+    ArrayUseCollector &Collector;
+    llvm::DenseSet<const ArraySubscriptExpr *> Seen;
+    double Weight = 1;
+    bool Exact = true;
+};
+
+// The parent of E, looking through parentheses; E is set to the outermost
+// parenthesis.
+const Stmt *ArrayUseVisitor::parentOf(const Expr *&E) {
+    while (true) {
+        DynTypedNodeList Parents = Collector.Context.getParents(*E);
+        if (Parents.size() != 1)
+            return nullptr;
+        const Stmt *Parent = Parents[0].get<Stmt>();
+        const auto *PE = dyn_cast_or_null<ParenExpr>(Parent);
+        if (!PE)
+            return Parent;
+        E = PE;
+    }
+}
+
+// True if E is evaluated only for its side effects.
+bool ArrayUseVisitor::isValueUnused(const Expr *E) {
+    const Stmt *Parent = parentOf(E);
+    if (!Parent)
+        return false;
+    if (isa<CompoundStmt>(Parent) || isa<LabelStmt>(Parent) || isa<SwitchCase>(Parent))
+        return true;
+    if (const auto *BO = dyn_cast<BinaryOperator>(Parent))
+        return BO->getOpcode() == BO_Comma && BO->getLHS() == E;
+    if (const auto *FS = dyn_cast<ForStmt>(Parent))
+        return FS->getInc() == E || FS->getBody() == E;
+    if (const auto *IS = dyn_cast<IfStmt>(Parent))
+        return IS->getCond() != E;
+    if (const auto *WS = dyn_cast<WhileStmt>(Parent))
+        return WS->getBody() == E;
+    if (const auto *DS = dyn_cast<DoStmt>(Parent))
+        return DS->getBody() == E;
+    return false;
+}
+
+bool ArrayUseVisitor::VisitArraySubscriptExpr(ArraySubscriptExpr *ASE) {
+    // Rows of multi-dimensional arrays are part of the element access
+    // around them.
+    if (!ASE->getType()->isRealFloatingType() || !Seen.insert(ASE).second)
+        return true;
+    ArrayUses *Uses = Collector.find(indexedArray(ASE));
+    if (!Uses)
+        return true;
+
+    const Expr *Outer = ASE;
+    const Stmt *Parent = parentOf(Outer);
+    if (isa_and_nonnull<UnaryExprOrTypeTraitExpr>(Parent))
+        return true; // sizeof stays consistent with the new element type
+    Uses->Accesses += Weight;
+    Uses->AccessesExact &= Exact;
+
+    const auto *ICE = dyn_cast_or_null<ImplicitCastExpr>(Parent);
+    const auto *BO = dyn_cast_or_null<BinaryOperator>(Parent);
+    if (ICE && ICE->getCastKind() == CK_LValueToRValue) {
+        if (Collector.rewritable(ASE->getSourceRange()))
+            Uses->Reads.push_back(ASE);
+        else
+            Collector.block(*Uses, "element access written in a macro");
+    } else if (BO && BO->getOpcode() == BO_Assign && BO->getLHS() == Outer) {
+        if (!isValueUnused(BO))
+            Collector.block(*Uses, "the value of an element assignment is used");
+        else if (!Collector.rewritable(BO->getRHS()->getSourceRange()))
+            Collector.block(*Uses, "element access written in a macro");
+        else
+            Uses->StoredValues.push_back(BO->getRHS());
+    } else {
+        Collector.block(*Uses, "element used other than by a read or an assignment");
+    }
+    return true;
+}
+
+static const ValueDecl *canonicalArray(const ValueDecl *Array) {
+    if (const auto *VD = dyn_cast_or_null<VarDecl>(Array))
+        return VD->getCanonicalDecl();
+    return Array;
+}
+
+ArrayUseCollector::ArrayUseCollector(ASTContext &Context, llvm::ArrayRef<const ValueDecl *> Arrays)
+    : Context(Context) {
+    for (const ValueDecl *Array : Arrays) {
+        ArrayUses &Entry = Uses[canonicalArray(Array)];
+        if (const auto *VD = dyn_cast<VarDecl>(Array)) {
+            if (VD->getPreviousDecl() || VD->getMostRecentDecl() != VD)
+                block(Entry, "declared more than once");
+            else if (const Expr *Init = VD->getInit())
+                addInitializer(Entry, Init);
+            continue;
+        }
+        const auto *FD = cast<FieldDecl>(Array);
+        if (FD->hasInClassInitializer())
+            block(Entry, "has a default member initializer");
+        if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(FD->getParent()))
+            if (CXXRD->hasUserDeclaredConstructor())
+                block(Entry, "its class has constructors");
+    }
+
+    SourceManager &SM = Context.getSourceManager();
+    ArrayUseVisitor Visitor(*this);
+    for (Decl *D : Context.getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Visitor.TraverseDecl(D);
+}
+
+const ArrayUses &ArrayUseCollector::uses(const ValueDecl *Array) const {
+    return Uses.find(canonicalArray(Array))->second;
+}
+
+ArrayUses *ArrayUseCollector::find(const ValueDecl *Array) {
+    auto It = Uses.find(canonicalArray(Array));
+    return It != Uses.end() ? &It->second : nullptr;
+}
+
+void ArrayUseCollector::block(ArrayUses &Entry, const char *Why) {
+    if (Entry.Blocked.empty())
+        Entry.Blocked = Why;
+}
+
+bool ArrayUseCollector::rewritable(SourceRange Range) const {
+    SourceManager &SM = Context.getSourceManager();
+    return Range.isValid() && Range.getBegin().isFileID() && Range.getEnd().isFileID() &&
+           SM.isInMainFile(Range.getBegin());
+}
+
+void ArrayUseCollector::addInitializer(ArrayUses &Entry, const Expr *Init) {
+    const auto *ILE = dyn_cast<InitListExpr>(Init->IgnoreImplicit());
+    if (!ILE) {
+        block(Entry, "not initialized by a braced list");
+        return;
+    }
+    forEachElementInit(ILE, [&](const Expr *Element) {
+        // A GNU range designator initializes several elements with one
+        // expression.
+        if (!Element || !SeenInits.insert(Element).second)
+            return;
+        if (rewritable(Element->IgnoreImplicit()->getSourceRange()))
+            Entry.InitElements.push_back(Element);
+        else
+            block(Entry, "initializer written in a macro");
+    });
+}
+
+// The fields of a record initialized by one list, with elided braces
+// followed into nested records.
+void ArrayUseCollector::scanRecordInit(const InitListExpr *ILE) {
+    if (!ILE || !SeenLists.insert(ILE).second)
+        return;
+    const auto *RT = ILE->getType()->getAs<RecordType>();
+    if (RT && !RT->getDecl()->isUnion()) {
+        const RecordDecl *RD = RT->getDecl();
+        unsigned Index = 0;
+        if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(RD))
+            Index = CXXRD->getNumBases();
+        for (const FieldDecl *FD : RD->fields()) {
+            if (FD->isUnnamedBitfield())
+                continue;
+            if (Index >= ILE->getNumInits())
+                break;
+            const Expr *Init = ILE->getInit(Index++);
+            ArrayUses *Entry = find(FD);
+            if (Entry && Init && !isa<ImplicitValueInitExpr>(Init))
+                addInitializer(*Entry, Init);
+        }
+    }
+    for (const Expr *Init : ILE->inits())
+        if (const auto *Nested = dyn_cast_or_null<InitListExpr>(Init))
+            scanRecordInit(Nested);
+}
+
+} // namespace fp16demotion
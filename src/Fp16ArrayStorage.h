@@ -0,0 +1,84 @@
+//===- Fp16ArrayStorage.h - binary16 storage for float arrays --*- C++ -*-===//
+//
+// Float arrays whose elements all fit binary16 can store 16-bit patterns
+// instead: half the memory, and half the bytes moved by every pass over
+// them. A converted array holds fp16_storage_t elements. Constant element
+// initializers are converted at analysis time and written as hex bit
+// patterns; every element read goes through fp16_load and every store
+// through fp16_store, defined by a short prelude at the top of the demoted
+// file.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_ARRAY_STORAGE_H
+#define FP16_ARRAY_STORAGE_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include <string>
+#include <vector>
+
+namespace fp16demotion {
+
+// Element type of converted arrays and the helpers reading and writing it.
+extern const char *const HalfStorageType;
+extern const char *const HalfStoragePrelude;
+
+// Bit pattern of V rounded to binary16, as a hex literal ("0x3c00").
+std::string halfBitsLiteral(const llvm::APFloat &V);
+
+// True for constant-size arrays, of any rank, of non-volatile float.
+bool isFloatArray(clang::ASTContext &Context, clang::QualType T);
+
+// Trip count of a counting loop with constant bounds and step:
+// for (i = A; i < B; ++i) and its variants. False for other loops.
+bool tripCount(clang::ASTContext &Context, const clang::ForStmt *FS, double &Count);
+
+// The uses of one array that a conversion rewrites.
+struct ArrayUses {
+    std::vector<const clang::ArraySubscriptExpr *> Reads;
+    std::vector<const clang::Expr *> StoredValues; // Right-hand side of each store
+    std::vector<const clang::Expr *> InitElements; // Explicit element initializers
+    // Element accesses, each weighted by the trip counts of the loops
+    // around it. Loops without a constant trip count count once, which
+    // makes the estimate inexact.
+    double Accesses = 0;
+    bool AccessesExact = true;
+    // Why the uses cannot be rewritten; empty if they can.
+    std::string Blocked;
+};
+
+// Collects the uses of the given arrays (variables or fields) in the main
+// file. Uses other than element reads, element stores whose value is not
+// used and initializers written in the main file block the conversion.
+class ArrayUseCollector {
+public:
+    ArrayUseCollector(clang::ASTContext &Context, llvm::ArrayRef<const clang::ValueDecl *> Arrays);
+
+    // Variables are looked up by their canonical declaration.
+    const ArrayUses &uses(const clang::ValueDecl *Array) const;
+
+private:
+    friend class ArrayUseVisitor;
+
+    ArrayUses *find(const clang::ValueDecl *Array);
+    void block(ArrayUses &Uses, const char *Why);
+    bool rewritable(clang::SourceRange Range) const;
+    void addInitializer(ArrayUses &Uses, const clang::Expr *Init);
+    void scanRecordInit(const clang::InitListExpr *ILE);
+
+    clang::ASTContext &Context;
+    llvm::DenseMap<const clang::ValueDecl *, ArrayUses> Uses;
+    llvm::DenseSet<const clang::Expr *> SeenInits;
+    llvm::DenseSet<const clang::InitListExpr *> SeenLists;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_ARRAY_STORAGE_H
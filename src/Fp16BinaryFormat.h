@@ -0,0 +1,85 @@
+//===- Fp16BinaryFormat.h - float_map.bin on-disk layout -------*- C++ -*-===//
+//
+// Layout of the binary float map written with -fprecision-demote-format=binary.
+// The file is designed to be mmap'ed and read in place:
+//
+//   FileHeader                       (64 bytes, at offset 0)
+//   Record[RecordCount]              (48 bytes each, at RecordOffset)
+//   FileIndexEntry[FileCount]        (24 bytes each, at FileIndexOffset)
+//   string table                     (StringTableSize bytes)
+//
+// Records are grouped by source file and the file index is sorted by file
+// name, so the records of one file are a contiguous slice found by binary
+// search. All strings (file names, reasons, variable names, formats) are
+// interned in the string table as NUL-terminated UTF-8 and referenced by
+// byte offset; offset 0 is always the empty string. Integers are stored in
+// the byte order of the writer, recorded in FileHeader::ByteOrder.
+//
+// This header has no dependencies beyond the C++ standard library so that
+// readers (Fp16BinaryReader.h) can be built without LLVM.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_BINARY_FORMAT_H
+#define FP16_BINARY_FORMAT_H
+
+#include <cstdint>
+
+namespace fp16demotion {
+namespace binfmt {
+
+const char Magic[8] = {'F', 'P', '1', '6', 'M', 'A', 'P', '\0'};
+const uint32_t FormatVersion = 1;
+const uint32_t ByteOrderMark = 0x01020304;
+
+enum RecordKind : uint8_t {
+    LiteralRecordKind = 0,
+    VariableRecordKind = 1,
+};
+
+enum RecordFlags : uint8_t {
+    SafeFlag = 1 << 0,
+};
+
+struct FileHeader {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ByteOrder;
+    uint64_t RecordCount;
+    uint64_t RecordOffset;
+    uint64_t FileCount;
+    uint64_t FileIndexOffset;
+    uint64_t StringTableOffset;
+    uint64_t StringTableSize;
+};
+
+struct Record {
+    double Value;      // Literal value; 0 for variables
+    double Error;      // Relative error of the fp16 round trip; 0 for variables
+    float Downcast;    // Value after the fp16 round trip; 0 for variables
+    uint32_t Reason;   // String offset; empty when safe
+    uint32_t Name;     // String offset of the variable name; empty for literals
+    uint32_t File;     // Index into the file index
+    uint32_t Line;
+    uint32_t Column;
+    uint8_t Kind;      // RecordKind
+    uint8_t Flags;     // RecordFlags
+    uint16_t Reserved0;
+    uint32_t Mode;     // String offset of the format name; empty means fp16
+};
+
+struct FileIndexEntry {
+    uint32_t Name;     // String offset of the file name
+    uint32_t Reserved;
+    uint64_t FirstRecord;
+    uint64_t RecordCount;
+};
+
+static_assert(sizeof(FileHeader) == 64, "FileHeader layout changed");
+static_assert(sizeof(Record) == 48, "Record layout changed");
+static_assert(sizeof(FileIndexEntry) == 24, "FileIndexEntry layout changed");
+
+} // namespace binfmt
+} // namespace fp16demotion
+
+#endif // FP16_BINARY_FORMAT_H
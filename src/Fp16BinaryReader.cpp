@@ -0,0 +1,130 @@
+#include "Fp16BinaryReader.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fp16demotion {
+
+std::unique_ptr<BinaryFloatMap> BinaryFloatMap::open(const std::string &Path,
+                                                     std::string *Error) {
+    auto Fail = [&](const std::string &Message) -> std::unique_ptr<BinaryFloatMap> {
+        if (Error)
+            *Error = Path + ": " + Message;
+        return nullptr;
+    };
+
+    int FD = ::open(Path.c_str(), O_RDONLY);
+    if (FD < 0)
+        return Fail(std::strerror(errno));
+    struct stat St;
+    if (::fstat(FD, &St) != 0) {
+        int Err = errno;
+        ::close(FD);
+        return Fail(std::strerror(Err));
+    }
+    size_t Size = size_t(St.st_size);
+    if (Size < sizeof(binfmt::FileHeader)) {
+        ::close(FD);
+        return Fail("file too small for a float map header");
+    }
+    void *Data = ::mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, FD, 0);
+    int Err = errno;
+    ::close(FD);
+    if (Data == MAP_FAILED)
+        return Fail(std::strerror(Err));
+
+    std::unique_ptr<BinaryFloatMap> Map(new BinaryFloatMap(Data, Size));
+    std::string Message;
+    if (!Map->validate(Message))
+        return Fail(Message);
+    return Map;
+}
+
+BinaryFloatMap::BinaryFloatMap(void *Data, size_t Size) : Data(Data), Size(Size) {}
+
+BinaryFloatMap::~BinaryFloatMap() { ::munmap(Data, Size); }
+
+bool BinaryFloatMap::validate(std::string &Error) {
+    const char *Base = static_cast<const char *>(Data);
+    Header = reinterpret_cast<const binfmt::FileHeader *>(Base);
+
+    if (std::memcmp(Header->Magic, binfmt::Magic, sizeof(binfmt::Magic)) != 0) {
+        Error = "not a float map (bad magic)";
+        return false;
+    }
+    if (Header->ByteOrder != binfmt::ByteOrderMark) {
+        Error = "float map was written with a different byte order";
+        return false;
+    }
+    if (Header->Version != binfmt::FormatVersion) {
+        Error = "unsupported float map version " + std::to_string(Header->Version);
+        return false;
+    }
+
+    // Each section must lie inside the file and be suitably aligned. Sizes
+    // are checked by division so a corrupt count cannot overflow.
+    auto SectionOK = [&](uint64_t Offset, uint64_t Count, uint64_t ElemSize, uint64_t Align) {
+        return Offset <= Size && Offset % Align == 0 && Count <= (Size - Offset) / ElemSize;
+    };
+    if (!SectionOK(Header->RecordOffset, Header->RecordCount, sizeof(binfmt::Record),
+                   alignof(binfmt::Record)) ||
+        !SectionOK(Header->FileIndexOffset, Header->FileCount, sizeof(binfmt::FileIndexEntry),
+                   alignof(binfmt::FileIndexEntry)) ||
+        !SectionOK(Header->StringTableOffset, Header->StringTableSize, 1, 1)) {
+        Error = "section extends past the end of the file";
+        return false;
+    }
+    Records = reinterpret_cast<const binfmt::Record *>(Base + Header->RecordOffset);
+    Files = reinterpret_cast<const binfmt::FileIndexEntry *>(Base + Header->FileIndexOffset);
+    Strings = Base + Header->StringTableOffset;
+
+    // Offset 0 must be the empty string and the table must end in a NUL so
+    // that every in-range offset yields a terminated string.
+    uint64_t TableSize = Header->StringTableSize;
+    if (TableSize == 0 || Strings[0] != '\0' || Strings[TableSize - 1] != '\0') {
+        Error = "malformed string table";
+        return false;
+    }
+
+    for (uint64_t I = 0; I < Header->FileCount; ++I) {
+        const binfmt::FileIndexEntry &Entry = Files[I];
+        if (Entry.Name >= TableSize || Entry.FirstRecord > Header->RecordCount ||
+            Entry.RecordCount > Header->RecordCount - Entry.FirstRecord) {
+            Error = "file index entry " + std::to_string(I) + " out of range";
+            return false;
+        }
+        if (I > 0 && std::strcmp(string(Files[I - 1].Name), string(Entry.Name)) >= 0) {
+            Error = "file index is not sorted";
+            return false;
+        }
+    }
+    for (uint64_t I = 0; I < Header->RecordCount; ++I) {
+        const binfmt::Record &Rec = Records[I];
+        if (Rec.Reason >= TableSize || Rec.Name >= TableSize || Rec.Mode >= TableSize ||
+            Rec.File >= Header->FileCount || Rec.Kind > binfmt::VariableRecordKind) {
+            Error = "record " + std::to_string(I) + " out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t BinaryFloatMap::findFile(const char *Name) const {
+    uint64_t Lo = 0, Hi = fileCount();
+    while (Lo < Hi) {
+        uint64_t Mid = Lo + (Hi - Lo) / 2;
+        int Cmp = std::strcmp(fileName(Mid), Name);
+        if (Cmp == 0)
+            return Mid;
+        if (Cmp < 0)
+            Lo = Mid + 1;
+        else
+            Hi = Mid;
+    }
+    return fileCount();
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,64 @@
+//===- Fp16BinaryReader.h - Read-only view of float_map.bin ----*- C++ -*-===//
+//
+// Maps a float_map.bin file into memory and exposes its records in place,
+// without parsing or copying. Depends only on the C++ standard library and
+// POSIX so that downstream tools can link it without LLVM.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_BINARY_READER_H
+#define FP16_BINARY_READER_H
+
+#include "Fp16BinaryFormat.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace fp16demotion {
+
+class BinaryFloatMap {
+public:
+    // Maps Path and validates the header, section bounds and string table.
+    // Returns null and sets *Error (if given) when the file is unusable.
+    static std::unique_ptr<BinaryFloatMap> open(const std::string &Path,
+                                                std::string *Error = nullptr);
+
+    ~BinaryFloatMap();
+    BinaryFloatMap(const BinaryFloatMap &) = delete;
+    BinaryFloatMap &operator=(const BinaryFloatMap &) = delete;
+
+    uint64_t recordCount() const { return Header->RecordCount; }
+    const binfmt::Record &record(uint64_t I) const { return Records[I]; }
+    const binfmt::Record *records() const { return Records; }
+
+    uint64_t fileCount() const { return Header->FileCount; }
+    const binfmt::FileIndexEntry &file(uint64_t I) const { return Files[I]; }
+    const char *fileName(uint64_t I) const { return string(Files[I].Name); }
+
+    // The contiguous slice of records belonging to file I.
+    const binfmt::Record *recordsForFile(uint64_t I) const {
+        return Records + Files[I].FirstRecord;
+    }
+
+    // Binary search of the file index. Returns fileCount() if Name is absent.
+    uint64_t findFile(const char *Name) const;
+
+    // NUL-terminated string at Offset in the string table.
+    const char *string(uint32_t Offset) const { return Strings + Offset; }
+
+private:
+    BinaryFloatMap(void *Data, size_t Size);
+    bool validate(std::string &Error);
+
+    void *Data;
+    size_t Size;
+    const binfmt::FileHeader *Header = nullptr;
+    const binfmt::Record *Records = nullptr;
+    const binfmt::FileIndexEntry *Files = nullptr;
+    const char *Strings = nullptr;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_BINARY_READER_H
@@ -0,0 +1,262 @@
+#include "Fp16ConversionCost.h"
+#include "Fp16ArrayStorage.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseSet.h"
+
+using namespace clang;
+
+namespace fp16demotion {
+
+bool parseCostModelMode(llvm::StringRef Name, CostModelMode &Mode) {
+    if (Name == "flag")
+        Mode = CostModelMode::Flag;
+    else if (Name == "reject")
+        Mode = CostModelMode::Reject;
+    else
+        return false;
+    return true;
+}
+
+const char *costModelModeName(CostModelMode Mode) {
+    switch (Mode) {
+    case CostModelMode::Flag: return "flag";
+    case CostModelMode::Reject: return "reject";
+    case CostModelMode::Off: break;
+    }
+    return "off";
+}
+
+// Scalar conversions cost a cvt instruction plus a move between register
+// files; without hardware support they are the compiler-rt calls
+// __extendhfsf2 and __truncsfhf2.
+static const TargetCosts Tables[] = {
+    {"x86-avx512fp16", 1, 1, true, 0.125},
+    {"x86-f16c", 2, 2, false, 0.125},
+    {"x86-soft", 10, 20, false, 0.125},
+    {"armv8.2-fp16", 1, 1, true, 0.25},
+    {"armv8", 1, 1, false, 0.25},
+    {"soft", 15, 25, false, 0.25},
+};
+
+llvm::ArrayRef<TargetCosts> targetCostTables() { return Tables; }
+
+const TargetCosts *findTargetCosts(llvm::StringRef Name) {
+    for (const TargetCosts &T : Tables)
+        if (Name == T.Name)
+            return &T;
+    return nullptr;
+}
+
+const TargetCosts &targetCostsFor(const TargetInfo &TI) {
+    const llvm::Triple &Triple = TI.getTriple();
+    const char *Name = "soft";
+    if (Triple.isX86()) {
+        if (TI.hasFeature("avx512fp16"))
+            Name = "x86-avx512fp16";
+        else
+            Name = TI.hasFeature("f16c") ? "x86-f16c" : "x86-soft";
+    } else if (Triple.isAArch64() || Triple.isARM() || Triple.isThumb()) {
+        Name = TI.hasFeature("fullfp16") ? "armv8.2-fp16" : "armv8";
+    }
+    return *findTargetCosts(Name);
+}
+
+static bool isFloatVariable(const VarDecl *VD) {
+    return VD->getType().getCanonicalType()->isSpecificBuiltinType(BuiltinType::Float);
+}
+
+// The float variable E names, by its canonical declaration
+static const VarDecl *floatVariable(const Expr *E) {
+    const auto *DRE = dyn_cast<DeclRefExpr>(E->IgnoreParens());
+    const auto *VD = DRE ? dyn_cast<VarDecl>(DRE->getDecl()) : nullptr;
+    if (!VD || !isFloatVariable(VD))
+        return nullptr;
+    return VD->getCanonicalDecl();
+}
+
+// A read of a float variable
+static const ImplicitCastExpr *variableRead(const Expr *E) {
+    const auto *ICE = dyn_cast<ImplicitCastExpr>(E->IgnoreParens());
+    if (ICE && ICE->getCastKind() == CK_LValueToRValue && floatVariable(ICE->getSubExpr()))
+        return ICE;
+    return nullptr;
+}
+
+class ConversionUseVisitor : public RecursiveASTVisitor<ConversionUseVisitor> {
+public:
+    explicit ConversionUseVisitor(ConversionCostModel &Model) : Model(Model) {}
+
+    bool VisitVarDecl(VarDecl *VD) {
+        if (const Expr *Init = VD->getInit())
+            if (isFloatVariable(VD))
+                store(VD->getCanonicalDecl(), Init);
+        return true;
+    }
+
+    bool VisitImplicitCastExpr(ImplicitCastExpr *ICE) {
+        if (!variableRead(ICE))
+            return true;
+        ConversionCostModel::Uses &U = uses(floatVariable(ICE->getSubExpr()));
+        U.Reads += Weight;
+        if (!HalfReads.count(ICE))
+            U.MixedReads += Weight;
+        return true;
+    }
+
+    // Runs before the operands are visited
+    bool VisitBinaryOperator(BinaryOperator *BO) {
+        if (BO->isAssignmentOp()) {
+            const VarDecl *VD = floatVariable(BO->getLHS());
+            if (!VD)
+                return true;
+            if (BO->getOpcode() == BO_Assign) {
+                store(VD, BO->getRHS());
+            } else {
+                ConversionCostModel::Uses &U = uses(VD);
+                U.Updates += Weight;
+                if (!staysHalf(BO->getRHS(), VD))
+                    U.MixedUpdates += Weight;
+            }
+            return true;
+        }
+        if (BO->isCommaOp() || BO->isLogicalOp())
+            return true;
+        // An operand computes in half if the other one does too.
+        markHalfRead(BO->getLHS(), BO->getRHS());
+        markHalfRead(BO->getRHS(), BO->getLHS());
+        return true;
+    }
+
+    bool VisitUnaryOperator(UnaryOperator *UO) {
+        const VarDecl *VD = floatVariable(UO->getSubExpr());
+        if (UO->getOpcode() == UO_AddrOf && VD)
+            uses(VD).AddressTaken = true;
+        else if (UO->isIncrementDecrementOp() && VD)
+            uses(VD).Updates += Weight;
+        else if (UO->getOpcode() == UO_Minus || UO->getOpcode() == UO_Plus)
+            if (const ImplicitCastExpr *Read = variableRead(UO->getSubExpr()))
+                HalfReads.insert(Read);
+        return true;
+    }
+
+    bool TraverseForStmt(ForStmt *S) {
+        double Count;
+        bool Known = tripCount(Model.Context, S, Count);
+        return traverseLoop(Known ? Count : UnknownTripCount, Known,
+                            [&] { return Base::TraverseForStmt(S); });
+    }
+    bool TraverseWhileStmt(WhileStmt *S) {
+        return traverseLoop(UnknownTripCount, false, [&] { return Base::TraverseWhileStmt(S); });
+    }
+    bool TraverseDoStmt(DoStmt *S) {
+        return traverseLoop(UnknownTripCount, false, [&] { return Base::TraverseDoStmt(S); });
+    }
+    bool TraverseCXXForRangeStmt(CXXForRangeStmt *S) {
+        return traverseLoop(UnknownTripCount, false,
+                            [&] { return Base::TraverseCXXForRangeStmt(S); });
+    }
+
+private:
+    using Base = RecursiveASTVisitor<ConversionUseVisitor>;
+
+    template <typename Fn> bool traverseLoop(double Count, bool Known, Fn Traverse) {
+        double OldWeight = Weight;
+        bool OldExact = Exact;
+        Weight *= Count;
+        Exact &= Known;
+        bool Continue = Traverse();
+        Weight = OldWeight;
+        Exact = OldExact;
+        return Continue;
+    }
+
+    ConversionCostModel::Uses &uses(const VarDecl *VD) {
+        ConversionCostModel::Uses &U = Model.Vars[VD];
+        U.Exact &= Exact;
+        return U;
+    }
+
+    void store(const VarDecl *VD, const Expr *Value) {
+        ConversionCostModel::Uses &U = uses(VD);
+        U.Writes += Weight;
+        if (isConstant(Value))
+            U.ConstantWrites += Weight;
+        else if (!staysHalf(Value, VD))
+            U.MixedWrites += Weight;
+    }
+
+    void markHalfRead(const Expr *Operand, const Expr *Other) {
+        const ImplicitCastExpr *Read = variableRead(Operand);
+        if (Read && staysHalf(Other, floatVariable(Read->getSubExpr())))
+            HalfReads.insert(Read);
+    }
+
+    bool isConstant(const Expr *E) const {
+        return !E->isValueDependent() && E->isEvaluatable(Model.Context);
+    }
+
+    // Whether E computes in half once VD is: built from constants and VD
+    // with arithmetic
+    bool staysHalf(const Expr *E, const VarDecl *VD) const {
+        E = E->IgnoreParenImpCasts();
+        if (isConstant(E))
+            return true;
+        if (const VarDecl *Var = floatVariable(E))
+            return Var == VD;
+        if (const auto *BO = dyn_cast<BinaryOperator>(E))
+            return (BO->isAdditiveOp() || BO->isMultiplicativeOp()) &&
+                   staysHalf(BO->getLHS(), VD) && staysHalf(BO->getRHS(), VD);
+        if (const auto *UO = dyn_cast<UnaryOperator>(E))
+            return (UO->getOpcode() == UO_Minus || UO->getOpcode() == UO_Plus) &&
+                   staysHalf(UO->getSubExpr(), VD);
+        return false;
+    }
+
+    ConversionCostModel &Model;
+    llvm::DenseSet<const ImplicitCastExpr *> HalfReads;
+    double Weight = 1;
+    bool Exact = true;
+};
+
+void ConversionCostModel::collect() {
+    if (Collected)
+        return;
+    Collected = true;
+    SourceManager &SM = Context.getSourceManager();
+    ConversionUseVisitor Visitor(*this);
+    for (Decl *D : Context.getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Visitor.TraverseDecl(D);
+}
+
+ConversionCost ConversionCostModel::cost(const VarDecl *VD, const FloatFormat &Format) {
+    collect();
+    Uses U = Vars.lookup(VD->getCanonicalDecl());
+    // Only _Float16 has arithmetic of its own; __fp16 and __bf16 are
+    // storage formats and always compute in float.
+    bool Native = Target.NativeHalf && llvm::StringRef(Format.Name) == "float16";
+
+    ConversionCost C;
+    C.Reads = U.Reads;
+    C.Writes = U.Writes;
+    C.Updates = U.Updates;
+    if (Native) {
+        C.ToFloat = U.MixedReads + U.MixedUpdates;
+        C.FromFloat = U.MixedWrites + U.MixedUpdates;
+    } else {
+        C.ToFloat = U.Reads + U.Updates;
+        C.FromFloat = U.Writes - U.ConstantWrites + U.Updates;
+    }
+    C.ConversionCycles = C.ToFloat * Target.ToFloat + C.FromFloat * Target.FromFloat;
+    C.BytesSaved = (32.0 - Format.bits()) / 8;
+    C.MemoryResident = VD->hasGlobalStorage() || U.AddressTaken;
+    // An update reads and writes memory
+    if (C.MemoryResident)
+        C.BenefitCycles = (C.Reads + C.Writes + 2 * C.Updates) * C.BytesSaved *
+                          Target.CyclesPerByte;
+    C.Exact = U.Exact;
+    return C;
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,115 @@
+//===- Fp16ConversionCost.h - Price of half/float conversions --*- C++ -*-===//
+//
+// A demoted variable still computes in float wherever it meets float
+// operands: every such read converts half to float and every store float to
+// half. Without native half arithmetic (__fp16 and __bf16 always, _Float16
+// on most targets) that is every read and every store. The cost model counts
+// these conversions, each weighted by the trip counts of the loops around
+// it, prices them with a per-target table and compares them with the memory
+// traffic the narrower variable saves. Only variables kept in memory
+// (globals, statics, and locals whose address is taken) save traffic;
+// register locals save none.
+//
+// The tables are rough cycle counts for scalar code, enough to tell a cold
+// global from a hot loop counter. The operands a variable meets are taken
+// to stay float.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_CONVERSION_COST_H
+#define FP16_CONVERSION_COST_H
+
+#include "Fp16Formats.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/Basic/TargetInfo.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace fp16demotion {
+
+enum class CostModelMode {
+    Off,
+    Flag,   // Warn about demotions that cost more than they save
+    Reject, // Keep those variables float
+};
+
+// Parses the value of -fprecision-demote-cost-model=: flag or reject
+bool parseCostModelMode(llvm::StringRef Name, CostModelMode &Mode);
+
+// "flag" or "reject"; "off" for Off
+const char *costModelModeName(CostModelMode Mode);
+
+struct TargetCosts {
+    const char *Name;     // As spelled in -fprecision-demote-cost-target=
+    double ToFloat;       // Cycles per half -> float conversion
+    double FromFloat;     // Cycles per float -> half conversion
+    bool NativeHalf;      // _Float16 arithmetic without promotion to float
+    double CyclesPerByte; // Of memory traffic through the cache hierarchy
+};
+
+llvm::ArrayRef<TargetCosts> targetCostTables();
+
+// The table named Name, or null
+const TargetCosts *findTargetCosts(llvm::StringRef Name);
+
+// The table matching the architecture and features of TI
+const TargetCosts &targetCostsFor(const clang::TargetInfo &TI);
+
+// Default weight of a loop without a constant trip count
+const double UnknownTripCount = 8;
+
+// What demoting one variable costs and saves. Counts are weighted by the
+// trip counts of the loops around each use.
+struct ConversionCost {
+    double Reads = 0;
+    double Writes = 0;  // Initializer and assignments
+    double Updates = 0; // Compound assignments, increments and decrements
+    double ToFloat = 0; // Conversions introduced
+    double FromFloat = 0;
+    double ConversionCycles = 0;
+    double BytesSaved = 0; // Per access
+    double BenefitCycles = 0;
+    bool MemoryResident = false;
+    bool Exact = true; // Every loop around a use had a constant trip count
+
+    bool outweighs() const { return ConversionCycles > BenefitCycles; }
+};
+
+class ConversionCostModel {
+public:
+    ConversionCostModel(clang::ASTContext &Context, const TargetCosts &Target)
+        : Context(Context), Target(Target) {}
+
+    const TargetCosts &target() const { return Target; }
+
+    // The cost of storing the float variable VD in Format
+    ConversionCost cost(const clang::VarDecl *VD, const FloatFormat &Format);
+
+private:
+    friend class ConversionUseVisitor;
+
+    // Weighted uses of one variable. Mixed ones meet an operand that would
+    // still compute in float: anything but constants and the variable
+    // itself.
+    struct Uses {
+        double Reads = 0, MixedReads = 0;
+        double Writes = 0, ConstantWrites = 0, MixedWrites = 0;
+        double Updates = 0, MixedUpdates = 0;
+        bool AddressTaken = false;
+        bool Exact = true;
+    };
+
+    void collect();
+
+    clang::ASTContext &Context;
+    const TargetCosts &Target;
+    // Keyed by canonical declaration; filled on first use
+    llvm::DenseMap<const clang::VarDecl *, Uses> Vars;
+    bool Collected = false;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_CONVERSION_COST_H
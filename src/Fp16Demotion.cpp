@@ -0,0 +1,1808 @@
+#include "Fp16Demotion.h"
+#include "Fp16FunctionSummaries.h"
+#include "Fp16StructLayout.h"
+#include "fp16_runtime.h"
+#include "clang/AST/AST.h"
+#include "clang/AST/Attr.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Type.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h" // For llvm::outs() and llvm::errs()
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <sstream>    // For std::ostringstream
+
+using namespace clang;
+
+namespace fp16demotion {
+
+bool parseDemotionArg(llvm::StringRef Arg, DemotionOptions &Opts) {
+    llvm::StringRef List = Arg;
+    if (List.consume_front("-fprecision-demote=")) {
+        if (!parseFormatList(List, Opts.Formats))
+            return false;
+        Opts.Enabled = true;
+        Opts.AnalysisArgs.push_back(Arg.str());
+        return true;
+    }
+    if (Arg == "-fprecision-demote-ndjson") {
+        Opts.Format = FloatMapFormat::NDJson;
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-format=")) {
+        if (Arg == "json")
+            Opts.Format = FloatMapFormat::Json;
+        else if (Arg == "ndjson")
+            Opts.Format = FloatMapFormat::NDJson;
+        else if (Arg == "binary")
+            Opts.Format = FloatMapFormat::Binary;
+        else
+            return false;
+        return true;
+    }
+    if (Arg == "-fprecision-demote-double") {
+        Opts.DemoteDouble = true;
+        Opts.AnalysisArgs.push_back(Arg.str());
+        return true;
+    }
+    if (Arg == "-fprecision-demote-reorder-fields") {
+        Opts.ReorderFields = true;
+        Opts.AnalysisArgs.push_back(Arg.str());
+        return true;
+    }
+    if (Arg == "-fprecision-demote-arrays") {
+        Opts.ConvertArrays = true;
+        Opts.AnalysisArgs.push_back(Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-cache=")) {
+        Opts.CacheDir = Arg.str();
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-summaries=")) {
+        // Which summaries are found depends on the directory's contents,
+        // which cached results are validated against instead.
+        Opts.SummaryDir = Arg.str();
+        Opts.AnalysisArgs.push_back("-fprecision-demote-summaries");
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-incremental=")) {
+        Opts.IncrementalDir = Arg.str();
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-output-dir=")) {
+        Opts.OutputDir = Arg.str();
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-output-prefix=")) {
+        Opts.OutputPrefix = Arg.str();
+        return true;
+    }
+    if (Arg == "-fprecision-demote-combined") {
+        Opts.CombinedOutput = true;
+        return true;
+    }
+    if (Arg == "-fprecision-demote-timing") {
+        Opts.Timing = true;
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-time-trace=")) {
+        Opts.TimeTraceFile = Arg.str();
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-cache-size=")) {
+        uint64_t MB;
+        if (Arg.getAsInteger(10, MB))
+            return false;
+        Opts.CacheMaxBytes = MB << 20;
+        return true;
+    }
+    if (Arg == "-fprecision-demote-instrument") {
+        Opts.Instrument = true;
+        Opts.AnalysisArgs.push_back(Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-profile=")) {
+        std::string Error;
+        Opts.Profile = ValueProfile::load(Arg, Error);
+        if (!Opts.Profile) {
+            llvm::errs() << "Error reading profile " << Arg << ": " << Error << "\n";
+            return false;
+        }
+        // The verdicts depend on the contents, not the name.
+        Opts.AnalysisArgs.push_back("-fprecision-demote-profile=" + Opts.Profile->digest());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-profile-margin=")) {
+        double Percent;
+        if (Arg.getAsDouble(Percent) || Percent < 0)
+            return false;
+        Opts.ProfileMargin = Percent;
+        Opts.AnalysisArgs.push_back("-fprecision-demote-profile-margin=" + Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-error-budget=")) {
+        if (!parseErrorBudget(Arg, false, Opts.Budgets))
+            return false;
+        Opts.AnalysisArgs.push_back("-fprecision-demote-error-budget=" + Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-abs-error-budget=")) {
+        if (!parseErrorBudget(Arg, true, Opts.Budgets))
+            return false;
+        Opts.AnalysisArgs.push_back("-fprecision-demote-abs-error-budget=" + Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-vector-width=")) {
+        if (!parseVectorWidths(Arg, Opts.VectorWidths))
+            return false;
+        Opts.AnalysisArgs.push_back("-fprecision-demote-vector-width=" + Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-cost-model=")) {
+        if (!parseCostModelMode(Arg, Opts.CostModel))
+            return false;
+        Opts.AnalysisArgs.push_back("-fprecision-demote-cost-model=" + Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-cost-target=")) {
+        Opts.CostTarget = findTargetCosts(Arg);
+        if (!Opts.CostTarget)
+            return false;
+        Opts.AnalysisArgs.push_back("-fprecision-demote-cost-target=" + Arg.str());
+        return true;
+    }
+    // Only decides which files are written.
+    if (Arg == "-fprecision-demote-replacements") {
+        Opts.EmitReplacements = true;
+        return true;
+    }
+    // Both decide which callee bodies the range analysis sees.
+    if (Arg == "-fprecision-demote-analysis-only") {
+        Opts.AnalysisOnly = true;
+        Opts.AnalysisArgs.push_back(Arg.str());
+        return true;
+    }
+    if (Arg.consume_front("-fprecision-demote-project-header=")) {
+        if (Arg.empty())
+            return false;
+        Opts.ProjectHeaders.push_back(Arg.str());
+        Opts.AnalysisArgs.push_back("-fprecision-demote-project-header=" + Arg.str());
+        return true;
+    }
+    return false;
+}
+
+// Simulate __fp16 conversion for error calculation in JSON: rounds to
+// nearest even and keeps subnormals, like the conversion itself
+float simulate_fp16(float value) {
+    return fp16_to_float(fp16_from_float(value));
+}
+
+//===----------------------------------------------------------------------===//
+// Fp16TypeChecker
+//===----------------------------------------------------------------------===//
+
+bool Fp16TypeChecker::isValueInFp16Range(float Value) {
+    if (std::isnan(Value) || std::isinf(Value))
+        return false;
+
+    float AbsValue = std::fabs(Value);
+    if (AbsValue > FP16_MAX)
+        return false;
+    if (AbsValue > 0 && AbsValue < FP16_MIN_POSITIVE)
+        return false;
+
+    return true;
+}
+
+bool Fp16TypeChecker::canDemoteFloatExpr(const Expr* E, ASTContext* Context, std::string* Reason,
+                                         RangeAnalysis* Ranges) {
+    ExprVerdicts Verdicts(Context, Ranges);
+    return Verdicts.canDemote(E, Reason);
+}
+
+//===----------------------------------------------------------------------===//
+// ExprVerdicts
+//===----------------------------------------------------------------------===//
+
+// How V converts to Format. Wider values are rounded to double first; a
+// value that loses digits there loses them in Format too.
+static FormatFit formatFit(const llvm::APFloat &V, const FloatFormat &Format) {
+    bool LosesInfo = false;
+    llvm::APFloat Double = V;
+    Double.convert(llvm::APFloat::IEEEdouble(), llvm::APFloat::rmNearestTiesToEven, &LosesInfo);
+    FormatFit Fit = Format.fit(Double.convertToDouble());
+    return Fit == FormatFit::Exact && LosesInfo ? FormatFit::Inexact : Fit;
+}
+
+// Why literals and folded constants fail for each format, built once so
+// verdicts can point at them
+struct FormatReasons {
+    std::string LiteralOutOfRange, LiteralInexact, ConstantOutOfRange, ConstantInexact;
+};
+
+static const std::array<FormatReasons, NumFloatFormats + 1> &formatReasons() {
+    static const auto Reasons = [] {
+        std::array<FormatReasons, NumFloatFormats + 1> Out;
+        auto Describe = [&](const FloatFormat &F) {
+            std::string OutOfRange = std::string(" value out of ") + F.Display + " range";
+            std::string Inexact =
+                std::string(" value loses precision when converted to ") + F.Display;
+            Out[formatIndex(F)] = {"literal" + OutOfRange, "literal" + Inexact,
+                                   "constant" + OutOfRange, "constant" + Inexact};
+        };
+        for (const FloatFormat &F : floatFormats())
+            Describe(F);
+        Describe(singleFormat());
+        return Out;
+    }();
+    return Reasons;
+}
+
+ExprVerdicts::ExprVerdicts(ASTContext *Context, RangeAnalysis *Ranges, const FloatFormat &Format,
+                           BuiltinType::Kind Source)
+    : Context(Context), Ranges(Ranges), Format(&Format), Source(Source) {
+    const FormatReasons &Reasons = formatReasons()[formatIndex(Format)];
+    LiteralOutOfRange = Reasons.LiteralOutOfRange.c_str();
+    LiteralInexact = Reasons.LiteralInexact.c_str();
+    ConstantOutOfRange = Reasons.ConstantOutOfRange.c_str();
+    ConstantInexact = Reasons.ConstantInexact.c_str();
+}
+
+// Only the operators the verdicts are composed from are looked through.
+static void forEachOperand(const Expr *E, llvm::function_ref<void(const Expr *)> Fn) {
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        Fn(BO->getLHS()->IgnoreParenCasts());
+        Fn(BO->getRHS()->IgnoreParenCasts());
+    } else if (const auto *UO = dyn_cast<UnaryOperator>(E)) {
+        Fn(UO->getSubExpr()->IgnoreParenCasts());
+    }
+}
+
+bool ExprVerdicts::canDemote(const Expr *E, std::string *Reason) {
+    if (!E || !Context)
+        return false;
+
+    // A constant is judged by its value, without looking at how it is
+    // written. Literals are checked directly, which is cheaper.
+    const Expr *Inner = E->IgnoreParenCasts();
+    Verdict Result = isa<FloatingLiteral>(Inner) ? evaluate(Inner) : fold(E);
+    if (!Result.Safe && Result.Reason && Reason)
+        *Reason = Result.Reason;
+    return Result.Safe;
+}
+
+// The verdict of E's value if it folds to a constant, else of its operands.
+// Kept under E either way, so the next query neither folds nor walks it
+// again.
+ExprVerdicts::Verdict ExprVerdicts::fold(const Expr *E) {
+    auto Known = Verdicts.find(E);
+    if (Known != Verdicts.end() && Known->second.Folded)
+        return Known->second;
+
+    Verdict Result;
+    llvm::APFloat Value(0.0f);
+    if (!E->isValueDependent() && E->getType()->isRealFloatingType() &&
+        E->EvaluateAsFloat(Value, *Context)) {
+        switch (formatFit(Value, *Format)) {
+        case FormatFit::Exact:
+            Result = {true, nullptr};
+            break;
+        case FormatFit::OutOfRange:
+            Result = {false, ConstantOutOfRange};
+            break;
+        case FormatFit::Inexact:
+            Result = {false, ConstantInexact};
+            break;
+        }
+    } else {
+        Result = evaluate(E->IgnoreParenCasts());
+    }
+    Result.Folded = true;
+    Verdicts[E] = Result;
+    return Result;
+}
+
+// Post-order over the operands, so every subexpression is judged once no
+// matter how many queries reach it and how deep the tree is.
+ExprVerdicts::Verdict ExprVerdicts::evaluate(const Expr *Root) {
+    auto Known = Verdicts.find(Root);
+    if (Known != Verdicts.end())
+        return Known->second;
+
+    llvm::SmallVector<std::pair<const Expr *, bool>, 16> Stack;
+    Stack.push_back({Root, false});
+    while (!Stack.empty()) {
+        auto [E, OperandsDone] = Stack.pop_back_val();
+        if (Verdicts.count(E))
+            continue;
+        if (OperandsDone) {
+            Verdicts[E] = combine(E);
+            continue;
+        }
+        Stack.push_back({E, true});
+        forEachOperand(E, [&](const Expr *Operand) {
+            if (!Verdicts.count(Operand))
+                Stack.push_back({Operand, false});
+        });
+    }
+    return Verdicts.lookup(Root);
+}
+
+// The verdict of E from the verdicts of its operands.
+ExprVerdicts::Verdict ExprVerdicts::combine(const Expr *E) {
+    auto Operand = [&](const Expr *Op) { return Verdicts.lookup(Op->IgnoreParenCasts()); };
+
+    // Handle literal values
+    if (const auto *FL = dyn_cast<FloatingLiteral>(E)) {
+        switch (formatFit(FL->getValue(), *Format)) {
+        case FormatFit::Exact:
+            return {true, nullptr};
+        case FormatFit::OutOfRange:
+            return {false, LiteralOutOfRange};
+        case FormatFit::Inexact:
+            // "Semantically safe and lossless": a literal that loses
+            // precision is not demoted.
+            return {false, LiteralInexact};
+        }
+    }
+
+    // Handle variables
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(E)) {
+        const auto *VD = dyn_cast<VarDecl>(DRE->getDecl());
+        return {VD && (Fp16TypeChecker::canDemoteType(VD->getType(), Context) ||
+                       Fp16TypeChecker::canDemoteType(VD->getType(), Context, Source)),
+                nullptr};
+    }
+
+    // Handle binary operations
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        // For division, check for very small denominators
+        if (BO->getOpcode() == BO_Div)
+            if (const auto *RHSLit = dyn_cast<FloatingLiteral>(BO->getRHS()->IgnoreParenCasts()))
+                if (std::fabs(float(RHSLit->getValueAsApproximateDouble())) <
+                    SMALL_DIVISION_THRESHOLD)
+                    return {false, "division by small number"};
+        // The right operand's reason wins if both fail.
+        Verdict LHS = Operand(BO->getLHS()), RHS = Operand(BO->getRHS());
+        if (!RHS.Safe && RHS.Reason)
+            return RHS;
+        if (!LHS.Safe)
+            return LHS;
+        return RHS;
+    }
+
+    // Handle unary operations
+    if (const auto *UO = dyn_cast<UnaryOperator>(E))
+        return Operand(UO->getSubExpr());
+
+    // Array elements - the range analysis checks the values stored to the
+    // array
+    if (isa<ArraySubscriptExpr>(E) && Ranges)
+        return {true, nullptr};
+
+    // Handle function calls - the range analysis checks the value a call
+    // returns through the callee's summary
+    if (const auto *CE = dyn_cast<CallExpr>(E)) {
+        const FunctionDecl *Callee = CE->getDirectCallee();
+        if (Ranges && Callee && Ranges->hasSummary(Callee))
+            return {true, nullptr};
+        return {false, "call to function without a summary"};
+    }
+
+    // Conservatively handle other expression types
+    return {false, "unsupported expression type for demotion analysis"};
+}
+
+bool Fp16TypeChecker::canDemoteRange(const Interval &Range, std::string *Reason) {
+    return halfFormat().canHold(Range, Reason);
+}
+
+bool Fp16TypeChecker::canDemoteType(QualType T, ASTContext* Context, BuiltinType::Kind Kind) {
+    if (!Context || T.isNull())
+        return false;
+
+    // Only handle float types, or double types for the double tier
+    if (!T->isSpecificBuiltinType(Kind))
+        return false;
+
+    // Don't demote volatile or atomic types
+    if (T.isVolatileQualified() || T->isAtomicType())
+        return false;
+
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Fp16DemotionVisitor
+//===----------------------------------------------------------------------===//
+
+bool Fp16DemotionVisitor::VisitVarDecl(VarDecl *VD) {
+    if (!VD || !Context)
+        return true;
+
+    SourceManager &SM = Context->getSourceManager();
+    if (!SM.isInMainFile(VD->getLocation()))
+        return true;
+
+    countKeyword(VD);
+    QualType T = VD->getType();
+    if (DemoteDouble && !isa<ParmVarDecl>(VD) &&
+        Fp16TypeChecker::canDemoteType(T, Context, BuiltinType::Double)) {
+        addDoubleVariable(VD);
+        return true;
+    }
+    if (!Fp16TypeChecker::canDemoteType(T, Context)) {
+        Layout.addVariable(VD, /*Demoted=*/false);
+        if (!isa<ParmVarDecl>(VD) && isFloatArray(*Context, T))
+            addFloatArray(VD, VD->getNameAsString());
+        return true;
+    }
+
+    if (ProcessedDecls.count(VD))
+        return true;
+
+    ProcessedDecls.insert(VD);
+
+    MemoryUsage &memoryStats = Result.Memory;
+    memoryStats.floatVarCount++;
+
+    std::string reason;
+    unsigned Fits = judge(reason, [&](std::string &Why) {
+        return judgeFormats(Why, [&](unsigned I, std::string &FormatWhy) {
+            return fitsFormat(VD, I, FormatWhy) &&
+                   Errors.withinBudget(VD, *Formats[I], FormatWhy);
+        });
+    });
+    countFits(Fits, &FormatUsage::varCount, Layout.originalLayout(T).Size);
+    const FloatFormat *Demoted = demotedFormat(Fits);
+    // Priced on every run: the uses outside VD's function can change
+    // without its verdicts being recomputed.
+    if (Demoted && !worthConverting(VD, *Demoted, reason))
+        Demoted = nullptr;
+    bool IsSafe = Demoted != nullptr;
+    const FloatFormat &Mode = IsSafe ? *Demoted : failedFormat();
+    if (!IsSafe) {
+        emitDemotionFailureDiagnostic(VD->getLocation(), VD->getName(), reason, Mode);
+        if (Instrument && sites().isObservable(VD))
+            Profiled.push_back(VD);
+    }
+
+    PresumedLoc PLoc = SM.getPresumedLoc(VD->getLocation());
+    VariableRecord Record;
+    Record.Name = VD->getName().str();
+    Record.Mode = Mode.Name;
+    Record.Safe = IsSafe;
+    Record.Reason = IsSafe ? std::string() : reason;
+    Record.File = PLoc.getFilename();
+    Record.Line = PLoc.getLine();
+    Record.Column = PLoc.getColumn();
+    if (Sink)
+        Sink->addVariable(Record);
+    else
+        Result.Variables.push_back(std::move(Record));
+
+    Layout.addVariable(VD, IsSafe);
+
+    if (IsSafe) {
+        // Track successful demotion
+        memoryStats.demotedVarCount++;
+        DemotedVars[VD->getCanonicalDecl()] = Demoted;
+
+        // Get the location of the 'float' keyword in the declaration
+        if (TypeSourceInfo *TSI = VD->getTypeSourceInfo()) {
+            TypeLoc TL = TSI->getTypeLoc();
+            SourceLocation Begin = TL.getBeginLoc();
+
+            if (Begin.isValid()) {
+                bool Invalid = false;
+                const char* StartPtr = Context->getSourceManager().getCharacterData(Begin, &Invalid);
+
+                if (!Invalid && StartPtr) {
+                    // Ensure we are replacing the 'float' keyword itself
+                    // This is a bit fragile as it assumes 'float' is a single token.
+                    // A more robust way might involve using Lexer to find the 'float' token.
+                    Token Tok;
+                    if (!Lexer::getRawToken(Begin, Tok, Context->getSourceManager(), Context->getLangOpts())) {
+                        std::string TokenText = Lexer::getSpelling(Tok, Context->getSourceManager(), Context->getLangOpts());
+                        if (TokenText == "float") {
+                            Replacements.push_back({Begin, Demoted->TypeName, TokenText.length()});
+                            emitDemotionSuccessDiagnostic(VD->getLocation(), VD->getName(), *Demoted);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Judged during the traversal, so the verdict is replayed with the others
+// of its function; demoteDoubles rewrites it once every declarator sharing
+// its keyword has been seen.
+void Fp16DemotionVisitor::addDoubleVariable(const VarDecl *VD) {
+    if (!ProcessedDecls.insert(VD).second)
+        return;
+    Layout.addVariable(VD, /*Demoted=*/false);
+    Result.Memory.doubleVarCount++;
+    Result.Memory.doubleBytes += Layout.originalLayout(VD->getType()).Size;
+
+    std::string Reason;
+    unsigned Fits = judge(Reason, [&](std::string &Why) {
+        return fitsSingle(VD, Why) ? 1u << formatIndex(singleFormat()) : 0u;
+    });
+    DoubleVariables.push_back({VD, Fits != 0, std::move(Reason)});
+}
+
+void Fp16DemotionVisitor::demoteDoubles() {
+    if (DoubleVariables.empty())
+        return;
+    SourceManager &SM = Context->getSourceManager();
+    MemoryUsage &Memory = Result.Memory;
+
+    // 'double a, b;' is only changed if both a and b are safe.
+    llvm::DenseMap<SourceLocation, unsigned> SafeUses;
+    for (const DoubleVariable &Var : DoubleVariables) {
+        SourceLocation Keyword = floatKeyword(Var.VD, "double");
+        if (Var.Safe && Keyword.isValid())
+            ++SafeUses[Keyword];
+    }
+    llvm::DenseSet<SourceLocation> Replaced;
+    for (DoubleVariable &Var : DoubleVariables) {
+        const VarDecl *VD = Var.VD;
+        SourceLocation Keyword = floatKeyword(VD, "double");
+        if (Var.Safe && VD->getCanonicalDecl() != VD->getMostRecentDecl()) {
+            Var.Safe = false;
+            Var.Reason = "declared more than once";
+        } else if (Var.Safe && (Keyword.isInvalid() ||
+                                SafeUses.lookup(Keyword) != KeywordUses.lookup(Keyword))) {
+            Var.Safe = false;
+            Var.Reason = "its declaration is shared with other declarators or not written as 'double'";
+        }
+
+        if (Var.Safe) {
+            if (Replaced.insert(Keyword).second)
+                Replacements.push_back({Keyword, singleFormat().TypeName, 6});
+            DemotedDoubles.insert(VD);
+            Layout.addDemotedVariable(VD);
+            Memory.demotedDoubleVarCount++;
+            Memory.demotedDoubleBytes += Layout.originalLayout(VD->getType()).Size;
+            emitDemotionSuccessDiagnostic(VD->getLocation(), VD->getName(), singleFormat(),
+                                          "double");
+        } else {
+            emitDemotionFailureDiagnostic(VD->getLocation(), VD->getName(), Var.Reason,
+                                          singleFormat());
+        }
+
+        PresumedLoc PLoc = SM.getPresumedLoc(VD->getLocation());
+        VariableRecord Record;
+        Record.Name = VD->getName().str();
+        Record.Mode = singleFormat().Name;
+        Record.Safe = Var.Safe;
+        Record.Reason = Var.Safe ? std::string() : Var.Reason;
+        Record.File = PLoc.getFilename();
+        Record.Line = PLoc.getLine();
+        Record.Column = PLoc.getColumn();
+        if (Sink)
+            Sink->addVariable(Record);
+        else
+            Result.Variables.push_back(std::move(Record));
+    }
+
+    // The values stored to the demoted doubles
+    for (const DoubleVariable &Var : DoubleVariables)
+        if (const Expr *Init = Var.Safe ? Var.VD->getInit() : nullptr)
+            rewriteMathCalls(Init);
+    for (const BinaryOperator *BO : DoubleStores) {
+        const auto *DRE = cast<DeclRefExpr>(BO->getLHS()->IgnoreParenImpCasts());
+        if (DemotedDoubles.count(cast<VarDecl>(DRE->getDecl())))
+            rewriteMathCalls(BO->getRHS());
+    }
+}
+
+// The float variant of a <math.h> function taking and returning double
+// (sinf for sin), or an empty string
+static std::string floatVariant(const FunctionDecl *FD) {
+    if (!FD || !FD->getIdentifier() || FD->hasBody() ||
+        !FD->getDeclContext()->getRedeclContext()->isTranslationUnit() ||
+        !isMathFunction(FD->getName()) ||
+        !FD->getReturnType()->isSpecificBuiltinType(BuiltinType::Double))
+        return std::string();
+    for (const ParmVarDecl *P : FD->parameters())
+        if (!P->getType()->isSpecificBuiltinType(BuiltinType::Double))
+            return std::string();
+    return FD->getName().str() + "f";
+}
+
+// Only arithmetic, demoted values and math calls are looked through; the
+// calls are collected as they are found and only switched if the whole
+// expression computes in float.
+bool Fp16DemotionVisitor::becomesFloat(const Expr *E,
+                                       std::vector<const CallExpr *> &Calls) const {
+    E = E->IgnoreParenImpCasts();
+    if (E->getType()->isSpecificBuiltinType(BuiltinType::Float))
+        return true;
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(E)) {
+        const auto *VD = dyn_cast<VarDecl>(DRE->getDecl());
+        return VD && DemotedDoubles.count(VD);
+    }
+    if (const auto *FL = dyn_cast<FloatingLiteral>(E))
+        return DemotedLiterals.count(FL) != 0;
+    if (const auto *BO = dyn_cast<BinaryOperator>(E))
+        return (BO->isAdditiveOp() || BO->isMultiplicativeOp()) &&
+               becomesFloat(BO->getLHS(), Calls) && becomesFloat(BO->getRHS(), Calls);
+    if (const auto *UO = dyn_cast<UnaryOperator>(E))
+        return (UO->getOpcode() == UO_Minus || UO->getOpcode() == UO_Plus) &&
+               becomesFloat(UO->getSubExpr(), Calls);
+    if (const auto *CE = dyn_cast<CallExpr>(E)) {
+        const SourceManager &SM = Context->getSourceManager();
+        const auto *Callee = dyn_cast<DeclRefExpr>(CE->getCallee()->IgnoreParenImpCasts());
+        if (!Callee || Callee->hasQualifier() || !Callee->getLocation().isFileID() ||
+            !SM.isInMainFile(Callee->getLocation()) || floatVariant(CE->getDirectCallee()).empty())
+            return false;
+        for (const Expr *Arg : CE->arguments())
+            if (!becomesFloat(Arg, Calls))
+                return false;
+        Calls.push_back(CE);
+        return true;
+    }
+    return false;
+}
+
+// Switches the math calls in E, a value stored to a demoted double, to
+// their float variants if E then computes in float: sin(x) for a demoted x
+// becomes sinf(x) instead of a double sin rounded on the store.
+void Fp16DemotionVisitor::rewriteMathCalls(const Expr *E) {
+    std::vector<const CallExpr *> Calls;
+    if (!becomesFloat(E, Calls))
+        return;
+    for (const CallExpr *CE : Calls) {
+        if (!FloatCalls.insert(CE).second)
+            continue;
+        const auto *Callee = cast<DeclRefExpr>(CE->getCallee()->IgnoreParenImpCasts());
+        const FunctionDecl *FD = CE->getDirectCallee();
+        Replacements.push_back({Callee->getLocation(), floatVariant(FD), FD->getName().size()});
+        Result.Memory.floatMathCalls++;
+    }
+}
+
+static std::string recordName(const RecordDecl *RD) {
+    if (!RD->getName().empty())
+        return RD->getNameAsString();
+    if (const TypedefNameDecl *TD = RD->getTypedefNameForAnonDecl())
+        return TD->getNameAsString();
+    return "(anonymous)";
+}
+
+bool Fp16DemotionVisitor::VisitFieldDecl(FieldDecl *FD) {
+    if (!FD || !Context || FD->isImplicit())
+        return true;
+
+    SourceManager &SM = Context->getSourceManager();
+    if (!SM.isInMainFile(FD->getLocation()))
+        return true;
+    countKeyword(FD);
+    const RecordDecl *RD = FD->getParent();
+    std::string Name = recordName(RD) + "." + FD->getNameAsString();
+    if (isFloatArray(*Context, FD->getType())) {
+        addFloatArray(FD, std::move(Name));
+        return true;
+    }
+    if (!Fp16TypeChecker::canDemoteType(FD->getType(), Context))
+        return true;
+
+    Result.Memory.floatFieldCount++;
+
+    // Every store to the field anywhere in the translation unit
+    std::string reason;
+    Interval Range;
+    unsigned Fits = 0;
+    if (Ranges.getFieldRange(FD, Range, &reason)) {
+        Fits = rangeFits(Range);
+        if (StorageFormat)
+            StorageFormat->canHold(Range, &reason);
+        else
+            reason = "fields are only demoted to binary16 (fp16 or float16)";
+    }
+    countFits(Fits, &FormatUsage::fieldCount, Layout.originalLayout(FD->getType()).Size);
+    bool IsSafe = StorageFormat && (Fits & (1u << formatIndex(*StorageFormat)));
+    const FloatFormat &Mode = StorageFormat ? *StorageFormat : failedFormat();
+    if (!IsSafe)
+        emitDemotionFailureDiagnostic(FD->getLocation(), Name, reason, Mode);
+
+    PresumedLoc PLoc = SM.getPresumedLoc(FD->getLocation());
+    VariableRecord Record;
+    Record.Name = Name;
+    Record.Mode = Mode.Name;
+    Record.Safe = IsSafe;
+    Record.Reason = IsSafe ? std::string() : reason;
+    Record.File = PLoc.getFilename();
+    Record.Line = PLoc.getLine();
+    Record.Column = PLoc.getColumn();
+    if (Sink)
+        Sink->addVariable(Record);
+    else
+        Result.Variables.push_back(std::move(Record));
+
+    Records.insert(RD);
+    if (IsSafe)
+        DemotableFields.insert(FD);
+    return true;
+}
+
+SourceLocation Fp16DemotionVisitor::floatKeyword(const DeclaratorDecl *D,
+                                                 llvm::StringRef Keyword) const {
+    SourceManager &SM = Context->getSourceManager();
+    TypeSourceInfo *TSI = D->getTypeSourceInfo();
+    if (!TSI)
+        return SourceLocation();
+    SourceLocation Begin = TSI->getTypeLoc().getBeginLoc();
+    if (Begin.isInvalid() || !Begin.isFileID() || !SM.isInMainFile(Begin))
+        return SourceLocation();
+    Token Tok;
+    if (Lexer::getRawToken(Begin, Tok, SM, Context->getLangOpts()) ||
+        Lexer::getSpelling(Tok, SM, Context->getLangOpts()) != Keyword)
+        return SourceLocation();
+    return Begin;
+}
+
+void Fp16DemotionVisitor::countKeyword(const DeclaratorDecl *D) {
+    SourceLocation Keyword = floatKeyword(D);
+    if (Keyword.isInvalid() && DemoteDouble)
+        Keyword = floatKeyword(D, "double");
+    if (Keyword.isValid())
+        ++KeywordUses[Keyword];
+}
+
+const char *Fp16DemotionVisitor::storageType(const FieldDecl *FD) const {
+    return FD->getType()->isArrayType() ? HalfStorageType : StorageFormat->TypeName;
+}
+
+// Records the range verdict for a float array; whether its uses can be
+// rewritten is decided by convertArrays once all of them have been seen.
+void Fp16DemotionVisitor::addFloatArray(const DeclaratorDecl *D, std::string Name) {
+    if (const auto *VD = dyn_cast<VarDecl>(D))
+        D = VD->getCanonicalDecl();
+    if (FloatArrays.count(D))
+        return;
+    Result.Memory.floatArrayCount++;
+
+    FloatArray &Array = FloatArrays[D];
+    Array.Name = std::move(Name);
+    Interval Range;
+    unsigned Fits = 0;
+    if (Ranges.getElementRange(D, Range, &Array.Reason)) {
+        Fits = rangeFits(Range);
+        if (StorageFormat)
+            StorageFormat->canHold(Range, &Array.Reason);
+        else
+            Array.Reason = "arrays are only stored as binary16 (fp16 or float16)";
+    }
+    countFits(Fits, &FormatUsage::arrayCount, Layout.originalLayout(D->getType()).Size);
+    Array.Safe = StorageFormat && (Fits & (1u << formatIndex(*StorageFormat)));
+    if (Array.Safe)
+        Array.Reason.clear();
+
+    SourceManager &SM = Context->getSourceManager();
+    PresumedLoc PLoc = SM.getPresumedLoc(D->getLocation());
+    VariableRecord Record;
+    Record.Name = Array.Name;
+    Record.Mode = StorageFormat ? StorageFormat->Name : failedFormat().Name;
+    Record.Safe = Array.Safe;
+    Record.Reason = Array.Reason;
+    Record.File = PLoc.getFilename();
+    Record.Line = PLoc.getLine();
+    Record.Column = PLoc.getColumn();
+    if (Sink)
+        Sink->addVariable(Record);
+    else
+        Result.Variables.push_back(std::move(Record));
+}
+
+void Fp16DemotionVisitor::convertArrays() {
+    if (FloatArrays.empty())
+        return;
+    SourceManager &SM = Context->getSourceManager();
+    std::vector<const ValueDecl *> Decls;
+    for (const auto &Entry : FloatArrays)
+        Decls.push_back(Entry.first);
+    ArrayUseCollector Collector(*Context, Decls);
+    uint64_t FloatSize = Layout.originalLayout(Context->FloatTy).Size;
+
+    std::vector<const ArrayUses *> Converted;
+    for (const auto &Entry : FloatArrays) {
+        const DeclaratorDecl *D = Entry.first;
+        const FloatArray &Array = Entry.second;
+        const ArrayUses &Uses = Collector.uses(D);
+        const auto *VD = dyn_cast<VarDecl>(D);
+
+        std::string Reason = Array.Safe ? Uses.Blocked : Array.Reason;
+        if (Reason.empty() && VD && VD->isConstexpr())
+            Reason = "constexpr; its elements may be used in constant expressions";
+        // Static storage needs constant initializers; fp16_store is a call.
+        if (Reason.empty() && VD && VD->hasGlobalStorage() &&
+            llvm::any_of(Uses.InitElements, [&](const Expr *Init) {
+                llvm::APFloat Value(0.0f);
+                return !Init->EvaluateAsFloat(Value, *Context);
+            }))
+            Reason = "initializer is not a constant";
+        SourceLocation Keyword = floatKeyword(D);
+        if (Reason.empty() && (Keyword.isInvalid() || KeywordUses.lookup(Keyword) != 1))
+            Reason = "its declaration is shared with other declarators or not written as 'float'";
+
+        PresumedLoc PLoc = SM.getPresumedLoc(D->getLocation());
+        TypeLayout Before = Layout.originalLayout(D->getType());
+        ArrayStorageRecord Record;
+        Record.Name = Array.Name;
+        Record.File = PLoc.getFilename();
+        Record.Line = PLoc.getLine();
+        Record.Elements = Context->getConstantArrayElementCount(
+            Context->getAsConstantArrayType(D->getType()));
+        Record.OldBytes = Before.Size;
+        Record.NewBytes = Before.Size / FloatSize * Layout.originalLayout(Context->HalfTy).Size;
+        Record.Safe = Array.Safe;
+        Record.Converted = ConvertArrays && Reason.empty();
+        Record.Reason = Reason;
+        Record.Reads = Uses.Reads.size();
+        Record.Writes = Uses.StoredValues.size();
+        Record.TrafficBytes = Uses.Accesses * FloatSize;
+        Record.TrafficExact = Uses.AccessesExact;
+        if (Reason.empty())
+            StorableArrays.insert(D);
+
+        if (Record.Converted) {
+            Converted.push_back(&Uses);
+            if (VD) {
+                Replacements.push_back({Keyword, HalfStorageType, 5});
+                Layout.addDemotedVariable(VD);
+            } else {
+                // The keyword goes with the rest of the record, which may
+                // be reordered.
+                const auto *FD = cast<FieldDecl>(D);
+                DemotedFields.insert(FD);
+                Layout.addDemotedField(FD);
+                Records.insert(FD->getParent());
+            }
+            Result.Memory.demotedArrayCount++;
+            emitArrayConversionDiagnostic(D->getLocation(), Array.Name);
+        } else if (ConvertArrays) {
+            emitDemotionFailureDiagnostic(D->getLocation(), Array.Name, Reason,
+                                          StorageFormat ? *StorageFormat : failedFormat());
+        }
+        Result.Arrays.push_back(std::move(Record));
+    }
+    if (Converted.empty())
+        return;
+    rewriteArrayUses(Converted);
+    Replacements.push_back({SM.getLocForStartOfFile(SM.getMainFileID()), HalfStoragePrelude, 0});
+}
+
+// Rewrites the initializers and element accesses of the converted arrays.
+// Constant initializers become hex bit patterns, replacing whatever was
+// already rewritten inside them; the rest goes through fp16_store. An
+// element copied between converted arrays is loaded and stored through one
+// pair of insertions, the store outside: fp16_store(fp16_load(...)).
+void Fp16DemotionVisitor::rewriteArrayUses(const std::vector<const ArrayUses *> &Converted) {
+    SourceManager &SM = Context->getSourceManager();
+    const LangOptions &LangOpts = Context->getLangOpts();
+    auto EndOf = [&](const Expr *E) {
+        return Lexer::getLocForEndOfToken(E->getEndLoc(), 0, SM, LangOpts);
+    };
+
+    std::vector<std::pair<unsigned, unsigned>> Constants; // Replaced offset ranges
+    std::vector<const Expr *> Stores;
+    for (const ArrayUses *Uses : Converted) {
+        for (const Expr *Init : Uses->InitElements) {
+            llvm::APFloat Value(0.0f);
+            const Expr *Written = Init->IgnoreImplicit();
+            if (!Init->EvaluateAsFloat(Value, *Context)) {
+                Stores.push_back(Written);
+                continue;
+            }
+            unsigned Begin = SM.getFileOffset(Written->getBeginLoc());
+            unsigned End = SM.getFileOffset(EndOf(Written));
+            llvm::erase_if(Replacements, [&](const Transformation &T) {
+                unsigned Offset = SM.getFileOffset(T.Loc);
+                return Offset >= Begin && Offset < End;
+            });
+            Replacements.push_back({Written->getBeginLoc(), halfBitsLiteral(Value), End - Begin});
+            Constants.push_back({Begin, End});
+        }
+        Stores.insert(Stores.end(), Uses->StoredValues.begin(), Uses->StoredValues.end());
+    }
+
+    // Where the opening insertion of each wrapped range is queued
+    llvm::DenseMap<std::pair<SourceLocation::UIntTy, SourceLocation::UIntTy>, size_t> Wrapped;
+    auto Wrap = [&](const Expr *E, const char *Helper) {
+        unsigned Offset = SM.getFileOffset(E->getBeginLoc());
+        for (const auto &Range : Constants)
+            if (Offset >= Range.first && Offset < Range.second)
+                return;
+        SourceLocation End = EndOf(E);
+        auto Inserted = Wrapped.try_emplace(
+            {E->getBeginLoc().getRawEncoding(), End.getRawEncoding()}, Replacements.size());
+        if (!Inserted.second) {
+            size_t Open = Inserted.first->second;
+            Replacements[Open].ReplacementText.insert(0, std::string(Helper) + "(");
+            Replacements[Open + 1].ReplacementText += ")";
+            return;
+        }
+        Replacements.push_back({E->getBeginLoc(), std::string(Helper) + "(", 0});
+        Replacements.push_back({End, ")", 0});
+    };
+    for (const ArrayUses *Uses : Converted)
+        for (const ArraySubscriptExpr *Read : Uses->Reads)
+            Wrap(Read, "fp16_load");
+    for (const Expr *Stored : Stores)
+        Wrap(Stored, "fp16_store");
+}
+
+// A field is demoted by replacing the 'float' keyword of its declaration,
+// so 'float x, y;' is only changed if both x and y are safe.
+void Fp16DemotionVisitor::selectDemotedFields(const RecordDecl *RD) {
+    llvm::DenseMap<SourceLocation, bool> AllSafe;
+    for (const FieldDecl *FD : RD->fields()) {
+        SourceLocation Keyword = floatKeyword(FD);
+        if (Keyword.isValid()) {
+            auto Inserted = AllSafe.insert({Keyword, true});
+            Inserted.first->second &= DemotableFields.count(FD) != 0;
+        }
+    }
+    for (const FieldDecl *FD : RD->fields()) {
+        if (!DemotableFields.count(FD))
+            continue;
+        SourceLocation Keyword = floatKeyword(FD);
+        if (Keyword.isInvalid() || !AllSafe.lookup(Keyword))
+            continue;
+        DemotedFields.insert(FD);
+        Layout.addDemotedField(FD);
+        Result.Memory.demotedFieldCount++;
+    }
+}
+
+void Fp16DemotionVisitor::analyzeRecords() {
+    if (Records.empty())
+        return;
+    for (const RecordDecl *RD : Records)
+        selectDemotedFields(RD);
+
+    FieldAccessCounter Accesses(*Context);
+    llvm::DenseSet<const RecordDecl *> Done;
+    for (const RecordDecl *RD : Records)
+        analyzeRecord(RD, Accesses, Done);
+}
+
+void Fp16DemotionVisitor::analyzeRecord(const RecordDecl *RD, const FieldAccessCounter &Accesses,
+                                        llvm::DenseSet<const RecordDecl *> &Done) {
+    if (!Done.insert(RD).second)
+        return;
+    // Nested records first: reordering them changes the size of this one.
+    for (const FieldDecl *FD : RD->fields())
+        if (const auto *RT = Context->getBaseElementType(FD->getType())->getAs<RecordType>())
+            if (const RecordDecl *Def = RT->getDecl()->getDefinition())
+                if (Records.count(Def))
+                    analyzeRecord(Def, Accesses, Done);
+
+    bool AnyDemoted = llvm::any_of(RD->fields(), [&](const FieldDecl *FD) {
+        return DemotedFields.count(FD) != 0;
+    });
+    if (!AnyDemoted)
+        return;
+
+    std::vector<const FieldDecl *> Order;
+    StructLayoutRecord Record = describeRecord(RD, Accesses, Order);
+    if (ReorderFields && !Order.empty() && rewriteRecord(RD, Accesses, Order)) {
+        Layout.setFieldOrder(RD, Order);
+        Record.Rewritten = true;
+    } else {
+        llvm::DenseSet<SourceLocation> Replaced;
+        for (const FieldDecl *FD : RD->fields()) {
+            if (!DemotedFields.count(FD))
+                continue;
+            SourceLocation Keyword = floatKeyword(FD);
+            if (Replaced.insert(Keyword).second)
+                Replacements.push_back({Keyword, storageType(FD), 5});
+        }
+    }
+    for (const FieldDecl *FD : RD->fields())
+        if (DemotedFields.count(FD) && !FD->getType()->isArrayType())
+            emitDemotionSuccessDiagnostic(FD->getLocation(),
+                                          recordName(RD) + "." + FD->getNameAsString(),
+                                          *StorageFormat);
+    Result.StructLayouts.push_back(std::move(Record));
+}
+
+// Reordering is only suggested where the C layout rules are all there is:
+// no bit-fields, bases, packing or per-field alignment.
+static bool canReorder(const RecordDecl *RD) {
+    if (RD->isUnion() || RD->hasAttr<PackedAttr>() || RD->hasAttr<MaxFieldAlignmentAttr>())
+        return false;
+    if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(RD))
+        if (CXXRD->getNumBases() || CXXRD->getNumVBases() || CXXRD->isDynamicClass())
+            return false;
+    return llvm::none_of(RD->fields(), [](const FieldDecl *FD) {
+        return FD->isBitField() || FD->hasAttrs() || FD->getType()->isIncompleteArrayType();
+    });
+}
+
+StructLayoutRecord Fp16DemotionVisitor::describeRecord(const RecordDecl *RD,
+                                                       const FieldAccessCounter &Accesses,
+                                                       std::vector<const FieldDecl *> &Order) {
+    SourceManager &SM = Context->getSourceManager();
+    PresumedLoc PLoc = SM.getPresumedLoc(RD->getLocation());
+    QualType T = Context->getRecordType(RD);
+
+    StructLayoutRecord Record;
+    Record.Name = recordName(RD);
+    Record.File = PLoc.getFilename();
+    Record.Line = PLoc.getLine();
+    Record.OldSize = Layout.originalLayout(T).Size;
+    Record.NewSize = Layout.demotedLayout(T).Size;
+    Record.ReorderedSize = Record.NewSize;
+    Record.OldLines = cacheLinesPerElement(Record.OldSize);
+    Record.NewLines = cacheLinesPerElement(Record.NewSize);
+
+    std::vector<const FieldDecl *> Fields(RD->field_begin(), RD->field_end());
+    std::vector<FieldSlot> Slots;
+    for (const FieldDecl *FD : Fields) {
+        TypeLayout Field = Layout.demotedFieldLayout(FD);
+        Slots.push_back({Field.Size, Field.Align, Accesses.weight(FD)});
+        if (DemotedFields.count(FD))
+            Record.DemotedFields.push_back(FD->getNameAsString());
+    }
+    if (!canReorder(RD))
+        return Record;
+
+    std::vector<bool> Hot;
+    std::vector<unsigned> Suggested = suggestFieldOrder(Slots, &Hot);
+    uint64_t MinAlign = RD->getMaxAlignment() / Context->getCharWidth();
+    uint64_t Size = layoutSize(Slots, Suggested, MinAlign);
+    for (unsigned Index = 0; Index < Fields.size(); ++Index)
+        if (Hot[Index])
+            Record.HotFields.push_back(Fields[Index]->getNameAsString());
+
+    bool Declared = true;
+    for (unsigned Index = 0; Index < Suggested.size(); ++Index)
+        Declared &= Suggested[Index] == Index;
+    if (Declared || Size > Record.NewSize)
+        return Record;
+
+    for (unsigned Index : Suggested) {
+        Order.push_back(Fields[Index]);
+        Record.SuggestedOrder.push_back(Fields[Index]->getNameAsString());
+    }
+    Record.ReorderedSize = Size;
+    Record.NewLines = cacheLinesPerElement(Size);
+    return Record;
+}
+
+// Replaces the body of RD with its fields in Order. Each field moves with
+// the comment lines above it and the rest of its line. Only done for C
+// records whose body holds nothing but fields, each with a declaration of
+// its own, outside of macros and not initialized by position.
+bool Fp16DemotionVisitor::rewriteRecord(const RecordDecl *RD, const FieldAccessCounter &Accesses,
+                                        const std::vector<const FieldDecl *> &Order) {
+    SourceManager &SM = Context->getSourceManager();
+    const LangOptions &LangOpts = Context->getLangOpts();
+    if (LangOpts.CPlusPlus || Accesses.initializedByPosition(RD->getCanonicalDecl()))
+        return false;
+    SourceRange Braces = RD->getBraceRange();
+    if (Braces.isInvalid() || !Braces.getBegin().isFileID() || !Braces.getEnd().isFileID() ||
+        !SM.isInMainFile(Braces.getBegin()))
+        return false;
+    if (llvm::any_of(RD->decls(), [](const Decl *D) { return !isa<FieldDecl>(D); }))
+        return false;
+
+    llvm::StringRef Buffer = SM.getBufferData(SM.getMainFileID());
+    unsigned Begin = SM.getFileOffset(Braces.getBegin()) + 1;
+    unsigned End = SM.getFileOffset(Braces.getEnd());
+    // Nothing else may be replaced inside the body.
+    for (const Transformation &T : Replacements) {
+        unsigned Offset = SM.getFileOffset(T.Loc);
+        if (Offset >= Begin && Offset < End)
+            return false;
+    }
+    // Start after the line break following '{'
+    size_t LineEnd = Buffer.find('\n', Begin);
+    if (LineEnd < End && Buffer.slice(Begin, LineEnd).trim().empty())
+        Begin = LineEnd + 1;
+
+    llvm::DenseMap<const FieldDecl *, std::string> Chunks;
+    llvm::DenseSet<SourceLocation> Starts;
+    unsigned ChunkBegin = Begin;
+    for (const FieldDecl *FD : RD->fields()) {
+        SourceRange Range = FD->getSourceRange();
+        if (!Range.getBegin().isFileID() || !Range.getEnd().isFileID() ||
+            !Starts.insert(Range.getBegin()).second)
+            return false;
+        SourceLocation AfterSemi =
+            Lexer::findLocationAfterToken(Range.getEnd(), tok::semi, SM, LangOpts, false);
+        if (AfterSemi.isInvalid())
+            return false;
+        unsigned ChunkEnd = SM.getFileOffset(AfterSemi);
+        LineEnd = Buffer.find('\n', ChunkEnd);
+        if (LineEnd < End) {
+            llvm::StringRef Rest = Buffer.slice(ChunkEnd, LineEnd).trim();
+            if (Rest.empty() || Rest.starts_with("//"))
+                ChunkEnd = LineEnd + 1;
+        }
+        if (ChunkEnd > End)
+            return false;
+
+        std::string Text = Buffer.slice(ChunkBegin, ChunkEnd).str();
+        if (DemotedFields.count(FD)) {
+            unsigned Keyword = SM.getFileOffset(floatKeyword(FD));
+            Text.replace(Keyword - ChunkBegin, 5, storageType(FD));
+        }
+        Chunks[FD] = std::move(Text);
+        ChunkBegin = ChunkEnd;
+    }
+
+    std::string Body;
+    for (const FieldDecl *FD : Order)
+        Body += Chunks[FD];
+    Replacements.push_back({SM.getComposedLoc(SM.getMainFileID(), Begin), Body, ChunkBegin - Begin});
+    return true;
+}
+
+// As demoted.c has it, except that arrays count as binary16 whenever they
+// could be converted, as with -fprecision-demote-arrays.
+unsigned Fp16DemotionVisitor::demotedBits(const ValueDecl *Storage, unsigned Bits,
+                                          bool &Candidate) const {
+    Candidate = false;
+    const auto *DD = dyn_cast_or_null<DeclaratorDecl>(Storage);
+    if (DD && FloatArrays.count(DD)) {
+        Candidate = true;
+        return StorableArrays.count(DD) ? StorageFormat->bits() : Bits;
+    }
+    if (const auto *VD = dyn_cast_or_null<VarDecl>(Storage)) {
+        Candidate = ProcessedDecls.count(VD) != 0;
+        if (const FloatFormat *F = DemotedVars.lookup(VD))
+            return F->bits();
+        if (DemotedDoubles.count(VD))
+            return singleFormat().bits();
+        return Bits;
+    }
+    if (const auto *FD = dyn_cast_or_null<FieldDecl>(Storage)) {
+        Candidate = Records.count(FD->getParent()) &&
+                    Fp16TypeChecker::canDemoteType(FD->getType(), Context);
+        if (DemotedFields.count(FD))
+            return StorageFormat->bits();
+    }
+    return Bits;
+}
+
+void Fp16DemotionVisitor::analyzeLoops() {
+    SourceManager &SM = Context->getSourceManager();
+    unsigned FloatBits = Context->getTypeSize(Context->FloatTy);
+    auto NameOf = [](const ValueDecl *D) {
+        if (const auto *FD = dyn_cast<FieldDecl>(D))
+            return recordName(FD->getParent()) + "." + FD->getNameAsString();
+        return D->getNameAsString();
+    };
+
+    for (const FloatLoop &Loop : findFloatLoops(*Context)) {
+        LoopVectorRecord Record;
+        bool Touches = false;
+        llvm::SetVector<const ValueDecl *> Demoted, Kept;
+        for (const LoopAccess &Access : Loop.Accesses) {
+            unsigned Bits = Context->getTypeSize(Access.E->getType());
+            bool Candidate;
+            unsigned NewBits = demotedBits(Access.Storage, Bits, Candidate);
+            // Accumulating in a narrower type loses the sum.
+            if (llvm::is_contained(Loop.Accumulators, Access.Storage))
+                NewBits = std::max(NewBits, std::min(Bits, FloatBits));
+            Touches |= Candidate;
+            Record.OldBits = std::max(Record.OldBits, Bits);
+            Record.NewBits = std::max(Record.NewBits, NewBits);
+            if (Access.Storage)
+                (NewBits < Bits ? Demoted : Kept).insert(Access.Storage);
+        }
+        if (!Touches)
+            continue;
+
+        PresumedLoc PLoc = SM.getPresumedLoc(SM.getExpansionLoc(Loop.Loop->getBeginLoc()));
+        Record.Function = Loop.Function->getNameAsString();
+        Record.File = PLoc.getFilename();
+        Record.Line = PLoc.getLine();
+        Record.Kind = loopKindName(Loop.Kind);
+        for (const ValueDecl *D : Demoted)
+            Record.Demoted.push_back(NameOf(D));
+        for (const ValueDecl *D : Kept)
+            if (!Demoted.count(D))
+                Record.Kept.push_back(NameOf(D));
+        for (const VarDecl *VD : Loop.Accumulators)
+            Record.Accumulators.push_back(NameOf(VD));
+        if (Loop.Carried)
+            Record.Carried = NameOf(Loop.Carried);
+        bool Vectorizes = Loop.Kind != LoopKind::Recurrence;
+        for (unsigned Width : VectorWidths)
+            Record.Lanes.push_back({Width, Vectorizes ? laneCount(Width, Record.OldBits) : 1,
+                                    Vectorizes ? laneCount(Width, Record.NewBits) : 1});
+        Record.TripCount = Loop.TripCount;
+        Record.TripExact = Loop.TripExact;
+        Result.Loops.push_back(std::move(Record));
+    }
+}
+
+bool Fp16DemotionVisitor::VisitFloatingLiteral(FloatingLiteral *F) {
+    SourceManager &SM = Context->getSourceManager();
+    if (!SM.isInMainFile(F->getLocation()))
+        return true; // Only process literals in the main file
+
+    // Literals are immediates or constant pool entries, not data, so they
+    // are counted but not part of the storage totals
+    MemoryUsage &memoryStats = Result.Memory;
+    memoryStats.floatLiteralCount++;
+
+    std::string reason;
+    unsigned Fits = judge(reason, [&](std::string &Why) {
+        return judgeFormats(Why, [&](unsigned I, std::string &FormatWhy) {
+            return Verdicts[I].canDemote(F, &FormatWhy);
+        });
+    });
+    countFits(Fits, &FormatUsage::literalCount, 0);
+    const FloatFormat *Demoted = demotedFormat(Fits);
+
+    // A double literal the narrow formats refuse may still fit float
+    bool IsDouble = DemoteDouble && F->getType()->isSpecificBuiltinType(BuiltinType::Double);
+    if (IsDouble)
+        memoryStats.doubleLiteralCount++;
+    if (!Demoted && IsDouble) {
+        std::string SingleReason;
+        unsigned SingleFits = judge(SingleReason, [&](std::string &Why) {
+            return DoubleVerdicts.canDemote(F, &Why) ? 1u << formatIndex(singleFormat()) : 0u;
+        });
+        if (SingleFits) {
+            Demoted = &singleFormat();
+            reason.clear();
+            memoryStats.demotedDoubleLiteralCount++;
+        }
+    }
+    bool isSafeForDemotion = Demoted != nullptr;
+    const FloatFormat &Mode = isSafeForDemotion ? *Demoted : failedFormat();
+
+    double original = F->getValueAsApproximateDouble();
+    float downcast = float(Mode.simulate(float(original)));
+    double error = fabs(original - downcast);
+    if (fabs(original) > 1e-9) { // Avoid division by zero for error calculation
+        error /= fabs(original);
+    } else if (original == 0.0 && downcast == 0.0) {
+        error = 0.0; // Both are zero, no error
+    } else {
+        error = std::numeric_limits<double>::infinity(); // One is zero, other not, infinite error
+    }
+
+    PresumedLoc ploc = SM.getPresumedLoc(F->getBeginLoc());
+
+    LiteralRecord Record;
+    Record.Value = original;
+    Record.Downcast = downcast;
+    Record.Error = error;
+    Record.Mode = Mode.Name;
+    Record.Safe = isSafeForDemotion;
+    Record.Reason = reason;
+    Record.File = ploc.getFilename();
+    Record.Line = ploc.getLine();
+    Record.Column = ploc.getColumn();
+    if (Sink)
+        Sink->addLiteral(Record);
+    else
+        Result.Literals.push_back(std::move(Record));
+
+    // If the literal itself can be safely demoted, add it to replacements
+    if (isSafeForDemotion) {
+        // Track successful literal demotion
+        memoryStats.demotedLiteralCount++;
+
+        std::ostringstream replacement;
+        // A C cast of the downcast value, written as a hex float literal so
+        // it is exact
+        replacement << "((" << Demoted->TypeName << ")" << std::hexfloat << double(downcast) << "f)";
+        CharSourceRange charRange = CharSourceRange::getTokenRange(F->getSourceRange());
+        if (charRange.isValid()) {
+            // Get the length of the original literal
+            Token Tok;
+            if (!Lexer::getRawToken(F->getBeginLoc(), Tok, SM, Context->getLangOpts())) {
+                std::string OriginalLiteralText = Lexer::getSpelling(Tok, SM, Context->getLangOpts());
+                // The value is exact in float, so the spelling can stay.
+                std::string Text = Demoted == &singleFormat() ? OriginalLiteralText + "f"
+                                                              : replacement.str();
+                Replacements.push_back({F->getBeginLoc(), Text, OriginalLiteralText.length()});
+                DemotedLiterals.insert(F);
+            } else {
+                // Fallback if token reading fails
+                Replacements.push_back({F->getBeginLoc(), replacement.str(), 5}); // Default length
+            }
+        }
+        emitLiteralDemotionSuccessDiagnostic(F->getLocation(), original, *Demoted);
+    } else {
+        emitLiteralDemotionFailureDiagnostic(F->getLocation(), original, reason, Mode);
+    }
+
+    return true;
+}
+
+bool Fp16DemotionVisitor::VisitBinaryOperator(BinaryOperator *BO) {
+    if (!DemoteDouble || !BO->isAssignmentOp())
+        return true;
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(BO->getLHS()->IgnoreParenImpCasts()))
+        if (const auto *VD = dyn_cast<VarDecl>(DRE->getDecl()))
+            if (VD->getType()->isSpecificBuiltinType(BuiltinType::Double))
+                DoubleStores.push_back(BO);
+    return true;
+}
+
+bool Fp16DemotionVisitor::TraverseDecl(Decl *D) {
+    if (!Incremental || Replaying || RecordingVerdicts || !D || !Incremental->isFunction(D))
+        return RecursiveASTVisitor::TraverseDecl(D);
+
+    Replaying = Incremental->findVerdicts(D);
+    NextVerdict = 0;
+    RecordingVerdicts = !Replaying;
+    Recorded.clear();
+    bool Continue = RecursiveASTVisitor::TraverseDecl(D);
+    if (RecordingVerdicts)
+        Incremental->storeVerdicts(D, std::move(Recorded));
+    Replaying = nullptr;
+    RecordingVerdicts = false;
+    return Continue;
+}
+
+bool Fp16DemotionVisitor::VisitDecl(Decl *) {
+    if (Timers)
+        ++Timers->Counters.NodesVisited;
+    return true;
+}
+
+bool Fp16DemotionVisitor::VisitStmt(Stmt *) {
+    if (Timers)
+        ++Timers->Counters.NodesVisited;
+    return true;
+}
+
+unsigned Fp16DemotionVisitor::judge(std::string &Reason,
+                                    llvm::function_ref<unsigned(std::string &)> Compute) {
+    // An unchanged function has as many verdicts as before; running out
+    // would mean the fingerprint missed something, so compute the rest.
+    if (Replaying && NextVerdict < Replaying->size()) {
+        const CachedVerdict &V = (*Replaying)[NextVerdict++];
+        Reason = V.Reason;
+        return V.Fits;
+    }
+    unsigned Fits;
+    {
+        PhaseScope Scope(Timers, Phase::Verdicts);
+        Fits = Compute(Reason);
+    }
+    if (RecordingVerdicts)
+        Recorded.push_back({Fits, Reason});
+    return Fits;
+}
+
+unsigned Fp16DemotionVisitor::judgeFormats(std::string &Why,
+                                           llvm::function_ref<bool(unsigned, std::string &)> Fits) {
+    unsigned Mask = 0;
+    bool Demoted = false, Explained = false;
+    for (unsigned I = 0; I < Formats.size(); ++I) {
+        std::string FormatWhy;
+        if (Fits(I, FormatWhy)) {
+            Mask |= 1u << formatIndex(*Formats[I]);
+            Demoted |= Formats[I]->TypeName != nullptr;
+        } else if (!Explained && Formats[I]->TypeName) {
+            Why = std::move(FormatWhy);
+            Explained = true;
+        }
+    }
+    if (Demoted)
+        Why.clear();
+    else if (!Explained)
+        Why = std::string(Formats.front()->Display) + " has no C type to demote to";
+    return Mask;
+}
+
+unsigned Fp16DemotionVisitor::rangeFits(const Interval &Range) const {
+    unsigned Mask = 0;
+    for (const FloatFormat *F : Formats)
+        if (F->canHold(Range))
+            Mask |= 1u << formatIndex(*F);
+    return Mask;
+}
+
+const FloatFormat *Fp16DemotionVisitor::demotedFormat(unsigned Fits) const {
+    for (const FloatFormat *F : Formats)
+        if (F->TypeName && (Fits & (1u << formatIndex(*F))))
+            return F;
+    return nullptr;
+}
+
+const FloatFormat &Fp16DemotionVisitor::failedFormat() const {
+    for (const FloatFormat *F : Formats)
+        if (F->TypeName)
+            return *F;
+    return *Formats.front();
+}
+
+void Fp16DemotionVisitor::countFits(unsigned Fits, size_t FormatUsage::*Count, uint64_t Bytes) {
+    for (unsigned I = 0; I < NumFloatFormats; ++I) {
+        if (!(Fits & (1u << I)))
+            continue;
+        FormatUsage &Usage = Result.Memory.formats[I];
+        ++(Usage.*Count);
+        Usage.floatBytes += Bytes;
+    }
+}
+
+void Fp16DemotionVisitor::setFormats(llvm::ArrayRef<const FloatFormat *> Enabled) {
+    Formats.assign(Enabled.begin(), Enabled.end());
+    Verdicts.clear();
+    StorageFormat = nullptr;
+    for (const FloatFormat *F : Formats) {
+        Verdicts.emplace_back(Context, &Ranges, *F);
+        if (!StorageFormat && F->TypeName && F->ExponentBits == 5 && F->MantissaBits == 10)
+            StorageFormat = F;
+    }
+}
+
+size_t Fp16DemotionVisitor::exprsEvaluated() const {
+    size_t Evaluated = DoubleVerdicts.evaluated();
+    for (const ExprVerdicts &V : Verdicts)
+        Evaluated += V.evaluated();
+    return Evaluated;
+}
+
+void Fp16DemotionVisitor::collectMemoryUsage() {
+    Layout.finish(Result.Memory);
+    for (const FloatFormat *F : Formats)
+        Result.Memory.formats[formatIndex(*F)].enabled = true;
+}
+
+void Fp16DemotionVisitor::applyTransformations() {
+    if (!Context || Replacements.empty())
+        return;
+
+    llvm::outs() << "\n=== TRANSFORMATIONS ===\n";
+    SourceManager &SM = Context->getSourceManager();
+    for (const auto& Transform : Replacements) {
+        if (Transform.Loc.isValid()) {
+            PresumedLoc PLoc = SM.getPresumedLoc(Transform.Loc);
+            llvm::outs() << "Transform at " << PLoc.getFilename() << ":"
+                       << PLoc.getLine() << ":" << PLoc.getColumn()
+                       << " -> " << Transform.ReplacementText << "\n";
+        }
+    }
+    llvm::outs() << "=== END TRANSFORMATIONS ===\n\n";
+}
+
+void Fp16DemotionVisitor::buildDemotedCode(ASTContext &Context) {
+    SourceManager &SM = Context.getSourceManager();
+    SourceEdits Edits(SM, Context.getLangOpts());
+    for (const SourceEdits::Refused &R : Edits.add(Replacements))
+        emitRewriteFailureDiagnostic(R.Loc, R.Why);
+
+    // By file, the main file first, and by offset within a file
+    Result.Transformations.clear();
+    for (const SourceEdits::FileEdits *F : Edits.files()) {
+        std::string File = F->FID == SM.getMainFileID() ? std::string() : F->Path;
+        for (const tooling::Replacement &R : F->Replaces)
+            Result.Transformations.push_back(
+                {File, R.getOffset(), R.getLength(), R.getReplacementText().str()});
+    }
+    Result.DemotedCode = Edits.apply(SM.getMainFileID());
+}
+
+ValueSites &Fp16DemotionVisitor::sites() {
+    if (!Sites)
+        Sites = std::make_unique<ValueSites>(*Context);
+    return *Sites;
+}
+
+bool Fp16DemotionVisitor::fitsFormat(const VarDecl *VD, unsigned I, std::string &Why) {
+    const FloatFormat &Format = *Formats[I];
+    // Check variable initialization
+    if (const Expr *Init = VD->getInit()) {
+        if (!Verdicts[I].canDemote(Init, &Why)) {
+            if (Why.empty())
+                Why = std::string("initialization value out of ") + Format.Display +
+                      " range or loses precision";
+            return Profile && canDemoteProfiled(VD, I, Why);
+        }
+    }
+
+    // Check every value the variable holds over its lifetime, not just the
+    // initializer
+    Interval Range;
+    if (Ranges.getRange(VD, Range, &Why) && Format.canHold(Range, &Why))
+        return true;
+    return Profile && canDemoteProfiled(VD, I, Why);
+}
+
+// Doubles are not recorded by the instrumentation, so only the static
+// verdict counts.
+bool Fp16DemotionVisitor::fitsSingle(const VarDecl *VD, std::string &Why) {
+    if (VD->hasExternalFormalLinkage()) {
+        Why = "visible to other translation units";
+        return false;
+    }
+    if (const Expr *Init = VD->getInit()) {
+        if (!DoubleVerdicts.canDemote(Init, &Why)) {
+            if (Why.empty())
+                Why = "initialization value out of float range or loses precision";
+            return false;
+        }
+    }
+    Interval Range;
+    return Ranges.getRange(VD, Range, &Why) && singleFormat().canHold(Range, &Why) &&
+           Errors.withinBudget(VD, singleFormat(), Why);
+}
+
+bool Fp16DemotionVisitor::canDemoteProfiled(const VarDecl *VD, unsigned I, std::string &Why) {
+    const SiteProfile *P = Profile->find(profileSiteName(VD, Context->getSourceManager()));
+    // Without samples, or if some of its values may not have been
+    // recorded, the static verdict stands.
+    if (!P || !sites().isObservable(VD))
+        return false;
+    // The initializer of a static is not recorded.
+    if (const Expr *Init = VD->getInit()) {
+        std::string InitWhy;
+        if (!sites().recordsInit(VD) && !Verdicts[I].canDemote(Init, &InitWhy))
+            return false;
+    }
+
+    auto Refuse = [&](const llvm::Twine &What) {
+        Why += "; profile: " + What.str();
+        return false;
+    };
+    if (P->NaNs || P->Infinities)
+        return Refuse("observed NaN or infinity");
+    if (!P->finite())
+        return Refuse("no finite values observed");
+    // The runtime counts the values below the binary16 normal range; only
+    // formats whose normal range starts there or higher lose them.
+    const FloatFormat &Format = *Formats[I];
+    if (P->Subnormals && Format.minNormal() >= FP16_MIN_POSITIVE)
+        return Refuse(llvm::Twine(P->Subnormals) + " values below the " + Format.Display +
+                      " normal range");
+    double Margin = ProfileMargin / 100;
+    Interval Widened{P->Min - std::fabs(P->Min) * Margin, P->Max + std::fabs(P->Max) * Margin};
+    std::string RangeWhy;
+    if (!Format.canHold(Widened, &RangeWhy))
+        return Refuse("observed " + RangeWhy);
+    Why.clear();
+    return true;
+}
+
+bool Fp16DemotionVisitor::worthConverting(const VarDecl *VD, const FloatFormat &Format,
+                                          std::string &Why) {
+    if (CostMode == CostModelMode::Off)
+        return true;
+    if (!Costs)
+        Costs = std::make_unique<ConversionCostModel>(
+            *Context, CostTarget ? *CostTarget : targetCostsFor(Context->getTargetInfo()));
+
+    ConversionCostRecord Record;
+    Record.Cost = Costs->cost(VD, Format);
+    bool Worth = !Record.Cost.outweighs();
+    PresumedLoc PLoc = Context->getSourceManager().getPresumedLoc(VD->getLocation());
+    Record.Name = VD->getName().str();
+    Record.File = PLoc.getFilename();
+    Record.Line = PLoc.getLine();
+    Record.Column = PLoc.getColumn();
+    Record.Mode = Format.Name;
+    Record.Target = Costs->target().Name;
+    Record.Decision = Worth ? "demoted"
+                            : CostMode == CostModelMode::Flag ? "flagged" : "rejected";
+    Result.ConversionCosts.push_back(Record);
+    if (Worth)
+        return true;
+
+    char Buf[192];
+    snprintf(Buf, sizeof(Buf),
+             "its half/float conversions cost about %.0f cycles on %s, more than the "
+             "%.0f cycles of memory traffic it saves",
+             Record.Cost.ConversionCycles, Record.Target.c_str(), Record.Cost.BenefitCycles);
+    if (CostMode == CostModelMode::Flag) {
+        emitConversionCostDiagnostic(VD->getLocation(), VD->getName(), Buf);
+        return true;
+    }
+    Why = Buf;
+    return false;
+}
+
+void Fp16DemotionVisitor::buildInstrumentedCode() {
+    if (Instrument)
+        Result.InstrumentedCode = sites().instrument(Profiled);
+}
+
+void Fp16DemotionVisitor::emitDemotionSuccessDiagnostic(SourceLocation Loc, StringRef VarName,
+                                                        const FloatFormat &Format, StringRef From) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
+        "Variable '%0' has been safely demoted from %1 to %2");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(VarName);
+    DB.AddString(From);
+    DB.AddString(Format.Display);
+}
+
+void Fp16DemotionVisitor::emitDemotionFailureDiagnostic(SourceLocation Loc, StringRef VarName, StringRef Reason,
+                                                        const FloatFormat &Format) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
+        "Cannot demote variable '%0' to %1: %2");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(VarName);
+    DB.AddString(Format.Display);
+    DB.AddString(Reason);
+}
+
+void Fp16DemotionVisitor::emitConversionCostDiagnostic(SourceLocation Loc, StringRef VarName,
+                                                       StringRef Why) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
+        "Demoting variable '%0' may be slower: %1");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(VarName);
+    DB.AddString(Why);
+}
+
+void Fp16DemotionVisitor::emitRewriteFailureDiagnostic(SourceLocation Loc, StringRef Why) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
+        "Cannot rewrite the demoted code here: %0");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(Why);
+}
+
+void Fp16DemotionVisitor::emitArrayConversionDiagnostic(SourceLocation Loc, StringRef Name) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
+        "Array '%0' is now stored as binary16");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(Name);
+}
+
+void Fp16DemotionVisitor::emitLiteralDemotionSuccessDiagnostic(SourceLocation Loc, double OriginalValue,
+                                                               const FloatFormat &Format) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
+        "Float literal has been safely demoted to %0");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(Format.Display);
+}
+
+void Fp16DemotionVisitor::emitLiteralDemotionFailureDiagnostic(SourceLocation Loc, double OriginalValue, StringRef Reason,
+                                                               const FloatFormat &Format) {
+    if (!Context) return;
+    DiagnosticsEngine &DE = Context->getDiagnostics();
+    unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Note,
+        "Cannot demote float literal to %0: %1");
+    auto DB = DE.Report(Loc, ID);
+    DB.AddString(Format.Display);
+    DB.AddString(Reason);
+}
+
+void Fp16DemotionVisitor::collectSummaries() {
+    if (!Summaries)
+        return;
+    Result.ExportedSummaries = Ranges.exportSummaries();
+    Result.SummaryDeps = Ranges.summaryDependencies();
+}
+
+//===----------------------------------------------------------------------===//
+// Fp16DemotionASTConsumer
+//===----------------------------------------------------------------------===//
+
+void Fp16DemotionASTConsumer::HandleTranslationUnit(ASTContext &Context) {
+    SourceManager &SM = Context.getSourceManager();
+    if (OptionalFileEntryRef FE = SM.getFileEntryRefForID(SM.getMainFileID()))
+        Result.MainFile = FE->getName().str();
+
+    std::unique_ptr<IncrementalState> State;
+    if (Incremental) {
+        State = Incremental->load(Result.MainFile, Summaries);
+        State->fingerprint(Context);
+        Visitor.setIncrementalState(State.get());
+    }
+
+    // Traverse the AST to collect transformations. Only the main file is
+    // analyzed and rewritten, so the declarations of the headers are not
+    // walked at all.
+    {
+        PhaseScope Scope(Timers, Phase::Traversal);
+        for (Decl *D : Context.getTranslationUnitDecl()->decls())
+            if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+                Visitor.TraverseDecl(D);
+    }
+
+    {
+        PhaseScope Scope(Timers, Phase::Records);
+        Visitor.demoteDoubles();
+        Visitor.convertArrays();
+        Visitor.analyzeRecords();
+        Visitor.analyzeLoops();
+    }
+    {
+        PhaseScope Scope(Timers, Phase::DemotedCode);
+        Visitor.buildDemotedCode(Context);
+        Visitor.buildInstrumentedCode();
+    }
+    {
+        PhaseScope Scope(Timers, Phase::Summaries);
+        Visitor.collectMemoryUsage();
+        Visitor.collectSummaries();
+    }
+    if (Timers)
+        Timers->Counters.ExprsEvaluated += Visitor.exprsEvaluated();
+
+    if (State) {
+        // Reused results depend on the summaries their analysis looked up.
+        if (Summaries)
+            State->mergeSummaryDeps(Result.SummaryDeps);
+        // Results of a broken parse would stand in for the fixed code.
+        if (!Context.getDiagnostics().hasErrorOccurred())
+            Incremental->save(*State);
+        Visitor.setIncrementalState(nullptr);
+    }
+}
+
+bool Fp16DemotionASTConsumer::shouldSkipFunctionBody(Decl *D) {
+    SourceManager &SM = D->getASTContext().getSourceManager();
+    SourceLocation Loc = SM.getExpansionLoc(D->getLocation());
+    if (Loc.isInvalid() || SM.isInMainFile(Loc))
+        return false;
+    if (ProjectHeaders.empty())
+        return SM.isInSystemHeader(Loc);
+    return !isProjectFile(SM, SM.getFileID(Loc));
+}
+
+void Fp16DemotionASTConsumer::setProjectHeaders(llvm::ArrayRef<std::string> Paths) {
+    ProjectHeaders.clear();
+    ProjectFiles.clear();
+    for (const std::string &Path : Paths) {
+        llvm::SmallString<256> Absolute(Path);
+        llvm::sys::fs::make_absolute(Absolute);
+        llvm::sys::path::remove_dots(Absolute, /*remove_dot_dot=*/true);
+        ProjectHeaders.push_back(std::string(Absolute));
+    }
+}
+
+bool Fp16DemotionASTConsumer::isProjectFile(const SourceManager &SM, FileID FID) {
+    auto Known = ProjectFiles.find(FID);
+    if (Known != ProjectFiles.end())
+        return Known->second;
+    bool Project = false;
+    if (OptionalFileEntryRef FE = SM.getFileEntryRefForID(FID)) {
+        llvm::SmallString<256> Name(FE->getName());
+        llvm::sys::fs::make_absolute(Name);
+        llvm::sys::path::remove_dots(Name, /*remove_dot_dot=*/true);
+        // A listed file, or a file under a listed directory
+        Project = llvm::any_of(ProjectHeaders, [&](const std::string &Path) {
+            llvm::StringRef Rest = Name;
+            return Rest.consume_front(Path) &&
+                   (Rest.empty() || llvm::sys::path::is_separator(Rest.front()) ||
+                    llvm::sys::path::is_separator(Path.back()));
+        });
+    }
+    ProjectFiles[FID] = Project;
+    return Project;
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,717 @@
+//===- Fp16Demotion.h - Shared FP16 demotion analysis ---------------------===//
+//
+// The analysis core used by both the clang plugin (Fp16DemotionPlugin.cpp)
+// and the standalone whole-project driver (Fp16DemotionTool.cpp). All state
+// produced for a translation unit lives in a DemotionResult owned by the
+// caller, so several translation units can be analyzed concurrently.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_DEMOTION_H
+#define FP16_DEMOTION_H
+
+#include "Fp16ArrayStorage.h"
+#include "Fp16ConversionCost.h"
+#include "Fp16ErrorAnalysis.h"
+#include "Fp16Formats.h"
+#include "Fp16Incremental.h"
+#include "Fp16LoopVectorization.h"
+#include "Fp16MemoryModel.h"
+#include "Fp16RangeAnalysis.h"
+#include "Fp16Rewrite.h"
+#include "Fp16Timing.h"
+#include "Fp16ValueProfile.h"
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace fp16demotion {
+
+class FieldAccessCounter;
+
+// One entry of float_map.json
+struct LiteralRecord {
+    double Value = 0.0;
+    float Downcast = 0.0f;
+    double Error = 0.0;
+    // The format the literal is demoted to, or the first one it was
+    // checked against; Downcast and Error are through it
+    std::string Mode = "fp16";
+    bool Safe = false;
+    std::string Reason;
+    std::string File;
+    unsigned Line = 0;
+    unsigned Column = 0;
+};
+
+// The demotion verdict for one float variable declaration
+struct VariableRecord {
+    std::string Name;
+    std::string Mode = "fp16"; // As in LiteralRecord
+    bool Safe = false;
+    std::string Reason;
+    std::string File;
+    unsigned Line = 0;
+    unsigned Column = 0;
+};
+
+// Receives result records as the visitor finds them.
+class RecordSink {
+public:
+    virtual ~RecordSink() = default;
+    virtual void addLiteral(const LiteralRecord &Record) = 0;
+    // float_map.json only lists literals, so variables are optional.
+    virtual void addVariable(const VariableRecord &Record) {}
+    // Called once after the last record. Must be idempotent.
+    virtual void finish() {}
+};
+
+// A struct whose float fields are partly or fully demotable, with the
+// layout before and after demotion
+struct StructLayoutRecord {
+    std::string Name;
+    std::string File;
+    unsigned Line = 0;
+    uint64_t OldSize = 0;      // sizeof as declared
+    uint64_t NewSize = 0;      // sizeof with the demoted fields, declared order
+    uint64_t ReorderedSize = 0; // sizeof in the suggested order
+    unsigned OldLines = 0;     // Cache lines one array element can touch
+    unsigned NewLines = 0;     // The same in the suggested order
+    std::vector<std::string> DemotedFields;
+    std::vector<std::string> HotFields;
+    // Every field in the suggested order; empty if no order is suggested
+    // (bit-fields, bases, packed records) or it is the declared one
+    std::vector<std::string> SuggestedOrder;
+    bool Rewritten = false; // Reordered in demoted.c
+};
+
+// A float array (variable or field) and whether its elements can be
+// stored as binary16 bit patterns
+struct ArrayStorageRecord {
+    std::string Name;
+    std::string File;
+    unsigned Line = 0;
+    uint64_t Elements = 0;
+    uint64_t OldBytes = 0;
+    uint64_t NewBytes = 0;
+    bool Safe = false;      // Every element value fits __fp16
+    bool Converted = false; // Stored as fp16_storage_t in demoted.c
+    std::string Reason;     // Why it is not converted; empty if it can be
+    unsigned Reads = 0;
+    unsigned Writes = 0;
+    // Bytes moved by the element accesses as declared, with each access
+    // weighted by the trip counts of the loops around it; conversion
+    // halves them.
+    double TrafficBytes = 0;
+    bool TrafficExact = false; // Every loop around an access had a known trip count
+};
+
+// SIMD lanes in one register width before and after demotion
+struct LaneEstimate {
+    unsigned VectorBits = 0;
+    unsigned Before = 0;
+    unsigned After = 0;
+};
+
+// An innermost loop that accesses demotion candidates (see
+// Fp16LoopVectorization.h), and the SIMD lanes it gets before and after
+// demotion
+struct LoopVectorRecord {
+    std::string Function;
+    std::string File;
+    unsigned Line = 0;
+    std::string Kind; // See loopKindName
+    // The floating-point storage the loop accesses, narrowed by the
+    // demotion or keeping its width
+    std::vector<std::string> Demoted;
+    std::vector<std::string> Kept;
+    std::vector<std::string> Accumulators; // Of a reduction; kept at least float
+    std::string Carried;                   // What carries a recurrence
+    unsigned OldBits = 0; // Widest floating-point access as declared
+    unsigned NewBits = 0; // The same after demotion
+    std::vector<LaneEstimate> Lanes; // One per vector width; 1 -> 1 for recurrences
+    double TripCount = 1;
+    bool TripExact = false; // TripCount is known
+};
+
+// The conversion cost model's decision on a float variable that fits a
+// narrower format (see Fp16ConversionCost.h)
+struct ConversionCostRecord {
+    std::string Name;
+    std::string File;
+    unsigned Line = 0;
+    unsigned Column = 0;
+    std::string Mode;     // The format, as in VariableRecord
+    std::string Target;   // The cost table, see TargetCosts
+    std::string Decision; // "demoted", "flagged" or "rejected"
+    ConversionCost Cost;
+};
+
+// A Transformation as a byte range of a file, valid after the
+// SourceManager that produced it is gone.
+struct TransformationRecord {
+    std::string File; // Absolute; empty for the main file
+    unsigned Offset = 0;
+    unsigned Length = 0;
+    std::string ReplacementText;
+};
+
+enum class FloatMapFormat {
+    Json,   // One JSON array, pretty-printed (float_map.json)
+    NDJson, // One compact JSON object per line (float_map.ndjson)
+    Binary, // Memory-mappable records, see Fp16BinaryFormat.h (float_map.bin)
+};
+
+// Options understood by the plugin (-plugin-arg-fp16-demotion) and
+// forwarded verbatim by the standalone driver (--plugin-arg).
+struct DemotionOptions {
+    bool Enabled = false;
+
+    // The formats tried, narrowest first (-fprecision-demote=LIST, e.g.
+    // fp16,bf16). Each float variable and literal is demoted to the first
+    // one with a C type that it fits; the others are only reported.
+    std::vector<const FloatFormat *> Formats{&halfFormat()};
+
+    // Also demote double variables and literals to float where every value
+    // fits, switching the <math.h> calls feeding them to their float
+    // variants (-fprecision-demote-double)
+    bool DemoteDouble = false;
+
+    // -fprecision-demote-format=json|ndjson|binary (-fprecision-demote-ndjson
+    // is shorthand for ndjson)
+    FloatMapFormat Format = FloatMapFormat::Json;
+
+    // On-disk result cache (-fprecision-demote-cache=DIR,
+    // -fprecision-demote-cache-size=MB). Disabled when CacheDir is empty.
+    std::string CacheDir;
+    uint64_t CacheMaxBytes = 256ull << 20;
+
+    // Write structs with demoted fields in the suggested field order to
+    // demoted.c (-fprecision-demote-reorder-fields)
+    bool ReorderFields = false;
+
+    // Store float arrays whose elements all fit __fp16 as binary16 bit
+    // patterns in demoted.c (-fprecision-demote-arrays). The arrays are
+    // analyzed and reported either way.
+    bool ConvertArrays = false;
+
+    // Function summary database shared by all translation units
+    // (-fprecision-demote-summaries=DIR). Disabled when SummaryDir is empty.
+    std::string SummaryDir;
+
+    // Keep per-function results between analyses of the same file and
+    // reanalyze only the functions an edit affects
+    // (-fprecision-demote-incremental=DIR). Disabled when IncrementalDir is
+    // empty.
+    std::string IncrementalDir;
+
+    // Where the artifacts go: OutputDir (-fprecision-demote-output-dir=DIR,
+    // created if missing; default the working directory) joined with
+    // OutputPrefix + the artifact name (-fprecision-demote-output-prefix=P).
+    std::string OutputDir;
+    std::string OutputPrefix;
+
+    // Write the float map, demoted source and memory analysis as one JSON
+    // object, fp16_report.json, instead of three files
+    // (-fprecision-demote-combined). Plugin only.
+    bool CombinedOutput = false;
+
+    // Print the time of each analysis phase and the work done
+    // (-fprecision-demote-timing). Plugin only.
+    bool Timing = false;
+
+    // Record the phases as Chrome trace events into FILE
+    // (-fprecision-demote-time-trace=FILE). Under clang's -ftime-trace they
+    // go to clang's trace instead. Plugin only.
+    std::string TimeTraceFile;
+
+    // Analyze without compiling: the plugin replaces the main action instead
+    // of running before it, and the parser skips the function bodies of
+    // headers outside the project (-fprecision-demote-analysis-only). Calls
+    // into skipped functions are treated as calls to external functions.
+    bool AnalysisOnly = false;
+
+    // Files and directories whose headers belong to the project, so their
+    // function bodies are parsed in analysis-only mode
+    // (-fprecision-demote-project-header=PATH, repeatable). Empty means
+    // every header outside the system include paths.
+    std::vector<std::string> ProjectHeaders;
+
+    // Write instrumented.c, a copy of the main file that records the values
+    // of the variables not proven safe (-fprecision-demote-instrument). See
+    // Fp16ValueProfile.h. Plugin only.
+    bool Instrument = false;
+
+    // Demote variables on the ranges recorded in a profile
+    // (-fprecision-demote-profile=FILE, read when the argument is parsed),
+    // widened by ProfileMargin percent on both ends
+    // (-fprecision-demote-profile-margin=PCT).
+    std::shared_ptr<const ValueProfile> Profile;
+    double ProfileMargin = 10;
+
+    // Refuse demotions whose first-order rounding error bound exceeds a
+    // budget (-fprecision-demote-error-budget=[NAME=]REL,
+    // -fprecision-demote-abs-error-budget=[NAME=]ABS, repeatable). See
+    // Fp16ErrorAnalysis.h.
+    ErrorBudgets Budgets;
+
+    // Register widths in bits the loop report gives SIMD lanes for
+    // (-fprecision-demote-vector-width=BITS,...)
+    std::vector<unsigned> VectorWidths{std::begin(DefaultVectorWidths),
+                                       std::end(DefaultVectorWidths)};
+
+    // Weigh the half/float conversions a demoted variable adds against the
+    // memory traffic it saves, and flag or reject the demotions that cost
+    // more (-fprecision-demote-cost-model=flag|reject), priced for
+    // CostTarget (-fprecision-demote-cost-target=NAME; null picks the table
+    // of the compilation's target). See Fp16ConversionCost.h.
+    CostModelMode CostModel = CostModelMode::Off;
+    const TargetCosts *CostTarget = nullptr;
+
+    // Also write the edits as clang-apply-replacements YAML
+    // (-fprecision-demote-replacements). See Fp16Rewrite.h.
+    bool EmitReplacements = false;
+
+    // Arguments that influence the analysis output, in command-line order.
+    // Part of the cache key.
+    std::vector<std::string> AnalysisArgs;
+};
+
+// Applies one plugin argument to Opts. Returns false for unknown arguments.
+bool parseDemotionArg(llvm::StringRef Arg, DemotionOptions &Opts);
+
+// Everything the analysis of one translation unit produces.
+struct DemotionResult {
+    std::string MainFile;
+    // Only filled when no RecordSink is attached to the visitor.
+    std::vector<LiteralRecord> Literals;
+    std::vector<VariableRecord> Variables;
+    MemoryUsage Memory;
+    std::string DemotedCode;
+    std::string InstrumentedCode; // With DemotionOptions::Instrument only
+    std::vector<TransformationRecord> Transformations;
+    std::vector<StructLayoutRecord> StructLayouts;
+    std::vector<ArrayStorageRecord> Arrays;
+    std::vector<LoopVectorRecord> Loops;
+    std::vector<ConversionCostRecord> ConversionCosts; // With the cost model only
+    // Only filled when a summary database is in use: the summaries this
+    // translation unit contributes and every database lookup it made.
+    std::vector<NamedSummary> ExportedSummaries;
+    std::vector<std::pair<std::string, std::string>> SummaryDeps;
+};
+
+// Bump whenever the analysis or its output format changes; cached results
+// from other versions are ignored.
+const char *const FP16_DEMOTION_VERSION = "1.18.0";
+
+// Simulate __fp16 conversion for error calculation in JSON
+float simulate_fp16(float value);
+
+// Constants for FP16 range
+const float FP16_MAX = 65504.0f;
+const float FP16_MIN_POSITIVE = 6.103515625e-5f; // 2^-14
+const float SMALL_DIVISION_THRESHOLD = 0.001f;   // Threshold for "small number" in division
+
+class Fp16TypeChecker {
+public:
+    static bool isValueInFp16Range(float Value);
+
+    // Overload: returns false and sets reason if not demotable
+    // Calls are accepted if Ranges has a summary for the callee. A one-off
+    // query; use ExprVerdicts to share verdicts between queries.
+    static bool canDemoteFloatExpr(const clang::Expr *E, clang::ASTContext *Context,
+                                   std::string *Reason = nullptr,
+                                   RangeAnalysis *Ranges = nullptr);
+
+    // Whether T is a plain Kind (float, or double for the double tier)
+    static bool canDemoteType(clang::QualType T, clang::ASTContext *Context,
+                              clang::BuiltinType::Kind Kind = clang::BuiltinType::Float);
+
+    // Returns false and sets reason unless every value in Range survives
+    // conversion to __fp16
+    static bool canDemoteRange(const Interval &Range, std::string *Reason = nullptr);
+};
+
+// Demotion verdicts of float expressions for one translation unit and one
+// target format, or of double expressions and float for the double tier.
+// Every subexpression is judged once, operands before the operators using
+// them, and the verdicts are kept for later queries: an initializer and the
+// literals inside it share their work. Queried constant expressions are
+// folded with Expr::EvaluateAsFloat once and judged by their value.
+class ExprVerdicts {
+public:
+    // Calls are accepted if Ranges has a summary for the callee. Variables
+    // of type Source (and float) are accepted; their values are left to the
+    // range analysis.
+    explicit ExprVerdicts(clang::ASTContext *Context, RangeAnalysis *Ranges = nullptr,
+                          const FloatFormat &Format = halfFormat(),
+                          clang::BuiltinType::Kind Source = clang::BuiltinType::Float);
+
+    // Returns false and sets reason if E is not demotable.
+    bool canDemote(const clang::Expr *E, std::string *Reason = nullptr);
+
+    // The number of expressions judged so far
+    size_t evaluated() const { return Verdicts.size(); }
+
+private:
+    struct Verdict {
+        bool Safe = false;
+        const char *Reason = nullptr; // Why not; null if no reason is given
+        bool Folded = false;          // Set by fold: E was tried as a constant
+    };
+
+    Verdict evaluate(const clang::Expr *Root);
+    Verdict combine(const clang::Expr *E);
+    Verdict fold(const clang::Expr *E);
+
+    clang::ASTContext *Context;
+    RangeAnalysis *Ranges;
+    const FloatFormat *Format;
+    clang::BuiltinType::Kind Source;
+    // Why literals and folded constants fail, naming Format
+    const char *LiteralOutOfRange;
+    const char *LiteralInexact;
+    const char *ConstantOutOfRange;
+    const char *ConstantInexact;
+    // Keyed by the expression with parentheses and casts stripped, and by
+    // the queried expression itself once it has been folded
+    llvm::DenseMap<const clang::Expr *, Verdict> Verdicts;
+};
+
+class Fp16DemotionVisitor : public clang::RecursiveASTVisitor<Fp16DemotionVisitor> {
+public:
+    Fp16DemotionVisitor(clang::ASTContext *Context, clang::Rewriter &R,
+                        DemotionResult &Result)
+        : Context(Context), TheRewriter(R), Result(Result), Ranges(Context),
+          Errors(Context, Ranges),
+          DoubleVerdicts(Context, &Ranges, singleFormat(), clang::BuiltinType::Double),
+          Layout(Context) {
+        setFormats({&halfFormat()});
+    }
+
+    // Visit Variable Declarations
+    bool VisitVarDecl(clang::VarDecl *VD);
+
+    // Visit float fields of structs; see analyzeRecords for the layout
+    bool VisitFieldDecl(clang::FieldDecl *FD);
+
+    // Visit Floating Literals for JSON output and potential demotion
+    bool VisitFloatingLiteral(clang::FloatingLiteral *F);
+
+    // Collect the assignments to double variables for demoteDoubles
+    bool VisitBinaryOperator(clang::BinaryOperator *BO);
+
+    // Replays or records the verdicts of the functions State fingerprinted
+    bool TraverseDecl(clang::Decl *D);
+
+    // Count the nodes walked
+    bool VisitDecl(clang::Decl *D);
+    bool VisitStmt(clang::Stmt *S);
+
+    // Prints the queued edits; buildDemotedCode applies them
+    void applyTransformations();
+
+    // Stream records to Sink instead of collecting them in Result.Literals
+    // and Result.Variables.
+    void setRecordSink(RecordSink *S) { Sink = S; }
+
+    void setSummaryDatabase(SummaryDatabase *DB) {
+        Summaries = DB;
+        Ranges.setSummaryDatabase(DB);
+    }
+
+    void setReorderFields(bool Reorder) { ReorderFields = Reorder; }
+    void setConvertArrays(bool Convert) { ConvertArrays = Convert; }
+
+    // The formats to try, narrowest first; see DemotionOptions::Formats
+    void setFormats(llvm::ArrayRef<const FloatFormat *> Enabled);
+
+    // See DemotionOptions::DemoteDouble
+    void setDemoteDouble(bool Enable) { DemoteDouble = Enable; }
+
+    // Reuse the verdicts and range effects of the functions State has from
+    // an earlier analysis, and record those of the others into it.
+    void setIncrementalState(IncrementalState *State) {
+        Incremental = State;
+        Ranges.setIncrementalState(State);
+    }
+
+    // Demote variables the analysis cannot prove safe on their ranges in
+    // Profile, widened by Margin percent
+    void setValueProfile(const ValueProfile *P, double Margin) {
+        Profile = P;
+        ProfileMargin = Margin;
+    }
+
+    // See DemotionOptions::Budgets
+    void setErrorBudgets(const ErrorBudgets *B) { Errors.setBudgets(B); }
+
+    // See DemotionOptions::VectorWidths
+    void setVectorWidths(llvm::ArrayRef<unsigned> Widths) {
+        VectorWidths.assign(Widths.begin(), Widths.end());
+    }
+
+    // See DemotionOptions::CostModel; a null Target picks the table of the
+    // translation unit's target
+    void setCostModel(CostModelMode Mode, const TargetCosts *Target) {
+        CostMode = Mode;
+        CostTarget = Target;
+    }
+
+    // Collect the observable variables not proven safe for
+    // buildInstrumentedCode
+    void setInstrument(bool Enable) { Instrument = Enable; }
+
+    // Time the verdicts and count the nodes walked into Timers
+    void setPhaseTimers(PhaseTimers *T) { Timers = T; }
+
+    size_t exprsEvaluated() const;
+
+    // Rewrites the double variables found safe by the traversal to float
+    // and switches the <math.h> calls whose values end up in them to their
+    // float variants. Run after the traversal, before convertArrays.
+    void demoteDoubles();
+
+    // Fills in Result.Arrays and, if enabled, rewrites the arrays that can
+    // be stored in binary16. Run after the traversal, before analyzeRecords.
+    void convertArrays();
+
+    // Fills in Result.StructLayouts for the structs with demotable fields
+    // and rewrites their fields. Run after the traversal.
+    void analyzeRecords();
+
+    // Fills in Result.Loops with the loops that access demotion candidates.
+    // Run after analyzeRecords.
+    void analyzeLoops();
+
+    // Computes the storage part of Result.Memory once all variables have
+    // been visited.
+    void collectMemoryUsage();
+
+    // Fills in Result.ExportedSummaries and Result.SummaryDeps if a summary
+    // database is in use.
+    void collectSummaries();
+
+    // Renders the main file with all transformations applied into
+    // Result.DemotedCode, and records the edits of every file in
+    // Result.Transformations. See Fp16Rewrite.h.
+    void buildDemotedCode(clang::ASTContext &Context);
+
+    // Renders the main file with recording calls for the variables found by
+    // the traversal into Result.InstrumentedCode, if enabled.
+    void buildInstrumentedCode();
+
+private:
+    ValueSites &sites();
+    // Whether every value VD holds fits Formats[I]; sets Why if not
+    bool fitsFormat(const clang::VarDecl *VD, unsigned I, std::string &Why);
+    // The profile-guided verdict of VD for Formats[I], which the analysis
+    // could not prove safe for Why; appends to Why if the profile does not
+    // help either
+    bool canDemoteProfiled(const clang::VarDecl *VD, unsigned I, std::string &Why);
+    // Whether every value the double VD holds fits float; sets Why if not
+    bool fitsSingle(const clang::VarDecl *VD, std::string &Why);
+    void addDoubleVariable(const clang::VarDecl *VD);
+    // Whether E computes in float once the demoted doubles and literals are
+    // rewritten, with the math calls in Calls switched to float variants
+    bool becomesFloat(const clang::Expr *E, std::vector<const clang::CallExpr *> &Calls) const;
+    void rewriteMathCalls(const clang::Expr *E);
+    // The formats of Formats that Fits accepts, as a mask of formatIndex
+    // bits. Why is the reason of the first format with a C type that fails,
+    // or empty if any of them passes.
+    unsigned judgeFormats(std::string &Why, llvm::function_ref<bool(unsigned, std::string &)> Fits);
+    // The mask of the formats of Formats that hold every value in Range
+    unsigned rangeFits(const Interval &Range) const;
+    // The first format in Fits with a C type, or null
+    const FloatFormat *demotedFormat(unsigned Fits) const;
+    // The format a value that is not demoted is reported against
+    const FloatFormat &failedFormat() const;
+    // Adds one variable, field, array or literal fitting the formats in
+    // Fits to the per-format totals
+    void countFits(unsigned Fits, size_t FormatUsage::*Count, uint64_t Bytes);
+    // The 'float' keyword (or Keyword) starting D's type, or an invalid
+    // location
+    clang::SourceLocation floatKeyword(const clang::DeclaratorDecl *D,
+                                       llvm::StringRef Keyword = "float") const;
+    // The type replacing FD's 'float' keyword
+    const char *storageType(const clang::FieldDecl *FD) const;
+    void countKeyword(const clang::DeclaratorDecl *D);
+    void addFloatArray(const clang::DeclaratorDecl *D, std::string Name);
+    // The width of an access to Storage, Bits wide as declared, after
+    // demotion; Candidate is set if Storage was judged for demotion
+    unsigned demotedBits(const clang::ValueDecl *Storage, unsigned Bits, bool &Candidate) const;
+    void rewriteArrayUses(const std::vector<const ArrayUses *> &Converted);
+    void selectDemotedFields(const clang::RecordDecl *RD);
+    void analyzeRecord(const clang::RecordDecl *RD, const FieldAccessCounter &Accesses,
+                       llvm::DenseSet<const clang::RecordDecl *> &Done);
+    StructLayoutRecord describeRecord(const clang::RecordDecl *RD,
+                                      const FieldAccessCounter &Accesses,
+                                      std::vector<const clang::FieldDecl *> &Order);
+    bool rewriteRecord(const clang::RecordDecl *RD, const FieldAccessCounter &Accesses,
+                       const std::vector<const clang::FieldDecl *> &Order);
+
+    // Whether the conversions demoting VD to Format adds are worth it under
+    // the cost model; records the decision and sets Why if not
+    bool worthConverting(const clang::VarDecl *VD, const FloatFormat &Format,
+                         std::string &Why);
+
+    // The verdict of the next float variable or literal, as the mask of the
+    // formats it fits: replayed from an earlier analysis, or from Compute
+    // (and recorded)
+    unsigned judge(std::string &Reason, llvm::function_ref<unsigned(std::string &)> Compute);
+
+    void emitDemotionSuccessDiagnostic(clang::SourceLocation Loc, llvm::StringRef VarName,
+                                       const FloatFormat &Format, llvm::StringRef From = "float");
+    void emitDemotionFailureDiagnostic(clang::SourceLocation Loc, llvm::StringRef VarName,
+                                       llvm::StringRef Reason, const FloatFormat &Format);
+    void emitConversionCostDiagnostic(clang::SourceLocation Loc, llvm::StringRef VarName,
+                                      llvm::StringRef Why);
+    void emitRewriteFailureDiagnostic(clang::SourceLocation Loc, llvm::StringRef Why);
+    void emitArrayConversionDiagnostic(clang::SourceLocation Loc, llvm::StringRef Name);
+    void emitLiteralDemotionSuccessDiagnostic(clang::SourceLocation Loc, double OriginalValue,
+                                              const FloatFormat &Format);
+    void emitLiteralDemotionFailureDiagnostic(clang::SourceLocation Loc, double OriginalValue,
+                                              llvm::StringRef Reason, const FloatFormat &Format);
+
+    clang::ASTContext *Context;
+    clang::Rewriter &TheRewriter;
+    DemotionResult &Result;
+    RecordSink *Sink = nullptr;
+    SummaryDatabase *Summaries = nullptr;
+    RangeAnalysis Ranges;
+    ErrorAnalysis Errors;
+    std::vector<const FloatFormat *> Formats; // Narrowest first
+    std::vector<ExprVerdicts> Verdicts;       // One per entry of Formats
+    // The binary16 format fields and arrays are demoted to; null if neither
+    // fp16 nor float16 is enabled
+    const FloatFormat *StorageFormat = nullptr;
+    bool DemoteDouble = false;
+    ExprVerdicts DoubleVerdicts; // Against float
+    MemoryModel Layout;
+    bool ReorderFields = false;
+    bool ConvertArrays = false;
+    std::vector<unsigned> VectorWidths{std::begin(DefaultVectorWidths),
+                                       std::end(DefaultVectorWidths)};
+
+    CostModelMode CostMode = CostModelMode::Off;
+    const TargetCosts *CostTarget = nullptr;
+    std::unique_ptr<ConversionCostModel> Costs; // Built on first use
+
+    const ValueProfile *Profile = nullptr;
+    double ProfileMargin = 0;
+    bool Instrument = false;
+    std::unique_ptr<ValueSites> Sites; // Built on first use
+    std::vector<const clang::VarDecl *> Profiled; // To be instrumented
+
+    PhaseTimers *Timers = nullptr;
+    IncrementalState *Incremental = nullptr;
+    // Inside a function with verdicts from an earlier analysis
+    const std::vector<CachedVerdict> *Replaying = nullptr;
+    size_t NextVerdict = 0;
+    // Inside a function without: its verdicts so far
+    bool RecordingVerdicts = false;
+    std::vector<CachedVerdict> Recorded;
+
+    struct FloatArray {
+        std::string Name;
+        bool Safe = false;
+        std::string Reason;
+    };
+    // Keyed by canonical declaration, in order of appearance
+    llvm::MapVector<const clang::DeclaratorDecl *, FloatArray> FloatArrays;
+    // Those that could be stored as binary16, converted or not
+    llvm::DenseSet<const clang::DeclaratorDecl *> StorableArrays;
+    // Canonical declaration -> the format a safe float variable gets
+    llvm::DenseMap<const clang::VarDecl *, const FloatFormat *> DemotedVars;
+    // Declarators sharing each 'float' keyword
+    llvm::DenseMap<clang::SourceLocation, unsigned> KeywordUses;
+    llvm::SetVector<const clang::RecordDecl *> Records; // With float fields
+    llvm::DenseSet<const clang::FieldDecl *> DemotableFields; // Safe in range
+    llvm::DenseSet<const clang::FieldDecl *> DemotedFields;   // Rewritten to StorageFormat
+                                                              // or fp16_storage_t arrays
+    struct DoubleVariable {
+        const clang::VarDecl *VD;
+        bool Safe;
+        std::string Reason;
+    };
+    std::vector<DoubleVariable> DoubleVariables; // In order of appearance
+    llvm::DenseSet<const clang::VarDecl *> DemotedDoubles;
+    std::vector<const clang::BinaryOperator *> DoubleStores;
+    // Every literal rewritten, to any format
+    llvm::DenseSet<const clang::FloatingLiteral *> DemotedLiterals;
+    llvm::DenseSet<const clang::CallExpr *> FloatCalls; // Switched to float variants
+    std::unordered_set<const clang::VarDecl*> ProcessedDecls;
+    std::vector<Transformation> Replacements; // Stores all text replacements
+};
+
+// Runs the analysis over a translation unit and fills in a DemotionResult.
+// Writing the result anywhere is left to the caller.
+class Fp16DemotionASTConsumer : public clang::ASTConsumer {
+public:
+    Fp16DemotionASTConsumer(clang::ASTContext *Context, clang::Rewriter &R,
+                            DemotionResult &Result)
+        : Visitor(Context, R, Result), Result(Result) {}
+
+    void HandleTranslationUnit(clang::ASTContext &Context) override;
+
+    // Consulted by the parser when FrontendOptions::SkipFunctionBodies is
+    // set: bodies outside the main file and the project headers are skipped.
+    bool shouldSkipFunctionBody(clang::Decl *D) override;
+
+    // See DemotionOptions::ProjectHeaders
+    void setProjectHeaders(llvm::ArrayRef<std::string> Paths);
+
+    void setRecordSink(RecordSink *Sink) { Visitor.setRecordSink(Sink); }
+    void setSummaryDatabase(SummaryDatabase *DB) {
+        Summaries = DB;
+        Visitor.setSummaryDatabase(DB);
+    }
+    void setReorderFields(bool Reorder) { Visitor.setReorderFields(Reorder); }
+    void setConvertArrays(bool Convert) { Visitor.setConvertArrays(Convert); }
+    void setFormats(llvm::ArrayRef<const FloatFormat *> Enabled) { Visitor.setFormats(Enabled); }
+    void setDemoteDouble(bool Enable) { Visitor.setDemoteDouble(Enable); }
+    void setValueProfile(const ValueProfile *P, double Margin) {
+        Visitor.setValueProfile(P, Margin);
+    }
+    void setErrorBudgets(const ErrorBudgets *B) { Visitor.setErrorBudgets(B); }
+    void setVectorWidths(llvm::ArrayRef<unsigned> Widths) { Visitor.setVectorWidths(Widths); }
+    void setCostModel(CostModelMode Mode, const TargetCosts *Target) {
+        Visitor.setCostModel(Mode, Target);
+    }
+    void setInstrument(bool Enable) { Visitor.setInstrument(Enable); }
+    void setIncrementalStore(IncrementalStore *Store) { Incremental = Store; }
+    void setPhaseTimers(PhaseTimers *T) {
+        Timers = T;
+        Visitor.setPhaseTimers(T);
+    }
+
+protected:
+    Fp16DemotionVisitor Visitor;
+    DemotionResult &Result;
+    SummaryDatabase *Summaries = nullptr;
+    IncrementalStore *Incremental = nullptr;
+    PhaseTimers *Timers = nullptr;
+
+private:
+    bool isProjectFile(const clang::SourceManager &SM, clang::FileID FID);
+
+    std::vector<std::string> ProjectHeaders; // Absolute, without dots
+    llvm::DenseMap<clang::FileID, bool> ProjectFiles;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_DEMOTION_H
@@ -0,0 +1,675 @@
+#include "Fp16DemotionOutput.h"
+#include "clang/Tooling/ReplacementsYaml.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/YAMLTraits.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>    // For std::setprecision
+#include <sstream>
+#include <tuple>
+
+namespace fp16demotion {
+
+const char *floatMapFileName(FloatMapFormat Format) {
+    switch (Format) {
+    case FloatMapFormat::NDJson: return "float_map.ndjson";
+    case FloatMapFormat::Binary: return "float_map.bin";
+    case FloatMapFormat::Json: break;
+    }
+    return "float_map.json";
+}
+
+std::string outputPath(const DemotionOptions &Options, llvm::StringRef Name) {
+    llvm::SmallString<256> Path(Options.OutputDir);
+    llvm::sys::path::append(Path, Options.OutputPrefix + Name);
+    return std::string(Path);
+}
+
+//===----------------------------------------------------------------------===//
+// AtomicOutputFile
+//===----------------------------------------------------------------------===//
+
+AtomicOutputFile::AtomicOutputFile(std::string Path, llvm::sys::fs::TempFile Temp)
+    : Path(std::move(Path)), Temp(std::move(Temp)) {
+    OS = std::make_unique<llvm::raw_fd_ostream>(this->Temp.FD, /*shouldClose=*/false);
+}
+
+std::unique_ptr<AtomicOutputFile> AtomicOutputFile::create(llvm::StringRef Path) {
+    // In the same directory, so the rename cannot cross file systems.
+    auto Temp = llvm::sys::fs::TempFile::create(Path + ".tmp-%%%%%%%%");
+    if (!Temp) {
+        llvm::errs() << "Error opening " << Path << " for writing: "
+                     << llvm::toString(Temp.takeError()) << "\n";
+        return nullptr;
+    }
+    return std::unique_ptr<AtomicOutputFile>(new AtomicOutputFile(Path.str(), std::move(*Temp)));
+}
+
+AtomicOutputFile::~AtomicOutputFile() {
+    if (Done)
+        return;
+    OS.reset();
+    llvm::consumeError(Temp.discard());
+}
+
+bool AtomicOutputFile::commit() {
+    if (Done)
+        return true;
+    Done = true;
+    OS->flush();
+    std::error_code EC = OS->error();
+    OS->clear_error();
+    OS.reset();
+    if (EC) {
+        llvm::errs() << "Error writing " << Path << ": " << EC.message() << "\n";
+        llvm::consumeError(Temp.discard());
+        return false;
+    }
+    if (llvm::Error Err = Temp.keep(Path)) {
+        llvm::errs() << "Error writing " << Path << ": " << llvm::toString(std::move(Err)) << "\n";
+        return false;
+    }
+    return true;
+}
+
+static bool writeFileAtomically(const std::string &Path, llvm::StringRef Contents) {
+    auto Output = AtomicOutputFile::create(Path);
+    if (!Output)
+        return false;
+    Output->os() << Contents;
+    return Output->commit();
+}
+
+static void writeJsonString(llvm::raw_ostream &OS, llvm::StringRef Str) {
+    OS << '"';
+    for (unsigned char C : Str) {
+        switch (C) {
+        case '"': OS << "\\\""; break;
+        case '\\': OS << "\\\\"; break;
+        case '\n': OS << "\\n"; break;
+        case '\r': OS << "\\r"; break;
+        case '\t': OS << "\\t"; break;
+        default:
+            if (C < 0x20)
+                OS << llvm::format("\\u%04x", C);
+            else
+                OS << C;
+        }
+    }
+    OS << '"';
+}
+
+static void writeJsonNumber(llvm::raw_ostream &OS, double V, const char *Fmt) {
+    if (std::isnan(V))
+        OS << "\"NaN\"";
+    else if (std::isinf(V))
+        OS << (V > 0 ? "\"Infinity\"" : "\"-Infinity\"");
+    else
+        OS << llvm::format(Fmt, V);
+}
+
+FloatMapWriter::FloatMapWriter(llvm::raw_ostream &OS, FloatMapFormat Format)
+    : OS(OS), Format(Format) {
+    if (Format == FloatMapFormat::Json)
+        OS << "[";
+}
+
+std::unique_ptr<FloatMapWriter> FloatMapWriter::create(llvm::StringRef Path,
+                                                       FloatMapFormat Format) {
+    auto Output = AtomicOutputFile::create(Path);
+    if (!Output)
+        return nullptr;
+    Output->os().SetBufferSize(1 << 16);
+    auto Writer = std::make_unique<FloatMapWriter>(Output->os(), Format);
+    Writer->Output = std::move(Output);
+    return Writer;
+}
+
+FloatMapWriter::~FloatMapWriter() {
+    finish();
+}
+
+void FloatMapWriter::beginRecord() {
+    if (Format == FloatMapFormat::Json)
+        OS << (Count ? ",\n" : "\n");
+    ++Count;
+}
+
+void FloatMapWriter::addLiteral(const LiteralRecord &R) {
+    beginRecord();
+    bool Pretty = Format == FloatMapFormat::Json;
+    const char *Open = Pretty ? "  {\n    " : "{";
+    const char *Sep = Pretty ? ",\n    " : ",";
+    const char *Close = Pretty ? "\n  }" : "}\n";
+
+    OS << Open << "\"value\": ";
+    writeJsonNumber(OS, R.Value, "%.9g");
+    OS << Sep << "\"downcast\": ";
+    writeJsonNumber(OS, R.Downcast, "%.9g");
+    OS << Sep << "\"error\": ";
+    writeJsonNumber(OS, R.Error, "%.6g");
+    OS << Sep << "\"mode\": ";
+    writeJsonString(OS, R.Mode);
+    OS << Sep << "\"safe\": " << (R.Safe ? "true" : "false");
+    OS << Sep << "\"reason\": ";
+    writeJsonString(OS, R.Reason);
+    OS << Sep << "\"location\": ";
+    writeJsonString(OS, (R.File + ":" + llvm::Twine(R.Line) + ", col " +
+                         llvm::Twine(R.Column)).str());
+    OS << Close;
+}
+
+void FloatMapWriter::addRaw(llvm::StringRef RecordJson) {
+    beginRecord();
+    if (Format == FloatMapFormat::Json)
+        OS << "  " << RecordJson;
+    else
+        OS << RecordJson << "\n";
+}
+
+void FloatMapWriter::finish() {
+    if (Finished)
+        return;
+    Finished = true;
+    if (Format == FloatMapFormat::Json)
+        OS << "\n]\n";
+    OS.flush();
+    if (Output)
+        Output->commit();
+}
+
+//===----------------------------------------------------------------------===//
+// BinaryFloatMapWriter
+//===----------------------------------------------------------------------===//
+
+BinaryFloatMapWriter::BinaryFloatMapWriter(std::string Path) : Path(std::move(Path)) {
+    // Offset 0 is the empty string.
+    StringTable.push_back('\0');
+    Strings[""] = 0;
+}
+
+BinaryFloatMapWriter::~BinaryFloatMapWriter() {
+    finish();
+}
+
+uint32_t BinaryFloatMapWriter::intern(llvm::StringRef Str) {
+    auto Inserted = Strings.try_emplace(Str, uint32_t(StringTable.size()));
+    if (Inserted.second) {
+        StringTable.append(Str.data(), Str.size());
+        StringTable.push_back('\0');
+    }
+    return Inserted.first->second;
+}
+
+uint32_t BinaryFloatMapWriter::fileId(llvm::StringRef File) {
+    auto Inserted = FileIds.try_emplace(File, uint32_t(FileNames.size()));
+    if (Inserted.second)
+        FileNames.push_back(intern(File));
+    return Inserted.first->second;
+}
+
+void BinaryFloatMapWriter::addLiteral(const LiteralRecord &R) {
+    binfmt::Record Rec = {};
+    Rec.Value = R.Value;
+    Rec.Error = R.Error;
+    Rec.Downcast = R.Downcast;
+    Rec.Reason = intern(R.Reason);
+    Rec.File = fileId(R.File);
+    Rec.Line = R.Line;
+    Rec.Column = R.Column;
+    Rec.Mode = intern(R.Mode);
+    Rec.Kind = binfmt::LiteralRecordKind;
+    Rec.Flags = R.Safe ? binfmt::SafeFlag : 0;
+    Records.push_back(Rec);
+}
+
+void BinaryFloatMapWriter::addVariable(const VariableRecord &R) {
+    binfmt::Record Rec = {};
+    Rec.Reason = intern(R.Reason);
+    Rec.Name = intern(R.Name);
+    Rec.File = fileId(R.File);
+    Rec.Line = R.Line;
+    Rec.Column = R.Column;
+    Rec.Mode = intern(R.Mode);
+    Rec.Kind = binfmt::VariableRecordKind;
+    Rec.Flags = R.Safe ? binfmt::SafeFlag : 0;
+    Records.push_back(Rec);
+}
+
+void BinaryFloatMapWriter::finish() {
+    if (Finished)
+        return;
+    Finished = true;
+
+    // Order files by name and renumber records to the sorted file index.
+    std::vector<uint32_t> ByName(FileNames.size());
+    for (uint32_t I = 0; I < ByName.size(); ++I)
+        ByName[I] = I;
+    std::sort(ByName.begin(), ByName.end(), [&](uint32_t A, uint32_t B) {
+        return std::strcmp(&StringTable[FileNames[A]], &StringTable[FileNames[B]]) < 0;
+    });
+    std::vector<uint32_t> Rank(FileNames.size());
+    for (uint32_t I = 0; I < ByName.size(); ++I)
+        Rank[ByName[I]] = I;
+    for (binfmt::Record &Rec : Records)
+        Rec.File = Rank[Rec.File];
+    // Within a file, order by location so the output does not depend on the
+    // order in which translation units were added.
+    std::stable_sort(Records.begin(), Records.end(),
+                     [](const binfmt::Record &A, const binfmt::Record &B) {
+                         return std::tie(A.File, A.Line, A.Column, A.Kind) <
+                                std::tie(B.File, B.Line, B.Column, B.Kind);
+                     });
+
+    std::vector<binfmt::FileIndexEntry> Index(FileNames.size());
+    for (uint32_t I = 0; I < Index.size(); ++I)
+        Index[I] = {FileNames[ByName[I]], 0, 0, 0};
+    for (uint64_t I = Records.size(); I-- > 0;) {
+        binfmt::FileIndexEntry &Entry = Index[Records[I].File];
+        Entry.FirstRecord = I;
+        ++Entry.RecordCount;
+    }
+
+    binfmt::FileHeader Header = {};
+    std::memcpy(Header.Magic, binfmt::Magic, sizeof(Header.Magic));
+    Header.Version = binfmt::FormatVersion;
+    Header.ByteOrder = binfmt::ByteOrderMark;
+    Header.RecordCount = Records.size();
+    Header.RecordOffset = sizeof(binfmt::FileHeader);
+    Header.FileCount = Index.size();
+    Header.FileIndexOffset = Header.RecordOffset + Records.size() * sizeof(binfmt::Record);
+    Header.StringTableOffset = Header.FileIndexOffset + Index.size() * sizeof(binfmt::FileIndexEntry);
+    Header.StringTableSize = StringTable.size();
+
+    auto Output = AtomicOutputFile::create(Path);
+    if (!Output)
+        return;
+    llvm::raw_ostream &OS = Output->os();
+    OS.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+    OS.write(reinterpret_cast<const char *>(Records.data()),
+             Records.size() * sizeof(binfmt::Record));
+    OS.write(reinterpret_cast<const char *>(Index.data()),
+             Index.size() * sizeof(binfmt::FileIndexEntry));
+    OS.write(StringTable.data(), StringTable.size());
+    Output->commit();
+}
+
+std::unique_ptr<RecordSink> createFloatMapWriter(llvm::StringRef Path, FloatMapFormat Format) {
+    if (Format == FloatMapFormat::Binary)
+        return std::make_unique<BinaryFloatMapWriter>(Path.str());
+    return FloatMapWriter::create(Path, Format);
+}
+
+void writeDemotedSource(std::ostream &OS, const std::string &Code) {
+    OS << "// This file shows the result of FP16 demotion transformations\n";
+    OS << "// Generated automatically by FP16 Demotion Plugin\n\n";
+    OS << Code;
+}
+
+void writeMemoryAnalysis(std::ostream &memoryOut, const MemoryUsage &memoryStats,
+                         const std::vector<StructLayoutRecord> &structLayouts,
+                         const std::vector<ArrayStorageRecord> &arrays,
+                         const std::vector<LoopVectorRecord> &loops) {
+    // Calculate memory savings
+    size_t memorySavings = memoryStats.originalBytes - memoryStats.demotedBytes;
+    double savingsPercentage = (memoryStats.originalBytes > 0) ?
+        (double(memorySavings) / double(memoryStats.originalBytes)) * 100.0 : 0.0;
+
+    memoryOut << "FP16 Demotion Plugin - Memory Usage Analysis\n";
+    memoryOut << "==========================================\n\n";
+
+    memoryOut << "VARIABLES:\n";
+    memoryOut << "  Total float variables found: " << memoryStats.floatVarCount << "\n";
+    memoryOut << "  Successfully demoted: " << memoryStats.demotedVarCount << "\n";
+    memoryOut << "  Demotion success rate: " << std::fixed << std::setprecision(1);
+    if (memoryStats.floatVarCount > 0) {
+        memoryOut << (double(memoryStats.demotedVarCount) / double(memoryStats.floatVarCount)) * 100.0;
+    } else {
+        memoryOut << "0.0";
+    }
+    memoryOut << "%\n\n";
+
+    memoryOut << "LITERALS:\n";
+    memoryOut << "  Total float literals found: " << memoryStats.floatLiteralCount << "\n";
+    memoryOut << "  Successfully demoted: " << memoryStats.demotedLiteralCount << "\n";
+    memoryOut << "  Demotion success rate: " << std::fixed << std::setprecision(1);
+    if (memoryStats.floatLiteralCount > 0) {
+        memoryOut << (double(memoryStats.demotedLiteralCount) / double(memoryStats.floatLiteralCount)) * 100.0;
+    } else {
+        memoryOut << "0.0";
+    }
+    memoryOut << "%\n\n";
+
+    memoryOut << "FIELDS:\n";
+    memoryOut << "  Total float struct fields found: " << memoryStats.floatFieldCount << "\n";
+    memoryOut << "  Successfully demoted: " << memoryStats.demotedFieldCount << "\n\n";
+
+    memoryOut << "ARRAYS:\n";
+    memoryOut << "  Total float arrays found: " << memoryStats.floatArrayCount << "\n";
+    memoryOut << "  Stored as binary16: " << memoryStats.demotedArrayCount << "\n\n";
+
+    bool Doubles = memoryStats.doubleVarCount > 0 || memoryStats.doubleLiteralCount > 0;
+    if (Doubles) {
+        memoryOut << "DOUBLES:\n";
+        memoryOut << "  Total double variables found: " << memoryStats.doubleVarCount << "\n";
+        memoryOut << "  Demoted to float: " << memoryStats.demotedDoubleVarCount << "\n";
+        memoryOut << "  Total double literals found: " << memoryStats.doubleLiteralCount << "\n";
+        memoryOut << "  Demoted to float: " << memoryStats.demotedDoubleLiteralCount << "\n";
+        memoryOut << "  Math calls switched to float variants: " << memoryStats.floatMathCalls << "\n";
+        memoryOut << "  Double storage: " << memoryStats.doubleBytes << " bytes, "
+                  << memoryStats.demotedDoubleBytes << " -> " << memoryStats.demotedDoubleBytes / 2
+                  << " bytes demoted (saves " << memoryStats.demotedDoubleBytes / 2 << " bytes)\n\n";
+    }
+
+    memoryOut << "MEMORY USAGE:\n";
+    memoryOut << "  Original memory usage: " << memoryStats.originalBytes << " bytes\n";
+    memoryOut << "  After demotion: " << memoryStats.demotedBytes << " bytes\n";
+    memoryOut << "  Memory saved: " << memorySavings << " bytes\n";
+    memoryOut << "  Memory reduction: " << std::fixed << std::setprecision(1) << savingsPercentage << "%\n\n";
+
+    memoryOut << "BREAKDOWN BY STORAGE:\n";
+    auto writeStorage = [&](const char *Name, const StorageUsage &Usage) {
+        memoryOut << "  " << Name << ": " << Usage.variableCount << " variables, "
+                  << Usage.originalBytes << " -> " << Usage.demotedBytes << " bytes ("
+                  << Usage.floatBytes << " bytes of float data)\n";
+    };
+    writeStorage("Global", memoryStats.global);
+    writeStorage("Static", memoryStats.staticLocal);
+    writeStorage("Stack ", memoryStats.stack);
+    memoryOut << "  Largest stack frame: " << memoryStats.largestFrameBytes << " -> "
+              << memoryStats.largestFrameDemotedBytes << " bytes\n\n";
+
+    std::vector<const FloatFormat *> Enabled;
+    for (const FloatFormat &F : floatFormats())
+        if (memoryStats.formats[formatIndex(F)].enabled)
+            Enabled.push_back(&F);
+    std::stable_sort(Enabled.begin(), Enabled.end(),
+                     [](const FloatFormat *A, const FloatFormat *B) { return A->bits() < B->bits(); });
+    if (!Enabled.empty()) {
+        memoryOut << "FORMATS:\n";
+        for (const FloatFormat *F : Enabled) {
+            const FormatUsage &U = memoryStats.formats[formatIndex(*F)];
+            memoryOut << "  " << F->Name << " (" << F->bits() << " bits"
+                      << (F->TypeName ? "" : ", report only") << "): " << U.varCount
+                      << " variables, " << U.fieldCount << " fields, " << U.arrayCount
+                      << " arrays, " << U.literalCount << " literals fit; " << U.floatBytes
+                      << " -> " << U.floatBytes * F->bits() / 32 << " bytes of float data\n";
+        }
+        memoryOut << "\n";
+    }
+
+    auto writeNames = [&](const std::vector<std::string> &Names) {
+        for (size_t i = 0; i < Names.size(); ++i)
+            memoryOut << (i ? ", " : "") << Names[i];
+        memoryOut << "\n";
+    };
+
+    if (!structLayouts.empty()) {
+        memoryOut << "STRUCT LAYOUTS:\n";
+        for (const StructLayoutRecord &S : structLayouts) {
+            memoryOut << "  struct " << S.Name << " (" << S.File << ":" << S.Line << "): sizeof "
+                      << S.OldSize << " -> " << S.NewSize << " bytes";
+            if (!S.SuggestedOrder.empty())
+                memoryOut << ", " << S.ReorderedSize << " reordered";
+            memoryOut << "; up to " << S.OldLines << " -> " << S.NewLines
+                      << " cache lines per element\n";
+            memoryOut << "    Demoted fields: ";
+            writeNames(S.DemotedFields);
+            if (!S.HotFields.empty()) {
+                memoryOut << "    Hot fields: ";
+                writeNames(S.HotFields);
+            }
+            if (!S.SuggestedOrder.empty()) {
+                memoryOut << (S.Rewritten ? "    Reordered in demoted.c: " : "    Suggested order: ");
+                writeNames(S.SuggestedOrder);
+            }
+        }
+        memoryOut << "\n";
+    }
+
+    if (!arrays.empty()) {
+        memoryOut << "ARRAY STORAGE:\n";
+        for (const ArrayStorageRecord &A : arrays) {
+            memoryOut << "  " << A.Name << " (" << A.File << ":" << A.Line << "): " << A.Elements
+                      << " elements, " << A.OldBytes << " -> " << A.NewBytes << " bytes; ";
+            if (A.Converted)
+                memoryOut << "converted\n";
+            else if (A.Reason.empty())
+                memoryOut << "convertible (-fprecision-demote-arrays)\n";
+            else
+                memoryOut << "kept: " << A.Reason << "\n";
+            memoryOut << "    " << A.Reads << " reads, " << A.Writes << " writes; traffic "
+                      << std::fixed << std::setprecision(0) << A.TrafficBytes << " -> "
+                      << A.TrafficBytes / 2 << " bytes"
+                      << (A.TrafficExact ? "" : " (estimate)") << "\n";
+        }
+        memoryOut << "\n";
+    }
+
+    if (!loops.empty()) {
+        // The loops gaining the most lanes first, the longest first among
+        // equals
+        auto Gain = [](const LoopVectorRecord &L) {
+            return L.Lanes.empty() ? 1.0 : double(L.Lanes[0].After) / L.Lanes[0].Before;
+        };
+        std::vector<const LoopVectorRecord *> Sorted;
+        for (const LoopVectorRecord &L : loops)
+            Sorted.push_back(&L);
+        std::stable_sort(Sorted.begin(), Sorted.end(),
+                         [&](const LoopVectorRecord *A, const LoopVectorRecord *B) {
+                             if (Gain(*A) != Gain(*B))
+                                 return Gain(*A) > Gain(*B);
+                             return A->TripCount > B->TripCount;
+                         });
+        size_t Gaining = std::count_if(loops.begin(), loops.end(),
+                                       [&](const LoopVectorRecord &L) { return Gain(L) > 1; });
+
+        memoryOut << "LOOP VECTORIZATION:\n";
+        memoryOut << "  " << Gaining << " of " << loops.size() << " loops gain SIMD lanes\n";
+        for (const LoopVectorRecord *L : Sorted) {
+            memoryOut << "  " << L->Kind << " in " << L->Function << " (" << L->File << ":"
+                      << L->Line << "): elements " << L->OldBits << " -> " << L->NewBits
+                      << " bits";
+            if (L->TripExact)
+                memoryOut << ", " << std::fixed << std::setprecision(0) << L->TripCount
+                          << " iterations";
+            memoryOut << "\n";
+            if (!L->Carried.empty()) {
+                memoryOut << "    Not vectorized: " << L->Carried
+                          << " is carried between iterations\n";
+            } else {
+                memoryOut << "    Lanes:";
+                for (size_t i = 0; i < L->Lanes.size(); ++i)
+                    memoryOut << (i ? ", " : " ") << L->Lanes[i].VectorBits << "-bit "
+                              << L->Lanes[i].Before << " -> " << L->Lanes[i].After;
+                memoryOut << "\n";
+            }
+            if (!L->Demoted.empty()) {
+                memoryOut << "    Narrowed: ";
+                writeNames(L->Demoted);
+            }
+            if (!L->Kept.empty()) {
+                memoryOut << "    Kept: ";
+                writeNames(L->Kept);
+            }
+            if (!L->Accumulators.empty()) {
+                memoryOut << "    Accumulators: ";
+                writeNames(L->Accumulators);
+            }
+        }
+        memoryOut << "\n";
+    }
+
+    // Add detailed explanation
+    memoryOut << "EXPLANATION:\n";
+    memoryOut << "- Sizes and alignments are the target's, so arrays, structs and padding are counted in full\n";
+    memoryOut << "- Variables are placed in declaration order; demoting a variable can open or close padding next to it\n";
+    memoryOut << "- Stack usage is the sum over all function frames, not the peak along a call chain\n";
+    memoryOut << "- Literals are immediates or constants, not data, and are only counted above\n";
+    if (Doubles)
+        memoryOut << "- DOUBLES lists the double tier: doubles whose every value fits float become float, 8 -> 4 bytes each; its savings are part of the totals\n";
+    if (!Enabled.empty())
+        memoryOut << "- FORMATS checks every value against each format; variables and literals are demoted to the narrowest with a C type, fields and arrays to binary16\n";
+    if (!structLayouts.empty()) {
+        memoryOut << "- Struct orders put the most accessed fields in one cache line, then sort by alignment to remove padding\n";
+        memoryOut << "- Cache lines per element assume an array aligned to a 64-byte line\n";
+    }
+    if (!arrays.empty())
+        memoryOut << "- Array traffic counts each element access once per iteration of the loops around it; loops without a constant trip count are counted once\n";
+    if (!loops.empty()) {
+        memoryOut << "- Loop lanes assume vectors sized for the widest floating-point access in the innermost loop; arrays count as binary16 if they can be converted (-fprecision-demote-arrays) and reduction accumulators as at least float\n";
+        memoryOut << "- Floating-point reductions only vectorize where reassociation is allowed (-ffast-math or -fassociative-math)\n";
+    }
+}
+
+bool writeDemotedFile(const std::string &Path, const std::string &Code) {
+    std::ostringstream demotedOut;
+    writeDemotedSource(demotedOut, Code);
+    return writeFileAtomically(Path, demotedOut.str());
+}
+
+bool writeInstrumentedFile(const std::string &Path, const std::string &Code) {
+    std::string Text = "// Records the values of the variables FP16 demotion could not prove\n"
+                       "// safe; build with runtime/fp16_profile.h on the include path\n";
+    Text += Code;
+    return writeFileAtomically(Path, Text);
+}
+
+bool writeMemoryAnalysisFile(const std::string &Path, const MemoryUsage &memoryStats,
+                             const std::vector<StructLayoutRecord> &structLayouts,
+                             const std::vector<ArrayStorageRecord> &arrays,
+                             const std::vector<LoopVectorRecord> &loops) {
+    std::ostringstream memoryOut;
+    writeMemoryAnalysis(memoryOut, memoryStats, structLayouts, arrays, loops);
+    return writeFileAtomically(Path, memoryOut.str());
+}
+
+void writeConversionCosts(llvm::raw_ostream &OS, const std::vector<ConversionCostRecord> &Costs) {
+    OS << "[";
+    for (size_t i = 0; i < Costs.size(); ++i) {
+        const ConversionCostRecord &R = Costs[i];
+        const ConversionCost &C = R.Cost;
+        OS << (i ? ",\n" : "\n") << "  {\n    \"name\": ";
+        writeJsonString(OS, R.Name);
+        OS << ",\n    \"location\": ";
+        writeJsonString(OS, (R.File + ":" + llvm::Twine(R.Line) + ", col " +
+                             llvm::Twine(R.Column)).str());
+        OS << ",\n    \"mode\": ";
+        writeJsonString(OS, R.Mode);
+        OS << ",\n    \"target\": ";
+        writeJsonString(OS, R.Target);
+        OS << ",\n    \"decision\": ";
+        writeJsonString(OS, R.Decision);
+        auto Field = [&](const char *Name, double V) {
+            OS << ",\n    \"" << Name << "\": ";
+            writeJsonNumber(OS, V, "%.6g");
+        };
+        Field("reads", C.Reads);
+        Field("writes", C.Writes);
+        Field("updates", C.Updates);
+        Field("half_to_float", C.ToFloat);
+        Field("float_to_half", C.FromFloat);
+        Field("conversion_cycles", C.ConversionCycles);
+        Field("bytes_saved_per_access", C.BytesSaved);
+        Field("benefit_cycles", C.BenefitCycles);
+        OS << ",\n    \"memory_resident\": " << (C.MemoryResident ? "true" : "false");
+        OS << ",\n    \"trip_counts_exact\": " << (C.Exact ? "true" : "false");
+        OS << "\n  }";
+    }
+    OS << "\n]";
+}
+
+bool writeConversionCostsFile(const std::string &Path,
+                              const std::vector<ConversionCostRecord> &Costs) {
+    auto Output = AtomicOutputFile::create(Path);
+    if (!Output)
+        return false;
+    writeConversionCosts(Output->os(), Costs);
+    Output->os() << "\n";
+    return Output->commit();
+}
+
+std::string flattenPath(llvm::StringRef Path) {
+    std::string Flat = Path.str();
+    std::replace_if(Flat.begin(), Flat.end(),
+                    [](char C) { return llvm::sys::path::is_separator(C) || C == ':'; },
+                    '_');
+    return Flat;
+}
+
+static std::string absolutePath(llvm::StringRef Path) {
+    llvm::SmallString<256> Abs(Path);
+    llvm::sys::fs::make_absolute(Abs);
+    llvm::sys::path::remove_dots(Abs, /*remove_dot_dot=*/true);
+    return std::string(Abs);
+}
+
+void writeReplacementsYaml(llvm::raw_ostream &OS, const DemotionResult &Result) {
+    clang::tooling::TranslationUnitReplacements TU;
+    TU.MainSourceFile = absolutePath(Result.MainFile);
+    for (const TransformationRecord &T : Result.Transformations)
+        TU.Replacements.emplace_back(T.File.empty() ? TU.MainSourceFile : T.File, T.Offset,
+                                     T.Length, T.ReplacementText);
+    llvm::yaml::Output YAML(OS);
+    YAML << TU;
+}
+
+std::string writeReplacementsFile(llvm::StringRef Dir, const DemotionResult &Result) {
+    llvm::SmallString<256> Path(Dir);
+    llvm::sys::path::append(Path, flattenPath(Result.MainFile) + ".yaml");
+    auto Output = AtomicOutputFile::create(Path);
+    if (!Output)
+        return std::string();
+    writeReplacementsYaml(Output->os(), Result);
+    if (!Output->commit())
+        return std::string();
+    return std::string(Path);
+}
+
+void writeCombinedReport(llvm::raw_ostream &OS, const DemotionResult &Result) {
+    std::string FloatMap;
+    llvm::raw_string_ostream FloatMapOS(FloatMap);
+    FloatMapWriter Writer(FloatMapOS, FloatMapFormat::Json);
+    for (const LiteralRecord &Record : Result.Literals)
+        Writer.addLiteral(Record);
+    Writer.finish();
+
+    std::ostringstream Demoted, Memory;
+    writeDemotedSource(Demoted, Result.DemotedCode);
+    writeMemoryAnalysis(Memory, Result.Memory, Result.StructLayouts, Result.Arrays, Result.Loops);
+
+    OS << "{\n\"version\": ";
+    writeJsonString(OS, FP16_DEMOTION_VERSION);
+    OS << ",\n\"main_file\": ";
+    writeJsonString(OS, Result.MainFile);
+    OS << ",\n\"float_map\": " << llvm::StringRef(FloatMap).rtrim();
+    OS << ",\n\"demoted_code\": ";
+    writeJsonString(OS, Demoted.str());
+    if (!Result.InstrumentedCode.empty()) {
+        OS << ",\n\"instrumented_code\": ";
+        writeJsonString(OS, Result.InstrumentedCode);
+    }
+    OS << ",\n\"memory_analysis\": ";
+    writeJsonString(OS, Memory.str());
+    if (!Result.ConversionCosts.empty()) {
+        OS << ",\n\"conversion_costs\": ";
+        writeConversionCosts(OS, Result.ConversionCosts);
+    }
+    OS << "\n}";
+}
+
+bool writeCombinedReportFile(const std::string &Path, const DemotionResult &Result) {
+    auto Output = AtomicOutputFile::create(Path);
+    if (!Output)
+        return false;
+    writeCombinedReport(Output->os(), Result);
+    Output->os() << "\n";
+    return Output->commit();
+}
+
+} // namespace fp16demotion
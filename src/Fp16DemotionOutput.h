@@ -0,0 +1,193 @@
+//===- Fp16DemotionOutput.h - Report writers -------------------*- C++ -*-===//
+//
+// Writers for the three artifacts produced per analysis: float_map.json (or
+// float_map.ndjson / float_map.bin), demoted.c and memory_analysis.txt, or
+// all three as one fp16_report.json. Shared by the plugin and the standalone
+// driver so both produce identical reports. Every file is written under a
+// temporary name and renamed into place once complete.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_DEMOTION_OUTPUT_H
+#define FP16_DEMOTION_OUTPUT_H
+
+#include "Fp16BinaryFormat.h"
+#include "Fp16Demotion.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace fp16demotion {
+
+// Default file name for a float map in the given format.
+const char *floatMapFileName(FloatMapFormat Format);
+
+// Name of the combined artifact written with -fprecision-demote-combined.
+const char *const CombinedReportFileName = "fp16_report.json";
+
+// Name of the cost model's decisions, written with
+// -fprecision-demote-cost-model.
+const char *const ConversionCostsFileName = "conversion_costs.json";
+
+// Directory of the clang-apply-replacements files written with
+// -fprecision-demote-replacements, one per translation unit.
+const char *const ReplacementsDirName = "replacements";
+
+// Path of the artifact Name: Options.OutputDir joined with
+// Options.OutputPrefix + Name.
+std::string outputPath(const DemotionOptions &Options, llvm::StringRef Name);
+
+// A file that appears under its final name only when complete. The contents
+// go to a uniquely named temporary file next to Path, and commit() renames
+// it over Path, so readers never see a partial file and concurrent writers
+// of the same Path do not interleave: the last commit wins.
+class AtomicOutputFile {
+public:
+    // Prints an error to llvm::errs() and returns null if the temporary file
+    // cannot be created.
+    static std::unique_ptr<AtomicOutputFile> create(llvm::StringRef Path);
+
+    // Removes the temporary file unless it was committed.
+    ~AtomicOutputFile();
+
+    llvm::raw_ostream &os() { return *OS; }
+
+    // Flushes and renames the temporary file to Path. Prints an error to
+    // llvm::errs() and returns false on failure. Later calls do nothing.
+    bool commit();
+
+private:
+    AtomicOutputFile(std::string Path, llvm::sys::fs::TempFile Temp);
+
+    std::string Path;
+    llvm::sys::fs::TempFile Temp;
+    std::unique_ptr<llvm::raw_fd_ostream> OS;
+    bool Done = false;
+};
+
+// Streams JSON or NDJSON float_map records to an output stream as they are
+// produced, so memory use does not grow with the number of literals. Strings
+// are JSON escaped and non-finite numbers are written as the strings
+// "Infinity", "-Infinity" and "NaN".
+class FloatMapWriter : public RecordSink {
+public:
+    FloatMapWriter(llvm::raw_ostream &OS, FloatMapFormat Format);
+
+    // Opens Path with a large write buffer; the file appears when finish()
+    // is called. Prints an error to llvm::errs() and returns null if the
+    // file cannot be created.
+    static std::unique_ptr<FloatMapWriter> create(llvm::StringRef Path, FloatMapFormat Format);
+
+    ~FloatMapWriter() override;
+
+    void addLiteral(const LiteralRecord &Record) override;
+
+    // Appends an already serialized, single-line record (as produced in
+    // NDJSON mode). Used to merge per-TU outputs.
+    void addRaw(llvm::StringRef RecordJson);
+
+    // Closes the array in JSON mode, flushes and, for a file opened with
+    // create(), moves it into place.
+    void finish() override;
+
+    size_t count() const { return Count; }
+
+private:
+    void beginRecord();
+
+    std::unique_ptr<AtomicOutputFile> Output;
+    llvm::raw_ostream &OS;
+    FloatMapFormat Format;
+    size_t Count = 0;
+    bool Finished = false;
+};
+
+// Writes float_map.bin (see Fp16BinaryFormat.h). Records are buffered as
+// fixed-size entries and written grouped by file, with files ordered by name
+// and records by location, when finish() is called.
+class BinaryFloatMapWriter : public RecordSink {
+public:
+    explicit BinaryFloatMapWriter(std::string Path);
+    ~BinaryFloatMapWriter() override;
+
+    void addLiteral(const LiteralRecord &Record) override;
+    void addVariable(const VariableRecord &Record) override;
+
+    // Writes the file; prints an error to llvm::errs() on failure.
+    void finish() override;
+
+    size_t count() const { return Records.size(); }
+
+private:
+    uint32_t intern(llvm::StringRef Str);
+    uint32_t fileId(llvm::StringRef File);
+
+    std::string Path;
+    std::vector<binfmt::Record> Records;
+    std::string StringTable;
+    llvm::StringMap<uint32_t> Strings;
+    llvm::StringMap<uint32_t> FileIds;
+    std::vector<uint32_t> FileNames; // String offsets, by file id
+    bool Finished = false;
+};
+
+// Creates the writer for Format at Path, or returns null after printing an
+// error if Path cannot be created.
+std::unique_ptr<RecordSink> createFloatMapWriter(llvm::StringRef Path, FloatMapFormat Format);
+
+void writeDemotedSource(std::ostream &OS, const std::string &Code);
+
+// structLayouts adds the STRUCT LAYOUTS section, arrays the ARRAY STORAGE
+// section and loops the LOOP VECTORIZATION section.
+void writeMemoryAnalysis(std::ostream &OS, const MemoryUsage &memoryStats,
+                         const std::vector<StructLayoutRecord> &structLayouts = {},
+                         const std::vector<ArrayStorageRecord> &arrays = {},
+                         const std::vector<LoopVectorRecord> &loops = {});
+
+// File-level wrappers. Each prints an error to llvm::errs() and returns
+// false if Path cannot be opened.
+bool writeDemotedFile(const std::string &Path, const std::string &Code);
+bool writeInstrumentedFile(const std::string &Path, const std::string &Code);
+bool writeMemoryAnalysisFile(const std::string &Path, const MemoryUsage &memoryStats,
+                             const std::vector<StructLayoutRecord> &structLayouts = {},
+                             const std::vector<ArrayStorageRecord> &arrays = {},
+                             const std::vector<LoopVectorRecord> &loops = {});
+
+// Writes the cost model's decisions as a JSON array with one object per
+// variable: the format and cost table, the decision, the weighted uses, the
+// conversions they add and their price against the traffic saved.
+void writeConversionCosts(llvm::raw_ostream &OS, const std::vector<ConversionCostRecord> &Costs);
+bool writeConversionCostsFile(const std::string &Path,
+                              const std::vector<ConversionCostRecord> &Costs);
+
+// Flattens a source path into a single file name so per-file artifacts from
+// different directories do not collide in one output directory.
+std::string flattenPath(llvm::StringRef Path);
+
+// Writes the edits of Result as the YAML clang-apply-replacements reads: a
+// TranslationUnitReplacements for Result.MainFile with absolute paths.
+// Running clang-apply-replacements on a directory of these applies the edits
+// of a whole tree, each header edit once however many translation units
+// made it.
+void writeReplacementsYaml(llvm::raw_ostream &OS, const DemotionResult &Result);
+// Writes it to Dir/<flattenPath(Result.MainFile)>.yaml and returns that path,
+// or an empty string after printing an error.
+std::string writeReplacementsFile(llvm::StringRef Dir, const DemotionResult &Result);
+
+// Writes the literals of Result as a JSON float map, its demoted source and
+// its memory analysis as the strings of one JSON object:
+//   {"version", "main_file", "float_map", "demoted_code", "memory_analysis"}
+// and "instrumented_code" with -fprecision-demote-instrument, and the
+// decisions of the cost model as "conversion_costs".
+// A reader then never pairs artifacts from different runs.
+void writeCombinedReport(llvm::raw_ostream &OS, const DemotionResult &Result);
+bool writeCombinedReportFile(const std::string &Path, const DemotionResult &Result);
+
+} // namespace fp16demotion
+
+#endif // FP16_DEMOTION_OUTPUT_H
@@ -0,0 +1,641 @@
+//===- Fp16DemotionServer.cpp - Persistent FP16 demotion analysis server --===//
+//
+// A long-running analysis service on a local UNIX socket, so a request does
+// not pay for starting clang or for writing and reading files:
+//
+//   fp16-demote-server --socket /tmp/fp16.sock [-j N] [--plugin-arg ARG]...
+//                      [--include-root DIR]...
+//
+// One request per connection. The client sends a JSON object and shuts down
+// its writing side:
+//
+//   {"source": "float x = 1.0f;", "file": "input.c",
+//    "args": ["-fprecision-demote-arrays"], "compile_args": ["-DN=4"]}
+//
+// Only "source" is required. "file" names the source (default input.c; its
+// extension selects the language); only requests that give one use the
+// server's incremental store and add to its summary store, both kept by
+// file name. "args" are plugin arguments added to the server's own, except
+// those that name files. "compile_args" are compiler flags, limited to -D,
+// -U, -I, -isystem, -std=, -W, -w, -O, --target=, -pedantic, -ansi and the
+// -f and -m options that do not load plugins or name files.
+//
+// The source is parsed from an in-memory file system layered over the real
+// one, so it can still include headers from disk, but only from the
+// --include-root directories and the compiler's own system header
+// directories: diagnostics quote the files they point into, so any other
+// file a request could include would be sent back to it. -I and -isystem
+// directories must lie below an include root. The server answers with one
+// JSON object and closes the connection:
+//
+//   {"success": true, "elapsed_ms": 12.5, "diagnostics": "...",
+//    "report": {...fp16_report.json...}}
+//
+// or {"success": false, "error": "..."} if the request cannot be served.
+// {"command": "stats"} returns the preamble cache and incremental analysis
+// counters instead.
+// Requests are analyzed on a fixed pool of worker threads; when every worker
+// is busy and the queue is full, new connections are refused with "server
+// busy" instead of waiting.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Fp16Demotion.h"
+#include "Fp16DemotionOutput.h"
+#include "Fp16PreambleCache.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Job.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/TargetParser/Host.h"
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace clang;
+using namespace fp16demotion;
+
+static llvm::cl::OptionCategory ServerCategory("fp16-demote-server options");
+
+static llvm::cl::opt<std::string> SocketPath(
+    "socket", llvm::cl::desc("UNIX socket to listen on"), llvm::cl::Required,
+    llvm::cl::cat(ServerCategory));
+
+static llvm::cl::opt<unsigned> Jobs(
+    "j", llvm::cl::desc("Number of worker threads (0 = one per hardware thread)"),
+    llvm::cl::init(0), llvm::cl::cat(ServerCategory));
+
+static llvm::cl::opt<unsigned> QueueLimit(
+    "queue", llvm::cl::desc("Connections that may wait for a worker before new ones are refused"),
+    llvm::cl::init(64), llvm::cl::cat(ServerCategory));
+
+static llvm::cl::list<std::string> PluginArgs(
+    "plugin-arg",
+    llvm::cl::desc("Argument applied to every request as if passed with "
+                   "-plugin-arg-fp16-demotion"),
+    llvm::cl::cat(ServerCategory));
+
+static llvm::cl::list<std::string> IncludeRoots(
+    "include-root",
+    llvm::cl::desc("Directory whose headers requests may include; may be repeated"),
+    llvm::cl::cat(ServerCategory));
+
+static llvm::cl::opt<std::string> ResourceDir(
+    "resource-dir",
+    llvm::cl::desc("Clang resource directory for builtin headers (default: next to this binary)"),
+    llvm::cl::cat(ServerCategory));
+
+static llvm::cl::opt<bool> ReusePreambles(
+    "reuse-preambles",
+    llvm::cl::desc("Keep the leading #includes of requests precompiled and reuse them"),
+    llvm::cl::init(false), llvm::cl::cat(ServerCategory));
+
+// Largest request body accepted; the web backend caps uploads at 5 MB.
+static const size_t MaxRequestBytes = 16 << 20;
+
+namespace {
+
+class ServerAction : public ASTFrontendAction {
+public:
+    ServerAction(DemotionResult &Result, const DemotionOptions &Options,
+                 SummaryDatabase *Summaries, IncrementalStore *Incremental)
+        : Result(Result), Options(Options), Summaries(Summaries), Incremental(Incremental) {}
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                   StringRef File) override {
+        if (Options.AnalysisOnly)
+            CI.getFrontendOpts().SkipFunctionBodies = true;
+        TheRewriter.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
+        auto Consumer = std::make_unique<Fp16DemotionASTConsumer>(&CI.getASTContext(),
+                                                                  TheRewriter, Result);
+        Consumer->setSummaryDatabase(Summaries);
+        Consumer->setIncrementalStore(Incremental);
+        Consumer->setProjectHeaders(Options.ProjectHeaders);
+        Consumer->setReorderFields(Options.ReorderFields);
+        Consumer->setConvertArrays(Options.ConvertArrays);
+        Consumer->setFormats(Options.Formats);
+        Consumer->setDemoteDouble(Options.DemoteDouble);
+        Consumer->setValueProfile(Options.Profile.get(), Options.ProfileMargin);
+        Consumer->setErrorBudgets(&Options.Budgets);
+        Consumer->setVectorWidths(Options.VectorWidths);
+        Consumer->setCostModel(Options.CostModel, Options.CostTarget);
+        return Consumer;
+    }
+
+private:
+    DemotionResult &Result;
+    const DemotionOptions &Options;
+    SummaryDatabase *Summaries;
+    IncrementalStore *Incremental;
+    Rewriter TheRewriter;
+};
+
+// Connections accepted but not yet picked up by a worker.
+class ConnectionQueue {
+public:
+    explicit ConnectionQueue(size_t Capacity) : Capacity(Capacity) {}
+
+    // Returns false if the queue is full.
+    bool push(int FD) {
+        {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            if (Pending.size() >= Capacity)
+                return false;
+            Pending.push_back(FD);
+        }
+        Ready.notify_one();
+        return true;
+    }
+
+    int pop() {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        Ready.wait(Lock, [&] { return !Pending.empty(); });
+        int FD = Pending.front();
+        Pending.pop_front();
+        return FD;
+    }
+
+private:
+    size_t Capacity;
+    std::mutex Mutex;
+    std::condition_variable Ready;
+    std::deque<int> Pending;
+};
+
+struct ServerState {
+    DemotionOptions Defaults;
+    std::unique_ptr<SummaryDatabase> Summaries;
+    std::unique_ptr<PreambleCache> Preambles;
+    std::unique_ptr<IncrementalStore> Incremental;
+    std::string ResourceDir;
+    // Real paths of the directories requests may read files from
+    std::vector<std::string> ReadableRoots;
+};
+
+// Whether the real path Path is Root or lies below it.
+bool isBelow(llvm::StringRef Path, llvm::StringRef Root) {
+    if (!Path.consume_front(Root))
+        return false;
+    return Path.empty() || llvm::sys::path::is_separator(Path.front()) ||
+           llvm::sys::path::is_separator(Root.back());
+}
+
+bool isReadable(llvm::StringRef RealPath, const std::vector<std::string> &Roots) {
+    return llvm::any_of(Roots, [&](const std::string &Root) { return isBelow(RealPath, Root); });
+}
+
+// The real file system, but files outside Roots cannot be opened. Symlinks
+// and ".." are resolved before the check. Lookups and directory listings
+// still pass, so the driver finds its toolchain as usual.
+class RootedFileSystem : public llvm::vfs::ProxyFileSystem {
+public:
+    RootedFileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS,
+                     const std::vector<std::string> &Roots)
+        : ProxyFileSystem(std::move(FS)), Roots(Roots) {}
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+    openFileForRead(const llvm::Twine &Path) override {
+        llvm::SmallString<256> Real;
+        if (getRealPath(Path, Real) || !isReadable(Real, Roots))
+            return std::make_error_code(std::errc::permission_denied);
+        return ProxyFileSystem::openFileForRead(Path);
+    }
+
+private:
+    const std::vector<std::string> &Roots;
+};
+
+// Driver name on the command lines of requests.
+const char *const DriverName = "fp16-demote-server";
+
+// The system header directories the driver passes to the frontend for C
+// and C++ sources, so requests can include the standard headers.
+std::vector<std::string> systemHeaderDirs(llvm::StringRef ResourceDir) {
+    IgnoringDiagConsumer IgnoreDiags;
+    DiagnosticsEngine Diags(new DiagnosticIDs, new DiagnosticOptions, &IgnoreDiags, false);
+    driver::Driver Driver(DriverName, llvm::sys::getDefaultTargetTriple(), Diags);
+    Driver.setCheckInputsExist(false);
+    std::string ResourceDirArg = "-resource-dir=" + ResourceDir.str();
+
+    std::vector<std::string> Dirs;
+    for (const char *File : {"input.c", "input.cpp"}) {
+        const char *Args[] = {DriverName, "-fsyntax-only", ResourceDirArg.c_str(), File};
+        std::unique_ptr<driver::Compilation> C(Driver.BuildCompilation(Args));
+        if (!C)
+            continue;
+        for (const driver::Command &Job : C->getJobs()) {
+            const llvm::opt::ArgStringList &JobArgs = Job.getArguments();
+            for (size_t I = 0; I + 1 < JobArgs.size(); ++I) {
+                llvm::StringRef Flag = JobArgs[I];
+                if (Flag == "-internal-isystem" || Flag == "-internal-externc-isystem" ||
+                    Flag == "-internal-iframework" || Flag == "-isysroot")
+                    Dirs.push_back(JobArgs[I + 1]);
+            }
+        }
+    }
+    return Dirs;
+}
+
+// Reads until the client shuts down its side. Fails on errors, timeouts and
+// bodies over MaxRequestBytes.
+bool readRequest(int FD, std::string &Body) {
+    char Buffer[1 << 16];
+    for (;;) {
+        ssize_t N = ::read(FD, Buffer, sizeof(Buffer));
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N < 0)
+            return false;
+        if (N == 0)
+            return true;
+        Body.append(Buffer, size_t(N));
+        if (Body.size() > MaxRequestBytes)
+            return false;
+    }
+}
+
+void writeResponse(int FD, llvm::StringRef Response) {
+    while (!Response.empty()) {
+        ssize_t N = ::write(FD, Response.data(), Response.size());
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            return;
+        Response = Response.drop_front(size_t(N));
+    }
+}
+
+std::string errorResponse(llvm::StringRef Message) {
+    std::string Response;
+    llvm::raw_string_ostream OS(Response);
+    llvm::json::OStream J(OS);
+    J.object([&] {
+        J.attribute("success", false);
+        J.attribute("error", Message);
+    });
+    OS << "\n";
+    return Response;
+}
+
+// Appends the strings of Array (a request field) to Out. Returns false if
+// it has anything but strings.
+bool appendStrings(const llvm::json::Array *Array, std::vector<std::string> &Out) {
+    if (!Array)
+        return true;
+    for (const llvm::json::Value &V : *Array) {
+        std::optional<llvm::StringRef> Str = V.getAsString();
+        if (!Str)
+            return false;
+        Out.push_back(Str->str());
+    }
+    return true;
+}
+
+// Plugin arguments a request may not pass: they name files the server
+// would read or write.
+const char *const ServerOnlyArgs[] = {
+    "-fprecision-demote-cache=",         "-fprecision-demote-summaries=",
+    "-fprecision-demote-output-dir=",    "-fprecision-demote-output-prefix=",
+    "-fprecision-demote-incremental=",   "-fprecision-demote-time-trace=",
+    "-fprecision-demote-profile=",
+};
+
+// Compiler flags a request may pass take a value; the value may be the next
+// argument.
+const char *const SeparateValueArgs[] = {"-D", "-U", "-I", "-isystem"};
+
+// Flags a request may pass: these, and those with the prefixes below.
+const char *const AllowedArgs[] = {"-w", "-ansi", "-pedantic", "-pedantic-errors"};
+
+// Macros, include paths, the language and target, warnings, and -f and -m
+// options but for those refused below.
+const char *const AllowedArgPrefixes[] = {
+    "-D", "-U", "-I", "-isystem", "-std=", "-W", "-O", "-f", "-m", "--target=",
+};
+
+// Refused although they match a prefix above: they load code, pass flags on
+// to other tools, or name files to read or write.
+const char *const RefusedArgPrefixes[] = {
+    "-Wl,", "-Wa,", "-Wp,", "-mllvm", "-fplugin", "-fpass-plugin", "-fmodule",
+    "-fprebuilt-module", "-fprofile", "-ftime-trace", "-fcrash-diagnostics",
+    "-fsave-optimization-record", "-foptimization-record", "-fproc-stat-report",
+    "-fsanitize", "-fxray", "-fembed-offload",
+};
+
+// Why a request may not pass its compiler flags Args, or an empty string if
+// it may. Include directories must lie below one of Roots.
+std::string refusedCompileArgs(const std::vector<std::string> &Args,
+                               const std::vector<std::string> &Roots) {
+    auto HasPrefix = [](llvm::StringRef Arg, llvm::ArrayRef<const char *> Prefixes) {
+        return llvm::any_of(Prefixes, [&](const char *P) { return Arg.starts_with(P); });
+    };
+    for (size_t I = 0; I < Args.size(); ++I) {
+        llvm::StringRef Arg = Args[I];
+        if (llvm::is_contained(AllowedArgs, Arg))
+            continue;
+        if (!HasPrefix(Arg, AllowedArgPrefixes) || HasPrefix(Arg, RefusedArgPrefixes))
+            return "compiler flag '" + Arg.str() + "' is not allowed";
+        if (llvm::is_contained(SeparateValueArgs, Arg) && ++I == Args.size())
+            return "compiler flag '" + Arg.str() + "' needs a value";
+
+        llvm::StringRef Dir;
+        if (Arg == "-I" || Arg == "-isystem")
+            Dir = Args[I];
+        else if (Arg.consume_front("-isystem") || Arg.consume_front("-I"))
+            Dir = Arg;
+        else
+            continue;
+        llvm::SmallString<256> Real;
+        if (llvm::sys::fs::real_path(Dir, Real) || !isReadable(Real, Roots))
+            return "include directory '" + Dir.str() + "' is not below an include root";
+    }
+    return std::string();
+}
+
+// Answers {"command": "stats"} with the preamble cache and incremental
+// analysis counters.
+std::string statsResponse(const ServerState &State) {
+    std::string Stats;
+    llvm::raw_string_ostream StatsOS(Stats);
+    if (State.Preambles)
+        State.Preambles->printStats(StatsOS);
+    if (State.Incremental)
+        State.Incremental->printStats(StatsOS);
+    std::string Response;
+    llvm::raw_string_ostream OS(Response);
+    llvm::json::OStream J(OS);
+    J.object([&] {
+        J.attribute("success", true);
+        J.attribute("stats", Stats);
+        if (State.Preambles) {
+            const PreambleCacheStats &P = State.Preambles->stats();
+            J.attribute("preamble_hits", int64_t(P.Hits));
+            J.attribute("preamble_builds", int64_t(P.Builds));
+            J.attribute("preamble_saved_ms", P.SavedMicros / 1000.0);
+        }
+        if (State.Incremental) {
+            const IncrementalStats &I = State.Incremental->stats();
+            J.attribute("incremental_reused", int64_t(I.Reused));
+            J.attribute("incremental_analyzed", int64_t(I.Analyzed));
+        }
+    });
+    OS << "\n";
+    return Response;
+}
+
+std::string handleRequest(const ServerState &State, llvm::StringRef Body) {
+    auto Start = std::chrono::steady_clock::now();
+
+    llvm::Expected<llvm::json::Value> Request = llvm::json::parse(Body);
+    if (!Request)
+        return errorResponse("invalid JSON: " + llvm::toString(Request.takeError()));
+    const llvm::json::Object *Fields = Request->getAsObject();
+    if (!Fields)
+        return errorResponse("request must be a JSON object");
+    if (Fields->getString("command") == llvm::StringRef("stats"))
+        return statsResponse(State);
+    std::optional<llvm::StringRef> Source = Fields->getString("source");
+    if (!Source)
+        return errorResponse("request has no \"source\" string");
+    // Only a plain file name: the file lives in the working directory of
+    // the in-memory file system.
+    std::string FileName = "input.c";
+    std::optional<llvm::StringRef> File = Fields->getString("file");
+    if (File)
+        FileName = llvm::sys::path::filename(*File).str();
+    if (FileName.empty() || !llvm::sys::path::has_extension(FileName))
+        return errorResponse("\"file\" must be a file name with an extension");
+
+    std::vector<std::string> Args, CompileArgs;
+    if (!appendStrings(Fields->getArray("args"), Args) ||
+        !appendStrings(Fields->getArray("compile_args"), CompileArgs))
+        return errorResponse("\"args\" and \"compile_args\" must be arrays of strings");
+    std::string Refused = refusedCompileArgs(CompileArgs, State.ReadableRoots);
+    if (!Refused.empty())
+        return errorResponse(Refused);
+    DemotionOptions Options = State.Defaults;
+    for (const std::string &Arg : Args) {
+        if (llvm::any_of(ServerOnlyArgs, [&](const char *P) {
+                return llvm::StringRef(Arg).starts_with(P);
+            }))
+            return errorResponse("plugin argument '" + Arg + "' is not allowed");
+        if (!parseDemotionArg(Arg, Options))
+            return errorResponse("unknown plugin argument '" + Arg + "'");
+    }
+
+    // The upload shadows the real file system only for its own name.
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> Overlay(
+        new llvm::vfs::OverlayFileSystem(
+            new RootedFileSystem(llvm::vfs::getRealFileSystem(), State.ReadableRoots)));
+    llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> Memory(
+        new llvm::vfs::InMemoryFileSystem);
+    Overlay->pushOverlay(Memory);
+    Memory->addFile(FileName, 0, llvm::MemoryBuffer::getMemBufferCopy(*Source, FileName));
+    llvm::IntrusiveRefCntPtr<FileManager> Files(new FileManager(FileSystemOptions(), Overlay));
+
+    std::vector<std::string> CommandLine = {DriverName, "-fsyntax-only"};
+    if (!State.ResourceDir.empty())
+        CommandLine.push_back("-resource-dir=" + State.ResourceDir);
+    CommandLine.insert(CommandLine.end(), CompileArgs.begin(), CompileArgs.end());
+    CommandLine.push_back(FileName);
+
+    std::string DiagText;
+    llvm::raw_string_ostream DiagOS(DiagText);
+    TextDiagnosticPrinter DiagPrinter(DiagOS, new DiagnosticOptions());
+
+    // The store keeps results by file name, and for the server's own
+    // analysis arguments only.
+    IncrementalStore *Incremental = File && Options.AnalysisArgs == State.Defaults.AnalysisArgs
+                                        ? State.Incremental.get()
+                                        : nullptr;
+
+    DemotionResult Result;
+    bool Success;
+    if (State.Preambles) {
+        PreambleActionFactory Factory(*State.Preambles, [&]() -> std::unique_ptr<FrontendAction> {
+            return std::make_unique<ServerAction>(Result, Options, State.Summaries.get(),
+                                                  Incremental);
+        });
+        tooling::ToolInvocation Invocation(CommandLine, &Factory, Files.get());
+        Invocation.setDiagnosticConsumer(&DiagPrinter);
+        Success = Invocation.run();
+    } else {
+        tooling::ToolInvocation Invocation(
+            CommandLine,
+            std::make_unique<ServerAction>(Result, Options, State.Summaries.get(), Incremental),
+            Files.get());
+        Invocation.setDiagnosticConsumer(&DiagPrinter);
+        Success = Invocation.run();
+    }
+    // The store keeps summaries by file name, so requests without one,
+    // which all share input.c, only read from it.
+    if (Success && File && State.Summaries && !Result.MainFile.empty())
+        State.Summaries->storeTranslationUnit(Result.MainFile, Result.ExportedSummaries);
+    DiagOS.flush();
+    // Diagnostics quote the source, which need not be UTF-8.
+    if (!llvm::json::isUTF8(DiagText))
+        DiagText = llvm::json::fixUTF8(DiagText);
+
+    double Elapsed = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - Start).count();
+
+    std::string Response;
+    llvm::raw_string_ostream OS(Response);
+    llvm::json::OStream J(OS);
+    J.object([&] {
+        J.attribute("success", Success);
+        J.attribute("elapsed_ms", Elapsed);
+        J.attribute("diagnostics", DiagText);
+        if (Success) {
+            J.attributeBegin("report");
+            J.rawValue([&](llvm::raw_ostream &Raw) { writeCombinedReport(Raw, Result); });
+            J.attributeEnd();
+        }
+    });
+    OS << "\n";
+    return Response;
+}
+
+void serveConnection(const ServerState &State, int FD) {
+    // A client that stops sending must not hold a worker forever.
+    timeval Timeout = {10, 0};
+    ::setsockopt(FD, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    std::string Body;
+    if (readRequest(FD, Body))
+        writeResponse(FD, handleRequest(State, Body));
+    else
+        writeResponse(FD, errorResponse("could not read request"));
+    ::close(FD);
+}
+
+int listenOn(llvm::StringRef Path) {
+    sockaddr_un Addr = {};
+    Addr.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Addr.sun_path)) {
+        llvm::errs() << "fp16-demote-server: socket path too long: " << Path << "\n";
+        return -1;
+    }
+    std::memcpy(Addr.sun_path, Path.data(), Path.size());
+
+    int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0) {
+        llvm::errs() << "fp16-demote-server: socket: " << std::strerror(errno) << "\n";
+        return -1;
+    }
+    // A socket left behind by an earlier server would make bind fail.
+    ::unlink(Addr.sun_path);
+    if (::bind(FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0 ||
+        ::listen(FD, SOMAXCONN) < 0) {
+        llvm::errs() << "fp16-demote-server: cannot listen on " << Path << ": "
+                     << std::strerror(errno) << "\n";
+        ::close(FD);
+        return -1;
+    }
+    return FD;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+    llvm::sys::PrintStackTraceOnErrorSignal(argv[0]);
+    llvm::cl::HideUnrelatedOptions(ServerCategory);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "FP16 demotion analysis server\n");
+
+    ServerState State;
+    parseDemotionArg("-fprecision-demote=fp16", State.Defaults);
+    for (const std::string &Arg : PluginArgs) {
+        if (!parseDemotionArg(Arg, State.Defaults)) {
+            llvm::errs() << "fp16-demote-server: unknown plugin argument '" << Arg << "'\n";
+            return 1;
+        }
+    }
+    if (!State.Defaults.SummaryDir.empty())
+        State.Summaries = std::make_unique<SummaryDatabase>(State.Defaults.SummaryDir);
+    if (!State.Defaults.IncrementalDir.empty())
+        State.Incremental = std::make_unique<IncrementalStore>(State.Defaults.IncrementalDir,
+                                                               State.Defaults.AnalysisArgs);
+    if (ReusePreambles)
+        State.Preambles = std::make_unique<PreambleCache>();
+    // Where ClangTool would look, unless given.
+    static int StaticSymbol;
+    State.ResourceDir = !ResourceDir.empty()
+                            ? ResourceDir.getValue()
+                            : CompilerInvocation::GetResourcesPath(argv[0], &StaticSymbol);
+
+    std::vector<std::string> Roots = IncludeRoots;
+    Roots.push_back(State.ResourceDir);
+    for (std::string &Dir : systemHeaderDirs(State.ResourceDir))
+        Roots.push_back(std::move(Dir));
+    for (const std::string &Root : Roots) {
+        llvm::SmallString<256> Real;
+        if (!llvm::sys::fs::real_path(Root, Real))
+            State.ReadableRoots.push_back(std::string(Real));
+        else if (llvm::is_contained(IncludeRoots, Root))
+            llvm::errs() << "fp16-demote-server: include root " << Root << " does not exist\n";
+    }
+
+    // Clients that hang up early must not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int ListenFD = listenOn(SocketPath);
+    if (ListenFD < 0)
+        return 1;
+    llvm::sys::RemoveFileOnSignal(SocketPath);
+
+    unsigned NumThreads = Jobs ? unsigned(Jobs)
+                               : llvm::hardware_concurrency().compute_thread_count();
+    NumThreads = std::max(1u, NumThreads);
+    ConnectionQueue Queue(QueueLimit);
+    for (unsigned T = 0; T < NumThreads; ++T)
+        std::thread([&] {
+            for (;;)
+                serveConnection(State, Queue.pop());
+        }).detach();
+
+    llvm::outs() << "Listening on " << SocketPath << " with " << NumThreads << " workers\n";
+    llvm::outs().flush();
+    for (;;) {
+        int FD = ::accept(ListenFD, nullptr, nullptr);
+        if (FD < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            llvm::errs() << "fp16-demote-server: accept: " << std::strerror(errno) << "\n";
+            break;
+        }
+        if (!Queue.push(FD)) {
+            writeResponse(FD, errorResponse("server busy"));
+            ::close(FD);
+        }
+    }
+    ::close(ListenFD);
+    llvm::sys::fs::remove(SocketPath);
+    return 1;
+}
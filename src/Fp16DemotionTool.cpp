@@ -0,0 +1,415 @@
+//===- Fp16DemotionTool.cpp - Whole-project FP16 demotion driver ----------===//
+//
+// Standalone libTooling front end for the FP16 demotion analysis. Reads a
+// compilation database, analyzes every translation unit on a pool of worker
+// threads and merges the per-TU results into one report:
+//
+//   fp16-demote -p build/ [-j N] [--output-dir DIR] [files...]
+//
+// With no files, every file in the compilation database is analyzed.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Fp16AnalysisCache.h"
+#include "Fp16Demotion.h"
+#include "Fp16DemotionOutput.h"
+#include "Fp16PreambleCache.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace clang;
+using namespace fp16demotion;
+
+static llvm::cl::OptionCategory Fp16DemoteCategory("fp16-demote options");
+
+static llvm::cl::opt<unsigned> Jobs(
+    "j", llvm::cl::desc("Number of worker threads (0 = one per hardware thread)"),
+    llvm::cl::init(0), llvm::cl::cat(Fp16DemoteCategory));
+
+static llvm::cl::opt<std::string> OutputDir(
+    "output-dir", llvm::cl::desc("Directory for the merged report"),
+    llvm::cl::init("."), llvm::cl::cat(Fp16DemoteCategory));
+
+static llvm::cl::list<std::string> PluginArgs(
+    "plugin-arg",
+    llvm::cl::desc("Argument forwarded as if passed with -plugin-arg-fp16-demotion"),
+    llvm::cl::cat(Fp16DemoteCategory));
+
+static llvm::cl::opt<bool> EmitDemoted(
+    "emit-demoted",
+    llvm::cl::desc("Write the demoted source of every TU under <output-dir>/demoted"),
+    llvm::cl::init(false), llvm::cl::cat(Fp16DemoteCategory));
+
+static llvm::cl::opt<bool> ReusePreambles(
+    "reuse-preambles",
+    llvm::cl::desc("Precompile the leading #includes once and reuse them for files that "
+                   "start with the same ones"),
+    llvm::cl::init(false), llvm::cl::cat(Fp16DemoteCategory));
+
+namespace {
+
+class Fp16DemotionToolAction : public ASTFrontendAction {
+public:
+    Fp16DemotionToolAction(DemotionResult &Result, RecordSink *Sink, SummaryDatabase *Summaries,
+                           IncrementalStore *Incremental, const DemotionOptions &Options)
+        : Result(Result), Sink(Sink), Summaries(Summaries), Incremental(Incremental),
+          Options(Options) {}
+
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                   StringRef File) override {
+        if (Options.AnalysisOnly)
+            CI.getFrontendOpts().SkipFunctionBodies = true;
+        TheRewriter.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
+        auto Consumer = std::make_unique<Fp16DemotionASTConsumer>(&CI.getASTContext(),
+                                                                  TheRewriter, Result);
+        Consumer->setRecordSink(Sink);
+        Consumer->setSummaryDatabase(Summaries);
+        Consumer->setIncrementalStore(Incremental);
+        Consumer->setProjectHeaders(Options.ProjectHeaders);
+        Consumer->setReorderFields(Options.ReorderFields);
+        Consumer->setConvertArrays(Options.ConvertArrays);
+        Consumer->setFormats(Options.Formats);
+        Consumer->setDemoteDouble(Options.DemoteDouble);
+        Consumer->setValueProfile(Options.Profile.get(), Options.ProfileMargin);
+        Consumer->setErrorBudgets(&Options.Budgets);
+        Consumer->setVectorWidths(Options.VectorWidths);
+        Consumer->setCostModel(Options.CostModel, Options.CostTarget);
+        return Consumer;
+    }
+
+private:
+    DemotionResult &Result;
+    RecordSink *Sink;
+    SummaryDatabase *Summaries;
+    IncrementalStore *Incremental;
+    const DemotionOptions &Options;
+    Rewriter TheRewriter;
+};
+
+// Computes the cache key of a translation unit by preprocessing it, which is
+// much cheaper than the parse and Sema a full analysis needs.
+class CacheKeyAction : public PreprocessorFrontendAction {
+public:
+    CacheKeyAction(const DemotionOptions &Options, std::string &Key)
+        : Options(Options), Key(Key) {}
+
+    void ExecuteAction() override {
+        CompilerInstance &CI = getCompilerInstance();
+        Preprocessor &PP = CI.getPreprocessor();
+        CacheKeyBuilder Builder(Options);
+        PP.EnterMainSourceFile();
+        Token Tok;
+        do {
+            PP.Lex(Tok);
+            Builder.addToken(PP, Tok);
+        } while (Tok.isNot(tok::eof));
+        Key = Builder.finish(CI.getSourceManager());
+    }
+
+private:
+    const DemotionOptions &Options;
+    std::string &Key;
+};
+
+class LambdaActionFactory : public tooling::FrontendActionFactory {
+public:
+    explicit LambdaActionFactory(std::function<std::unique_ptr<FrontendAction>()> Create)
+        : Create(std::move(Create)) {}
+
+    std::unique_ptr<FrontendAction> create() override { return Create(); }
+
+private:
+    std::function<std::unique_ptr<FrontendAction>()> Create;
+};
+
+} // namespace
+
+int main(int argc, const char **argv) {
+    auto ExpectedParser = tooling::CommonOptionsParser::create(
+        argc, argv, Fp16DemoteCategory, llvm::cl::ZeroOrMore);
+    if (!ExpectedParser) {
+        llvm::errs() << ExpectedParser.takeError();
+        return 1;
+    }
+    tooling::CommonOptionsParser &OptionsParser = ExpectedParser.get();
+    const tooling::CompilationDatabase &Compilations = OptionsParser.getCompilations();
+
+    DemotionOptions Options;
+    parseDemotionArg("-fprecision-demote=fp16", Options);
+    for (const std::string &Arg : PluginArgs) {
+        if (!parseDemotionArg(Arg, Options)) {
+            llvm::errs() << "fp16-demote: unknown plugin argument '" << Arg << "'\n";
+            return 1;
+        }
+    }
+    // The plugin's output arguments name the merged report; without them it
+    // goes to --output-dir.
+    if (Options.OutputDir.empty())
+        Options.OutputDir = OutputDir;
+    if (Options.CombinedOutput)
+        llvm::errs() << "fp16-demote: -fprecision-demote-combined is ignored, the merged "
+                        "report is always written as separate files\n";
+
+    std::vector<std::string> Files = OptionsParser.getSourcePathList();
+    if (Files.empty())
+        Files = Compilations.getAllFiles();
+    if (Files.empty()) {
+        llvm::errs() << "fp16-demote: no input files\n";
+        return 1;
+    }
+
+    // Hand out the largest files first so a big TU picked up last does not
+    // leave every other worker idle at the end of the run.
+    std::vector<std::pair<uint64_t, size_t>> Order;
+    Order.reserve(Files.size());
+    for (size_t I = 0; I < Files.size(); ++I) {
+        uint64_t Size = 0;
+        llvm::sys::fs::file_size(Files[I], Size);
+        Order.push_back({Size, I});
+    }
+    std::stable_sort(Order.begin(), Order.end(),
+                     [](const auto &A, const auto &B) { return A.first > B.first; });
+
+    unsigned NumThreads = Jobs ? unsigned(Jobs)
+                               : llvm::hardware_concurrency().compute_thread_count();
+    NumThreads = std::max(1u, std::min<unsigned>(NumThreads, Files.size()));
+
+    std::unique_ptr<AnalysisCache> Cache;
+    if (!Options.CacheDir.empty())
+        Cache = std::make_unique<AnalysisCache>(Options.CacheDir, Options.CacheMaxBytes);
+
+    // Shared by all workers. Files are scheduled largest first, not in call
+    // graph order, so a callee defined in another TU is only known once its
+    // summary is in the database, e.g. on the next run.
+    std::unique_ptr<SummaryDatabase> Summaries;
+    if (!Options.SummaryDir.empty())
+        Summaries = std::make_unique<SummaryDatabase>(Options.SummaryDir);
+
+    std::unique_ptr<IncrementalStore> Incremental;
+    if (!Options.IncrementalDir.empty())
+        Incremental = std::make_unique<IncrementalStore>(Options.IncrementalDir,
+                                                         Options.AnalysisArgs);
+
+    std::unique_ptr<PreambleCache> Preambles;
+    if (ReusePreambles)
+        Preambles = std::make_unique<PreambleCache>();
+
+    if (std::error_code EC = llvm::sys::fs::create_directories(Options.OutputDir)) {
+        llvm::errs() << "fp16-demote: cannot create " << Options.OutputDir << ": "
+                     << EC.message() << "\n";
+        return 1;
+    }
+
+    // Each TU streams its float map records as NDJSON into its own part file;
+    // the parts are concatenated in input order once all workers finish. The
+    // binary map is indexed by file, so there records go straight into one
+    // shared writer that orders them itself.
+    bool Binary = Options.Format == FloatMapFormat::Binary;
+    std::string FloatMapPath = outputPath(Options, floatMapFileName(Options.Format));
+    std::unique_ptr<BinaryFloatMapWriter> BinaryMap;
+    std::mutex BinaryMapMutex;
+    if (Binary)
+        BinaryMap = std::make_unique<BinaryFloatMapWriter>(FloatMapPath);
+
+    std::string PartsDir = outputPath(Options, ".fp16-parts");
+    llvm::sys::fs::create_directories(PartsDir);
+    auto PartPath = [&](size_t Index) {
+        llvm::SmallString<256> Path(PartsDir);
+        llvm::sys::path::append(Path, llvm::Twine(Index) + ".ndjson");
+        return std::string(Path);
+    };
+
+    std::string DemotedDir = outputPath(Options, "demoted");
+    if (EmitDemoted)
+        llvm::sys::fs::create_directories(DemotedDir);
+    std::string ReplacementsDir = outputPath(Options, ReplacementsDirName);
+    if (Options.EmitReplacements)
+        llvm::sys::fs::create_directories(ReplacementsDir);
+
+    // Only the small per-TU counters outlive a worker iteration; records and
+    // demoted sources go to disk as soon as a TU is done.
+    std::vector<DemotionResult> Results(Files.size());
+    std::atomic<size_t> NextFile{0};
+    std::atomic<unsigned> Failures{0};
+    std::mutex DiagMutex;
+
+    // Every worker pulls the next unclaimed file off a shared atomic cursor,
+    // so idle threads take over remaining work instead of waiting on a
+    // static partition.
+    auto Worker = [&]() {
+        for (size_t Next = NextFile++; Next < Order.size(); Next = NextFile++) {
+            size_t Index = Order[Next].second;
+            const std::string &File = Files[Index];
+            DemotionResult &Result = Results[Index];
+
+            std::string DiagText;
+            llvm::raw_string_ostream DiagOS(DiagText);
+            TextDiagnosticPrinter DiagPrinter(DiagOS, new DiagnosticOptions());
+
+            tooling::ClangTool Tool(Compilations, {File});
+            Tool.appendArgumentsAdjuster(OptionsParser.getArgumentsAdjuster());
+            Tool.setDiagnosticConsumer(&DiagPrinter);
+
+            std::unique_ptr<FloatMapWriter> Part;
+            if (!Binary)
+                Part = FloatMapWriter::create(PartPath(Index), FloatMapFormat::NDJson);
+
+            std::string Key;
+            if (Cache) {
+                LambdaActionFactory KeyFactory([&]() {
+                    return std::make_unique<CacheKeyAction>(Options, Key);
+                });
+                if (Tool.run(&KeyFactory) != 0)
+                    Key.clear();
+            }
+
+            // A cached result is stale once a callee summary it used changed.
+            bool Cached = !Key.empty() && Cache->lookup(Key, Result);
+            if (Cached && Summaries && !Summaries->isCurrent(Result.SummaryDeps)) {
+                Result = DemotionResult();
+                Cached = false;
+            }
+            if (!Cached) {
+                // Cache entries need the records, so only stream without one.
+                RecordSink *Sink = Cache ? nullptr : Part.get();
+                auto Create = [&]() -> std::unique_ptr<FrontendAction> {
+                    return std::make_unique<Fp16DemotionToolAction>(
+                        Result, Sink, Summaries.get(), Incremental.get(), Options);
+                };
+                LambdaActionFactory Factory(Create);
+                std::unique_ptr<PreambleActionFactory> PreambleFactory;
+                if (Preambles)
+                    PreambleFactory = std::make_unique<PreambleActionFactory>(*Preambles, Create);
+                int Status = PreambleFactory ? Tool.run(PreambleFactory.get()) : Tool.run(&Factory);
+                if (Status != 0)
+                    ++Failures;
+                else if (!Key.empty())
+                    Cache->store(Key, Result);
+            }
+            if (Summaries && !Result.MainFile.empty())
+                Summaries->storeTranslationUnit(Result.MainFile, Result.ExportedSummaries);
+
+            if (Part) {
+                for (const LiteralRecord &Record : Result.Literals)
+                    Part->addLiteral(Record);
+                Part->finish();
+            } else if (BinaryMap) {
+                std::lock_guard<std::mutex> Lock(BinaryMapMutex);
+                for (const LiteralRecord &Record : Result.Literals)
+                    BinaryMap->addLiteral(Record);
+                for (const VariableRecord &Record : Result.Variables)
+                    BinaryMap->addVariable(Record);
+            }
+            if (EmitDemoted && !Result.MainFile.empty()) {
+                llvm::SmallString<256> Path(DemotedDir);
+                llvm::sys::path::append(Path, flattenPath(Result.MainFile));
+                writeDemotedFile(std::string(Path), Result.DemotedCode);
+            }
+            if (Options.EmitReplacements && !Result.MainFile.empty())
+                writeReplacementsFile(ReplacementsDir, Result);
+            std::vector<LiteralRecord>().swap(Result.Literals);
+            std::vector<VariableRecord>().swap(Result.Variables);
+            std::vector<TransformationRecord>().swap(Result.Transformations);
+            std::string().swap(Result.DemotedCode);
+            std::vector<NamedSummary>().swap(Result.ExportedSummaries);
+            std::vector<std::pair<std::string, std::string>>().swap(Result.SummaryDeps);
+
+            DiagOS.flush();
+            if (!DiagText.empty()) {
+                std::lock_guard<std::mutex> Lock(DiagMutex);
+                llvm::errs() << DiagText;
+            }
+        }
+    };
+
+    auto Start = std::chrono::steady_clock::now();
+    std::vector<std::thread> Threads;
+    for (unsigned T = 0; T < NumThreads; ++T)
+        Threads.emplace_back(Worker);
+    for (std::thread &T : Threads)
+        T.join();
+    double Seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - Start).count();
+
+    // Merge in input order so the report is independent of scheduling.
+    MemoryUsage Total;
+    std::vector<StructLayoutRecord> StructLayouts;
+    std::vector<ArrayStorageRecord> Arrays;
+    std::vector<LoopVectorRecord> Loops;
+    std::vector<ConversionCostRecord> ConversionCosts;
+    for (const DemotionResult &R : Results) {
+        Total += R.Memory;
+        StructLayouts.insert(StructLayouts.end(), R.StructLayouts.begin(), R.StructLayouts.end());
+        Arrays.insert(Arrays.end(), R.Arrays.begin(), R.Arrays.end());
+        Loops.insert(Loops.end(), R.Loops.begin(), R.Loops.end());
+        ConversionCosts.insert(ConversionCosts.end(), R.ConversionCosts.begin(),
+                               R.ConversionCosts.end());
+    }
+
+    if (BinaryMap) {
+        BinaryMap->finish();
+    } else {
+        std::unique_ptr<FloatMapWriter> FloatMap =
+            FloatMapWriter::create(FloatMapPath, Options.Format);
+        if (!FloatMap)
+            return 1;
+        for (size_t I = 0; I < Files.size(); ++I) {
+            std::string Path = PartPath(I);
+            auto Buffer = llvm::MemoryBuffer::getFile(Path);
+            if (!Buffer)
+                continue;
+            for (llvm::StringRef Rest = (*Buffer)->getBuffer(); !Rest.empty();) {
+                llvm::StringRef Line;
+                std::tie(Line, Rest) = Rest.split('\n');
+                if (!Line.empty())
+                    FloatMap->addRaw(Line);
+            }
+            llvm::sys::fs::remove(Path);
+        }
+        FloatMap->finish();
+    }
+    llvm::sys::fs::remove(PartsDir);
+
+    if (!writeMemoryAnalysisFile(outputPath(Options, "memory_analysis.txt"), Total,
+                                 StructLayouts, Arrays, Loops))
+        return 1;
+    if (Options.CostModel != CostModelMode::Off &&
+        !writeConversionCostsFile(outputPath(Options, ConversionCostsFileName), ConversionCosts))
+        return 1;
+
+    llvm::outs() << "Analyzed " << Files.size() << " translation units on "
+                 << NumThreads << " threads in " << Seconds << " s ("
+                 << Failures << " failed)\n";
+    llvm::outs() << "Found " << Total.floatLiteralCount << " floating point literals, "
+                 << Total.demotedVarCount << "/" << Total.floatVarCount
+                 << " variables demotable\n";
+    if (Cache)
+        Cache->printStats(llvm::outs());
+    if (Preambles)
+        Preambles->printStats(llvm::outs());
+    if (Incremental)
+        Incremental->printStats(llvm::outs());
+    llvm::outs() << "Report written to " << Options.OutputDir << "\n";
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,435 @@
+#include "Fp16ErrorAnalysis.h"
+#include "clang/AST/Attr.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+bool parseErrorBudget(llvm::StringRef Value, bool Absolute, ErrorBudgets &Budgets) {
+    llvm::StringRef Name, Bound = Value;
+    if (Value.contains('=')) {
+        std::tie(Name, Bound) = Value.rsplit('=');
+        if (Name.empty())
+            return false;
+    }
+    double Limit;
+    if (Bound.getAsDouble(Limit) || !(Limit >= 0))
+        return false;
+    ErrorBudget &Budget = Name.empty() ? Budgets.Default : Budgets.Named[Name];
+    (Absolute ? Budget.Absolute : Budget.Relative) = Limit;
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Error propagation
+//===----------------------------------------------------------------------===//
+
+static double maxMagnitude(const Interval &R) {
+    return std::max(std::fabs(R.Lo), std::fabs(R.Hi));
+}
+
+// Zero if R contains zero
+static double minMagnitude(const Interval &R) {
+    if (R.contains(0))
+        return 0;
+    return std::min(std::fabs(R.Lo), std::fabs(R.Hi));
+}
+
+// An error bound times a magnitude; an exact or zero factor contributes
+// nothing, even against an infinite other
+static double scaled(double Error, double Magnitude) {
+    return Error == 0 || Magnitude == 0 ? 0 : Error * Magnitude;
+}
+
+static bool sameSign(const Interval &A, const Interval &B) {
+    return (A.Lo >= 0 && B.Lo >= 0) || (A.Hi <= 0 && B.Hi <= 0);
+}
+
+static double unitRoundoff(const FloatFormat &F) {
+    return std::ldexp(1.0, -int(F.MantissaBits) - 1);
+}
+
+// The error of rounding a value in R to F once. Below the normal range the
+// spacing stops shrinking, so the absolute error does too.
+static ErrorBound rounded(const Interval &R, const FloatFormat &F) {
+    if (R.isEmpty())
+        return ErrorBound::exact(R);
+    double U = unitRoundoff(F);
+    double Absolute = U * std::max(maxMagnitude(R), F.minNormal());
+    double Min = minMagnitude(R);
+    double Relative = std::numeric_limits<double>::infinity();
+    if (Min >= F.minNormal())
+        Relative = U;
+    else if (Min > 0)
+        Relative = Absolute / Min;
+    return {R, Absolute, Relative};
+}
+
+// Each bound limits the other through the range.
+static ErrorBound tighten(ErrorBound B) {
+    if (B.Range.isEmpty())
+        return ErrorBound::exact(B.Range);
+    B.Absolute = std::min(B.Absolute, scaled(B.Relative, maxMagnitude(B.Range)));
+    double Min = minMagnitude(B.Range);
+    if (Min > 0)
+        B.Relative = std::min(B.Relative, B.Absolute / Min);
+    return B;
+}
+
+// A op B computed in F, first order in the errors
+static ErrorBound arithmetic(BinaryOperatorKind Op, const ErrorBound &A, const ErrorBound &B,
+                             const FloatFormat &F) {
+    const double Inf = std::numeric_limits<double>::infinity();
+    ErrorBound Out;
+    switch (Op) {
+    case BO_Add: Out.Range = A.Range.add(B.Range); break;
+    case BO_Sub: Out.Range = A.Range.sub(B.Range); break;
+    case BO_Mul: Out.Range = A.Range.mul(B.Range); break;
+    case BO_Div: Out.Range = A.Range.div(B.Range); break;
+    default: return Out;
+    }
+    ErrorBound Round = rounded(Out.Range, F);
+    switch (Op) {
+    case BO_Add:
+    case BO_Sub:
+        Out.Absolute = A.Absolute + B.Absolute + Round.Absolute;
+        // Without cancellation the relative errors do not grow.
+        Out.Relative = sameSign(A.Range, Op == BO_Add ? B.Range : B.Range.neg())
+                           ? std::max(A.Relative, B.Relative) + Round.Relative
+                           : Inf;
+        break;
+    case BO_Mul:
+        Out.Absolute = scaled(A.Absolute, maxMagnitude(B.Range)) +
+                       scaled(B.Absolute, maxMagnitude(A.Range)) + Round.Absolute;
+        Out.Relative = A.Relative + B.Relative + Round.Relative;
+        break;
+    default: {
+        Out.Relative = A.Relative + B.Relative + Round.Relative;
+        double Divisor = minMagnitude(B.Range);
+        Out.Absolute = Divisor > 0 ? A.Absolute / Divisor +
+                                         scaled(B.Absolute, maxMagnitude(A.Range)) /
+                                             (Divisor * Divisor) +
+                                         Round.Absolute
+                                   : Inf;
+        break;
+    }
+    }
+    return tighten(Out);
+}
+
+static BinaryOperatorKind arithmeticOpcode(BinaryOperatorKind Op) {
+    switch (Op) {
+    case BO_AddAssign: return BO_Add;
+    case BO_SubAssign: return BO_Sub;
+    case BO_MulAssign: return BO_Mul;
+    case BO_DivAssign: return BO_Div;
+    default: return Op;
+    }
+}
+
+// Parentheses, reads and conversions between arithmetic types are looked
+// through; the leaf they lead to accounts for the conversion.
+static const Expr *strip(const Expr *E) {
+    while (true) {
+        E = E->IgnoreParens();
+        const auto *CE = dyn_cast<CastExpr>(E);
+        if (!CE)
+            return E;
+        CastKind Kind = CE->getCastKind();
+        if (Kind != CK_LValueToRValue && Kind != CK_NoOp && Kind != CK_FloatingCast &&
+            Kind != CK_IntegralToFloating && Kind != CK_IntegralCast)
+            return E;
+        E = CE->getSubExpr();
+    }
+}
+
+static double toDouble(const llvm::APFloat &V) {
+    bool LosesInfo;
+    llvm::APFloat Double = V;
+    Double.convert(llvm::APFloat::IEEEdouble(), llvm::APFloat::rmNearestTiesToEven, &LosesInfo);
+    return Double.convertToDouble();
+}
+
+// Only the operators the bounds are composed from are looked through.
+static void forEachOperand(const Expr *E, llvm::function_ref<void(const Expr *)> Fn) {
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        Fn(strip(BO->getLHS()));
+        Fn(strip(BO->getRHS()));
+    } else if (const auto *UO = dyn_cast<UnaryOperator>(E)) {
+        Fn(strip(UO->getSubExpr()));
+    } else if (const auto *CE = dyn_cast<CallExpr>(E)) {
+        for (const Expr *Arg : CE->arguments())
+            Fn(strip(Arg));
+    }
+}
+
+// The error of storing the constant E in F, from its exact value. Returns
+// false if E is not a constant.
+static bool constantBound(const Expr *E, ASTContext &Context, const FloatFormat &F,
+                          ErrorBound &Out) {
+    Expr::EvalResult Value;
+    if (E->isValueDependent() || !E->EvaluateAsRValue(Value, Context))
+        return false;
+    double V;
+    if (Value.Val.isFloat())
+        V = toDouble(Value.Val.getFloat());
+    else if (Value.Val.isInt())
+        V = Value.Val.getInt().isSigned() ? Value.Val.getInt().signedRoundToDouble()
+                                          : Value.Val.getInt().roundToDouble();
+    else
+        return false;
+    Out = ErrorBound();
+    Out.Range = Interval::point(V);
+    double Stored = F.simulate(V);
+    if (std::isfinite(Stored)) {
+        Out.Absolute = std::fabs(V - Stored);
+        Out.Relative = V == 0 ? 0 : Out.Absolute / std::fabs(V);
+    }
+    return true;
+}
+
+ErrorBound ErrorAnalysis::bound(const Expr *E, const FloatFormat &Format) {
+    // A constant expression is folded and rounded once.
+    ErrorBound Constant;
+    if (constantBound(E, *Context, Format, Constant))
+        return Constant;
+    return evaluate(strip(E), Format);
+}
+
+// Post-order over the operands, like ExprVerdicts::evaluate
+ErrorBound ErrorAnalysis::evaluate(const Expr *Root, const FloatFormat &Format) {
+    auto Known = Bounds.find({Root, &Format});
+    if (Known != Bounds.end())
+        return Known->second;
+
+    llvm::SmallVector<std::pair<const Expr *, bool>, 16> Stack;
+    Stack.push_back({Root, false});
+    while (!Stack.empty()) {
+        auto [E, OperandsDone] = Stack.pop_back_val();
+        if (Bounds.count({E, &Format}))
+            continue;
+        if (OperandsDone) {
+            Bounds[{E, &Format}] = combine(E, Format);
+            continue;
+        }
+        Stack.push_back({E, true});
+        forEachOperand(E, [&](const Expr *Operand) {
+            if (!Bounds.count({Operand, &Format}))
+                Stack.push_back({Operand, false});
+        });
+    }
+    return Bounds.lookup({Root, &Format});
+}
+
+ErrorBound ErrorAnalysis::combine(const Expr *E, const FloatFormat &Format) {
+    auto Operand = [&](const Expr *Op) { return Bounds.lookup({strip(Op), &Format}); };
+
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        if (BO->getOpcode() == BO_Assign)
+            return Operand(BO->getRHS());
+        return arithmetic(arithmeticOpcode(BO->getOpcode()), Operand(BO->getLHS()),
+                          Operand(BO->getRHS()), Format);
+    }
+
+    if (const auto *UO = dyn_cast<UnaryOperator>(E)) {
+        ErrorBound Sub = Operand(UO->getSubExpr());
+        switch (UO->getOpcode()) {
+        case UO_Plus:
+            return Sub;
+        case UO_Minus:
+            Sub.Range = Sub.Range.neg();
+            return Sub;
+        case UO_PreInc:
+        case UO_PostInc:
+            return arithmetic(BO_Add, Sub, ErrorBound::exact(Interval::point(1)), Format);
+        case UO_PreDec:
+        case UO_PostDec:
+            return arithmetic(BO_Sub, Sub, ErrorBound::exact(Interval::point(1)), Format);
+        default:
+            return ErrorBound();
+        }
+    }
+
+    // Calls are assumed to pass the relative error of their arguments
+    // through without amplifying it, and to round their result once.
+    if (const auto *CE = dyn_cast<CallExpr>(E)) {
+        const FunctionDecl *Callee = CE->getDirectCallee();
+        if (!Callee || !Ranges.hasSummary(Callee))
+            return ErrorBound();
+        llvm::SmallVector<Interval, 4> Args;
+        double Relative = 0;
+        for (const Expr *Arg : CE->arguments()) {
+            ErrorBound A = Operand(Arg);
+            Args.push_back(A.Range);
+            Relative = std::max(Relative, A.Relative);
+        }
+        ErrorBound Round = rounded(Ranges.evaluateCall(Callee, Args), Format);
+        Round.Relative += Relative;
+        Round.Absolute = std::numeric_limits<double>::infinity();
+        return tighten(Round);
+    }
+
+    return leaf(E, Format);
+}
+
+// Constants, and values read from storage: stored in Format, or converted
+// to it from an integer
+ErrorBound ErrorAnalysis::leaf(const Expr *E, const FloatFormat &Format) {
+    ErrorBound Constant;
+    if (constantBound(E, *Context, Format, Constant))
+        return Constant;
+
+    Interval Range;
+    bool Known = false;
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(E)) {
+        if (const auto *VD = dyn_cast<VarDecl>(DRE->getDecl()))
+            Known = Ranges.getRange(VD, Range);
+    } else if (const auto *ME = dyn_cast<MemberExpr>(E)) {
+        if (const auto *FD = dyn_cast<FieldDecl>(ME->getMemberDecl()))
+            Known = Ranges.getFieldRange(FD, Range);
+    } else if (isa<ArraySubscriptExpr>(E)) {
+        if (const ValueDecl *Array = indexedArray(E))
+            Known = Ranges.getElementRange(Array, Range);
+    } else {
+        return ErrorBound();
+    }
+    if (!Known)
+        Range = Interval::top();
+
+    // Integers up to 2^(p+1) convert exactly.
+    if (E->getType()->isIntegerType() && Range.isBounded() &&
+        maxMagnitude(Range) <= std::ldexp(1.0, int(Format.MantissaBits) + 1))
+        return ErrorBound::exact(Range);
+    return rounded(Range, Format);
+}
+
+//===----------------------------------------------------------------------===//
+// Budgets
+//===----------------------------------------------------------------------===//
+
+// The budget an fp16_error_budget= (or, with Absolute,
+// fp16_abs_error_budget=) annotation on D gives
+static bool annotatedBudget(const Decl *D, bool Absolute, double &Out) {
+    if (!D)
+        return false;
+    llvm::StringRef Key = Absolute ? "fp16_abs_error_budget=" : "fp16_error_budget=";
+    for (const AnnotateAttr *A : D->specific_attrs<AnnotateAttr>()) {
+        llvm::StringRef Text = A->getAnnotation();
+        double Limit;
+        if (Text.consume_front(Key) && !Text.getAsDouble(Limit) && Limit >= 0) {
+            Out = Limit;
+            return true;
+        }
+    }
+    return false;
+}
+
+ErrorBudget ErrorAnalysis::budgetFor(const VarDecl *VD) {
+    const FunctionDecl *Function = nullptr;
+    if (const DeclContext *DC = VD->getParentFunctionOrMethod())
+        Function = dyn_cast<FunctionDecl>(Decl::castFromDeclContext(DC));
+    std::string VarKey = VD->getName().str();
+    if (Function)
+        VarKey = Function->getName().str() + ":" + VarKey;
+
+    auto Pick = [&](bool Absolute) {
+        double Limit;
+        if (annotatedBudget(VD, Absolute, Limit))
+            return Limit;
+        auto Named = [&](llvm::StringRef Key, double &Out) {
+            if (!Budgets)
+                return false;
+            auto It = Budgets->Named.find(Key);
+            if (It == Budgets->Named.end())
+                return false;
+            Out = Absolute ? It->second.Absolute : It->second.Relative;
+            return std::isfinite(Out);
+        };
+        if (Named(VarKey, Limit) || annotatedBudget(Function, Absolute, Limit) ||
+            (Function && Named(Function->getName(), Limit)))
+            return Limit;
+        if (!Budgets)
+            return std::numeric_limits<double>::infinity();
+        return Absolute ? Budgets->Default.Absolute : Budgets->Default.Relative;
+    };
+    return {Pick(false), Pick(true)};
+}
+
+namespace {
+
+class StoreCollector : public RecursiveASTVisitor<StoreCollector> {
+public:
+    explicit StoreCollector(llvm::DenseMap<const VarDecl *, std::vector<const Expr *>> &Stores)
+        : Stores(Stores) {}
+
+    bool VisitBinaryOperator(BinaryOperator *BO) {
+        if (BO->isAssignmentOp())
+            add(BO->getLHS(), BO->getOpcode() == BO_Assign ? BO->getRHS() : BO);
+        return true;
+    }
+
+    bool VisitUnaryOperator(UnaryOperator *UO) {
+        if (UO->isIncrementDecrementOp())
+            add(UO->getSubExpr(), UO);
+        return true;
+    }
+
+private:
+    void add(const Expr *Target, const Expr *Value) {
+        if (const auto *DRE = dyn_cast<DeclRefExpr>(Target->IgnoreParenImpCasts()))
+            if (const auto *VD = dyn_cast<VarDecl>(DRE->getDecl()))
+                Stores[VD->getCanonicalDecl()].push_back(Value);
+    }
+
+    llvm::DenseMap<const VarDecl *, std::vector<const Expr *>> &Stores;
+};
+
+} // namespace
+
+const std::vector<const Expr *> &ErrorAnalysis::storesTo(const VarDecl *VD) {
+    if (!CollectedStores) {
+        CollectedStores = true;
+        SourceManager &SM = Context->getSourceManager();
+        StoreCollector Collector(Stores);
+        for (Decl *D : Context->getTranslationUnitDecl()->decls())
+            if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+                Collector.TraverseDecl(D);
+    }
+    return Stores[VD->getCanonicalDecl()];
+}
+
+bool ErrorAnalysis::withinBudget(const VarDecl *VD, const FloatFormat &Format, std::string &Why) {
+    ErrorBudget Budget = budgetFor(VD);
+    if (!Budget.isSet())
+        return true;
+
+    std::vector<const Expr *> Values;
+    if (const Expr *Init = VD->getInit())
+        Values.push_back(Init);
+    const std::vector<const Expr *> &Stored = storesTo(VD);
+    Values.insert(Values.end(), Stored.begin(), Stored.end());
+
+    auto Refuse = [&](const char *Kind, double Bound, double Limit) {
+        char Buf[160];
+        snprintf(Buf, sizeof(Buf), "%s error bound %g in %s exceeds the budget of %g", Kind,
+                 Bound, Format.Display, Limit);
+        Why = Buf;
+        return false;
+    };
+    for (const Expr *Value : Values) {
+        ErrorBound B = bound(Value, Format);
+        if (!(B.Relative <= Budget.Relative))
+            return Refuse("relative", B.Relative, Budget.Relative);
+        if (!(B.Absolute <= Budget.Absolute))
+            return Refuse("absolute", B.Absolute, Budget.Absolute);
+    }
+    return true;
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,113 @@
+//===- Fp16ErrorAnalysis.h - Rounding error bounds -------------*- C++ -*-===//
+//
+// First-order bounds on the rounding error of float expressions evaluated
+// in a narrower format. Every variable, field and array element read is
+// taken as stored in the format, every arithmetic operation as rounded to
+// it; the bounds follow the operators' error propagation rules, with the
+// value ranges of the operands from the range analysis. Products of error
+// terms are dropped, and so is accumulation across loop iterations: each
+// store is bounded once, reading values that carry one rounding.
+//
+// Error budgets cap the bounds a demoted variable may reach. They come from
+// annotations on the variable or its function,
+//   __attribute__((annotate("fp16_error_budget=1e-3")))      relative
+//   __attribute__((annotate("fp16_abs_error_budget=0.01")))  absolute
+// or from -fprecision-demote-error-budget=[NAME=]REL and
+// -fprecision-demote-abs-error-budget=[NAME=]ABS, NAME being a function, a
+// global variable or FUNCTION:VARIABLE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_ERROR_ANALYSIS_H
+#define FP16_ERROR_ANALYSIS_H
+
+#include "Fp16Formats.h"
+#include "Fp16Interval.h"
+#include "Fp16RangeAnalysis.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fp16demotion {
+
+// Bounds on |computed - exact| and on that divided by |exact| for a value
+// in Range. Infinite when nothing is known.
+struct ErrorBound {
+    Interval Range = Interval::top();
+    double Absolute = std::numeric_limits<double>::infinity();
+    double Relative = std::numeric_limits<double>::infinity();
+
+    static ErrorBound exact(const Interval &Range) { return {Range, 0, 0}; }
+};
+
+// Limits on the error of the values a demoted variable holds; unlimited
+// where not set.
+struct ErrorBudget {
+    double Relative = std::numeric_limits<double>::infinity();
+    double Absolute = std::numeric_limits<double>::infinity();
+
+    bool isSet() const { return std::isfinite(Relative) || std::isfinite(Absolute); }
+};
+
+// The budgets given on the command line
+struct ErrorBudgets {
+    ErrorBudget Default;
+    // Keyed by function, global variable or "FUNCTION:VARIABLE"
+    llvm::StringMap<ErrorBudget> Named;
+
+    bool empty() const { return !Default.isSet() && Named.empty(); }
+};
+
+// Applies the value of -fprecision-demote-error-budget= (or, with Absolute,
+// -fprecision-demote-abs-error-budget=) to Budgets. Returns false unless
+// Value is [NAME=]BOUND with a non-negative BOUND.
+bool parseErrorBudget(llvm::StringRef Value, bool Absolute, ErrorBudgets &Budgets);
+
+class ErrorAnalysis {
+public:
+    ErrorAnalysis(clang::ASTContext *Context, RangeAnalysis &Ranges)
+        : Context(Context), Ranges(Ranges) {}
+
+    void setBudgets(const ErrorBudgets *B) { Budgets = B; }
+
+    // The error of E evaluated in Format
+    ErrorBound bound(const clang::Expr *E, const FloatFormat &Format);
+
+    // The budget of VD: from its own annotation or name, else its
+    // function's, else the default, for each kind separately
+    ErrorBudget budgetFor(const clang::VarDecl *VD);
+
+    // Whether every value stored to VD (its initializer, assignments,
+    // compound assignments and increments) stays within VD's budget when
+    // computed in Format. Sets Why if not.
+    bool withinBudget(const clang::VarDecl *VD, const FloatFormat &Format, std::string &Why);
+
+private:
+    ErrorBound evaluate(const clang::Expr *Root, const FloatFormat &Format);
+    ErrorBound combine(const clang::Expr *E, const FloatFormat &Format);
+    ErrorBound leaf(const clang::Expr *E, const FloatFormat &Format);
+    const std::vector<const clang::Expr *> &storesTo(const clang::VarDecl *VD);
+
+    clang::ASTContext *Context;
+    RangeAnalysis &Ranges;
+    const ErrorBudgets *Budgets = nullptr;
+    // Keyed by the expression with parentheses and value-preserving casts
+    // stripped
+    llvm::DenseMap<std::pair<const clang::Expr *, const FloatFormat *>, ErrorBound> Bounds;
+    // Canonical variable -> assignments, compound assignments and
+    // increments in the main file; filled on first use
+    llvm::DenseMap<const clang::VarDecl *, std::vector<const clang::Expr *>> Stores;
+    bool CollectedStores = false;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_ERROR_ANALYSIS_H
@@ -0,0 +1,117 @@
+#include "Fp16Formats.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace fp16demotion {
+
+// The selectable formats, then binary32 for the double tier
+static const FloatFormat Formats[NumFloatFormats + 1] = {
+    {"fp16", "__fp16", "__fp16", 5, 10, true},
+    {"float16", "_Float16", "_Float16", 5, 10, true},
+    {"bf16", "__bf16", "__bf16", 8, 7, true},
+    {"fp8-e5m2", "fp8 E5M2", nullptr, 5, 2, true},
+    {"fp8-e4m3", "fp8 E4M3", nullptr, 4, 3, false},
+    {"float", "float", "float", 8, 23, true},
+};
+
+llvm::ArrayRef<FloatFormat> floatFormats() { return {Formats, NumFloatFormats}; }
+
+const FloatFormat *findFloatFormat(llvm::StringRef Name) {
+    for (const FloatFormat &F : floatFormats())
+        if (Name == F.Name)
+            return &F;
+    return nullptr;
+}
+
+unsigned formatIndex(const FloatFormat &F) { return unsigned(&F - Formats); }
+
+const FloatFormat &halfFormat() { return Formats[0]; }
+
+const FloatFormat &singleFormat() { return Formats[NumFloatFormats]; }
+
+bool parseFormatList(llvm::StringRef List, std::vector<const FloatFormat *> &Out) {
+    llvm::SmallVector<llvm::StringRef, 4> Names;
+    List.split(Names, ',');
+    std::vector<const FloatFormat *> Parsed;
+    for (llvm::StringRef Name : Names) {
+        const FloatFormat *F = findFloatFormat(Name.trim());
+        if (!F || llvm::is_contained(Parsed, F))
+            return false;
+        Parsed.push_back(F);
+    }
+    if (Parsed.empty())
+        return false;
+    std::stable_sort(Parsed.begin(), Parsed.end(),
+                     [](const FloatFormat *A, const FloatFormat *B) { return A->bits() < B->bits(); });
+    Out = std::move(Parsed);
+    return true;
+}
+
+double FloatFormat::maxFinite() const {
+    int MaxExponent = (1 << (ExponentBits - 1)) - 1;
+    if (HasInfinity)
+        return std::ldexp(2 - std::ldexp(1, -int(MantissaBits)), MaxExponent);
+    // The all-ones exponent is usable except for the all-ones mantissa.
+    return std::ldexp(2 - std::ldexp(1, 1 - int(MantissaBits)), MaxExponent + 1);
+}
+
+double FloatFormat::minNormal() const {
+    return std::ldexp(1, 2 - (1 << (ExponentBits - 1)));
+}
+
+double FloatFormat::simulate(double V) const {
+    if (V == 0 || !std::isfinite(V))
+        return V;
+    int Exponent;
+    std::frexp(V, &Exponent); // |V| = m * 2^Exponent, m in [0.5, 1)
+    int MinExponent = 2 - (1 << (ExponentBits - 1));
+    // The spacing of the values around V, constant below the normal range
+    int Quantum = std::max(Exponent - 1, MinExponent) - int(MantissaBits);
+    double Rounded = std::ldexp(std::nearbyint(std::ldexp(V, -Quantum)), Quantum);
+    if (std::fabs(Rounded) > maxFinite())
+        return HasInfinity ? std::copysign(std::numeric_limits<double>::infinity(), V)
+                           : std::numeric_limits<double>::quiet_NaN();
+    return Rounded;
+}
+
+FormatFit FloatFormat::fit(double V) const {
+    float Single = float(V);
+    double Abs = std::fabs(Single);
+    if (!std::isfinite(Single) || Abs > maxFinite() || (Abs > 0 && Abs < minNormal()))
+        return FormatFit::OutOfRange;
+    return simulate(V) == V ? FormatFit::Exact : FormatFit::Inexact;
+}
+
+bool FloatFormat::canHold(const Interval &Range, std::string *Reason) const {
+    if (Range.isEmpty())
+        return true;
+
+    auto Describe = [&](const std::string &What) {
+        if (Reason) {
+            char Buf[64];
+            snprintf(Buf, sizeof(Buf), "value range [%g, %g] ", Range.Lo, Range.Hi);
+            *Reason = Buf + What;
+        }
+        return false;
+    };
+    if (!Range.isBounded())
+        return Describe("is unbounded");
+    double Largest = std::max(std::fabs(Range.Lo), std::fabs(Range.Hi));
+    if (Largest > maxFinite())
+        return Describe(std::string("exceeds ") + Display + " range");
+    // Values below the normal range only lose precision if the whole range
+    // is there; otherwise intervals cannot tell.
+    if ((Range.Lo > 0 || Range.Hi < 0) && Largest < minNormal())
+        return Describe(std::string("is below ") + Display + " normal range");
+    return true;
+}
+
+float simulate_bf16(float value) { return float(Formats[2].simulate(value)); }
+float simulate_fp8_e5m2(float value) { return float(Formats[3].simulate(value)); }
+float simulate_fp8_e4m3(float value) { return float(Formats[4].simulate(value)); }
+
+} // namespace fp16demotion
@@ -0,0 +1,82 @@
+//===- Fp16Formats.h - Narrow floating-point formats -----------*- C++ -*-===//
+//
+// The formats float values can be demoted to, described by their exponent
+// and mantissa widths, and a rounding converter that works for all of them.
+// -fprecision-demote=LIST selects the formats tried; every float variable
+// and literal gets the smallest one it fits. Formats without a C type (the
+// fp8 formats) cannot be written into demoted.c and are only reported.
+// Doubles have a tier of their own with float as the only format.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_FORMATS_H
+#define FP16_FORMATS_H
+
+#include "Fp16Interval.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace fp16demotion {
+
+enum class FormatFit { Exact, OutOfRange, Inexact };
+
+struct FloatFormat {
+    const char *Name;     // As spelled in -fprecision-demote=LIST
+    const char *Display;  // In diagnostics and reasons
+    const char *TypeName; // The C type of demoted scalars; null if there is none
+    unsigned ExponentBits;
+    unsigned MantissaBits; // Stored, without the implicit bit
+    // Whether the all-ones exponent means infinity and NaN. Without, as in
+    // OCP fp8 E4M3, it holds normal values and only all ones is NaN.
+    bool HasInfinity;
+
+    unsigned bits() const { return 1 + ExponentBits + MantissaBits; }
+    double maxFinite() const;
+    double minNormal() const;
+
+    // V rounded to nearest, ties to even, keeping subnormals. Values beyond
+    // the largest finite one become infinity, or NaN without infinities.
+    double simulate(double V) const;
+
+    // How V converts: out of range if its float value is not finite, beyond
+    // the largest finite value or below the normal range; inexact if it
+    // does not survive the conversion.
+    FormatFit fit(double V) const;
+
+    // Returns false and sets Reason unless every value in Range survives
+    // conversion to this format
+    bool canHold(const Interval &Range, std::string *Reason = nullptr) const;
+};
+
+// All formats, in the order they are preferred at the same width
+llvm::ArrayRef<FloatFormat> floatFormats();
+const unsigned NumFloatFormats = 5;
+
+// The format named Name, or null
+const FloatFormat *findFloatFormat(llvm::StringRef Name);
+
+// The position of F in floatFormats(); NumFloatFormats for singleFormat()
+unsigned formatIndex(const FloatFormat &F);
+
+// IEEE binary16 as __fp16, the default
+const FloatFormat &halfFormat();
+
+// IEEE binary32, what doubles are demoted to (-fprecision-demote-double).
+// Not selectable in -fprecision-demote=LIST.
+const FloatFormat &singleFormat();
+
+// Parses a comma-separated list of format names into Out, narrowest first
+// and otherwise in list order. Returns false for an unknown or repeated
+// name or an empty list.
+bool parseFormatList(llvm::StringRef List, std::vector<const FloatFormat *> &Out);
+
+// Round-trip conversions through each format, for error estimates
+float simulate_bf16(float value);
+float simulate_fp8_e5m2(float value);
+float simulate_fp8_e4m3(float value);
+
+} // namespace fp16demotion
+
+#endif // FP16_FORMATS_H
@@ -0,0 +1,460 @@
+#include "Fp16FunctionSummaries.h"
+#include "Fp16Demotion.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+#include <cstdlib>
+
+namespace fp16demotion {
+
+//===----------------------------------------------------------------------===//
+// FunctionSummary
+//===----------------------------------------------------------------------===//
+
+std::string FunctionSummary::str() const {
+    char Buf[64];
+    snprintf(Buf, sizeof(Buf), "%.17g %.17g", Return.Lo, Return.Hi);
+    std::string Text = Buf;
+    if (!Expr.empty())
+        Text += " " + Expr;
+    return Text;
+}
+
+bool FunctionSummary::parse(llvm::StringRef Text, FunctionSummary &Out) {
+    llvm::StringRef Lo, Hi;
+    std::tie(Lo, Text) = Text.split(' ');
+    std::tie(Hi, Text) = Text.split(' ');
+    std::string LoStr = Lo.str(), HiStr = Hi.str();
+    char *End;
+    Out.Return.Lo = std::strtod(LoStr.c_str(), &End);
+    if (LoStr.empty() || *End)
+        return false;
+    Out.Return.Hi = std::strtod(HiStr.c_str(), &End);
+    if (HiStr.empty() || *End)
+        return false;
+    Out.Expr = Text.str();
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// <math.h> summaries
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+enum class MathFunction {
+    Unknown,
+    // Monotonically increasing on their domain
+    Sqrt, Cbrt, Exp, Exp2, Expm1, Log, Log2, Log10, Log1p, Sinh, Tanh, Asinh, Acosh,
+    Atanh, Atan, Asin, Erf, Floor, Ceil, Trunc, Round, Rint, NearbyInt,
+    // Monotonically decreasing on their domain
+    Acos, Erfc,
+    // Everything else
+    Sin, Cos, Tan, Cosh, Fabs, Fmin, Fmax, Fmod, Pow, Hypot, Atan2, Copysign, Fma,
+};
+
+} // namespace
+
+static MathFunction classifyMathFunction(llvm::StringRef Name) {
+    auto Classify = [](llvm::StringRef Base) {
+        return llvm::StringSwitch<MathFunction>(Base)
+            .Case("sqrt", MathFunction::Sqrt).Case("cbrt", MathFunction::Cbrt)
+            .Case("exp", MathFunction::Exp).Case("exp2", MathFunction::Exp2)
+            .Case("expm1", MathFunction::Expm1).Case("log", MathFunction::Log)
+            .Case("log2", MathFunction::Log2).Case("log10", MathFunction::Log10)
+            .Case("log1p", MathFunction::Log1p).Case("sinh", MathFunction::Sinh)
+            .Case("tanh", MathFunction::Tanh).Case("asinh", MathFunction::Asinh)
+            .Case("acosh", MathFunction::Acosh).Case("atanh", MathFunction::Atanh)
+            .Case("atan", MathFunction::Atan).Case("asin", MathFunction::Asin)
+            .Case("erf", MathFunction::Erf).Case("floor", MathFunction::Floor)
+            .Case("ceil", MathFunction::Ceil).Case("trunc", MathFunction::Trunc)
+            .Case("round", MathFunction::Round).Case("rint", MathFunction::Rint)
+            .Case("nearbyint", MathFunction::NearbyInt).Case("acos", MathFunction::Acos)
+            .Case("erfc", MathFunction::Erfc).Case("sin", MathFunction::Sin)
+            .Case("cos", MathFunction::Cos).Case("tan", MathFunction::Tan)
+            .Case("cosh", MathFunction::Cosh).Case("fabs", MathFunction::Fabs)
+            .Case("fmin", MathFunction::Fmin).Case("fmax", MathFunction::Fmax)
+            .Case("fmod", MathFunction::Fmod).Case("pow", MathFunction::Pow)
+            .Case("hypot", MathFunction::Hypot).Case("atan2", MathFunction::Atan2)
+            .Case("copysign", MathFunction::Copysign).Case("fma", MathFunction::Fma)
+            .Default(MathFunction::Unknown);
+    };
+    Name.consume_front("__builtin_");
+    MathFunction Kind = Classify(Name);
+    // sinf, sinl
+    if (Kind == MathFunction::Unknown && (Name.endswith("f") || Name.endswith("l")))
+        Kind = Classify(Name.drop_back());
+    return Kind;
+}
+
+bool isMathFunction(llvm::StringRef Name) {
+    return classifyMathFunction(Name) != MathFunction::Unknown;
+}
+
+static double callMath(MathFunction Kind, double X) {
+    switch (Kind) {
+    case MathFunction::Sqrt: return std::sqrt(X);
+    case MathFunction::Cbrt: return std::cbrt(X);
+    case MathFunction::Exp: return std::exp(X);
+    case MathFunction::Exp2: return std::exp2(X);
+    case MathFunction::Expm1: return std::expm1(X);
+    case MathFunction::Log: return std::log(X);
+    case MathFunction::Log2: return std::log2(X);
+    case MathFunction::Log10: return std::log10(X);
+    case MathFunction::Log1p: return std::log1p(X);
+    case MathFunction::Sinh: return std::sinh(X);
+    case MathFunction::Tanh: return std::tanh(X);
+    case MathFunction::Asinh: return std::asinh(X);
+    case MathFunction::Acosh: return std::acosh(X);
+    case MathFunction::Atanh: return std::atanh(X);
+    case MathFunction::Atan: return std::atan(X);
+    case MathFunction::Asin: return std::asin(X);
+    case MathFunction::Erf: return std::erf(X);
+    case MathFunction::Floor: return std::floor(X);
+    case MathFunction::Ceil: return std::ceil(X);
+    case MathFunction::Trunc: return std::trunc(X);
+    case MathFunction::Round: return std::round(X);
+    case MathFunction::Rint: return std::rint(X);
+    case MathFunction::NearbyInt: return std::nearbyint(X);
+    case MathFunction::Acos: return std::acos(X);
+    case MathFunction::Erfc: return std::erfc(X);
+    case MathFunction::Sin: return std::sin(X);
+    case MathFunction::Cos: return std::cos(X);
+    case MathFunction::Tan: return std::tan(X);
+    case MathFunction::Cosh: return std::cosh(X);
+    case MathFunction::Fabs: return std::fabs(X);
+    default: return std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+// Applies a function that is monotonic on its domain to an interval. Values
+// outside the domain produce NaN, so the result is top().
+static Interval applyMonotonic(MathFunction Kind, const Interval &X, bool Increasing) {
+    double A = callMath(Kind, X.Lo), B = callMath(Kind, X.Hi);
+    if (std::isnan(A) || std::isnan(B))
+        return Interval::top();
+    return Increasing ? Interval{A, B} : Interval{B, A};
+}
+
+static double magnitude(const Interval &X) { return std::max(std::fabs(X.Lo), std::fabs(X.Hi)); }
+
+bool evaluateMathFunction(llvm::StringRef Name, llvm::ArrayRef<Interval> Args, Interval &Result) {
+    MathFunction Kind = classifyMathFunction(Name);
+    if (Kind == MathFunction::Unknown)
+        return false;
+
+    unsigned Arity = 1;
+    switch (Kind) {
+    case MathFunction::Fmin: case MathFunction::Fmax: case MathFunction::Fmod:
+    case MathFunction::Pow: case MathFunction::Hypot: case MathFunction::Atan2:
+    case MathFunction::Copysign:
+        Arity = 2;
+        break;
+    case MathFunction::Fma:
+        Arity = 3;
+        break;
+    default:
+        break;
+    }
+    if (Args.size() != Arity)
+        return false;
+    for (const Interval &Arg : Args) {
+        if (Arg.isEmpty()) {
+            Result = Interval();
+            return true;
+        }
+    }
+
+    const Interval &X = Args[0];
+    // Exact for constant arguments of one-argument functions
+    if (Arity == 1 && X.Lo == X.Hi) {
+        double V = callMath(Kind, X.Lo);
+        Result = std::isnan(V) ? Interval::top() : Interval::point(V);
+        return true;
+    }
+
+    const double Pi = 3.14159265358979323846;
+    switch (Kind) {
+    case MathFunction::Acos: case MathFunction::Erfc:
+        Result = applyMonotonic(Kind, X, /*Increasing=*/false);
+        break;
+    case MathFunction::Sin: case MathFunction::Cos:
+        Result = {-1, 1};
+        break;
+    case MathFunction::Tan:
+        Result = Interval::top();
+        break;
+    case MathFunction::Cosh:
+        Result = {X.contains(0) ? 1.0 : std::cosh(std::min(std::fabs(X.Lo), std::fabs(X.Hi))),
+                  std::cosh(magnitude(X))};
+        break;
+    case MathFunction::Fabs:
+        Result = {X.contains(0) ? 0.0 : std::min(std::fabs(X.Lo), std::fabs(X.Hi)), magnitude(X)};
+        break;
+    case MathFunction::Fmin:
+        Result = {std::min(X.Lo, Args[1].Lo), std::min(X.Hi, Args[1].Hi)};
+        break;
+    case MathFunction::Fmax:
+        Result = {std::max(X.Lo, Args[1].Lo), std::max(X.Hi, Args[1].Hi)};
+        break;
+    case MathFunction::Fmod: {
+        // |fmod(x, y)| < |y| and has the sign of x
+        if (Args[1].contains(0)) {
+            Result = Interval::top();
+            break;
+        }
+        double M = std::min(magnitude(Args[1]), magnitude(X));
+        Result = {X.Lo < 0 ? -M : 0.0, X.Hi > 0 ? M : 0.0};
+        break;
+    }
+    case MathFunction::Pow:
+        // For a positive base x^y is monotonic in each argument, so the
+        // extremes are at the corners.
+        if (X.Lo > 0)
+            Result = Interval::hull(std::pow(X.Lo, Args[1].Lo), std::pow(X.Lo, Args[1].Hi),
+                                    std::pow(X.Hi, Args[1].Lo), std::pow(X.Hi, Args[1].Hi));
+        else if (X.Lo == X.Hi && Args[1].Lo == Args[1].Hi)
+            Result = Interval::point(std::pow(X.Lo, Args[1].Lo));
+        else
+            Result = Interval::top();
+        break;
+    case MathFunction::Hypot:
+        Result = {0, std::hypot(magnitude(X), magnitude(Args[1]))};
+        break;
+    case MathFunction::Atan2:
+        Result = {-Pi, Pi};
+        break;
+    case MathFunction::Copysign:
+        Result = {-magnitude(X), magnitude(X)};
+        break;
+    case MathFunction::Fma:
+        Result = X.mul(Args[1]).add(Args[2]);
+        break;
+    default:
+        Result = applyMonotonic(Kind, X, /*Increasing=*/true);
+        break;
+    }
+    if (std::isnan(Result.Lo) || std::isnan(Result.Hi))
+        Result = Interval::top();
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Summary expressions
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+class SummaryExprEvaluator {
+public:
+    SummaryExprEvaluator(
+        llvm::StringRef Text, llvm::ArrayRef<Interval> Args,
+        llvm::function_ref<Interval(llvm::StringRef, llvm::ArrayRef<Interval>)> Resolve)
+        : Rest(Text), Args(Args), Resolve(Resolve) {}
+
+    bool evaluate(Interval &Out) { return term(Out) && token().empty(); }
+
+private:
+    // Returns "(", ")", an atom, or an empty string at the end of the input.
+    llvm::StringRef token() {
+        Rest = Rest.ltrim();
+        if (Rest.empty())
+            return Rest;
+        size_t Len = 1;
+        if (Rest[0] != '(' && Rest[0] != ')')
+            Len = std::min(Rest.find_first_of(" ()"), Rest.size());
+        llvm::StringRef Tok = Rest.take_front(Len);
+        Rest = Rest.drop_front(Len);
+        return Tok;
+    }
+
+    bool number(double &Out) {
+        std::string Tok = token().str();
+        char *End;
+        Out = std::strtod(Tok.c_str(), &End);
+        return !Tok.empty() && !*End;
+    }
+
+    bool close() { return token() == ")"; }
+
+    bool term(Interval &Out) {
+        if (token() != "(")
+            return false;
+        llvm::StringRef Op = token();
+        Interval A, B;
+        if (Op == "num") {
+            double V;
+            if (!number(V))
+                return false;
+            Out = Interval::point(V);
+        } else if (Op == "range") {
+            if (!number(Out.Lo) || !number(Out.Hi))
+                return false;
+        } else if (Op == "arg") {
+            unsigned Index;
+            if (token().getAsInteger(10, Index) || Index >= Args.size())
+                return false;
+            Out = Args[Index];
+        } else if (Op == "neg" || Op == "trunc") {
+            if (!term(A))
+                return false;
+            Out = Op == "neg" ? A.neg() : A.trunc();
+        } else if (Op == "add" || Op == "sub" || Op == "mul" || Op == "div" || Op == "join") {
+            if (!term(A) || !term(B))
+                return false;
+            Out = llvm::StringSwitch<Interval>(Op)
+                      .Case("add", A.add(B))
+                      .Case("sub", A.sub(B))
+                      .Case("mul", A.mul(B))
+                      .Case("div", A.div(B))
+                      .Default(A.join(B));
+        } else if (Op == "call") {
+            llvm::StringRef Key = token();
+            std::vector<Interval> CallArgs;
+            while (Rest.ltrim().starts_with("(")) {
+                if (!term(A))
+                    return false;
+                CallArgs.push_back(A);
+            }
+            Out = Resolve(Key, CallArgs);
+        } else {
+            return false;
+        }
+        return close();
+    }
+
+    llvm::StringRef Rest;
+    llvm::ArrayRef<Interval> Args;
+    llvm::function_ref<Interval(llvm::StringRef, llvm::ArrayRef<Interval>)> Resolve;
+};
+
+} // namespace
+
+Interval evaluateSummaryExpr(
+    llvm::StringRef Expr, llvm::ArrayRef<Interval> Args,
+    llvm::function_ref<Interval(llvm::StringRef Key, llvm::ArrayRef<Interval> Args)> Resolve) {
+    Interval Result;
+    SummaryExprEvaluator Evaluator(Expr, Args, Resolve);
+    if (!Evaluator.evaluate(Result))
+        return Interval::top();
+    return Result;
+}
+
+//===----------------------------------------------------------------------===//
+// SummaryDatabase
+//===----------------------------------------------------------------------===//
+
+std::string SummaryDatabase::pathFor(llvm::StringRef MainFile) const {
+    auto Hash = llvm::SHA256::hash(llvm::arrayRefFromStringRef(MainFile));
+    llvm::SmallString<256> Path(Dir);
+    llvm::sys::path::append(Path, llvm::toHex(llvm::ArrayRef<uint8_t>(Hash).take_front(8),
+                                              /*LowerCase=*/true) + ".json");
+    return std::string(Path);
+}
+
+void SummaryDatabase::loadLocked() {
+    if (Loaded)
+        return;
+    Loaded = true;
+
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC;
+         It.increment(EC)) {
+        if (llvm::sys::path::extension(It->path()) != ".json")
+            continue;
+        auto Buffer = llvm::MemoryBuffer::getFile(It->path());
+        if (!Buffer)
+            continue;
+        llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse((*Buffer)->getBuffer());
+        if (!Parsed) {
+            llvm::consumeError(Parsed.takeError());
+            continue;
+        }
+        const llvm::json::Object *O = Parsed->getAsObject();
+        if (!O || O->getString("version") != llvm::StringRef(FP16_DEMOTION_VERSION))
+            continue;
+        auto File = O->getString("file");
+        const llvm::json::Object *Summaries = O->getObject("functions");
+        if (!File || !Summaries)
+            continue;
+
+        std::vector<std::string> &Keys = KeysByFile[*File];
+        for (const auto &Entry : *Summaries) {
+            FunctionSummary Summary;
+            auto Text = Entry.second.getAsString();
+            if (!Text || !FunctionSummary::parse(*Text, Summary))
+                continue;
+            Functions[Entry.first.str()] = std::move(Summary);
+            Keys.push_back(Entry.first.str());
+        }
+    }
+}
+
+bool SummaryDatabase::lookup(llvm::StringRef Key, FunctionSummary &Out) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    loadLocked();
+    auto It = Functions.find(Key);
+    if (It == Functions.end())
+        return false;
+    Out = It->second;
+    return true;
+}
+
+void SummaryDatabase::storeTranslationUnit(llvm::StringRef MainFile,
+                                           const std::vector<NamedSummary> &Summaries) {
+    if (MainFile.empty())
+        return;
+
+    llvm::json::Object Functions;
+    for (const NamedSummary &Entry : Summaries)
+        Functions[Entry.first] = Entry.second.str();
+    llvm::json::Value File = llvm::json::Object{
+        {"version", FP16_DEMOTION_VERSION},
+        {"file", MainFile},
+        {"functions", std::move(Functions)},
+    };
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    loadLocked();
+    std::vector<std::string> &Keys = KeysByFile[MainFile];
+    for (const std::string &Key : Keys)
+        this->Functions.erase(Key);
+    Keys.clear();
+    for (const NamedSummary &Entry : Summaries) {
+        this->Functions[Entry.first] = Entry.second;
+        Keys.push_back(Entry.first);
+    }
+
+    llvm::sys::fs::create_directories(Dir);
+    std::string Path = pathFor(MainFile);
+    llvm::Error Err = llvm::writeToOutput(Path, [&](llvm::raw_ostream &OS) {
+        OS << File;
+        return llvm::Error::success();
+    });
+    if (Err)
+        llvm::errs() << "Warning: cannot write function summaries " << Path << ": "
+                     << llvm::toString(std::move(Err)) << "\n";
+}
+
+bool SummaryDatabase::isCurrent(
+    const std::vector<std::pair<std::string, std::string>> &Dependencies) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    loadLocked();
+    for (const auto &Dep : Dependencies) {
+        auto It = Functions.find(Dep.first);
+        std::string Current = It == Functions.end() ? std::string() : It->second.str();
+        if (Current != Dep.second)
+            return false;
+    }
+    return true;
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,92 @@
+//===- Fp16FunctionSummaries.h - Interprocedural range summaries -*- C++ -*-===//
+//
+// A function summary describes the range of a function's return value in
+// terms of the ranges of its arguments, so that a call no longer has to be
+// treated as returning an arbitrary value. Summaries come from three places:
+// built-in transfer functions for <math.h>, the bodies of functions defined
+// in the translation unit (computed by RangeAnalysis) and a summary database
+// that translation units share through a directory
+// (-fprecision-demote-summaries=DIR).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_FUNCTION_SUMMARIES_H
+#define FP16_FUNCTION_SUMMARIES_H
+
+#include "Fp16Interval.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fp16demotion {
+
+struct FunctionSummary {
+    // Range of the return value when nothing is known about the arguments.
+    Interval Return;
+
+    // The return value as an interval expression over the arguments, for
+    // functions that compute and return a single expression; empty
+    // otherwise. Prefix notation:
+    //   (arg N) (num V) (range LO HI) (neg E) (trunc E)
+    //   (add E E) (sub E E) (mul E E) (div E E) (join E E)
+    //   (call KEY E...)
+    std::string Expr;
+
+    // Single-line textual form, also used to compare summaries.
+    std::string str() const;
+    static bool parse(llvm::StringRef Text, FunctionSummary &Out);
+};
+
+// A summary together with the key it is looked up by: the mangled name of
+// an externally visible function.
+using NamedSummary = std::pair<std::string, FunctionSummary>;
+
+// True if Name is a <math.h> function with a built-in summary.
+bool isMathFunction(llvm::StringRef Name);
+
+// Applies the built-in summary of the <math.h> function Name (sinf, sqrt,
+// __builtin_expf, ...). Returns false if Name is not one of them.
+bool evaluateMathFunction(llvm::StringRef Name, llvm::ArrayRef<Interval> Args, Interval &Result);
+
+// Evaluates a summary expression for the given argument ranges. Calls are
+// resolved through Resolve. Malformed expressions evaluate to top().
+Interval evaluateSummaryExpr(
+    llvm::StringRef Expr, llvm::ArrayRef<Interval> Args,
+    llvm::function_ref<Interval(llvm::StringRef Key, llvm::ArrayRef<Interval> Args)> Resolve);
+
+// Summaries of externally visible functions, one JSON file per translation
+// unit, so that concurrent compiler processes never write the same file.
+// Thread-safe.
+class SummaryDatabase {
+public:
+    explicit SummaryDatabase(std::string Dir) : Dir(std::move(Dir)) {}
+
+    bool lookup(llvm::StringRef Key, FunctionSummary &Out);
+
+    // Replaces everything previously stored for MainFile.
+    void storeTranslationUnit(llvm::StringRef MainFile, const std::vector<NamedSummary> &Summaries);
+
+    // Dependencies are (key, FunctionSummary::str() or "" if none) pairs as
+    // recorded by RangeAnalysis. Returns true if every lookup would still
+    // give the same answer.
+    bool isCurrent(const std::vector<std::pair<std::string, std::string>> &Dependencies);
+
+private:
+    void loadLocked();
+    std::string pathFor(llvm::StringRef MainFile) const;
+
+    std::string Dir;
+    std::mutex Mutex; // Guards the fields below
+    bool Loaded = false;
+    llvm::StringMap<FunctionSummary> Functions;
+    llvm::StringMap<std::vector<std::string>> KeysByFile;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_FUNCTION_SUMMARIES_H
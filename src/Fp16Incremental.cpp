@@ -0,0 +1,612 @@
+#include "Fp16Incremental.h"
+#include "Fp16AnalysisCache.h"
+#include "Fp16Demotion.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include <algorithm>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+std::string stableDeclName(const NamedDecl *D) {
+    if (const auto *FD = dyn_cast<FieldDecl>(D)) {
+        const RecordDecl *RD = FD->getParent();
+        std::string Record = "(anonymous)";
+        if (RD->getDeclName())
+            Record = RD->getQualifiedNameAsString();
+        else if (const TypedefNameDecl *TD = RD->getTypedefNameForAnonDecl())
+            Record = TD->getQualifiedNameAsString();
+        return Record + "::" + FD->getNameAsString();
+    }
+    return D->getQualifiedNameAsString();
+}
+
+//===----------------------------------------------------------------------===//
+// Fingerprints
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+// The function definitions, and the globals, static locals and fields, that
+// the code under a node refers to.
+class ReferenceCollector : public RecursiveASTVisitor<ReferenceCollector> {
+public:
+    bool VisitDeclRefExpr(DeclRefExpr *E) {
+        add(E->getDecl());
+        return true;
+    }
+    bool VisitMemberExpr(MemberExpr *E) {
+        add(E->getMemberDecl());
+        return true;
+    }
+    bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+        add(E->getConstructor());
+        return true;
+    }
+
+    std::vector<const Decl *> Functions;
+    std::vector<const ValueDecl *> Objects; // Canonical
+
+private:
+    void add(const ValueDecl *D) {
+        if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+            if (const FunctionDecl *Def = FD->getDefinition())
+                Functions.push_back(Def);
+        } else if (const auto *VD = dyn_cast<VarDecl>(D)) {
+            if (!VD->hasLocalStorage())
+                Objects.push_back(VD->getCanonicalDecl());
+        } else if (isa<FieldDecl>(D)) {
+            Objects.push_back(D);
+        }
+    }
+};
+
+// The bodies RangeAnalysis analyzes separately: the function itself and
+// the lambdas, blocks and local class methods inside it, in order.
+class NestedBodyCollector : public RecursiveASTVisitor<NestedBodyCollector> {
+public:
+    bool VisitFunctionDecl(FunctionDecl *FD) {
+        if (FD->doesThisDeclarationHaveABody())
+            Bodies.push_back(FD);
+        return true;
+    }
+    bool VisitLambdaExpr(LambdaExpr *LE) {
+        Bodies.push_back(LE->getCallOperator());
+        return true;
+    }
+    bool VisitBlockDecl(BlockDecl *BD) {
+        Bodies.push_back(BD);
+        return true;
+    }
+
+    std::vector<const Decl *> Bodies;
+};
+
+// A function definition or the initializer of a global in the main file.
+// Entities whose text can be cut out of the main file are fingerprinted by
+// that text; the others stay part of the context.
+struct Entity {
+    const Decl *D;
+    unsigned Begin = 0, End = 0; // Byte range in the main file
+    bool Cut = false;
+};
+
+// Functions and initialized globals declared in DC and the namespaces and
+// linkage specifications of the main file inside it, in order.
+void collectEntities(const DeclContext *DC, const SourceManager &SM,
+                     std::vector<Entity> &Out) {
+    for (const Decl *D : DC->decls()) {
+        if (!SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            continue;
+        if (isa<NamespaceDecl>(D) || isa<LinkageSpecDecl>(D)) {
+            collectEntities(cast<DeclContext>(D), SM, Out);
+        } else if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+            if (FD->doesThisDeclarationHaveABody() && !FD->isTemplated())
+                Out.push_back({FD});
+        } else if (const auto *VD = dyn_cast<VarDecl>(D)) {
+            if (VD->getInit() && !VD->isTemplated())
+                Out.push_back({VD});
+        }
+    }
+}
+
+// The byte range of R in the main file, if R is written there outside of
+// macros and spans no preprocessor directive, which could affect the code
+// after it.
+bool cutRange(const SourceManager &SM, const LangOptions &LangOpts, SourceRange R,
+              unsigned &Begin, unsigned &End) {
+    SourceLocation B = R.getBegin(), E = R.getEnd();
+    if (B.isInvalid() || E.isInvalid() || !B.isFileID() || !E.isFileID() ||
+        !SM.isWrittenInMainFile(B) || !SM.isWrittenInMainFile(E))
+        return false;
+    Begin = SM.getFileOffset(B);
+    End = SM.getFileOffset(E) + Lexer::MeasureTokenLength(E, SM, LangOpts);
+    llvm::StringRef Buffer = SM.getBufferData(SM.getMainFileID());
+    if (Begin >= End || End > Buffer.size())
+        return false;
+    llvm::StringRef Text = Buffer.slice(Begin, End);
+    for (size_t Pos = Text.find('\n'); Pos != llvm::StringRef::npos;
+         Pos = Text.find('\n', Pos + 1)) {
+        llvm::StringRef Line = Text.drop_front(Pos + 1).ltrim(" \t");
+        if (Line.starts_with("#"))
+            return false;
+    }
+    return true;
+}
+
+void addField(llvm::SHA256 &Hasher, llvm::StringRef Bytes) {
+    // Length-prefixed so that adjacent fields cannot alias.
+    uint32_t Length = Bytes.size();
+    Hasher.update(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&Length),
+                                          sizeof(Length)));
+    Hasher.update(Bytes);
+}
+
+std::string hashText(llvm::StringRef Text) {
+    auto Hash = llvm::SHA256::hash(llvm::arrayRefFromStringRef(Text));
+    return std::string(Hash.begin(), Hash.end());
+}
+
+} // namespace
+
+void IncrementalState::fingerprint(ASTContext &Context) {
+    const SourceManager &SM = Context.getSourceManager();
+    FileID Main = SM.getMainFileID();
+    llvm::StringRef Buffer = SM.getBufferData(Main);
+
+    std::vector<Entity> Entities;
+    collectEntities(Context.getTranslationUnitDecl(), SM, Entities);
+    for (Entity &E : Entities) {
+        SourceRange Range = E.D->getSourceRange();
+        if (const auto *VD = dyn_cast<VarDecl>(E.D))
+            Range = VD->getInit()->getSourceRange();
+        E.Cut = cutRange(SM, Context.getLangOpts(), Range, E.Begin, E.End);
+    }
+    std::vector<Entity *> Cuts;
+    for (Entity &E : Entities)
+        if (E.Cut)
+            Cuts.push_back(&E);
+    llvm::sort(Cuts, [](const Entity *A, const Entity *B) { return A->Begin < B->Begin; });
+    unsigned Pos = 0;
+    for (Entity *E : Cuts) {
+        if (E->Begin < Pos)
+            E->Cut = false; // Inside the previous one, whose text covers it
+        else
+            Pos = E->End;
+    }
+
+    // Everything but the text of the cut entities
+    llvm::SHA256 ContextHasher;
+    addField(ContextHasher, Salt);
+    Pos = 0;
+    for (const Entity *E : Cuts) {
+        if (!E->Cut)
+            continue;
+        addField(ContextHasher, Buffer.slice(Pos, E->Begin));
+        Pos = E->End;
+    }
+    addField(ContextHasher, Buffer.drop_front(Pos));
+    const SrcMgr::ContentCache *MainContent = &SM.getSLocEntry(Main).getFile().getContentCache();
+    std::vector<std::string> Headers;
+    for (auto It = SM.fileinfo_begin(), End = SM.fileinfo_end(); It != End; ++It) {
+        const SrcMgr::ContentCache *Content = It->second;
+        if (Content == MainContent || !Content->OrigEntry)
+            continue;
+        std::string Header;
+        llvm::raw_string_ostream OS(Header);
+        OS << Content->OrigEntry->getName() << '\n' << Content->OrigEntry->getSize() << '\n'
+           << int64_t(Content->OrigEntry->getModificationTime());
+        Headers.push_back(OS.str());
+    }
+    llvm::sort(Headers);
+    for (const std::string &Header : Headers)
+        addField(ContextHasher, Header);
+    // Buffers without a file: the predefined and command-line macros. The
+    // scratch space holds tokens pasted in the main file, which is already
+    // covered.
+    for (unsigned I = 0, N = SM.local_sloc_entry_size(); I != N; ++I) {
+        const SrcMgr::SLocEntry &Entry = SM.getLocalSLocEntry(I);
+        if (!Entry.isFile())
+            continue;
+        const SrcMgr::ContentCache &Content = Entry.getFile().getContentCache();
+        if (&Content == MainContent || Content.OrigEntry)
+            continue;
+        if (auto Loaded = Content.getBufferIfLoaded())
+            if (Loaded->getBufferIdentifier() != "<scratch space>")
+                addField(ContextHasher, Loaded->getBuffer());
+    }
+    auto ContextHash = ContextHasher.final();
+
+    llvm::DenseMap<const Decl *, std::string> TextHashes;
+    for (const Entity &E : Entities)
+        if (E.Cut)
+            TextHashes[E.D] = hashText(Buffer.slice(E.Begin, E.End));
+
+    llvm::DenseMap<const Decl *, ReferenceCollector> References;
+    auto ReferencesOf = [&](const Decl *D) -> const ReferenceCollector & {
+        auto It = References.find(D);
+        if (It != References.end())
+            return It->second;
+        ReferenceCollector &Collector = References[D];
+        if (const auto *VD = dyn_cast<VarDecl>(D))
+            Collector.TraverseStmt(const_cast<Expr *>(VD->getInit()));
+        else
+            Collector.TraverseDecl(const_cast<Decl *>(D));
+        return Collector;
+    };
+
+    // The range of a global or field is the join of what every function
+    // stores to it, so reading one depends on all the main file entities
+    // that name it.
+    llvm::DenseMap<const ValueDecl *, std::vector<const Decl *>> Mentions;
+    for (const Entity &E : Entities)
+        for (const ValueDecl *Object : ReferencesOf(E.D).Objects)
+            Mentions[Object].push_back(E.D);
+
+    for (const Entity &E : Entities) {
+        const auto *FD = dyn_cast<FunctionDecl>(E.D);
+        if (!FD || !E.Cut)
+            continue;
+
+        // Everything FD reaches, through headers too: an inline function
+        // there may call back into the main file.
+        llvm::DenseSet<const Decl *> Reached = {FD};
+        llvm::DenseSet<const ValueDecl *> ReachedObjects;
+        std::vector<const Decl *> Worklist = {FD};
+        auto Reach = [&](const Decl *D) {
+            if (Reached.insert(D).second)
+                Worklist.push_back(D);
+        };
+        std::vector<std::string> Texts;
+        while (!Worklist.empty()) {
+            const Decl *D = Worklist.back();
+            Worklist.pop_back();
+            auto Text = TextHashes.find(D);
+            if (Text != TextHashes.end())
+                Texts.push_back(Text->second);
+            const ReferenceCollector &Refs = ReferencesOf(D);
+            for (const Decl *Callee : Refs.Functions)
+                Reach(Callee);
+            for (const ValueDecl *Object : Refs.Objects) {
+                if (!ReachedObjects.insert(Object).second)
+                    continue;
+                const VarDecl *InitDecl = nullptr;
+                if (const auto *VD = dyn_cast<VarDecl>(Object))
+                    if (VD->getAnyInitializer(InitDecl))
+                        Reach(InitDecl);
+                for (const Decl *Mention : Mentions.lookup(Object))
+                    Reach(Mention);
+            }
+        }
+        llvm::sort(Texts);
+
+        llvm::SHA256 Hasher;
+        Hasher.update(ContextHash);
+        addField(Hasher, FD->getQualifiedNameAsString());
+        for (const std::string &Text : Texts)
+            addField(Hasher, Text);
+        auto Hash = Hasher.final();
+        std::string Fingerprint =
+            llvm::toHex(llvm::ArrayRef<uint8_t>(Hash).take_front(16), /*LowerCase=*/true);
+
+        NestedBodyCollector Nested;
+        Nested.TraverseDecl(const_cast<FunctionDecl *>(FD));
+        for (size_t I = 0; I < Nested.Bodies.size(); ++I)
+            Bodies[Nested.Bodies[I]] = Fingerprint + "/" + std::to_string(I);
+        Functions[FD] = std::move(Fingerprint);
+    }
+}
+
+const std::vector<CachedVerdict> *IncrementalState::findVerdicts(const Decl *FD) {
+    auto Key = Functions.find(FD);
+    if (Key == Functions.end())
+        return nullptr;
+    auto Current = Verdicts.find(Key->second);
+    if (Current != Verdicts.end())
+        return &Current->second;
+    auto Old = OldVerdicts.find(Key->second);
+    if (Old == OldVerdicts.end()) {
+        ++Analyzed;
+        return nullptr;
+    }
+    ++Reused;
+    std::vector<CachedVerdict> &Found = Verdicts[Key->second];
+    Found = std::move(Old->second);
+    OldVerdicts.erase(Old);
+    return &Found;
+}
+
+void IncrementalState::storeVerdicts(const Decl *FD, std::vector<CachedVerdict> Found) {
+    auto Key = Functions.find(FD);
+    if (Key != Functions.end())
+        Verdicts[Key->second] = std::move(Found);
+}
+
+const BodyEffects *IncrementalState::findEffects(const Decl *Body) {
+    auto Key = Bodies.find(Body);
+    if (Key == Bodies.end())
+        return nullptr;
+    auto Current = Effects.find(Key->second);
+    if (Current != Effects.end())
+        return &Current->second;
+    auto Old = OldEffects.find(Key->second);
+    if (Old == OldEffects.end())
+        return nullptr;
+    BodyEffects &Found = Effects[Key->second];
+    Found = std::move(Old->second);
+    OldEffects.erase(Old);
+    return &Found;
+}
+
+void IncrementalState::storeEffects(const Decl *Body, BodyEffects Found) {
+    auto Key = Bodies.find(Body);
+    if (Key != Bodies.end())
+        Effects[Key->second] = std::move(Found);
+}
+
+void IncrementalState::mergeSummaryDeps(std::vector<std::pair<std::string, std::string>> &Deps) {
+    // This analysis's own lookups are the current answers.
+    llvm::StringMap<std::string> Merged;
+    for (const auto &Dep : SummaryDeps)
+        Merged[Dep.first] = Dep.second;
+    for (const auto &Dep : Deps)
+        Merged[Dep.first] = Dep.second;
+    Deps.clear();
+    for (const auto &Entry : Merged)
+        Deps.emplace_back(Entry.getKey().str(), Entry.getValue());
+    llvm::sort(Deps);
+    SummaryDeps = Deps;
+}
+
+//===----------------------------------------------------------------------===//
+// IncrementalStore
+//===----------------------------------------------------------------------===//
+
+static llvm::json::Value encodeInterval(const Interval &V) {
+    return llvm::json::Array{encodeDouble(V.Lo), encodeDouble(V.Hi)};
+}
+
+static bool decodeInterval(const llvm::json::Value *V, Interval &Out) {
+    const llvm::json::Array *A = V ? V->getAsArray() : nullptr;
+    return A && A->size() == 2 && decodeDouble(&(*A)[0], Out.Lo) &&
+           decodeDouble(&(*A)[1], Out.Hi);
+}
+
+// As [name, lo, hi] triples
+static llvm::json::Array encodeValues(const std::vector<std::pair<std::string, Interval>> &Values) {
+    llvm::json::Array A;
+    for (const auto &Value : Values)
+        A.push_back(llvm::json::Array{Value.first, encodeDouble(Value.second.Lo),
+                                      encodeDouble(Value.second.Hi)});
+    return A;
+}
+
+static bool decodeValues(const llvm::json::Array *A,
+                         std::vector<std::pair<std::string, Interval>> &Out) {
+    if (!A)
+        return false;
+    for (const llvm::json::Value &V : *A) {
+        const llvm::json::Array *Triple = V.getAsArray();
+        if (!Triple || Triple->size() != 3)
+            return false;
+        auto Name = (*Triple)[0].getAsString();
+        Interval Value;
+        if (!Name || !decodeDouble(&(*Triple)[1], Value.Lo) ||
+            !decodeDouble(&(*Triple)[2], Value.Hi))
+            return false;
+        Out.emplace_back(Name->str(), Value);
+    }
+    return true;
+}
+
+static llvm::json::Array encodeNames(const std::vector<std::string> &Names) {
+    llvm::json::Array A;
+    for (const std::string &Name : Names)
+        A.push_back(Name);
+    return A;
+}
+
+static bool decodeNames(const llvm::json::Array *A, std::vector<std::string> &Out) {
+    if (!A)
+        return false;
+    for (const llvm::json::Value &V : *A) {
+        auto Name = V.getAsString();
+        if (!Name)
+            return false;
+        Out.push_back(Name->str());
+    }
+    return true;
+}
+
+llvm::json::Value IncrementalStore::encode(const IncrementalState &State) {
+    // Results of unchanged functions that this analysis did not need are
+    // kept too; those of functions that are gone are dropped.
+    auto Lookup = [](const auto &Current, const auto &Old, llvm::StringRef Key) {
+        auto It = Current.find(Key);
+        if (It != Current.end())
+            return &It->second;
+        It = Old.find(Key);
+        return It != Old.end() ? &It->second : nullptr;
+    };
+
+    llvm::json::Object Verdicts;
+    for (const auto &Function : State.Functions) {
+        const auto *Found = Lookup(State.Verdicts, State.OldVerdicts, Function.second);
+        if (!Found)
+            continue;
+        llvm::json::Array List;
+        for (const CachedVerdict &V : *Found)
+            List.push_back(llvm::json::Array{int64_t(V.Fits), V.Reason});
+        Verdicts[Function.second] = std::move(List);
+    }
+
+    llvm::json::Object Bodies;
+    for (const auto &Body : State.Bodies) {
+        const BodyEffects *E = Lookup(State.Effects, State.OldEffects, Body.second);
+        if (!E)
+            continue;
+        Bodies[Body.second] = llvm::json::Object{
+            {"succeeded", E->Succeeded},
+            {"return", encodeInterval(E->Return)},
+            {"stores", encodeValues(E->Stores)},
+            {"field_stores", encodeValues(E->FieldStores)},
+            {"element_stores", encodeValues(E->ElementStores)},
+            {"field_element_stores", encodeValues(E->FieldElementStores)},
+            {"escapes", encodeNames(E->Escapes)},
+            {"field_escapes", encodeNames(E->FieldEscapes)},
+        };
+    }
+
+    llvm::json::Array Deps;
+    for (const auto &D : State.SummaryDeps)
+        Deps.push_back(llvm::json::Array{D.first, D.second});
+
+    return llvm::json::Object{
+        {"version", FP16_DEMOTION_VERSION},
+        {"file", State.MainFile},
+        {"summary_deps", std::move(Deps)},
+        {"verdicts", std::move(Verdicts)},
+        {"bodies", std::move(Bodies)},
+    };
+}
+
+bool IncrementalStore::decode(const llvm::json::Value &V, IncrementalState &Out) {
+    const llvm::json::Object *O = V.getAsObject();
+    if (!O || O->getString("version") != llvm::StringRef(FP16_DEMOTION_VERSION) ||
+        O->getString("file") != llvm::StringRef(Out.MainFile))
+        return false;
+
+    const llvm::json::Array *Deps = O->getArray("summary_deps");
+    const llvm::json::Object *Verdicts = O->getObject("verdicts");
+    const llvm::json::Object *Bodies = O->getObject("bodies");
+    if (!Deps || !Verdicts || !Bodies)
+        return false;
+
+    for (const llvm::json::Value &DV : *Deps) {
+        const llvm::json::Array *Pair = DV.getAsArray();
+        if (!Pair || Pair->size() != 2)
+            return false;
+        auto Key = (*Pair)[0].getAsString();
+        auto Summary = (*Pair)[1].getAsString();
+        if (!Key || !Summary)
+            return false;
+        Out.SummaryDeps.emplace_back(Key->str(), Summary->str());
+    }
+
+    for (const auto &Entry : *Verdicts) {
+        const llvm::json::Array *List = Entry.second.getAsArray();
+        if (!List)
+            return false;
+        std::vector<CachedVerdict> &Found = Out.OldVerdicts[Entry.first.str()];
+        for (const llvm::json::Value &VV : *List) {
+            const llvm::json::Array *Pair = VV.getAsArray();
+            if (!Pair || Pair->size() != 2)
+                return false;
+            auto Fits = (*Pair)[0].getAsInteger();
+            auto Reason = (*Pair)[1].getAsString();
+            if (!Fits || *Fits < 0 || *Fits >= (1 << (NumFloatFormats + 1)) || !Reason)
+                return false;
+            Found.push_back({unsigned(*Fits), Reason->str()});
+        }
+    }
+
+    for (const auto &Entry : *Bodies) {
+        const llvm::json::Object *B = Entry.second.getAsObject();
+        if (!B)
+            return false;
+        BodyEffects &E = Out.OldEffects[Entry.first.str()];
+        auto Succeeded = B->getBoolean("succeeded");
+        if (!Succeeded || !decodeInterval(B->get("return"), E.Return) ||
+            !decodeValues(B->getArray("stores"), E.Stores) ||
+            !decodeValues(B->getArray("field_stores"), E.FieldStores) ||
+            !decodeValues(B->getArray("element_stores"), E.ElementStores) ||
+            !decodeValues(B->getArray("field_element_stores"), E.FieldElementStores) ||
+            !decodeNames(B->getArray("escapes"), E.Escapes) ||
+            !decodeNames(B->getArray("field_escapes"), E.FieldEscapes))
+            return false;
+        E.Succeeded = *Succeeded;
+    }
+    return true;
+}
+
+IncrementalStore::IncrementalStore(std::string Dir, llvm::ArrayRef<std::string> AnalysisArgs)
+    : Dir(std::move(Dir)) {
+    llvm::raw_string_ostream OS(Salt);
+    OS << FP16_DEMOTION_VERSION << '\0' << getClangFullVersion();
+    for (const std::string &Arg : AnalysisArgs)
+        OS << '\0' << Arg;
+}
+
+std::string IncrementalStore::pathFor(llvm::StringRef MainFile) const {
+    auto Hash = llvm::SHA256::hash(llvm::arrayRefFromStringRef(MainFile));
+    llvm::SmallString<256> Path(Dir);
+    llvm::sys::path::append(Path, llvm::toHex(llvm::ArrayRef<uint8_t>(Hash).take_front(8),
+                                              /*LowerCase=*/true) + ".incremental.json");
+    return std::string(Path);
+}
+
+std::unique_ptr<IncrementalState> IncrementalStore::load(llvm::StringRef MainFile,
+                                                         SummaryDatabase *Summaries) {
+    auto Fresh = [&] {
+        auto State = std::make_unique<IncrementalState>();
+        State->MainFile = MainFile.str();
+        State->Salt = Salt;
+        return State;
+    };
+    std::unique_ptr<IncrementalState> State = Fresh();
+
+    auto Buffer = llvm::MemoryBuffer::getFile(pathFor(MainFile));
+    if (!Buffer)
+        return State;
+    llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse((*Buffer)->getBuffer());
+    if (!Parsed) {
+        llvm::consumeError(Parsed.takeError());
+        return State;
+    }
+    // Stale or truncated files are replaced by the next save.
+    if (!decode(*Parsed, *State) ||
+        (Summaries && !Summaries->isCurrent(State->SummaryDeps)))
+        return Fresh();
+    return State;
+}
+
+void IncrementalStore::save(const IncrementalState &State) {
+    Stats.Reused += State.Reused;
+    Stats.Analyzed += State.Analyzed;
+    if (State.MainFile.empty())
+        return;
+
+    std::string Path = pathFor(State.MainFile);
+    llvm::sys::fs::create_directories(Dir);
+    llvm::Error Err = llvm::writeToOutput(Path, [&](llvm::raw_ostream &OS) {
+        OS << encode(State);
+        return llvm::Error::success();
+    });
+    if (Err)
+        llvm::errs() << "Warning: cannot write incremental state " << Path << ": "
+                     << llvm::toString(std::move(Err)) << "\n";
+}
+
+void IncrementalStore::printStats(llvm::raw_ostream &OS) const {
+    uint64_t Reused = Stats.Reused, Analyzed = Stats.Analyzed;
+    OS << "Incremental analysis: " << Reused << " functions reused, " << Analyzed
+       << " analyzed";
+    if (Reused + Analyzed)
+        OS << " (" << (Reused * 100 / (Reused + Analyzed)) << "% reused)";
+    OS << "\n";
+}
+
+} // namespace fp16demotion
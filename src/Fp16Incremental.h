@@ -0,0 +1,156 @@
+//===- Fp16Incremental.h - Function-granular reanalysis --------*- C++ -*-===//
+//
+// Incremental analysis for files that are edited and reanalyzed over and
+// over (-fprecision-demote-incremental=DIR). Every function defined in the
+// main file is fingerprinted, and what analyzing it produced is kept under
+// its fingerprint: the verdicts of its float variables and literals, and
+// what its body contributes to the ranges of globals, fields and arrays.
+// The next analysis of the file takes both from there for every function
+// whose fingerprint has not changed. Records, transformations and memory
+// counters are still built from the new AST, so locations and offsets
+// follow the edit.
+//
+// A fingerprint covers the function's own text, the text of the functions
+// and global initializers of the main file it references and of those that
+// name a global or field it uses, transitively, and everything else the
+// analysis sees as one context: the rest of the main file, the headers (by
+// name, size and modification time), the predefined macros and the analysis
+// arguments. Editing a function body or a global initializer invalidates the
+// functions that reach it; any other edit invalidates the whole file.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_INCREMENTAL_H
+#define FP16_INCREMENTAL_H
+
+#include "Fp16FunctionSummaries.h"
+#include "Fp16Interval.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fp16demotion {
+
+// The verdict of one float variable or literal, or of one double against
+// float
+struct CachedVerdict {
+    unsigned Fits = 0; // The formats it fits, as formatIndex bits
+    std::string Reason;
+};
+
+// What the range analysis of one body added to the ranges of the
+// declarations it stores to. Variables are named by stableDeclName, or by
+// "#N" for the N-th local of the body (parameters first); fields by
+// stableDeclName.
+struct BodyEffects {
+    bool Succeeded = false;
+    Interval Return;
+    std::vector<std::pair<std::string, Interval>> Stores;
+    std::vector<std::pair<std::string, Interval>> FieldStores;
+    std::vector<std::pair<std::string, Interval>> ElementStores; // Array variables
+    std::vector<std::pair<std::string, Interval>> FieldElementStores; // Array fields
+    std::vector<std::string> Escapes;
+    std::vector<std::string> FieldEscapes;
+};
+
+// A name for a global, static local or field that is the same in every
+// parse of the translation unit. Declarations may share one (anonymous
+// records); effects recorded for it then apply to all of them.
+std::string stableDeclName(const clang::NamedDecl *D);
+
+// The results kept for one main file: those of the previous analysis, and
+// those of the current one as they are looked up or recorded.
+class IncrementalState {
+public:
+    // Fingerprints the functions of the main file. Call once, before the
+    // analysis.
+    void fingerprint(clang::ASTContext &Context);
+
+    // True if D is a function of the main file that has a fingerprint.
+    bool isFunction(const clang::Decl *D) const { return Functions.count(D); }
+
+    // Verdicts of FD's float variables and literals in traversal order, if
+    // FD is unchanged since they were recorded; null otherwise.
+    const std::vector<CachedVerdict> *findVerdicts(const clang::Decl *FD);
+    void storeVerdicts(const clang::Decl *FD, std::vector<CachedVerdict> Verdicts);
+
+    // True if Body, a function of the main file or a lambda, block or local
+    // class method inside one, has a fingerprint.
+    bool hasEffects(const clang::Decl *Body) const { return Bodies.count(Body); }
+
+    // The effects of Body if it is unchanged since they were recorded;
+    // null otherwise.
+    const BodyEffects *findEffects(const clang::Decl *Body);
+    void storeEffects(const clang::Decl *Body, BodyEffects Effects);
+
+    // Adds the summary database lookups that the reused results depended
+    // on to Deps, the lookups of this analysis, and keeps the union for the
+    // next one.
+    void mergeSummaryDeps(std::vector<std::pair<std::string, std::string>> &Deps);
+
+    unsigned reusedFunctions() const { return Reused; }
+    unsigned analyzedFunctions() const { return Analyzed; }
+
+private:
+    friend class IncrementalStore;
+
+    std::string MainFile;
+    std::string Salt; // Version and analysis arguments
+    // Summary database lookups the previous analyses depended on
+    std::vector<std::pair<std::string, std::string>> SummaryDeps;
+
+    llvm::DenseMap<const clang::Decl *, std::string> Functions; // -> fingerprint
+    llvm::DenseMap<const clang::Decl *, std::string> Bodies;    // -> fingerprint/N
+    llvm::StringMap<std::vector<CachedVerdict>> OldVerdicts, Verdicts;
+    llvm::StringMap<BodyEffects> OldEffects, Effects;
+    unsigned Reused = 0;
+    unsigned Analyzed = 0;
+};
+
+struct IncrementalStats {
+    std::atomic<uint64_t> Reused{0};   // Functions whose results were reused
+    std::atomic<uint64_t> Analyzed{0}; // Functions analyzed again
+};
+
+// One JSON file per main file in a directory. Thread-safe.
+class IncrementalStore {
+public:
+    IncrementalStore(std::string Dir, llvm::ArrayRef<std::string> AnalysisArgs);
+
+    // The results of the previous analysis of MainFile. Empty if there is
+    // none, or if a function summary from Summaries it relied on changed.
+    std::unique_ptr<IncrementalState> load(llvm::StringRef MainFile,
+                                           SummaryDatabase *Summaries = nullptr);
+
+    // Replaces the stored results of State's main file by the ones looked
+    // up or recorded in this analysis.
+    void save(const IncrementalState &State);
+
+    const IncrementalStats &stats() const { return Stats; }
+
+    void printStats(llvm::raw_ostream &OS) const;
+
+private:
+    std::string pathFor(llvm::StringRef MainFile) const;
+    static llvm::json::Value encode(const IncrementalState &State);
+    static bool decode(const llvm::json::Value &V, IncrementalState &Out);
+
+    std::string Dir;
+    std::string Salt;
+    IncrementalStats Stats;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_INCREMENTAL_H
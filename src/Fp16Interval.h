@@ -0,0 +1,119 @@
+//===- Fp16Interval.h - Interval arithmetic --------------------*- C++ -*-===//
+//
+// The abstract value of the range analysis (Fp16RangeAnalysis.h) and of
+// function summaries (Fp16FunctionSummaries.h).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_INTERVAL_H
+#define FP16_INTERVAL_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace fp16demotion {
+
+// A closed interval of real values; Lo > Hi is the empty interval. Infinite
+// bounds mean the value is unbounded in that direction. Operations whose
+// bounds come out as NaN (inf - inf, 0 * inf, ...) give up and return top().
+struct Interval {
+    double Lo = std::numeric_limits<double>::infinity();
+    double Hi = -std::numeric_limits<double>::infinity();
+
+    static Interval point(double V) { return {V, V}; }
+    static Interval top() {
+        return {-std::numeric_limits<double>::infinity(),
+                std::numeric_limits<double>::infinity()};
+    }
+
+    bool isEmpty() const { return Lo > Hi; }
+    bool isBounded() const { return std::isfinite(Lo) && std::isfinite(Hi); }
+    bool contains(double V) const { return Lo <= V && V <= Hi; }
+    bool operator==(const Interval &Other) const {
+        return (isEmpty() && Other.isEmpty()) || (Lo == Other.Lo && Hi == Other.Hi);
+    }
+    bool operator!=(const Interval &Other) const { return !(*this == Other); }
+
+    Interval join(const Interval &Other) const {
+        if (isEmpty())
+            return Other;
+        if (Other.isEmpty())
+            return *this;
+        return {std::min(Lo, Other.Lo), std::max(Hi, Other.Hi)};
+    }
+
+    Interval meet(const Interval &Other) const {
+        return {std::max(Lo, Other.Lo), std::min(Hi, Other.Hi)};
+    }
+
+    // Joins Next into this interval, moving every bound that grew to
+    // infinity so that loops reach a fixpoint in a few iterations.
+    Interval widen(const Interval &Next) const {
+        Interval Joined = join(Next);
+        if (isEmpty())
+            return Joined;
+        if (Joined.Lo < Lo)
+            Joined.Lo = -std::numeric_limits<double>::infinity();
+        if (Joined.Hi > Hi)
+            Joined.Hi = std::numeric_limits<double>::infinity();
+        return Joined;
+    }
+
+    Interval add(const Interval &Other) const {
+        if (isEmpty() || Other.isEmpty())
+            return Interval();
+        return checked(Lo + Other.Lo, Hi + Other.Hi);
+    }
+
+    Interval sub(const Interval &Other) const {
+        if (isEmpty() || Other.isEmpty())
+            return Interval();
+        return checked(Lo - Other.Hi, Hi - Other.Lo);
+    }
+
+    Interval mul(const Interval &Other) const {
+        if (isEmpty() || Other.isEmpty())
+            return Interval();
+        return hull(Lo * Other.Lo, Lo * Other.Hi, Hi * Other.Lo, Hi * Other.Hi);
+    }
+
+    Interval div(const Interval &Other) const {
+        if (isEmpty() || Other.isEmpty())
+            return Interval();
+        if (Other.contains(0))
+            return top();
+        return hull(Lo / Other.Lo, Lo / Other.Hi, Hi / Other.Lo, Hi / Other.Hi);
+    }
+
+    Interval neg() const {
+        if (isEmpty())
+            return *this;
+        return {-Hi, -Lo};
+    }
+
+    // Rounding toward zero, as in a floating to integer conversion.
+    Interval trunc() const {
+        if (isEmpty())
+            return *this;
+        return {std::trunc(Lo), std::trunc(Hi)};
+    }
+
+    // Smallest interval containing all of the given values.
+    static Interval hull(double P0, double P1, double P2, double P3) {
+        if (std::isnan(P0) || std::isnan(P1) || std::isnan(P2) || std::isnan(P3))
+            return top();
+        return {std::min({P0, P1, P2, P3}), std::max({P0, P1, P2, P3})};
+    }
+
+private:
+    static Interval checked(double Lo, double Hi) {
+        if (std::isnan(Lo) || std::isnan(Hi))
+            return top();
+        return {Lo, Hi};
+    }
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_INTERVAL_H
@@ -0,0 +1,385 @@
+#include "Fp16LoopVectorization.h"
+#include "Fp16ArrayStorage.h"
+#include "Fp16RangeAnalysis.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+const char *loopKindName(LoopKind Kind) {
+    switch (Kind) {
+    case LoopKind::Map: return "map";
+    case LoopKind::Reduction: return "reduction";
+    case LoopKind::Recurrence: return "recurrence";
+    }
+    return "map";
+}
+
+bool parseVectorWidths(llvm::StringRef List, std::vector<unsigned> &Widths) {
+    llvm::SmallVector<llvm::StringRef, 4> Items;
+    List.split(Items, ',');
+    std::vector<unsigned> Parsed;
+    for (llvm::StringRef Item : Items) {
+        unsigned Bits;
+        if (Item.getAsInteger(10, Bits) || Bits < 16 || Bits > 4096 || !llvm::isPowerOf2_32(Bits))
+            return false;
+        Parsed.push_back(Bits);
+    }
+    Widths = std::move(Parsed);
+    return true;
+}
+
+unsigned laneCount(unsigned VectorBits, unsigned ElementBits) {
+    return std::max(1u, VectorBits / std::max(1u, ElementBits));
+}
+
+// See LoopAccess::Storage
+static const ValueDecl *storageOf(const Expr *E) {
+    E = E->IgnoreParenImpCasts();
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(E)) {
+        if (const auto *VD = dyn_cast<VarDecl>(DRE->getDecl()))
+            return VD->getCanonicalDecl();
+        return nullptr;
+    }
+    if (const auto *ME = dyn_cast<MemberExpr>(E))
+        return dyn_cast<FieldDecl>(ME->getMemberDecl());
+    if (const auto *ASE = dyn_cast<ArraySubscriptExpr>(E)) {
+        if (const ValueDecl *Array = indexedArray(ASE))
+            return Array;
+        return storageOf(ASE->getBase());
+    }
+    if (const auto *UO = dyn_cast<UnaryOperator>(E))
+        if (UO->getOpcode() == UO_Deref)
+            return storageOf(UO->getSubExpr());
+    return nullptr;
+}
+
+static bool isVar(const Expr *E, const VarDecl *X) {
+    const auto *DRE = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+    const auto *VD = DRE ? dyn_cast<VarDecl>(DRE->getDecl()) : nullptr;
+    return VD && VD->getCanonicalDecl() == X;
+}
+
+static bool mentions(const Stmt *S, const VarDecl *X) {
+    if (!S)
+        return false;
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(S)) {
+        const auto *VD = dyn_cast<VarDecl>(DRE->getDecl());
+        return VD && VD->getCanonicalDecl() == X;
+    }
+    return llvm::any_of(S->children(), [&](const Stmt *Child) { return mentions(Child, X); });
+}
+
+static bool containsLoop(const Stmt *S) {
+    return S && llvm::any_of(S->children(), [](const Stmt *Child) {
+        return isa_and_nonnull<ForStmt, WhileStmt, DoStmt, CXXForRangeStmt>(Child) ||
+               containsLoop(Child);
+    });
+}
+
+static void collectLocals(const Stmt *S, llvm::DenseSet<const VarDecl *> &Locals) {
+    if (!S)
+        return;
+    if (const auto *DS = dyn_cast<DeclStmt>(S))
+        for (const Decl *D : DS->decls())
+            if (const auto *VD = dyn_cast<VarDecl>(D); VD && VD->hasLocalStorage())
+                Locals.insert(VD->getCanonicalDecl());
+    for (const Stmt *Child : S->children())
+        collectLocals(Child, Locals);
+}
+
+static bool sameAccess(ASTContext &Context, const Expr *A, const Expr *B) {
+    llvm::FoldingSetNodeID IdA, IdB;
+    A->IgnoreParenImpCasts()->Profile(IdA, Context, /*Canonical=*/true);
+    B->IgnoreParenImpCasts()->Profile(IdB, Context, /*Canonical=*/true);
+    return IdA == IdB;
+}
+
+namespace {
+
+enum class Use { Read, Write, Update };
+
+struct Occurrence {
+    LoopAccess Access;
+    Use Kind;
+    const Expr *Store; // The assignment, increment or '&'; null for reads
+};
+
+// The floating-point accesses of the parts of a loop, in the order one
+// iteration runs them
+class AccessScanner : public RecursiveASTVisitor<AccessScanner> {
+public:
+    bool VisitBinaryOperator(BinaryOperator *BO) {
+        if (BO->isAssignmentOp())
+            Stores[BO->getLHS()->IgnoreParens()] = {BO->getOpcode() == BO_Assign ? Use::Write
+                                                                                 : Use::Update,
+                                                    BO};
+        return true;
+    }
+    // A variable whose address is taken may be written through it.
+    bool VisitUnaryOperator(UnaryOperator *UO) {
+        if (UO->isIncrementDecrementOp() || UO->getOpcode() == UO_AddrOf)
+            Stores[UO->getSubExpr()->IgnoreParens()] = {Use::Update, UO};
+        if (UO->getOpcode() == UO_Deref)
+            add(UO);
+        return true;
+    }
+    bool VisitDeclRefExpr(DeclRefExpr *E) {
+        add(E);
+        return true;
+    }
+    bool VisitMemberExpr(MemberExpr *E) {
+        add(E);
+        return true;
+    }
+    bool VisitArraySubscriptExpr(ArraySubscriptExpr *E) {
+        add(E);
+        return true;
+    }
+
+    std::vector<Occurrence> Occurrences;
+
+private:
+    void add(const Expr *E) {
+        if (!E->getType()->isRealFloatingType())
+            return;
+        auto It = Stores.find(E);
+        if (It == Stores.end())
+            Occurrences.push_back({{E, storageOf(E)}, Use::Read, nullptr});
+        else
+            Occurrences.push_back({{E, storageOf(E)}, It->second.first, It->second.second});
+    }
+
+    llvm::DenseMap<const Expr *, std::pair<Use, const Expr *>> Stores;
+};
+
+enum class Reduction { Add, Mul, Min, Max };
+
+} // namespace
+
+// Whether Store, which writes X, is one step of a reduction into X:
+// X op= E, ++X, X = X op E, X = E op X (for + and *) or X = fmin(X, E)
+// and the like, with E not using X. ReadsX is set if the step reads X
+// explicitly.
+static bool reductionStep(const Expr *Store, const VarDecl *X, Reduction &Op, bool &ReadsX) {
+    ReadsX = false;
+    if (const auto *UO = dyn_cast<UnaryOperator>(Store)) {
+        Op = Reduction::Add;
+        return UO->isIncrementDecrementOp();
+    }
+    const auto *BO = cast<BinaryOperator>(Store);
+    switch (BO->getOpcode()) {
+    case BO_AddAssign:
+    case BO_SubAssign:
+        Op = Reduction::Add;
+        return !mentions(BO->getRHS(), X);
+    case BO_MulAssign:
+        Op = Reduction::Mul;
+        return !mentions(BO->getRHS(), X);
+    case BO_Assign:
+        break;
+    default:
+        return false;
+    }
+
+    ReadsX = true;
+    auto OneSide = [&](const Expr *A, const Expr *B) {
+        return (isVar(A, X) && !mentions(B, X)) || (isVar(B, X) && !mentions(A, X));
+    };
+    const Expr *Value = BO->getRHS()->IgnoreParenImpCasts();
+    if (const auto *Arith = dyn_cast<BinaryOperator>(Value)) {
+        switch (Arith->getOpcode()) {
+        case BO_Add:
+            Op = Reduction::Add;
+            return OneSide(Arith->getLHS(), Arith->getRHS());
+        case BO_Mul:
+            Op = Reduction::Mul;
+            return OneSide(Arith->getLHS(), Arith->getRHS());
+        case BO_Sub:
+            Op = Reduction::Add;
+            return isVar(Arith->getLHS(), X) && !mentions(Arith->getRHS(), X);
+        default:
+            return false;
+        }
+    }
+    const auto *Call = dyn_cast<CallExpr>(Value);
+    const FunctionDecl *Callee = Call ? Call->getDirectCallee() : nullptr;
+    if (!Callee || !Callee->getIdentifier() || Call->getNumArgs() != 2)
+        return false;
+    llvm::StringRef Name = Callee->getName();
+    if (Name == "fmin" || Name == "fminf" || Name == "fminl")
+        Op = Reduction::Min;
+    else if (Name == "fmax" || Name == "fmaxf" || Name == "fmaxl")
+        Op = Reduction::Max;
+    else
+        return false;
+    return OneSide(Call->getArg(0), Call->getArg(1));
+}
+
+// Whether every use of X is part of a step of one reduction
+static bool isAccumulator(const VarDecl *X, llvm::ArrayRef<const Occurrence *> Uses) {
+    bool First = true;
+    Reduction Kind = Reduction::Add;
+    unsigned Reads = 0, StepReads = 0;
+    for (const Occurrence *O : Uses) {
+        if (O->Kind == Use::Read) {
+            ++Reads;
+            continue;
+        }
+        Reduction Op;
+        bool ReadsX;
+        if (!reductionStep(O->Store, X, Op, ReadsX) || (!First && Op != Kind))
+            return false;
+        First = false;
+        Kind = Op;
+        StepReads += ReadsX;
+    }
+    return Reads == StepReads;
+}
+
+static void classify(ASTContext &Context, FloatLoop &Loop, const Stmt *Body,
+                     const std::vector<Occurrence> &Occurrences) {
+    llvm::DenseSet<const VarDecl *> Locals;
+    collectLocals(Body, Locals);
+    auto TopLevel = [&](const Expr *Store) {
+        if (Store == Body)
+            return true;
+        const auto *CS = dyn_cast_or_null<CompoundStmt>(Body);
+        return CS && llvm::is_contained(CS->body(), Store);
+    };
+
+    llvm::MapVector<const VarDecl *, llvm::SmallVector<const Occurrence *, 4>> Scalars;
+    llvm::MapVector<const ValueDecl *, llvm::SmallVector<const Occurrence *, 4>> Elements;
+    for (const Occurrence &O : Occurrences) {
+        const ValueDecl *Storage = O.Access.Storage;
+        if (!Storage)
+            continue;
+        const auto *VD = dyn_cast<VarDecl>(Storage);
+        if (VD && isa<DeclRefExpr>(O.Access.E)) {
+            if (!Locals.count(VD))
+                Scalars[VD].push_back(&O);
+        } else {
+            Elements[Storage].push_back(&O);
+        }
+    }
+
+    for (const auto &Entry : Scalars) {
+        const VarDecl *X = Entry.first;
+        llvm::ArrayRef<const Occurrence *> Uses = Entry.second;
+        if (llvm::none_of(Uses, [](const Occurrence *O) { return O->Kind != Use::Read; }))
+            continue; // Invariant
+        const Occurrence *First = Uses.front();
+        if (First->Kind == Use::Write && TopLevel(First->Store) &&
+            !mentions(cast<BinaryOperator>(First->Store)->getRHS(), X))
+            continue; // Private to the iteration
+        if (isAccumulator(X, Uses))
+            Loop.Accumulators.push_back(X);
+        else if (!Loop.Carried)
+            Loop.Carried = X;
+    }
+
+    // An element read through another subscript than the one written may
+    // be the one an earlier iteration wrote.
+    for (const auto &Entry : Elements) {
+        if (Loop.Carried)
+            break;
+        for (const Occurrence *Write : Entry.second) {
+            if (Write->Kind == Use::Read)
+                continue;
+            bool Carried = llvm::any_of(Entry.second, [&](const Occurrence *Read) {
+                return Read->Kind == Use::Read &&
+                       !sameAccess(Context, Read->Access.E, Write->Access.E);
+            });
+            if (Carried) {
+                Loop.Carried = Entry.first;
+                break;
+            }
+        }
+    }
+
+    if (Loop.Carried)
+        Loop.Kind = LoopKind::Recurrence;
+    else if (!Loop.Accumulators.empty())
+        Loop.Kind = LoopKind::Reduction;
+}
+
+namespace {
+
+class LoopFinder : public RecursiveASTVisitor<LoopFinder> {
+public:
+    LoopFinder(ASTContext &Context, std::vector<FloatLoop> &Loops)
+        : Context(Context), Loops(Loops) {}
+
+    bool TraverseDecl(Decl *D) {
+        const FunctionDecl *Outer = Function;
+        if (const auto *FD = dyn_cast_or_null<FunctionDecl>(D))
+            Function = FD;
+        bool Continue = RecursiveASTVisitor::TraverseDecl(D);
+        Function = Outer;
+        return Continue;
+    }
+
+    bool VisitForStmt(ForStmt *S) {
+        add(S, S->getBody(), {S->getCond(), S->getBody(), S->getInc()});
+        return true;
+    }
+    bool VisitWhileStmt(WhileStmt *S) {
+        add(S, S->getBody(), {S->getCond(), S->getBody()});
+        return true;
+    }
+    bool VisitDoStmt(DoStmt *S) {
+        add(S, S->getBody(), {S->getBody(), S->getCond()});
+        return true;
+    }
+
+private:
+    void add(const Stmt *S, const Stmt *Body, std::initializer_list<const Stmt *> Parts) {
+        if (!Function || containsLoop(Body))
+            return;
+        AccessScanner Scanner;
+        for (const Stmt *Part : Parts)
+            Scanner.TraverseStmt(const_cast<Stmt *>(Part));
+        if (Scanner.Occurrences.empty())
+            return;
+
+        FloatLoop Loop;
+        Loop.Loop = S;
+        Loop.Function = Function;
+        for (const Occurrence &O : Scanner.Occurrences)
+            Loop.Accesses.push_back(O.Access);
+        if (const auto *FS = dyn_cast<ForStmt>(S))
+            Loop.TripExact = tripCount(Context, FS, Loop.TripCount);
+        if (!Loop.TripExact)
+            Loop.TripCount = 1;
+        classify(Context, Loop, Body, Scanner.Occurrences);
+        Loops.push_back(std::move(Loop));
+    }
+
+    ASTContext &Context;
+    std::vector<FloatLoop> &Loops;
+    const FunctionDecl *Function = nullptr;
+};
+
+} // namespace
+
+std::vector<FloatLoop> findFloatLoops(ASTContext &Context) {
+    std::vector<FloatLoop> Loops;
+    SourceManager &SM = Context.getSourceManager();
+    LoopFinder Finder(Context, Loops);
+    for (Decl *D : Context.getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Finder.TraverseDecl(D);
+    return Loops;
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,76 @@
+//===- Fp16LoopVectorization.h - SIMD lanes of float loops -----*- C++ -*-===//
+//
+// Halving the element size only doubles throughput in loops that vectorize.
+// This finds the innermost for, while and do loops of the main file that
+// access floating-point storage and classifies them: elementwise maps,
+// reductions into scalar accumulators, and recurrences that carry a value
+// from one iteration to the next. A vectorizer sizes its vectors for the
+// widest element in the loop, so the lanes of a loop follow its widest
+// floating-point access.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_LOOP_VECTORIZATION_H
+#define FP16_LOOP_VECTORIZATION_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace fp16demotion {
+
+enum class LoopKind {
+    Map,        // Every iteration independent
+    Reduction,  // Scalars accumulated with +, -, * or fmin/fmax
+    Recurrence, // A value carried between iterations; not vectorized
+};
+
+// Register widths reported by default: SSE and NEON, AVX2, AVX-512
+const unsigned DefaultVectorWidths[] = {128, 256, 512};
+
+// "map", "reduction" or "recurrence"
+const char *loopKindName(LoopKind Kind);
+
+// Parses the value of -fprecision-demote-vector-width=: a comma-separated
+// list of register widths in bits, each a power of two from 16 to 4096.
+bool parseVectorWidths(llvm::StringRef List, std::vector<unsigned> &Widths);
+
+// Lanes of a VectorBits-wide register holding ElementBits-wide elements;
+// at least one
+unsigned laneCount(unsigned VectorBits, unsigned ElementBits);
+
+// One floating-point read or write in a loop
+struct LoopAccess {
+    const clang::Expr *E; // DeclRefExpr, MemberExpr, ArraySubscriptExpr or '*'
+    // The variable (canonical), field or array accessed, or the pointer
+    // variable indexed; null for other pointers
+    const clang::ValueDecl *Storage;
+};
+
+struct FloatLoop {
+    const clang::Stmt *Loop;
+    const clang::FunctionDecl *Function;
+    LoopKind Kind = LoopKind::Map;
+    std::vector<LoopAccess> Accesses;                 // In order of appearance
+    std::vector<const clang::VarDecl *> Accumulators; // Of a reduction
+    const clang::ValueDecl *Carried = nullptr;        // Of a recurrence
+    double TripCount = 1;
+    bool TripExact = false; // A for loop with constant bounds and step
+};
+
+// The innermost loops in the main file's function bodies that access
+// floating-point storage, in order of appearance. Scalars declared in the
+// body, and scalars the body assigns before any other use, are private to
+// an iteration; any other scalar written in the loop is an accumulator if
+// it is only updated by one reduction operator, and carries a recurrence
+// if not. Array elements carry a recurrence if the loop writes an element
+// and reads one through a different subscript expression.
+std::vector<FloatLoop> findFloatLoops(clang::ASTContext &Context);
+
+} // namespace fp16demotion
+
+#endif // FP16_LOOP_VECTORIZATION_H
@@ -0,0 +1,130 @@
+//===- Fp16MapToJson.cpp - float_map.bin to float_map.json ----------------===//
+//
+// Converts a binary float map back to the JSON format consumed by the web
+// frontend:
+//
+//   fp16-map2json float_map.bin [--file NAME] [--include-variables]
+//
+// --file restricts the output to records from one source file (found by
+// binary search of the file index); --include-variables also emits the
+// variable verdicts, which the JSON format otherwise omits.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Fp16BinaryReader.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace fp16demotion;
+
+static void writeString(FILE *Out, const char *Str) {
+    std::fputc('"', Out);
+    for (const unsigned char *P = reinterpret_cast<const unsigned char *>(Str); *P; ++P) {
+        switch (*P) {
+        case '"': std::fputs("\\\"", Out); break;
+        case '\\': std::fputs("\\\\", Out); break;
+        case '\n': std::fputs("\\n", Out); break;
+        case '\r': std::fputs("\\r", Out); break;
+        case '\t': std::fputs("\\t", Out); break;
+        default:
+            if (*P < 0x20)
+                std::fprintf(Out, "\\u%04x", *P);
+            else
+                std::fputc(*P, Out);
+        }
+    }
+    std::fputc('"', Out);
+}
+
+// Same spelling as FloatMapWriter so both paths produce identical JSON.
+static void writeNumber(FILE *Out, double V, const char *Fmt) {
+    if (std::isnan(V))
+        std::fputs("\"NaN\"", Out);
+    else if (std::isinf(V))
+        std::fputs(V > 0 ? "\"Infinity\"" : "\"-Infinity\"", Out);
+    else
+        std::fprintf(Out, Fmt, V);
+}
+
+static void writeRecord(FILE *Out, const BinaryFloatMap &Map, const binfmt::Record &R) {
+    bool Safe = R.Flags & binfmt::SafeFlag;
+    std::string Location = std::string(Map.fileName(R.File)) + ":" +
+                           std::to_string(R.Line) + ", col " + std::to_string(R.Column);
+
+    std::fputs("  {\n    ", Out);
+    if (R.Kind == binfmt::VariableRecordKind) {
+        std::fputs("\"variable\": ", Out);
+        writeString(Out, Map.string(R.Name));
+    } else {
+        std::fputs("\"value\": ", Out);
+        writeNumber(Out, R.Value, "%.9g");
+        std::fputs(",\n    \"downcast\": ", Out);
+        writeNumber(Out, R.Downcast, "%.9g");
+        std::fputs(",\n    \"error\": ", Out);
+        writeNumber(Out, R.Error, "%.6g");
+    }
+    std::fputs(",\n    \"mode\": ", Out);
+    writeString(Out, R.Mode ? Map.string(R.Mode) : "fp16");
+    std::fprintf(Out, ",\n    \"safe\": %s", Safe ? "true" : "false");
+    std::fputs(",\n    \"reason\": ", Out);
+    writeString(Out, Map.string(R.Reason));
+    std::fputs(",\n    \"location\": ", Out);
+    writeString(Out, Location.c_str());
+    std::fputs("\n  }", Out);
+}
+
+int main(int argc, char **argv) {
+    const char *Input = nullptr;
+    const char *OnlyFile = nullptr;
+    bool IncludeVariables = false;
+    for (int I = 1; I < argc; ++I) {
+        if (std::strcmp(argv[I], "--file") == 0 && I + 1 < argc)
+            OnlyFile = argv[++I];
+        else if (std::strcmp(argv[I], "--include-variables") == 0)
+            IncludeVariables = true;
+        else if (!Input && argv[I][0] != '-')
+            Input = argv[I];
+        else {
+            std::fprintf(stderr, "fp16-map2json: unknown argument '%s'\n", argv[I]);
+            return 1;
+        }
+    }
+    if (!Input) {
+        std::fprintf(stderr,
+                     "usage: fp16-map2json float_map.bin [--file NAME] [--include-variables]\n");
+        return 1;
+    }
+
+    std::string Error;
+    std::unique_ptr<BinaryFloatMap> Map = BinaryFloatMap::open(Input, &Error);
+    if (!Map) {
+        std::fprintf(stderr, "fp16-map2json: %s\n", Error.c_str());
+        return 1;
+    }
+
+    const binfmt::Record *Begin = Map->records();
+    const binfmt::Record *End = Begin + Map->recordCount();
+    if (OnlyFile) {
+        uint64_t File = Map->findFile(OnlyFile);
+        if (File == Map->fileCount()) {
+            Begin = End = nullptr;
+        } else {
+            Begin = Map->recordsForFile(File);
+            End = Begin + Map->file(File).RecordCount;
+        }
+    }
+
+    FILE *Out = stdout;
+    std::fputc('[', Out);
+    size_t Count = 0;
+    for (const binfmt::Record *R = Begin; R != End; ++R) {
+        if (R->Kind == binfmt::VariableRecordKind && !IncludeVariables)
+            continue;
+        std::fputs(Count++ ? ",\n" : "\n", Out);
+        writeRecord(Out, *Map, *R);
+    }
+    std::fputs("\n]\n", Out);
+    return std::fflush(Out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,297 @@
+#include "Fp16MemoryModel.h"
+#include "clang/AST/Attr.h"
+#include "clang/AST/DeclCXX.h"
+#include "clang/AST/RecordLayout.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+StorageUsage &StorageUsage::operator+=(const StorageUsage &Other) {
+    variableCount += Other.variableCount;
+    originalBytes += Other.originalBytes;
+    demotedBytes += Other.demotedBytes;
+    floatBytes += Other.floatBytes;
+    return *this;
+}
+
+FormatUsage &FormatUsage::operator+=(const FormatUsage &Other) {
+    enabled |= Other.enabled;
+    varCount += Other.varCount;
+    fieldCount += Other.fieldCount;
+    arrayCount += Other.arrayCount;
+    literalCount += Other.literalCount;
+    floatBytes += Other.floatBytes;
+    return *this;
+}
+
+MemoryUsage &MemoryUsage::operator+=(const MemoryUsage &Other) {
+    originalBytes += Other.originalBytes;
+    demotedBytes += Other.demotedBytes;
+    floatVarCount += Other.floatVarCount;
+    demotedVarCount += Other.demotedVarCount;
+    floatLiteralCount += Other.floatLiteralCount;
+    demotedLiteralCount += Other.demotedLiteralCount;
+    floatFieldCount += Other.floatFieldCount;
+    demotedFieldCount += Other.demotedFieldCount;
+    floatArrayCount += Other.floatArrayCount;
+    demotedArrayCount += Other.demotedArrayCount;
+    doubleVarCount += Other.doubleVarCount;
+    demotedDoubleVarCount += Other.demotedDoubleVarCount;
+    doubleLiteralCount += Other.doubleLiteralCount;
+    demotedDoubleLiteralCount += Other.demotedDoubleLiteralCount;
+    doubleBytes += Other.doubleBytes;
+    demotedDoubleBytes += Other.demotedDoubleBytes;
+    floatMathCalls += Other.floatMathCalls;
+    global += Other.global;
+    staticLocal += Other.staticLocal;
+    stack += Other.stack;
+    largestFrameBytes = std::max(largestFrameBytes, Other.largestFrameBytes);
+    largestFrameDemotedBytes = std::max(largestFrameDemotedBytes, Other.largestFrameDemotedBytes);
+    for (unsigned I = 0; I < NumFloatFormats; ++I)
+        formats[I] += Other.formats[I];
+    return *this;
+}
+
+void MemoryModel::addVariable(const VarDecl *VD, bool Demoted) {
+    if (!VD || isa<ParmVarDecl>(VD) || VD->isInvalidDecl() || VD->hasExternalStorage())
+        return;
+    QualType T = VD->getType();
+    if (T->isDependentType() || T->isIncompleteType() || T->isVariablyModifiedType() ||
+        T->isReferenceType() || VD->getDeclContext()->isDependentContext())
+        return;
+    // A file-scope variable is counted once, at its definition (or at the
+    // tentative definition standing in for one).
+    if (VD->isFileVarDecl() && VD->isThisDeclarationADefinition() != VarDecl::Definition &&
+        VD->getActingDefinition() != VD)
+        return;
+    if (!Seen.insert(VD->getCanonicalDecl()).second)
+        return;
+
+    Variable Var{VD, Demoted, StorageClass::Global, nullptr};
+    if (VD->hasLocalStorage()) {
+        const DeclContext *DC = VD->getParentFunctionOrMethod();
+        if (!DC)
+            return;
+        Var.Class = StorageClass::Stack;
+        Var.Frame = Decl::castFromDeclContext(DC);
+    } else if (VD->isStaticLocal()) {
+        Var.Class = StorageClass::StaticLocal;
+    }
+    Variables.push_back(Var);
+}
+
+void MemoryModel::addDemotedField(const FieldDecl *FD) {
+    if (DemotedFields.insert(FD).second) {
+        ChangedRecords.clear();
+        RecordLayouts.clear();
+    }
+}
+
+void MemoryModel::addDemotedVariable(const VarDecl *VD) {
+    DemotedVariables.insert(VD->getCanonicalDecl());
+}
+
+void MemoryModel::setFieldOrder(const RecordDecl *RD, std::vector<const FieldDecl *> Order) {
+    FieldOrders[RD] = std::move(Order);
+    ChangedRecords.clear();
+    RecordLayouts.clear();
+}
+
+TypeLayout MemoryModel::demotedFieldLayout(const FieldDecl *FD) {
+    return DemotedFields.count(FD) ? narrowLayout(FD->getType()) : demotedLayout(FD->getType());
+}
+
+// T (float, double or an array of float) with every float stored in
+// binary16 and a double as float
+TypeLayout MemoryModel::narrowLayout(QualType T) const {
+    if (const ConstantArrayType *CAT = Context->getAsConstantArrayType(T)) {
+        TypeLayout Element = narrowLayout(CAT->getElementType());
+        return {Element.Size * CAT->getSize().getZExtValue(), Element.Align};
+    }
+    if (T->isSpecificBuiltinType(BuiltinType::Double))
+        return originalLayout(Context->FloatTy);
+    return originalLayout(Context->HalfTy);
+}
+
+TypeLayout MemoryModel::originalLayout(QualType T) const {
+    TypeInfoChars Info = Context->getTypeInfoInChars(T);
+    return {uint64_t(Info.Width.getQuantity()),
+            std::max<uint64_t>(1, Info.Align.getQuantity())};
+}
+
+uint64_t MemoryModel::floatBytes(QualType T) const {
+    if (T->isDependentType() || T->isIncompleteType())
+        return 0;
+    if (const ConstantArrayType *CAT = Context->getAsConstantArrayType(T))
+        return floatBytes(CAT->getElementType()) * CAT->getSize().getZExtValue();
+    if (const auto *RT = T->getAs<RecordType>()) {
+        const RecordDecl *RD = RT->getDecl()->getDefinition();
+        if (!RD)
+            return 0;
+        uint64_t Bytes = 0;
+        for (const FieldDecl *FD : RD->fields()) {
+            uint64_t FieldBytes = floatBytes(FD->getType());
+            Bytes = RD->isUnion() ? std::max(Bytes, FieldBytes) : Bytes + FieldBytes;
+        }
+        if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(RD))
+            for (const CXXBaseSpecifier &Base : CXXRD->bases())
+                Bytes += floatBytes(Base.getType());
+        return Bytes;
+    }
+    if (T->isSpecificBuiltinType(BuiltinType::Float))
+        return originalLayout(T).Size;
+    return 0;
+}
+
+bool MemoryModel::changesLayout(const RecordDecl *RD) {
+    auto Known = ChangedRecords.find(RD);
+    if (Known != ChangedRecords.end())
+        return Known->second;
+    ChangedRecords[RD] = false; // Guards against cycles through invalid code
+
+    bool Changed = FieldOrders.count(RD);
+    for (const FieldDecl *FD : RD->fields()) {
+        QualType T = Context->getBaseElementType(FD->getType());
+        if (DemotedFields.count(FD)) {
+            Changed = true;
+        } else if (const auto *RT = T->getAs<RecordType>()) {
+            if (const RecordDecl *Def = RT->getDecl()->getDefinition())
+                Changed |= changesLayout(Def);
+        }
+    }
+    ChangedRecords[RD] = Changed;
+    return Changed;
+}
+
+TypeLayout MemoryModel::demotedLayout(QualType T) {
+    if (const ConstantArrayType *CAT = Context->getAsConstantArrayType(T)) {
+        TypeLayout Element = demotedLayout(CAT->getElementType());
+        return {Element.Size * CAT->getSize().getZExtValue(), Element.Align};
+    }
+    if (const auto *RT = T->getAs<RecordType>())
+        if (const RecordDecl *RD = RT->getDecl()->getDefinition())
+            return recordLayout(RD);
+    return originalLayout(T);
+}
+
+// Lays the fields out again the way the C ABI does: each field at the next
+// offset that satisfies its alignment, the size rounded up to the record's
+// alignment. Records this cannot reproduce exactly (bit-fields, C++ bases
+// and virtual members) keep their original layout, i.e. are reported
+// without savings.
+TypeLayout MemoryModel::recordLayout(const RecordDecl *RD) {
+    const ASTRecordLayout &RL = Context->getASTRecordLayout(RD);
+    TypeLayout Original{uint64_t(RL.getSize().getQuantity()),
+                        uint64_t(RL.getAlignment().getQuantity())};
+    if (!changesLayout(RD))
+        return Original;
+    auto Known = RecordLayouts.find(RD);
+    if (Known != RecordLayouts.end())
+        return Known->second;
+
+    if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(RD))
+        if (CXXRD->getNumBases() || CXXRD->getNumVBases() || CXXRD->isDynamicClass())
+            return RecordLayouts[RD] = Original;
+    for (const FieldDecl *FD : RD->fields())
+        if (FD->isBitField())
+            return RecordLayouts[RD] = Original;
+
+    uint64_t CharWidth = Context->getCharWidth();
+    bool Packed = RD->hasAttr<PackedAttr>();
+    uint64_t MaxFieldAlign = 0; // #pragma pack
+    if (const auto *MFA = RD->getAttr<MaxFieldAlignmentAttr>())
+        MaxFieldAlign = MFA->getAlignment() / CharWidth;
+
+    std::vector<const FieldDecl *> Fields(RD->field_begin(), RD->field_end());
+    auto Order = FieldOrders.find(RD);
+    if (Order != FieldOrders.end())
+        Fields = Order->second;
+
+    uint64_t Offset = 0, Align = 1;
+    for (const FieldDecl *FD : Fields) {
+        TypeLayout Field = demotedFieldLayout(FD);
+        uint64_t FieldAlign = Field.Align;
+        if (Packed || FD->hasAttr<PackedAttr>())
+            FieldAlign = 1;
+        if (MaxFieldAlign)
+            FieldAlign = std::min(FieldAlign, MaxFieldAlign);
+        if (FD->hasAttr<AlignedAttr>())
+            FieldAlign = std::max<uint64_t>(FieldAlign, FD->getMaxAlignment() / CharWidth);
+        if (RD->isUnion())
+            Offset = std::max(Offset, Field.Size);
+        else
+            Offset = llvm::alignTo(Offset, FieldAlign) + Field.Size;
+        Align = std::max(Align, FieldAlign);
+    }
+    if (unsigned RecordAlign = RD->getMaxAlignment())
+        Align = std::max<uint64_t>(Align, RecordAlign / CharWidth);
+    return RecordLayouts[RD] = TypeLayout{llvm::alignTo(Offset, Align), Align};
+}
+
+void MemoryModel::layOut(const std::vector<const Variable *> &Vars, StorageUsage &Usage,
+                         size_t &Original, size_t &Demoted) {
+    uint64_t OriginalEnd = 0, DemotedEnd = 0;
+    uint64_t OriginalAlign = 1, DemotedAlign = 1;
+    for (const Variable *Var : Vars) {
+        QualType T = Var->VD->getType();
+        TypeLayout Before = originalLayout(T);
+        bool Demoted = Var->Demoted || DemotedVariables.count(Var->VD->getCanonicalDecl());
+        TypeLayout After = Demoted ? narrowLayout(T) : demotedLayout(T);
+        // alignas and __attribute__((aligned)) on the variable itself
+        uint64_t DeclAlign = Context->getDeclAlign(Var->VD).getQuantity();
+        if (Var->VD->hasAttr<AlignedAttr>()) {
+            Before.Align = std::max(Before.Align, DeclAlign);
+            After.Align = std::max(After.Align, DeclAlign);
+        }
+        OriginalEnd = llvm::alignTo(OriginalEnd, Before.Align) + Before.Size;
+        DemotedEnd = llvm::alignTo(DemotedEnd, After.Align) + After.Size;
+        OriginalAlign = std::max(OriginalAlign, Before.Align);
+        DemotedAlign = std::max(DemotedAlign, After.Align);
+        ++Usage.variableCount;
+        Usage.floatBytes += floatBytes(T);
+    }
+    Original = llvm::alignTo(OriginalEnd, OriginalAlign);
+    Demoted = llvm::alignTo(DemotedEnd, DemotedAlign);
+    Usage.originalBytes += Original;
+    Usage.demotedBytes += Demoted;
+}
+
+void MemoryModel::finish(MemoryUsage &Usage) {
+    std::vector<const Variable *> Globals, Statics;
+    // Frames in order of their first variable
+    std::vector<const Decl *> FrameOrder;
+    llvm::DenseMap<const Decl *, std::vector<const Variable *>> Frames;
+    for (const Variable &Var : Variables) {
+        switch (Var.Class) {
+        case StorageClass::Global: Globals.push_back(&Var); break;
+        case StorageClass::StaticLocal: Statics.push_back(&Var); break;
+        case StorageClass::Stack: {
+            std::vector<const Variable *> &Frame = Frames[Var.Frame];
+            if (Frame.empty())
+                FrameOrder.push_back(Var.Frame);
+            Frame.push_back(&Var);
+            break;
+        }
+        }
+    }
+
+    size_t Original, Demoted;
+    layOut(Globals, Usage.global, Original, Demoted);
+    layOut(Statics, Usage.staticLocal, Original, Demoted);
+    for (const Decl *Frame : FrameOrder) {
+        layOut(Frames[Frame], Usage.stack, Original, Demoted);
+        Usage.largestFrameBytes = std::max(Usage.largestFrameBytes, Original);
+        Usage.largestFrameDemotedBytes = std::max(Usage.largestFrameDemotedBytes, Demoted);
+    }
+
+    Usage.originalBytes = Usage.global.originalBytes + Usage.staticLocal.originalBytes +
+                          Usage.stack.originalBytes;
+    Usage.demotedBytes = Usage.global.demotedBytes + Usage.staticLocal.demotedBytes +
+                         Usage.stack.demotedBytes;
+    Variables.clear();
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,158 @@
+//===- Fp16MemoryModel.h - Storage accounting ------------------*- C++ -*-===//
+//
+// Byte-accurate accounting of the data a translation unit defines, before
+// and after demotion. Sizes and alignments come from the target through
+// ASTContext::getTypeInfoInChars and ASTRecordLayout, so arrays, nested
+// structs and padding are counted as the compiler lays them out. Variables
+// are grouped by storage class: file-scope globals, static locals and the
+// stack frames of each function.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_MEMORY_MODEL_H
+#define FP16_MEMORY_MODEL_H
+
+#include "Fp16Formats.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fp16demotion {
+
+// Bytes used by one storage class. Variables are placed one after another in
+// declaration order, each at its alignment, so padding between them is
+// included; the real placement is up to the compiler and linker.
+struct StorageUsage {
+    size_t variableCount = 0;
+    size_t originalBytes = 0;
+    size_t demotedBytes = 0;
+    size_t floatBytes = 0; // Part of originalBytes holding float values
+
+    StorageUsage &operator+=(const StorageUsage &Other);
+};
+
+// What demoting to one format would save: the float variables, fields,
+// arrays and literals whose values all fit it. Each variable, field and
+// array is counted once, at its declared size.
+struct FormatUsage {
+    bool enabled = false;
+    size_t varCount = 0;
+    size_t fieldCount = 0;
+    size_t arrayCount = 0;
+    size_t literalCount = 0;
+    size_t floatBytes = 0; // Of the variables, fields and arrays counted
+
+    FormatUsage &operator+=(const FormatUsage &Other);
+};
+
+// Memory usage tracking
+struct MemoryUsage {
+    // Totals over all storage classes
+    size_t originalBytes = 0;
+    size_t demotedBytes = 0;
+
+    size_t floatVarCount = 0;
+    size_t demotedVarCount = 0;
+    size_t floatLiteralCount = 0;
+    size_t demotedLiteralCount = 0;
+    size_t floatFieldCount = 0;
+    size_t demotedFieldCount = 0;
+    size_t floatArrayCount = 0;   // Float arrays, variables and fields
+    size_t demotedArrayCount = 0; // Stored as binary16
+
+    // The double tier (-fprecision-demote-double); zero without it
+    size_t doubleVarCount = 0;
+    size_t demotedDoubleVarCount = 0; // Rewritten to float
+    size_t doubleLiteralCount = 0;
+    size_t demotedDoubleLiteralCount = 0; // To float; narrower formats count as demotedLiteralCount
+    size_t doubleBytes = 0;        // Declared size of the double variables
+    size_t demotedDoubleBytes = 0; // Of those rewritten, which halves it
+    size_t floatMathCalls = 0;     // <math.h> calls switched to float variants
+
+    StorageUsage global;      // File-scope variables and static data members
+    StorageUsage staticLocal; // Function-scope static variables
+    StorageUsage stack;       // Automatic variables, summed over all frames
+    size_t largestFrameBytes = 0;
+    size_t largestFrameDemotedBytes = 0;
+
+    std::array<FormatUsage, NumFloatFormats> formats; // Indexed like floatFormats()
+
+    MemoryUsage &operator+=(const MemoryUsage &Other);
+};
+
+// Size and alignment of a type, in bytes.
+struct TypeLayout {
+    uint64_t Size = 0;
+    uint64_t Align = 1;
+};
+
+class MemoryModel {
+public:
+    explicit MemoryModel(clang::ASTContext *Context) : Context(Context) {}
+
+    // Adds a variable defined in the main file. Demoted means its type
+    // becomes __fp16 (a float) or float (a double). Declarations that do not allocate storage (extern,
+    // parameters, templates) are ignored.
+    void addVariable(const clang::VarDecl *VD, bool Demoted);
+
+    // Marks a float field (or float array field) as stored in binary16;
+    // every record containing it is laid out again.
+    void addDemotedField(const clang::FieldDecl *FD);
+
+    // Marks a variable added before as demoted once the traversal is done:
+    // a float array stored in binary16 or a double stored as float.
+    void addDemotedVariable(const clang::VarDecl *VD);
+
+    // Lays RD's fields out in Order instead of declaration order.
+    void setFieldOrder(const clang::RecordDecl *RD, std::vector<const clang::FieldDecl *> Order);
+
+    // Size and alignment of FD's storage after demotion.
+    TypeLayout demotedFieldLayout(const clang::FieldDecl *FD);
+
+    // The target's layout of T.
+    TypeLayout originalLayout(clang::QualType T) const;
+
+    // Layout of T with the demoted fields stored in __fp16.
+    TypeLayout demotedLayout(clang::QualType T);
+
+    // Bytes of T holding float values.
+    uint64_t floatBytes(clang::QualType T) const;
+
+    // Adds the storage of every variable to Usage.
+    void finish(MemoryUsage &Usage);
+
+private:
+    enum class StorageClass { Global, StaticLocal, Stack };
+
+    struct Variable {
+        const clang::VarDecl *VD;
+        bool Demoted;
+        StorageClass Class;
+        const clang::Decl *Frame; // Owning function of stack variables
+    };
+
+    TypeLayout narrowLayout(clang::QualType T) const;
+    TypeLayout recordLayout(const clang::RecordDecl *RD);
+    bool changesLayout(const clang::RecordDecl *RD);
+    void layOut(const std::vector<const Variable *> &Vars, StorageUsage &Usage,
+                size_t &Original, size_t &Demoted);
+
+    clang::ASTContext *Context;
+    std::vector<Variable> Variables;
+    llvm::DenseSet<const clang::VarDecl *> Seen;
+    llvm::DenseSet<const clang::FieldDecl *> DemotedFields;
+    llvm::DenseSet<const clang::VarDecl *> DemotedVariables;
+    llvm::DenseMap<const clang::RecordDecl *, std::vector<const clang::FieldDecl *>> FieldOrders;
+    // Memoized per record definition; cleared when a field is demoted.
+    llvm::DenseMap<const clang::RecordDecl *, bool> ChangedRecords;
+    llvm::DenseMap<const clang::RecordDecl *, TypeLayout> RecordLayouts;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_MEMORY_MODEL_H
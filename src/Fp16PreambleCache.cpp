@@ -0,0 +1,188 @@
+#include "Fp16PreambleCache.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendOptions.h"
+#include "clang/Lex/HeaderSearchOptions.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+#include <chrono>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+std::shared_ptr<const PreambleCache::Entry>
+PreambleCache::build(const CompilerInvocation &Invocation, const llvm::MemoryBuffer &MainFile,
+                     PreambleBounds Bounds, llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS,
+                     std::shared_ptr<PCHContainerOperations> PCHContainerOps) {
+    auto Start = std::chrono::steady_clock::now();
+    // Errors in the headers are reported again by the parse that follows.
+    IgnoringDiagConsumer IgnoreDiags;
+    llvm::IntrusiveRefCntPtr<DiagnosticsEngine> Diags = CompilerInstance::createDiagnostics(
+        new DiagnosticOptions(), &IgnoreDiags, /*ShouldOwnClient=*/false);
+    PreambleCallbacks Callbacks;
+    auto Built = PrecompiledPreamble::Build(Invocation, &MainFile, Bounds, *Diags, VFS,
+                                            std::move(PCHContainerOps),
+                                            /*StoreInMemory=*/true, /*StoragePath=*/"",
+                                            Callbacks);
+
+    auto NewEntry = std::make_shared<Entry>();
+    NewEntry->BuildMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - Start).count();
+    if (Built) {
+        NewEntry->Preamble = std::make_shared<const PrecompiledPreamble>(std::move(*Built));
+        ++Stats.Builds;
+        Stats.BuildMicros += NewEntry->BuildMicros;
+    } else {
+        ++Stats.Failures;
+    }
+    return NewEntry;
+}
+
+// Everything that decides which file an #include finds. The module hash
+// leaves the include paths out, and CanReuse only checks the files the
+// preamble read, not whether another one would be found now.
+static std::string searchPathKey(const CompilerInvocation &Invocation,
+                                 llvm::vfs::FileSystem &VFS) {
+    std::string Key;
+    llvm::raw_string_ostream OS(Key);
+    if (llvm::ErrorOr<std::string> CWD = VFS.getCurrentWorkingDirectory())
+        OS << *CWD;
+    OS << '\0' << Invocation.getFileSystemOpts().WorkingDir;
+    // Quoted includes are looked up next to the main file first.
+    llvm::SmallString<256> Dir(
+        llvm::sys::path::parent_path(Invocation.getFrontendOpts().Inputs[0].getFile()));
+    VFS.makeAbsolute(Dir);
+    OS << '\0' << Dir;
+    const HeaderSearchOptions &HS = Invocation.getHeaderSearchOpts();
+    OS << '\0' << HS.Sysroot << '\0' << HS.ResourceDir;
+    for (const HeaderSearchOptions::Entry &E : HS.UserEntries)
+        OS << '\0' << E.Path << '\0' << unsigned(E.Group) << E.IsFramework << E.IgnoreSysRoot;
+    for (const HeaderSearchOptions::SystemHeaderPrefix &P : HS.SystemHeaderPrefixes)
+        OS << '\0' << P.Prefix << P.IsSystemHeader;
+    return llvm::utohexstr(llvm::xxh3_64bits(llvm::arrayRefFromStringRef(OS.str())));
+}
+
+std::shared_ptr<const PrecompiledPreamble>
+PreambleCache::apply(CompilerInvocation &Invocation, llvm::MemoryBuffer &MainFile,
+                     llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> &VFS,
+                     std::shared_ptr<PCHContainerOperations> PCHContainerOps) {
+    const FrontendOptions &FrontendOpts = Invocation.getFrontendOpts();
+    if (FrontendOpts.Inputs.size() != 1)
+        return nullptr;
+    PreambleBounds Bounds =
+        ComputePreambleBounds(Invocation.getLangOpts(), MainFile.getMemBufferRef(), 0);
+    if (Bounds.Size == 0)
+        return nullptr;
+
+    llvm::StringRef Prefix = MainFile.getBuffer().take_front(Bounds.Size);
+    std::string Key = Invocation.getModuleHash();
+    Key += '/';
+    Key += std::to_string(unsigned(FrontendOpts.Inputs[0].getKind().getLanguage()));
+    Key += Bounds.PreambleEndsAtStartOfLine ? "/l/" : "/c/";
+    Key += llvm::utohexstr(llvm::xxh3_64bits(llvm::arrayRefFromStringRef(Prefix)));
+    Key += '/';
+    Key += searchPathKey(Invocation, *VFS);
+
+    std::shared_ptr<const Entry> Found;
+    {
+        std::unique_lock<std::mutex> Lock(Mutex);
+        auto It = Slots.find(Key);
+        if (It != Slots.end()) {
+            It->second.LastUse = ++Clock;
+            EntryFuture Future = It->second.Future;
+            Lock.unlock();
+            Found = Future.get();
+        }
+    }
+
+    bool Stale = false;
+    if (Found) {
+        // A failed build is remembered, so the headers are not parsed twice
+        // for nothing.
+        if (!Found->Preamble)
+            return nullptr;
+        if (Found->Preamble->CanReuse(Invocation, MainFile.getMemBufferRef(), Bounds, *VFS)) {
+            ++Stats.Hits;
+            Stats.SavedMicros += Found->BuildMicros;
+            Found->Preamble->AddImplicitPreamble(Invocation, VFS, &MainFile);
+            return Found->Preamble;
+        }
+        Stale = true;
+    }
+
+    // Publish the build before starting it, so others wait for it.
+    std::promise<std::shared_ptr<const Entry>> Promise;
+    {
+        std::lock_guard<std::mutex> Lock(Mutex);
+        Slots[Key] = {Promise.get_future().share(), ++Clock};
+        while (Slots.size() > MaxEntries) {
+            auto Oldest = Slots.begin();
+            for (auto It = Slots.begin(); It != Slots.end(); ++It)
+                if (It->second.LastUse < Oldest->second.LastUse)
+                    Oldest = It;
+            Slots.erase(Oldest);
+        }
+    }
+    if (Stale)
+        ++Stats.Rebuilds;
+    std::shared_ptr<const Entry> Built = build(Invocation, MainFile, Bounds, VFS, PCHContainerOps);
+    Promise.set_value(Built);
+    if (!Built->Preamble)
+        return nullptr;
+    Built->Preamble->AddImplicitPreamble(Invocation, VFS, &MainFile);
+    return Built->Preamble;
+}
+
+void PreambleCache::printStats(llvm::raw_ostream &OS) const {
+    uint64_t Hits = Stats.Hits, Builds = Stats.Builds;
+    OS << "Preamble cache: " << Hits << " hits, " << Builds << " builds";
+    if (Hits + Builds)
+        OS << " (" << (Hits * 100 / (Hits + Builds)) << "% hit rate)";
+    OS << ", " << Stats.Rebuilds << " rebuilt after header changes, " << Stats.Failures
+       << " failed; built in " << llvm::format("%.3f", Stats.BuildMicros / 1e6)
+       << " s, saved ~" << llvm::format("%.3f", Stats.SavedMicros / 1e6) << " s\n";
+}
+
+bool PreambleActionFactory::runInvocation(std::shared_ptr<CompilerInvocation> Invocation,
+                                          FileManager *Files,
+                                          std::shared_ptr<PCHContainerOperations> PCHContainerOps,
+                                          DiagnosticConsumer *DiagConsumer) {
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS = &Files->getVirtualFileSystem();
+    std::shared_ptr<const PrecompiledPreamble> Preamble;
+    std::unique_ptr<llvm::MemoryBuffer> MainFile;
+    const FrontendOptions &FrontendOpts = Invocation->getFrontendOpts();
+    if (FrontendOpts.Inputs.size() == 1 && FrontendOpts.Inputs[0].isFile()) {
+        if (auto Buffer = VFS->getBufferForFile(FrontendOpts.Inputs[0].getFile()))
+            MainFile = std::move(*Buffer);
+    }
+    if (MainFile)
+        Preamble = Cache.apply(*Invocation, *MainFile, VFS, PCHContainerOps);
+
+    // As in tooling::FrontendActionFactory::runInvocation, but with a file
+    // manager over the VFS that serves the preamble.
+    CompilerInstance Compiler(std::move(PCHContainerOps));
+    Compiler.setInvocation(std::move(Invocation));
+    if (Preamble)
+        Compiler.createFileManager(VFS);
+    else
+        Compiler.setFileManager(Files);
+
+    // Destroyed before Compiler, which it may refer to.
+    std::unique_ptr<FrontendAction> Action = Create();
+
+    Compiler.createDiagnostics(DiagConsumer, /*ShouldOwnClient=*/false);
+    if (!Compiler.hasDiagnostics())
+        return false;
+    Compiler.createSourceManager(Compiler.getFileManager());
+
+    bool Success = Compiler.ExecuteAction(*Action);
+    Files->clearStatCache();
+    return Success;
+}
+
+} // namespace fp16demotion
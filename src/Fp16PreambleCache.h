@@ -0,0 +1,115 @@
+//===- Fp16PreambleCache.h - Shared precompiled preambles ------*- C++ -*-===//
+//
+// Most translation units start with the same block of #includes, and
+// parsing those headers dominates the parse time of a small file. Processes
+// that parse many translation units (the analysis server, fp16-demote) keep
+// the headers precompiled as clang::PrecompiledPreambles and reuse them.
+//
+// A preamble is keyed by the text of the include prefix (as far as
+// clang::ComputePreambleBounds reaches), the input language, the compiler
+// flags that affect it (CompilerInvocation::getModuleHash) and everything
+// that decides which header an #include finds: the include paths, the
+// working directory and the directory of the main file. Before a cached
+// preamble is used, PrecompiledPreamble::CanReuse checks that none of the
+// headers it read has changed; a stale one is rebuilt.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_PREAMBLE_CACHE_H
+#define FP16_PREAMBLE_CACHE_H
+
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/PrecompiledPreamble.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+
+namespace fp16demotion {
+
+struct PreambleCacheStats {
+    std::atomic<uint64_t> Hits{0};
+    std::atomic<uint64_t> Builds{0};
+    std::atomic<uint64_t> Rebuilds{0}; // Builds because a header changed
+    std::atomic<uint64_t> Failures{0}; // Files whose preamble could not be built
+    std::atomic<uint64_t> BuildMicros{0};
+    // The build time of the preamble behind each hit: the header parsing
+    // the hit skipped.
+    std::atomic<uint64_t> SavedMicros{0};
+};
+
+// Thread-safe; concurrent requests for the same missing preamble wait for
+// one build. Preambles are kept in memory, at most MaxEntries of them, and
+// the least recently used is dropped first.
+class PreambleCache {
+public:
+    explicit PreambleCache(size_t MaxEntries = 16) : MaxEntries(MaxEntries) {}
+
+    // Makes Invocation, about to parse MainFile, start from a cached
+    // preamble, building it first if needed. VFS is replaced by one that
+    // also serves the precompiled preamble. Returns the preamble, which must
+    // outlive the compilation, or null if MainFile has no preamble or it
+    // cannot be built; Invocation and VFS are then unchanged.
+    std::shared_ptr<const clang::PrecompiledPreamble>
+    apply(clang::CompilerInvocation &Invocation, llvm::MemoryBuffer &MainFile,
+          llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> &VFS,
+          std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps);
+
+    const PreambleCacheStats &stats() const { return Stats; }
+
+    void printStats(llvm::raw_ostream &OS) const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const clang::PrecompiledPreamble> Preamble; // Null if the build failed
+        uint64_t BuildMicros = 0;
+    };
+    using EntryFuture = std::shared_future<std::shared_ptr<const Entry>>;
+    struct Slot {
+        EntryFuture Future;
+        uint64_t LastUse = 0;
+    };
+
+    std::shared_ptr<const Entry>
+    build(const clang::CompilerInvocation &Invocation, const llvm::MemoryBuffer &MainFile,
+          clang::PreambleBounds Bounds, llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS,
+          std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps);
+
+    size_t MaxEntries;
+    PreambleCacheStats Stats;
+
+    std::mutex Mutex; // Guards the fields below
+    llvm::StringMap<Slot> Slots;
+    uint64_t Clock = 0;
+};
+
+// Runs the FrontendActions made by Create like
+// tooling::FrontendActionFactory, except that every invocation starts from
+// a preamble from Cache. For use with ClangTool::run and ToolInvocation.
+class PreambleActionFactory : public clang::tooling::ToolAction {
+public:
+    PreambleActionFactory(PreambleCache &Cache,
+                          std::function<std::unique_ptr<clang::FrontendAction>()> Create)
+        : Cache(Cache), Create(std::move(Create)) {}
+
+    bool runInvocation(std::shared_ptr<clang::CompilerInvocation> Invocation,
+                       clang::FileManager *Files,
+                       std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps,
+                       clang::DiagnosticConsumer *DiagConsumer) override;
+
+private:
+    PreambleCache &Cache;
+    std::function<std::unique_ptr<clang::FrontendAction>()> Create;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_PREAMBLE_CACHE_H
@@ -0,0 +1,1679 @@
+#include "Fp16RangeAnalysis.h"
+#include "clang/AST/Attr.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Analysis/CFG.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <vector>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+// Result of converting A to bool (or of a logical operator on it).
+static Interval truthOf(const Interval &A) {
+    if (A.isEmpty())
+        return A;
+    if (A.Lo == 0 && A.Hi == 0)
+        return Interval::point(0);
+    if (A.Lo > 0 || A.Hi < 0)
+        return Interval::point(1);
+    return {0, 1};
+}
+
+static bool isArithmetic(QualType T) {
+    return T->isRealFloatingType() || T->isIntegerType();
+}
+
+static const VarDecl *referencedVar(const Expr *E) {
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(E->IgnoreParens()))
+        return dyn_cast<VarDecl>(DRE->getDecl());
+    return nullptr;
+}
+
+static Interval pointOf(const APValue &V) {
+    if (V.isFloat()) {
+        llvm::APFloat F = V.getFloat();
+        bool LosesInfo;
+        F.convert(llvm::APFloat::IEEEdouble(), llvm::APFloat::rmNearestTiesToEven, &LosesInfo);
+        return Interval::point(F.convertToDouble());
+    }
+    if (V.isInt())
+        return Interval::point(V.getInt().roundToDouble(V.getInt().isSigned()));
+    return Interval::top();
+}
+
+// Every value of type T.
+static Interval typeRange(ASTContext &Ctx, QualType T) {
+    if (T->isBooleanType())
+        return {0, 1};
+    if (T->isIntegerType()) {
+        int Width = int(Ctx.getIntWidth(T));
+        if (T->isSignedIntegerOrEnumerationType())
+            return {-std::ldexp(1.0, Width - 1), std::ldexp(1.0, Width - 1) - 1};
+        return {0, std::ldexp(1.0, Width) - 1};
+    }
+    return Interval::top();
+}
+
+// V converted to type T.
+static Interval fitToType(ASTContext &Ctx, Interval V, QualType T) {
+    if (V.isEmpty() || !T->isIntegerType())
+        return V;
+    if (T->isBooleanType())
+        return truthOf(V);
+    Interval Range = typeRange(Ctx, T);
+    if (V.Lo < Range.Lo || V.Hi > Range.Hi)
+        return Range; // Wraps around (or is undefined behavior)
+    return V.trunc();
+}
+
+// The member access E is, if it names a non-static data member.
+static const MemberExpr *fieldAccess(const Expr *E) {
+    const auto *ME = dyn_cast<MemberExpr>(E->IgnoreParens());
+    return ME && isa<FieldDecl>(ME->getMemberDecl()) ? ME : nullptr;
+}
+
+static const FieldDecl *referencedField(const Expr *E) {
+    const MemberExpr *ME = fieldAccess(E);
+    return ME ? cast<FieldDecl>(ME->getMemberDecl()) : nullptr;
+}
+
+const ValueDecl *indexedArray(const Expr *E) {
+    const auto *ASE = dyn_cast<ArraySubscriptExpr>(E->IgnoreParens());
+    if (!ASE)
+        return nullptr;
+    const auto *Decay = dyn_cast<ImplicitCastExpr>(ASE->getBase()->IgnoreParens());
+    if (!Decay || Decay->getCastKind() != CK_ArrayToPointerDecay)
+        return nullptr;
+    const Expr *Array = Decay->getSubExpr();
+    if (const VarDecl *VD = referencedVar(Array))
+        return VD->getCanonicalDecl();
+    if (const FieldDecl *FD = referencedField(Array))
+        return FD;
+    return indexedArray(Array);
+}
+
+void forEachElementInit(const InitListExpr *ILE, llvm::function_ref<void(const Expr *)> Fn) {
+    for (const Expr *Init : ILE->inits()) {
+        if (const auto *Nested = dyn_cast_or_null<InitListExpr>(Init))
+            forEachElementInit(Nested, Fn);
+        else if (!Init || isa<ImplicitValueInitExpr>(Init))
+            Fn(nullptr);
+        else
+            Fn(Init);
+    }
+    // Elements after the last initializer are zero.
+    const auto *CAT = dyn_cast_or_null<ConstantArrayType>(ILE->getType()->getAsArrayTypeUnsafe());
+    if (CAT && ILE->getNumInits() < CAT->getSize().getZExtValue())
+        Fn(nullptr);
+}
+
+// Join of every element of a constant array (or the value itself).
+static Interval elementsOf(const APValue &V) {
+    if (!V.isArray())
+        return pointOf(V);
+    Interval All;
+    for (unsigned I = 0; I < V.getArrayInitializedElts(); ++I)
+        All = All.join(elementsOf(V.getArrayInitializedElt(I)));
+    if (V.hasArrayFiller())
+        All = All.join(elementsOf(V.getArrayFiller()));
+    return All;
+}
+
+static void collectEscapes(const Stmt *S, llvm::DenseSet<const VarDecl *> &Escaped,
+                           llvm::DenseSet<const FieldDecl *> *FieldEscapes = nullptr);
+
+// True if E names a variable, a field or an array element that is read or
+// stored directly. Only the parts of E evaluated on the way, the base
+// object of a field and the indices, can escape.
+static bool isDirectAccess(const Expr *E, llvm::DenseSet<const VarDecl *> &Escaped,
+                           llvm::DenseSet<const FieldDecl *> *FieldEscapes) {
+    if (referencedVar(E))
+        return true;
+    if (const MemberExpr *ME = fieldAccess(E)) {
+        collectEscapes(ME->getBase(), Escaped, FieldEscapes);
+        return true;
+    }
+    if (const auto *ASE = dyn_cast<ArraySubscriptExpr>(E->IgnoreParens())) {
+        const auto *Decay = dyn_cast<ImplicitCastExpr>(ASE->getBase()->IgnoreParens());
+        if (Decay && Decay->getCastKind() == CK_ArrayToPointerDecay &&
+            isDirectAccess(Decay->getSubExpr(), Escaped, FieldEscapes)) {
+            collectEscapes(ASE->getIdx(), Escaped, FieldEscapes);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Records every variable used other than by a plain read or as the direct
+// target of a store: address taken, bound to a reference, captured by
+// reference, an array decayed to a pointer. Such variables can change
+// behind the analysis' back. Fields used that way go to FieldEscapes, if
+// given.
+static void collectEscapes(const Stmt *S, llvm::DenseSet<const VarDecl *> &Escaped,
+                           llvm::DenseSet<const FieldDecl *> *FieldEscapes) {
+    if (!S)
+        return;
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(S)) {
+        if (const auto *VD = dyn_cast<VarDecl>(DRE->getDecl()))
+            Escaped.insert(VD->getCanonicalDecl());
+        return;
+    }
+    auto Direct = [&](const Expr *E) { return isDirectAccess(E, Escaped, FieldEscapes); };
+    if (const auto *ICE = dyn_cast<ImplicitCastExpr>(S)) {
+        if (ICE->getCastKind() == CK_LValueToRValue && Direct(ICE->getSubExpr()))
+            return;
+    } else if (const auto *BO = dyn_cast<BinaryOperator>(S)) {
+        if (BO->isAssignmentOp() && Direct(BO->getLHS())) {
+            collectEscapes(BO->getRHS(), Escaped, FieldEscapes);
+            return;
+        }
+    } else if (const auto *UO = dyn_cast<UnaryOperator>(S)) {
+        if (UO->isIncrementDecrementOp() && Direct(UO->getSubExpr()))
+            return;
+    } else if (const auto *ME = dyn_cast<MemberExpr>(S)) {
+        if (FieldEscapes)
+            if (const auto *FD = dyn_cast<FieldDecl>(ME->getMemberDecl()))
+                FieldEscapes->insert(FD);
+    } else if (isa<UnaryExprOrTypeTraitExpr>(S)) {
+        return; // sizeof and friends do not evaluate their operand
+    }
+    for (const Stmt *Child : S->children())
+        collectEscapes(Child, Escaped, FieldEscapes);
+}
+
+namespace {
+
+// The abstract state at one program point. Tracked variables without an
+// entry may hold any value of their type.
+struct State {
+    bool Reachable = false;
+    llvm::DenseMap<const VarDecl *, Interval> Vars;
+
+    bool operator==(const State &Other) const {
+        if (Reachable != Other.Reachable || Vars.size() != Other.Vars.size())
+            return false;
+        for (const auto &Entry : Vars) {
+            auto It = Other.Vars.find(Entry.first);
+            if (It == Other.Vars.end() || It->second != Entry.second)
+                return false;
+        }
+        return true;
+    }
+};
+
+static State mergeStates(const State &Old, const State &New, bool Widen) {
+    if (!Old.Reachable)
+        return New;
+    if (!New.Reachable)
+        return Old;
+    State Merged;
+    Merged.Reachable = true;
+    for (const auto &Entry : Old.Vars) {
+        auto It = New.Vars.find(Entry.first);
+        if (It == New.Vars.end())
+            continue;
+        Merged.Vars[Entry.first] =
+            Widen ? Entry.second.widen(It->second) : Entry.second.join(It->second);
+    }
+    return Merged;
+}
+
+// Abstract interpreter for one function body.
+class IntervalInterpreter {
+public:
+    IntervalInterpreter(ASTContext &Ctx, RangeAnalysis &Analysis,
+                        const llvm::DenseSet<const VarDecl *> &Escaped)
+        : Ctx(Ctx), Analysis(Analysis), Escaped(Escaped) {}
+
+    // Returns false if no fixpoint was found within the iteration budget.
+    bool run(const Decl *D, Stmt *Body);
+
+private:
+    bool isTracked(const VarDecl *VD) const {
+        return VD->hasLocalStorage() && isArithmetic(VD->getType()) &&
+               !VD->getType().isVolatileQualified() && !Escaped.count(VD->getCanonicalDecl());
+    }
+
+    Interval typeRange(QualType T) const { return fp16demotion::typeRange(Ctx, T); }
+    Interval fitToType(Interval V, QualType T) const {
+        return fp16demotion::fitToType(Ctx, V, T);
+    }
+    Interval read(const VarDecl *VD, const State &S) const;
+    Interval valueOf(const Expr *E, const State &S);
+    Interval eval(const Expr *E, const State &S);
+    Interval evalCast(const CastExpr *CE, const State &S);
+    Interval evalCall(const CallExpr *CE, const State &S);
+    Interval evalBinary(BinaryOperatorKind Op, const Interval &L, const Interval &R, QualType T);
+    void store(const VarDecl *VD, Interval V, State &S);
+    void storeField(const FieldDecl *FD, const Interval &V);
+    void storeElement(const ValueDecl *Array, const Interval &V);
+    void storeElements(const ValueDecl *Array, const Expr *Init, const State &S);
+    Interval readElement(const ValueDecl *Array) const;
+    void storeInitList(const InitListExpr *ILE, const State &S);
+    void storeNestedInitLists(const Stmt *St, const State &S);
+    void transfer(const Stmt *St, State &S);
+    State refine(const State &S, const Expr *Cond, bool Branch);
+    void constrain(State &S, const VarDecl *VD, BinaryOperatorKind Op, const Interval &Bound,
+                   bool Integral);
+
+    ASTContext &Ctx;
+    RangeAnalysis &Analysis;
+    const Decl *Current = nullptr;
+    const llvm::DenseSet<const VarDecl *> &Escaped;
+    // Value of every expression evaluated so far. With every subexpression
+    // added to the CFG, operands are always evaluated before their users.
+    llvm::DenseMap<const Expr *, Interval> ExprValues;
+};
+
+} // namespace
+
+Interval IntervalInterpreter::read(const VarDecl *VD, const State &S) const {
+    if (isTracked(VD)) {
+        auto It = S.Vars.find(VD);
+        return It != S.Vars.end() ? It->second : typeRange(VD->getType());
+    }
+    // Constants keep their initial value.
+    const VarDecl *InitDecl = nullptr;
+    if (VD->getType().isConstQualified()) {
+        const Expr *Init = VD->getAnyInitializer(InitDecl);
+        if (Init && !Init->isValueDependent())
+            if (const APValue *V = InitDecl->evaluateValue())
+                return pointOf(*V);
+    }
+    return typeRange(VD->getType());
+}
+
+Interval IntervalInterpreter::valueOf(const Expr *E, const State &S) {
+    E = E->IgnoreParens();
+    auto It = ExprValues.find(E);
+    if (It != ExprValues.end())
+        return It->second;
+    return eval(E, S);
+}
+
+Interval IntervalInterpreter::evalBinary(BinaryOperatorKind Op, const Interval &L,
+                                         const Interval &R, QualType T) {
+    switch (Op) {
+    case BO_Add: case BO_AddAssign: return fitToType(L.add(R), T);
+    case BO_Sub: case BO_SubAssign: return fitToType(L.sub(R), T);
+    case BO_Mul: case BO_MulAssign: return fitToType(L.mul(R), T);
+    case BO_Div: case BO_DivAssign: return fitToType(L.div(R), T);
+    default: return typeRange(T);
+    }
+}
+
+Interval IntervalInterpreter::evalCast(const CastExpr *CE, const State &S) {
+    const Expr *Sub = CE->getSubExpr();
+    switch (CE->getCastKind()) {
+    case CK_LValueToRValue:
+        if (const VarDecl *VD = referencedVar(Sub))
+            return read(VD, S);
+        if (const ValueDecl *Array = indexedArray(Sub))
+            return fitToType(readElement(Array), CE->getType());
+        return typeRange(CE->getType());
+    case CK_NoOp:
+    case CK_IntegralCast:
+    case CK_IntegralToFloating:
+    case CK_FloatingCast:
+    case CK_FloatingToIntegral:
+    case CK_IntegralToBoolean:
+    case CK_FloatingToBoolean:
+        return fitToType(valueOf(Sub, S), CE->getType());
+    default:
+        return typeRange(CE->getType());
+    }
+}
+
+Interval IntervalInterpreter::evalCall(const CallExpr *CE, const State &S) {
+    const FunctionDecl *Callee = CE->getDirectCallee();
+    if (!Callee || isa<CXXMemberCallExpr>(CE) || isa<CXXOperatorCallExpr>(CE))
+        return typeRange(CE->getType());
+    std::vector<Interval> Args;
+    for (const Expr *Arg : CE->arguments())
+        Args.push_back(isArithmetic(Arg->getType()) ? valueOf(Arg, S) : Interval::top());
+    return fitToType(Analysis.evaluateCall(Callee, Args), CE->getType());
+}
+
+Interval IntervalInterpreter::eval(const Expr *E, const State &S) {
+    E = E->IgnoreParens();
+    QualType T = E->getType();
+    if (!isArithmetic(T))
+        return Interval::top();
+
+    if (const auto *FL = dyn_cast<FloatingLiteral>(E))
+        return Interval::point(FL->getValueAsApproximateDouble());
+    if (const auto *IL = dyn_cast<IntegerLiteral>(E))
+        return Interval::point(IL->getValue().roundToDouble(T->isSignedIntegerType()));
+    if (const auto *CL = dyn_cast<CharacterLiteral>(E))
+        return Interval::point(CL->getValue());
+    if (const auto *CE = dyn_cast<CastExpr>(E))
+        return evalCast(CE, S);
+
+    if (const auto *UO = dyn_cast<UnaryOperator>(E)) {
+        const Expr *Sub = UO->getSubExpr();
+        switch (UO->getOpcode()) {
+        case UO_Plus: return valueOf(Sub, S);
+        case UO_Minus: return fitToType(valueOf(Sub, S).neg(), T);
+        case UO_LNot: {
+            Interval Truth = truthOf(valueOf(Sub, S));
+            return Truth.isEmpty() ? Truth : Interval{1 - Truth.Hi, 1 - Truth.Lo};
+        }
+        case UO_PostInc: case UO_PostDec:
+        case UO_PreInc: case UO_PreDec: {
+            const VarDecl *VD = referencedVar(Sub);
+            if (!VD)
+                return typeRange(T);
+            Interval Old = read(VD, S);
+            if (UO->isPostfix())
+                return Old;
+            Interval One = Interval::point(1);
+            return fitToType(UO->isIncrementOp() ? Old.add(One) : Old.sub(One), T);
+        }
+        default: return typeRange(T);
+        }
+    }
+
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        BinaryOperatorKind Op = BO->getOpcode();
+        if (BO->isComparisonOp() || BO->isLogicalOp())
+            return {0, 1};
+        if (Op == BO_Assign)
+            return valueOf(BO->getRHS(), S);
+        if (Op == BO_Comma)
+            return valueOf(BO->getRHS(), S);
+        if (const auto *CAO = dyn_cast<CompoundAssignOperator>(BO)) {
+            const VarDecl *VD = referencedVar(CAO->getLHS());
+            if (!VD)
+                return typeRange(T);
+            Interval Result = evalBinary(Op, read(VD, S), valueOf(CAO->getRHS(), S),
+                                         CAO->getComputationResultType());
+            return fitToType(Result, T);
+        }
+        return evalBinary(Op, valueOf(BO->getLHS(), S), valueOf(BO->getRHS(), S), T);
+    }
+
+    if (const auto *Call = dyn_cast<CallExpr>(E)) {
+        // Calls the constant evaluator can fold are handled below.
+        Expr::EvalResult Result;
+        if (!Call->isValueDependent() && Call->EvaluateAsRValue(Result, Ctx) &&
+            !Result.HasSideEffects)
+            return pointOf(Result.Val);
+        return evalCall(Call, S);
+    }
+
+    if (const auto *DIE = dyn_cast<CXXDefaultInitExpr>(E))
+        return valueOf(DIE->getExpr(), S);
+
+    if (const auto *CO = dyn_cast<ConditionalOperator>(E))
+        return valueOf(CO->getTrueExpr(), S).join(valueOf(CO->getFalseExpr(), S));
+
+    if (const auto *DRE = dyn_cast<DeclRefExpr>(E)) {
+        if (const auto *ECD = dyn_cast<EnumConstantDecl>(DRE->getDecl()))
+            return Interval::point(ECD->getInitVal().roundToDouble(ECD->getInitVal().isSigned()));
+        return typeRange(T);
+    }
+
+    // sizeof, calls to constant functions and the like.
+    if (E->isPRValue() && !E->isValueDependent()) {
+        Expr::EvalResult Result;
+        if (E->EvaluateAsRValue(Result, Ctx) && !Result.HasSideEffects)
+            return pointOf(Result.Val);
+    }
+    return typeRange(T);
+}
+
+void IntervalInterpreter::store(const VarDecl *VD, Interval V, State &S) {
+    if (!isArithmetic(VD->getType()))
+        return;
+    if (V.isEmpty())
+        V = typeRange(VD->getType());
+    Analysis.addStoredValue(VD, V);
+    if (isTracked(VD))
+        S.Vars[VD] = V;
+}
+
+void IntervalInterpreter::storeField(const FieldDecl *FD, const Interval &V) {
+    if (isArithmetic(FD->getType()))
+        Analysis.addFieldValue(FD, V.isEmpty() ? typeRange(FD->getType())
+                                               : fitToType(V, FD->getType()));
+}
+
+void IntervalInterpreter::storeElement(const ValueDecl *Array, const Interval &V) {
+    QualType Element = Ctx.getBaseElementType(Array->getType());
+    if (isArithmetic(Element))
+        Analysis.addElementValue(Array, V.isEmpty() ? typeRange(Element) : fitToType(V, Element));
+}
+
+void IntervalInterpreter::storeElements(const ValueDecl *Array, const Expr *Init, const State &S) {
+    const auto *ILE = dyn_cast<InitListExpr>(Init->IgnoreImplicit());
+    if (!ILE) {
+        storeElement(Array, Interval::top());
+        return;
+    }
+    forEachElementInit(ILE, [&](const Expr *Element) {
+        storeElement(Array, Element ? valueOf(Element, S) : Interval::point(0));
+    });
+}
+
+// Elements of constant arrays keep their initial values; the elements of
+// other arrays are only known once every store has been seen.
+Interval IntervalInterpreter::readElement(const ValueDecl *Array) const {
+    QualType Element = Ctx.getBaseElementType(Array->getType());
+    const auto *VD = dyn_cast<VarDecl>(Array);
+    if (VD && Element.isConstQualified()) {
+        const VarDecl *InitDecl = nullptr;
+        const Expr *Init = VD->getAnyInitializer(InitDecl);
+        if (Init && !Init->isValueDependent())
+            if (const APValue *V = InitDecl->evaluateValue())
+                return elementsOf(*V);
+    }
+    return typeRange(Element);
+}
+
+// Nested initializer lists are elements of the CFG of their own, so only
+// the scalar fields initialized directly are stored.
+void IntervalInterpreter::storeInitList(const InitListExpr *ILE, const State &S) {
+    const auto *RT = ILE->getType()->getAs<RecordType>();
+    if (!RT)
+        return;
+    const RecordDecl *RD = RT->getDecl();
+    if (RD->isUnion()) {
+        if (const FieldDecl *FD = ILE->getInitializedFieldInUnion())
+            if (ILE->getNumInits() == 1)
+                storeField(FD, valueOf(ILE->getInit(0), S));
+        return;
+    }
+    unsigned Index = 0;
+    if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(RD))
+        Index = CXXRD->getNumBases(); // Aggregate bases come first
+    for (const FieldDecl *FD : RD->fields()) {
+        if (FD->isUnnamedBitfield())
+            continue;
+        if (Index >= ILE->getNumInits())
+            break;
+        const Expr *Init = ILE->getInit(Index++);
+        if (FD->getType()->isConstantArrayType())
+            storeElements(FD, Init, S);
+        else
+            storeField(FD, valueOf(Init, S));
+    }
+}
+
+void IntervalInterpreter::storeNestedInitLists(const Stmt *St, const State &S) {
+    if (!St)
+        return;
+    if (const auto *ILE = dyn_cast<InitListExpr>(St))
+        storeInitList(ILE, S);
+    for (const Stmt *Child : St->children())
+        storeNestedInitLists(Child, S);
+}
+
+void IntervalInterpreter::transfer(const Stmt *St, State &S) {
+    if (const auto *DS = dyn_cast<DeclStmt>(St)) {
+        for (const Decl *D : DS->decls()) {
+            const auto *VD = dyn_cast<VarDecl>(D);
+            // Static locals are initialized once, see RangeAnalysis::getRange.
+            if (!VD || !VD->hasLocalStorage())
+                continue;
+            if (VD->getType()->isConstantArrayType()) {
+                if (const Expr *Init = VD->getInit())
+                    storeElements(VD->getCanonicalDecl(), Init, S);
+                continue;
+            }
+            if (!isArithmetic(VD->getType()))
+                continue;
+            if (const Expr *Init = VD->getInit())
+                store(VD, fitToType(valueOf(Init, S), VD->getType()), S);
+            else
+                S.Vars.erase(VD);
+        }
+        return;
+    }
+
+    if (const auto *RS = dyn_cast<ReturnStmt>(St)) {
+        if (const Expr *Value = RS->getRetValue())
+            if (isArithmetic(Value->getType()))
+                Analysis.addReturnValue(Current, valueOf(Value, S));
+        return;
+    }
+
+    const auto *E = dyn_cast<Expr>(St);
+    if (!E)
+        return;
+    Interval V = eval(E, S);
+    Interval &Known = ExprValues[E];
+    Known = Known.join(V);
+
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        if (BO->isAssignmentOp()) {
+            if (const VarDecl *VD = referencedVar(BO->getLHS()))
+                store(VD, fitToType(V, VD->getType()), S);
+            else if (const FieldDecl *FD = referencedField(BO->getLHS()))
+                storeField(FD, V); // Compound assignments to fields are unknown
+            else if (const ValueDecl *Array = indexedArray(BO->getLHS()))
+                storeElement(Array, V); // Likewise for elements
+        }
+    } else if (const auto *UO = dyn_cast<UnaryOperator>(E)) {
+        if (UO->isIncrementDecrementOp()) {
+            if (const VarDecl *VD = referencedVar(UO->getSubExpr())) {
+                Interval Old = read(VD, S);
+                Interval One = Interval::point(1);
+                store(VD, fitToType(UO->isIncrementOp() ? Old.add(One) : Old.sub(One),
+                                    VD->getType()), S);
+            } else if (const FieldDecl *FD = referencedField(UO->getSubExpr())) {
+                storeField(FD, typeRange(FD->getType()));
+            } else if (const ValueDecl *Array = indexedArray(UO->getSubExpr())) {
+                storeElement(Array, Interval::top());
+            }
+        }
+    } else if (const auto *ILE = dyn_cast<InitListExpr>(E)) {
+        storeInitList(ILE, S);
+    }
+}
+
+void IntervalInterpreter::constrain(State &S, const VarDecl *VD, BinaryOperatorKind Op,
+                                    const Interval &Bound, bool Integral) {
+    if (Bound.isEmpty())
+        return;
+    // A strict integer comparison excludes the bound itself.
+    double Step = Integral ? 1 : 0;
+    Interval V = read(VD, S);
+    switch (Op) {
+    case BO_LT: V.Hi = std::min(V.Hi, Bound.Hi - Step); break;
+    case BO_LE: V.Hi = std::min(V.Hi, Bound.Hi); break;
+    case BO_GT: V.Lo = std::max(V.Lo, Bound.Lo + Step); break;
+    case BO_GE: V.Lo = std::max(V.Lo, Bound.Lo); break;
+    case BO_EQ: V = V.meet(Bound); break;
+    default: return;
+    }
+    if (V.isEmpty())
+        S.Reachable = false;
+    else
+        S.Vars[VD] = V;
+}
+
+State IntervalInterpreter::refine(const State &S, const Expr *Cond, bool Branch) {
+    const auto *BO = dyn_cast<BinaryOperator>(Cond->IgnoreParenImpCasts());
+    if (!BO || !BO->isComparisonOp())
+        return S;
+
+    BinaryOperatorKind Op = BO->getOpcode();
+    if (!Branch)
+        Op = BinaryOperator::negateComparisonOp(Op);
+    bool Integral = BO->getLHS()->getType()->isIntegerType();
+
+    State Refined = S;
+    auto TrackedVar = [&](const Expr *E) -> const VarDecl * {
+        const VarDecl *VD = referencedVar(E->IgnoreParenImpCasts());
+        return VD && isTracked(VD) ? VD : nullptr;
+    };
+    if (const VarDecl *VD = TrackedVar(BO->getLHS()))
+        constrain(Refined, VD, Op, valueOf(BO->getRHS(), S), Integral);
+    if (const VarDecl *VD = TrackedVar(BO->getRHS()))
+        constrain(Refined, VD, BinaryOperator::reverseComparisonOp(Op),
+                  valueOf(BO->getLHS(), S), Integral);
+    return Refined;
+}
+
+bool IntervalInterpreter::run(const Decl *D, Stmt *Body) {
+    Current = D;
+    CFG::BuildOptions Options;
+    Options.setAllAlwaysAdd();
+    std::unique_ptr<CFG> Cfg = CFG::buildCFG(D, Body, &Ctx, Options);
+    if (!Cfg)
+        return false;
+
+    // Visit blocks in reverse post-order so that, outside of loops, a block
+    // is only processed once all of its predecessors are.
+    unsigned NumBlocks = Cfg->getNumBlockIDs();
+    std::vector<unsigned> Order(NumBlocks, ~0u);
+    std::vector<const CFGBlock *> ByOrder;
+    {
+        std::vector<const CFGBlock *> PostOrder;
+        llvm::BitVector Seen(NumBlocks);
+        std::vector<std::pair<const CFGBlock *, CFGBlock::const_succ_iterator>> Stack;
+        const CFGBlock *Entry = &Cfg->getEntry();
+        Seen.set(Entry->getBlockID());
+        Stack.push_back({Entry, Entry->succ_begin()});
+        while (!Stack.empty()) {
+            auto &Top = Stack.back();
+            if (Top.second == Top.first->succ_end()) {
+                PostOrder.push_back(Top.first);
+                Stack.pop_back();
+                continue;
+            }
+            const CFGBlock *Succ = *Top.second++;
+            if (Succ && !Seen.test(Succ->getBlockID())) {
+                Seen.set(Succ->getBlockID());
+                Stack.push_back({Succ, Succ->succ_begin()});
+            }
+        }
+        ByOrder.assign(PostOrder.rbegin(), PostOrder.rend());
+        for (unsigned I = 0; I < ByOrder.size(); ++I)
+            Order[ByOrder[I]->getBlockID()] = I;
+    }
+
+    std::vector<State> In(NumBlocks);
+    std::vector<unsigned> Visits(NumBlocks);
+    In[Cfg->getEntry().getBlockID()].Reachable = true;
+
+    // Parameters hold whatever the caller passes.
+    if (const auto *FD = dyn_cast<FunctionDecl>(D)) {
+        for (const ParmVarDecl *P : FD->parameters())
+            store(P, typeRange(P->getType()), In[Cfg->getEntry().getBlockID()]);
+    } else if (const auto *BD = dyn_cast<BlockDecl>(D)) {
+        for (const ParmVarDecl *P : BD->parameters())
+            store(P, typeRange(P->getType()), In[Cfg->getEntry().getBlockID()]);
+    }
+
+    // Constructor member initializers run before the body; they are not
+    // part of the CFG.
+    if (const auto *CD = dyn_cast<CXXConstructorDecl>(D)) {
+        const State &Entry = In[Cfg->getEntry().getBlockID()];
+        for (const CXXCtorInitializer *Init : CD->inits()) {
+            storeNestedInitLists(Init->getInit(), Entry);
+            const FieldDecl *FD = Init->getMember();
+            if (FD && FD->getType()->isConstantArrayType())
+                storeElements(FD, Init->getInit(), Entry);
+            else if (FD && !isa<InitListExpr>(Init->getInit()->IgnoreImplicit()))
+                storeField(FD, valueOf(Init->getInit(), Entry));
+        }
+    }
+
+    std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> Worklist;
+    llvm::BitVector Queued(ByOrder.size());
+    Worklist.push(0);
+    Queued.set(0);
+
+    const unsigned WideningDelay = 3;
+    uint64_t Budget = uint64_t(ByOrder.size()) * 32 + 256;
+    while (!Worklist.empty()) {
+        if (Budget-- == 0)
+            return false;
+        unsigned Index = Worklist.top();
+        Worklist.pop();
+        Queued.reset(Index);
+        const CFGBlock *B = ByOrder[Index];
+        ++Visits[B->getBlockID()];
+
+        State Out = In[B->getBlockID()];
+        for (const CFGElement &Element : *B)
+            if (auto S = Element.getAs<CFGStmt>())
+                transfer(S->getStmt(), Out);
+
+        const Expr *Cond = B->succ_size() == 2 ? B->getTerminatorCondition() : nullptr;
+        unsigned SuccIndex = 0;
+        for (auto It = B->succ_begin(); It != B->succ_end(); ++It, ++SuccIndex) {
+            const CFGBlock *Succ = *It;
+            if (!Succ)
+                continue;
+            State Edge = Cond ? refine(Out, Cond, SuccIndex == 0) : Out;
+            if (!Edge.Reachable)
+                continue;
+            State &Target = In[Succ->getBlockID()];
+            State Merged = mergeStates(Target, Edge, Visits[Succ->getBlockID()] >= WideningDelay);
+            if (Merged == Target)
+                continue;
+            Target = std::move(Merged);
+            unsigned SuccOrder = Order[Succ->getBlockID()];
+            if (!Queued.test(SuccOrder)) {
+                Queued.set(SuccOrder);
+                Worklist.push(SuccOrder);
+            }
+        }
+    }
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// RangeAnalysis
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+// Collects every body and global initializer of the main file, including
+// lambdas and blocks, which are not FunctionDecls of their own. Default
+// member initializers count as global initializers.
+class BodyCollector : public RecursiveASTVisitor<BodyCollector> {
+public:
+    bool VisitFunctionDecl(FunctionDecl *FD) {
+        if (FD->doesThisDeclarationHaveABody())
+            Bodies.push_back(FD);
+        return true;
+    }
+    bool VisitLambdaExpr(LambdaExpr *LE) {
+        Bodies.push_back(LE->getCallOperator());
+        return true;
+    }
+    bool VisitBlockDecl(BlockDecl *BD) {
+        Bodies.push_back(BD);
+        return true;
+    }
+    bool VisitVarDecl(VarDecl *VD) {
+        if (!VD->hasLocalStorage() && VD->getInit())
+            GlobalInits.push_back(VD->getInit());
+        return true;
+    }
+    bool VisitFieldDecl(FieldDecl *FD) {
+        if (const Expr *Init = FD->getInClassInitializer())
+            GlobalInits.push_back(Init);
+        return true;
+    }
+
+    std::vector<const Decl *> Bodies;
+    std::vector<const Expr *> GlobalInits;
+};
+
+// The parameters and locals of a body, nested lambdas and blocks included,
+// in order.
+class LocalCollector : public RecursiveASTVisitor<LocalCollector> {
+public:
+    bool VisitVarDecl(VarDecl *VD) {
+        if (VD->hasLocalStorage())
+            Locals.push_back(VD->getCanonicalDecl());
+        return true;
+    }
+
+    std::vector<const VarDecl *> Locals;
+};
+
+// Every global, static local and field of the translation unit by its
+// stable name.
+class StableNameCollector : public RecursiveASTVisitor<StableNameCollector> {
+public:
+    explicit StableNameCollector(
+        llvm::StringMap<llvm::SmallVector<const ValueDecl *, 1>> &Names)
+        : Names(Names) {}
+
+    bool VisitVarDecl(VarDecl *VD) {
+        if (!VD->hasLocalStorage())
+            add("v" + stableDeclName(VD), VD->getCanonicalDecl());
+        return true;
+    }
+    bool VisitFieldDecl(FieldDecl *FD) {
+        add("f" + stableDeclName(FD), FD);
+        return true;
+    }
+
+private:
+    void add(const std::string &Name, const ValueDecl *D) {
+        llvm::SmallVector<const ValueDecl *, 1> &Decls = Names[Name];
+        if (!llvm::is_contained(Decls, D))
+            Decls.push_back(D);
+    }
+
+    llvm::StringMap<llvm::SmallVector<const ValueDecl *, 1>> &Names;
+};
+
+} // namespace
+
+// Every variable S assigns, compound-assigns or increments. Fields stored
+// to, including by an initializer list, go to FieldTargets if given, arrays
+// whose elements are stored to or initialized to ArrayTargets.
+static void collectStores(const Stmt *S, llvm::DenseSet<const VarDecl *> &Targets,
+                          llvm::DenseSet<const FieldDecl *> *FieldTargets = nullptr,
+                          llvm::DenseSet<const ValueDecl *> *ArrayTargets = nullptr) {
+    if (!S)
+        return;
+    const Expr *Target = nullptr;
+    if (const auto *DS = dyn_cast<DeclStmt>(S))
+        for (const Decl *D : DS->decls())
+            if (const auto *VD = dyn_cast<VarDecl>(D))
+                if (VD->getType()->isConstantArrayType() && VD->getInit() && ArrayTargets)
+                    ArrayTargets->insert(VD->getCanonicalDecl());
+    if (const auto *BO = dyn_cast<BinaryOperator>(S)) {
+        if (BO->isAssignmentOp())
+            Target = BO->getLHS();
+    } else if (const auto *UO = dyn_cast<UnaryOperator>(S)) {
+        if (UO->isIncrementDecrementOp())
+            Target = UO->getSubExpr();
+    } else if (const auto *ILE = dyn_cast<InitListExpr>(S)) {
+        if (const auto *RT = ILE->getType()->getAs<RecordType>())
+            if (FieldTargets)
+                for (const FieldDecl *FD : RT->getDecl()->fields())
+                    FieldTargets->insert(FD);
+    }
+    if (Target) {
+        if (const VarDecl *VD = referencedVar(Target))
+            Targets.insert(VD->getCanonicalDecl());
+        else if (const FieldDecl *FD = referencedField(Target))
+            if (FieldTargets)
+                FieldTargets->insert(FD);
+        if (const ValueDecl *Array = indexedArray(Target))
+            if (ArrayTargets)
+                ArrayTargets->insert(Array);
+    }
+    for (const Stmt *Child : S->children())
+        collectStores(Child, Targets, FieldTargets, ArrayTargets);
+}
+
+// Fallback for bodies that could not be analyzed: anything they store to may
+// hold any value.
+void RangeAnalysis::markStoresUnknown(const Stmt *S) {
+    llvm::DenseSet<const VarDecl *> Targets;
+    llvm::DenseSet<const FieldDecl *> FieldTargets;
+    llvm::DenseSet<const ValueDecl *> ArrayTargets;
+    collectStores(S, Targets, &FieldTargets, &ArrayTargets);
+    for (const VarDecl *VD : Targets)
+        addStoredValue(VD, Interval::top());
+    for (const FieldDecl *FD : FieldTargets) {
+        addFieldValue(FD, Interval::top());
+        if (FD->getType()->isConstantArrayType())
+            addElementValue(FD, Interval::top());
+    }
+    for (const ValueDecl *Array : ArrayTargets)
+        addElementValue(Array, Interval::top());
+}
+
+void RangeAnalysis::addEscapes(const Stmt *S) {
+    llvm::DenseSet<const VarDecl *> Vars;
+    llvm::DenseSet<const FieldDecl *> Fields;
+    collectEscapes(S, Vars, &Fields);
+    for (const VarDecl *VD : Vars) {
+        Escaped.insert(VD);
+        std::string Name;
+        if (Recording.empty())
+            continue;
+        if (effectsName(VD, Name))
+            Recording.back().Effects.Escapes.push_back(std::move(Name));
+        else
+            Recording.back().Complete = false;
+    }
+    for (const FieldDecl *FD : Fields) {
+        FieldEscaped.insert(FD);
+        if (!Recording.empty())
+            Recording.back().Effects.FieldEscapes.push_back(stableDeclName(FD));
+    }
+}
+
+bool RangeAnalysis::analyzeBody(const Decl *D) {
+    auto Known = Analyzed.find(D);
+    if (Known != Analyzed.end())
+        return Known->second;
+    // Reached again through a recursive call; the caller treats the call
+    // as unknown. Not cached, the outer analysis has the final word.
+    if (InProgress.count(D))
+        return false;
+
+    if (Incremental) {
+        if (const BodyEffects *Effects = Incremental->findEffects(D)) {
+            if (replayEffects(D, *Effects)) {
+                Analyzed[D] = Effects->Succeeded;
+                return Effects->Succeeded;
+            }
+        }
+        Recording.push_back({D});
+    }
+
+    Stmt *Body = D->getBody();
+    bool Succeeded = false;
+    if (Body) {
+        addEscapes(Body);
+        if (const auto *CD = dyn_cast<CXXConstructorDecl>(D))
+            for (const CXXCtorInitializer *Init : CD->inits())
+                addEscapes(Init->getInit());
+        const auto *DC = dyn_cast<DeclContext>(D);
+        if (!(DC && DC->isDependentContext())) {
+            InProgress.insert(D);
+            IntervalInterpreter Interpreter(*Context, *this, Escaped);
+            Succeeded = Interpreter.run(D, Body);
+            InProgress.erase(D);
+        }
+        if (!Succeeded) {
+            markStoresUnknown(Body);
+            ReturnValues.erase(D);
+        }
+    }
+    Analyzed[D] = Succeeded;
+
+    if (Incremental) {
+        BodyRecording Done = std::move(Recording.back());
+        Recording.pop_back();
+        if (Done.Complete && Incremental->hasEffects(D)) {
+            Done.Effects.Succeeded = Succeeded;
+            Done.Effects.Return = ReturnValues.lookup(D);
+            Incremental->storeEffects(D, std::move(Done.Effects));
+        }
+    }
+    return Succeeded;
+}
+
+// Applies the effects recorded for D by an earlier analysis as if D had
+// been analyzed. Returns false, changing nothing, if a declaration they name
+// is not found.
+bool RangeAnalysis::replayEffects(const Decl *D, const BodyEffects &Effects) {
+    auto Resolve = [&](llvm::StringRef Name, bool Field,
+                       llvm::SmallVectorImpl<const ValueDecl *> &Out) {
+        unsigned Index;
+        if (!Field && Name.consume_front("#")) {
+            const std::vector<const VarDecl *> &List = localsOf(D);
+            if (Name.getAsInteger(10, Index) || Index >= List.size())
+                return false;
+            Out.push_back(List[Index]);
+            return true;
+        }
+        llvm::ArrayRef<const ValueDecl *> Found =
+            lookupStableName((Field ? "f" : "v") + Name.str());
+        Out.append(Found.begin(), Found.end());
+        return !Found.empty();
+    };
+
+    using Resolved = std::pair<llvm::SmallVector<const ValueDecl *, 1>, Interval>;
+    auto ResolveValues = [&](const std::vector<std::pair<std::string, Interval>> &Values,
+                             bool Field, std::vector<Resolved> &Out) {
+        for (const auto &Value : Values) {
+            Out.emplace_back();
+            Out.back().second = Value.second;
+            if (!Resolve(Value.first, Field, Out.back().first))
+                return false;
+        }
+        return true;
+    };
+    auto ResolveNames = [&](const std::vector<std::string> &Names, bool Field,
+                            llvm::SmallVectorImpl<const ValueDecl *> &Out) {
+        return llvm::all_of(Names, [&](const std::string &Name) {
+            return Resolve(Name, Field, Out);
+        });
+    };
+
+    std::vector<Resolved> Stores, FieldStores, ElementStores, FieldElementStores;
+    llvm::SmallVector<const ValueDecl *, 4> Escapes, FieldEscapes;
+    if (!ResolveValues(Effects.Stores, false, Stores) ||
+        !ResolveValues(Effects.FieldStores, true, FieldStores) ||
+        !ResolveValues(Effects.ElementStores, false, ElementStores) ||
+        !ResolveValues(Effects.FieldElementStores, true, FieldElementStores) ||
+        !ResolveNames(Effects.Escapes, false, Escapes) ||
+        !ResolveNames(Effects.FieldEscapes, true, FieldEscapes))
+        return false;
+
+    auto Join = [](Interval &All, const Interval &Value) { All = All.join(Value); };
+    for (const Resolved &R : Stores)
+        for (const ValueDecl *VD : R.first)
+            Join(Stored[cast<VarDecl>(VD)], R.second);
+    for (const Resolved &R : FieldStores)
+        for (const ValueDecl *FD : R.first)
+            Join(FieldStored[cast<FieldDecl>(FD)], R.second);
+    for (const std::vector<Resolved> *Elements : {&ElementStores, &FieldElementStores})
+        for (const Resolved &R : *Elements)
+            for (const ValueDecl *Array : R.first)
+                Join(ElementStored[Array], R.second);
+    for (const ValueDecl *VD : Escapes)
+        Escaped.insert(cast<VarDecl>(VD));
+    for (const ValueDecl *FD : FieldEscapes)
+        FieldEscaped.insert(cast<FieldDecl>(FD));
+    if (Effects.Succeeded && !Effects.Return.isEmpty())
+        Join(ReturnValues[D], Effects.Return);
+    return true;
+}
+
+// How the effects of the innermost recorded body name VD.
+bool RangeAnalysis::effectsName(const VarDecl *VD, std::string &Out) {
+    if (!VD->hasLocalStorage()) {
+        Out = stableDeclName(VD);
+        return true;
+    }
+    const std::vector<const VarDecl *> &List = localsOf(Recording.back().Body);
+    auto It = llvm::find(List, VD->getCanonicalDecl());
+    if (It == List.end())
+        return false;
+    Out = "#" + std::to_string(It - List.begin());
+    return true;
+}
+
+const std::vector<const VarDecl *> &RangeAnalysis::localsOf(const Decl *Body) {
+    auto It = Locals.find(Body);
+    if (It != Locals.end())
+        return It->second;
+    LocalCollector Collector;
+    Collector.TraverseDecl(const_cast<Decl *>(Body));
+    return Locals[Body] = std::move(Collector.Locals);
+}
+
+llvm::ArrayRef<const ValueDecl *> RangeAnalysis::lookupStableName(llvm::StringRef Key) {
+    if (!IndexedStableNames) {
+        IndexedStableNames = true;
+        StableNameCollector Collector(StableNames);
+        Collector.TraverseDecl(Context->getTranslationUnitDecl());
+    }
+    auto It = StableNames.find(Key);
+    if (It == StableNames.end())
+        return {};
+    return It->second;
+}
+
+void RangeAnalysis::analyzeTranslationUnit() {
+    if (AnalyzedTranslationUnit)
+        return;
+    AnalyzedTranslationUnit = true;
+
+    // Globals of the main file can only be named by code that follows
+    // them, so only the main file's own declarations need to be walked.
+    SourceManager &SM = Context->getSourceManager();
+    BodyCollector Collector;
+    for (Decl *D : Context->getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Collector.TraverseDecl(D);
+
+    for (const Expr *Init : Collector.GlobalInits) {
+        collectEscapes(Init, Escaped, &FieldEscaped);
+        addConstantFieldInits(Init);
+    }
+    for (const Decl *D : Collector.Bodies)
+        analyzeBody(D);
+}
+
+// Static initializers are constants (or computed before main in C++, which
+// is treated as unknown).
+void RangeAnalysis::addConstantFieldInits(const Expr *E) {
+    const auto *ILE = dyn_cast<InitListExpr>(E->IgnoreImplicit());
+    if (!ILE) {
+        // Compound literals and the like
+        for (const Stmt *Child : E->children())
+            if (const auto *ChildExpr = dyn_cast_or_null<Expr>(Child))
+                addConstantFieldInits(ChildExpr);
+        return;
+    }
+    auto Store = [&](const FieldDecl *FD, const Expr *Init) {
+        if (FD->getType()->isConstantArrayType() &&
+            isArithmetic(Context->getBaseElementType(FD->getType()))) {
+            addConstantElementInits(FD, Init);
+            return;
+        }
+        if (isa<InitListExpr>(Init->IgnoreImplicit())) {
+            addConstantFieldInits(Init);
+            return;
+        }
+        if (!isArithmetic(FD->getType()))
+            return;
+        Interval V = typeRange(*Context, FD->getType());
+        Expr::EvalResult Result;
+        if (!Init->isValueDependent() && Init->EvaluateAsRValue(Result, *Context) &&
+            !Result.HasSideEffects)
+            V = fitToType(*Context, pointOf(Result.Val), FD->getType());
+        addFieldValue(FD, V);
+    };
+
+    if (const auto *RT = ILE->getType()->getAs<RecordType>()) {
+        const RecordDecl *RD = RT->getDecl();
+        if (RD->isUnion()) {
+            if (const FieldDecl *FD = ILE->getInitializedFieldInUnion())
+                if (ILE->getNumInits() == 1)
+                    Store(FD, ILE->getInit(0));
+            return;
+        }
+        unsigned Index = 0;
+        if (const auto *CXXRD = dyn_cast<CXXRecordDecl>(RD))
+            Index = CXXRD->getNumBases();
+        for (const FieldDecl *FD : RD->fields()) {
+            if (FD->isUnnamedBitfield())
+                continue;
+            if (Index >= ILE->getNumInits())
+                break;
+            Store(FD, ILE->getInit(Index++));
+        }
+        return;
+    }
+    // Arrays of records
+    for (const Expr *Init : ILE->inits())
+        addConstantFieldInits(Init);
+}
+
+void RangeAnalysis::addConstantElementInits(const FieldDecl *FD, const Expr *Init) {
+    QualType Element = Context->getBaseElementType(FD->getType());
+    const auto *ILE = dyn_cast<InitListExpr>(Init->IgnoreImplicit());
+    if (!ILE) {
+        addElementValue(FD, Interval::top());
+        return;
+    }
+    forEachElementInit(ILE, [&](const Expr *E) {
+        Interval V = Interval::point(0);
+        if (E) {
+            Expr::EvalResult Result;
+            V = !E->isValueDependent() && E->EvaluateAsRValue(Result, *Context) &&
+                        !Result.HasSideEffects
+                    ? fitToType(*Context, pointOf(Result.Val), Element)
+                    : typeRange(*Context, Element);
+        }
+        addElementValue(FD, V);
+    });
+}
+
+void RangeAnalysis::addStoredValue(const VarDecl *VD, const Interval &Value) {
+    Interval &All = Stored[VD->getCanonicalDecl()];
+    All = All.join(Value);
+    if (Recording.empty())
+        return;
+    std::string Name;
+    if (effectsName(VD, Name))
+        Recording.back().Effects.Stores.emplace_back(std::move(Name), Value);
+    else
+        Recording.back().Complete = false;
+}
+
+void RangeAnalysis::addFieldValue(const FieldDecl *FD, const Interval &Value) {
+    Interval &All = FieldStored[FD];
+    All = All.join(Value);
+    if (!Recording.empty())
+        Recording.back().Effects.FieldStores.emplace_back(stableDeclName(FD), Value);
+}
+
+void RangeAnalysis::addElementValue(const ValueDecl *Array, const Interval &Value) {
+    Interval &All = ElementStored[Array];
+    All = All.join(Value);
+    if (Recording.empty())
+        return;
+    BodyRecording &Current = Recording.back();
+    std::string Name;
+    if (const auto *FD = dyn_cast<FieldDecl>(Array))
+        Current.Effects.FieldElementStores.emplace_back(stableDeclName(FD), Value);
+    else if (effectsName(cast<VarDecl>(Array), Name))
+        Current.Effects.ElementStores.emplace_back(std::move(Name), Value);
+    else
+        Current.Complete = false;
+}
+
+bool RangeAnalysis::getElementRange(const ValueDecl *Array, Interval &Range, std::string *Reason) {
+    auto Fail = [&](const char *Why) {
+        if (Reason)
+            *Reason = Why;
+        return false;
+    };
+    if (!Context)
+        return Fail("no AST context for range analysis");
+
+    if (const auto *FD = dyn_cast<FieldDecl>(Array)) {
+        const RecordDecl *RD = FD->getParent();
+        if (RD->isUnion())
+            return Fail("union member; other members share its storage");
+        if (RD->isDependentContext())
+            return Fail("value range unknown in templates");
+        analyzeTranslationUnit();
+        if (FieldEscaped.count(FD))
+            return Fail("address escapes; value range unknown");
+        // Objects of static storage start out zero.
+        Range = Interval::point(0).join(ElementStored.lookup(FD));
+        if (const Expr *Init = FD->getInClassInitializer()) {
+            addConstantElementInits(FD, Init);
+            Range = Range.join(ElementStored.lookup(FD));
+        }
+        return true;
+    }
+
+    const auto *VD = cast<VarDecl>(Array)->getCanonicalDecl();
+    if (isa<ParmVarDecl>(VD))
+        return Fail("parameter value range depends on the callers");
+    Interval Initial;
+    if (VD->hasLocalStorage()) {
+        const DeclContext *DC = VD->getParentFunctionOrMethod();
+        const Decl *Owner = DC ? Decl::castFromDeclContext(DC) : nullptr;
+        if (!Owner || !Owner->getBody())
+            return Fail("value range unknown outside of a function body");
+        if (VD->getDeclContext()->isDependentContext())
+            return Fail("value range unknown in templates");
+        if (!analyzeBody(Owner))
+            return Fail("control flow too complex for range analysis");
+    } else {
+        // Even a constant table is read through its declared element type
+        // by other translation units.
+        if (VD->isExternallyVisible())
+            return Fail("externally visible; other translation units may access its storage");
+        analyzeTranslationUnit();
+
+        const VarDecl *InitDecl = nullptr;
+        const Expr *Init = VD->getAnyInitializer(InitDecl);
+        Initial = Interval::point(0);
+        if (Init) {
+            const APValue *V = Init->isValueDependent() ? nullptr : InitDecl->evaluateValue();
+            Initial = V ? elementsOf(*V) : Interval::top();
+        }
+    }
+
+    if (Escaped.count(VD))
+        return Fail("address escapes; value range unknown");
+
+    Range = Initial.join(ElementStored.lookup(VD));
+    return true;
+}
+
+bool RangeAnalysis::getFieldRange(const FieldDecl *FD, Interval &Range, std::string *Reason) {
+    auto Fail = [&](const char *Why) {
+        if (Reason)
+            *Reason = Why;
+        return false;
+    };
+    if (!Context)
+        return Fail("no AST context for range analysis");
+    const RecordDecl *RD = FD->getParent();
+    if (RD->isUnion())
+        return Fail("union member; other members share its storage");
+    if (RD->isDependentContext())
+        return Fail("value range unknown in templates");
+
+    analyzeTranslationUnit();
+    if (FieldEscaped.count(FD))
+        return Fail("address escapes; value range unknown");
+
+    // Objects of static storage start out zero.
+    Range = Interval::point(0).join(FieldStored.lookup(FD));
+    if (const Expr *Init = FD->getInClassInitializer()) {
+        Expr::EvalResult Result;
+        bool Constant = !Init->isValueDependent() && Init->EvaluateAsRValue(Result, *Context) &&
+                        !Result.HasSideEffects;
+        Range = Range.join(Constant ? pointOf(Result.Val) : Interval::top());
+    }
+    return true;
+}
+
+bool RangeAnalysis::getRange(const VarDecl *VD, Interval &Range, std::string *Reason) {
+    auto Fail = [&](const char *Why) {
+        if (Reason)
+            *Reason = Why;
+        return false;
+    };
+    if (!Context)
+        return Fail("no AST context for range analysis");
+
+    if (isa<ParmVarDecl>(VD))
+        return Fail("parameter value range depends on the callers");
+    if (VD->hasAttr<BlocksAttr>())
+        return Fail("__block variable may be modified by blocks");
+
+    Interval Initial;
+    if (VD->hasLocalStorage()) {
+        const DeclContext *DC = VD->getParentFunctionOrMethod();
+        const Decl *Owner = DC ? Decl::castFromDeclContext(DC) : nullptr;
+        if (!Owner || !Owner->getBody())
+            return Fail("value range unknown outside of a function body");
+        if (VD->getDeclContext()->isDependentContext())
+            return Fail("value range unknown in templates");
+        if (!analyzeBody(Owner))
+            return Fail("control flow too complex for range analysis");
+    } else {
+        if (VD->isExternallyVisible() && !VD->getType().isConstQualified())
+            return Fail("externally visible; may be written by other translation units");
+        analyzeTranslationUnit();
+
+        // Static storage starts out zero-initialized or with a constant.
+        const VarDecl *InitDecl = nullptr;
+        const Expr *Init = VD->getAnyInitializer(InitDecl);
+        Initial = Interval::point(0);
+        if (Init) {
+            const APValue *V = Init->isValueDependent() ? nullptr : InitDecl->evaluateValue();
+            Initial = V ? pointOf(*V) : Interval::top();
+        }
+    }
+
+    if (Escaped.count(VD->getCanonicalDecl()))
+        return Fail("address escapes; value range unknown");
+
+    Range = Initial.join(Stored.lookup(VD->getCanonicalDecl()));
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Function summaries
+//===----------------------------------------------------------------------===//
+
+// Summary expressions are substituted textually; beyond this size a
+// function is summarized by its return range only.
+static const size_t MaxExpressionSize = 4096;
+
+// Summary expressions that call each other (recursion, or chains through
+// the summary database) are only expanded this deep.
+static const unsigned MaxResolveDepth = 8;
+
+// A <math.h> function known by its name rather than by a body.
+static bool isLibraryMathFunction(const FunctionDecl *FD) {
+    if (!FD->getIdentifier() || FD->hasBody())
+        return false;
+    if (!FD->getBuiltinID() && !FD->getDeclContext()->getRedeclContext()->isTranslationUnit())
+        return false;
+    return isMathFunction(FD->getName());
+}
+
+static bool hasExternalSummary(const FunctionDecl *FD) {
+    return FD->isExternallyVisible() && !isa<CXXConstructorDecl>(FD) &&
+           !isa<CXXDestructorDecl>(FD) && !FD->isDependentContext();
+}
+
+std::string RangeAnalysis::summaryKey(const FunctionDecl *FD) {
+    if (!Mangler)
+        Mangler.reset(Context->createMangleContext());
+    std::string Key;
+    llvm::raw_string_ostream OS(Key);
+    if (Mangler->shouldMangleDeclName(FD))
+        Mangler->mangleName(GlobalDecl(FD), OS);
+    else
+        OS << FD->getName();
+    return OS.str();
+}
+
+const FunctionSummary *RangeAnalysis::lookupDatabase(llvm::StringRef Key) {
+    if (!Database || Key.empty())
+        return nullptr;
+    auto It = DatabaseSummaries.find(Key);
+    if (It == DatabaseSummaries.end()) {
+        auto Summary = std::make_unique<FunctionSummary>();
+        if (!Database->lookup(Key, *Summary))
+            Summary.reset();
+        It = DatabaseSummaries.try_emplace(Key, std::move(Summary)).first;
+    }
+    return It->second.get();
+}
+
+std::vector<std::pair<std::string, std::string>> RangeAnalysis::summaryDependencies() const {
+    std::vector<std::pair<std::string, std::string>> Deps;
+    for (const auto &Entry : DatabaseSummaries)
+        Deps.emplace_back(Entry.getKey().str(), Entry.getValue() ? Entry.getValue()->str() : "");
+    llvm::sort(Deps);
+    return Deps;
+}
+
+Interval RangeAnalysis::resolveCall(llvm::StringRef Key, llvm::ArrayRef<Interval> Args) {
+    Interval Result;
+    if (evaluateMathFunction(Key, Args, Result))
+        return Result;
+    auto Local = LocalKeys.find(Key);
+    if (Local != LocalKeys.end())
+        return evaluateCall(Local->second, Args);
+
+    const FunctionSummary *Summary = lookupDatabase(Key);
+    if (!Summary)
+        return Interval::top();
+    if (Summary->Expr.empty() || ResolveDepth >= MaxResolveDepth)
+        return Summary->Return;
+    ++ResolveDepth;
+    Result = evaluateSummaryExpr(Summary->Expr, Args,
+                                 [this](llvm::StringRef Callee, llvm::ArrayRef<Interval> CalleeArgs) {
+                                     return resolveCall(Callee, CalleeArgs);
+                                 });
+    --ResolveDepth;
+    return Result.meet(Summary->Return);
+}
+
+bool RangeAnalysis::buildExpression(const Expr *E, const FunctionDecl *FD,
+                                    const llvm::DenseMap<const VarDecl *, std::string> &Locals,
+                                    std::string &Out) {
+    E = E->IgnoreParens();
+    QualType T = E->getType();
+    if (!isArithmetic(T))
+        return false;
+    char Buf[64];
+    auto Number = [&](const Interval &V) {
+        if (V.Lo == V.Hi)
+            snprintf(Buf, sizeof(Buf), "(num %.17g)", V.Lo);
+        else
+            snprintf(Buf, sizeof(Buf), "(range %.17g %.17g)", V.Lo, V.Hi);
+        Out = Buf;
+        return true;
+    };
+    auto Operator = [&](const char *Op, std::initializer_list<const Expr *> Operands) {
+        std::string Text = std::string("(") + Op;
+        for (const Expr *Operand : Operands) {
+            std::string Sub;
+            if (!buildExpression(Operand, FD, Locals, Sub))
+                return false;
+            Text += " " + Sub;
+        }
+        Out = Text + ")";
+        return Out.size() <= MaxExpressionSize;
+    };
+
+    if (isa<FloatingLiteral>(E) || isa<IntegerLiteral>(E) || isa<CharacterLiteral>(E)) {
+        Expr::EvalResult Result;
+        return E->EvaluateAsRValue(Result, *Context) && Number(pointOf(Result.Val));
+    }
+
+    if (const auto *CE = dyn_cast<CastExpr>(E)) {
+        const Expr *Sub = CE->getSubExpr();
+        switch (CE->getCastKind()) {
+        case CK_LValueToRValue: {
+            const VarDecl *VD = referencedVar(Sub);
+            if (!VD)
+                return false;
+            if (const auto *P = dyn_cast<ParmVarDecl>(VD)) {
+                if (P->getDeclContext() != FD)
+                    return false;
+                Out = "(arg " + std::to_string(P->getFunctionScopeIndex()) + ")";
+                return true;
+            }
+            auto Local = Locals.find(VD);
+            if (Local != Locals.end()) {
+                Out = Local->second;
+                return true;
+            }
+            const VarDecl *InitDecl = nullptr;
+            const Expr *Init = VD->getAnyInitializer(InitDecl);
+            if (VD->getType().isConstQualified() && Init && !Init->isValueDependent())
+                if (const APValue *V = InitDecl->evaluateValue())
+                    return Number(pointOf(*V));
+            return false;
+        }
+        case CK_NoOp:
+        case CK_IntegralToFloating:
+        case CK_FloatingCast:
+            return buildExpression(Sub, FD, Locals, Out);
+        case CK_FloatingToIntegral:
+            return Operator("trunc", {Sub});
+        case CK_IntegralCast: {
+            // Only conversions that keep every value.
+            QualType From = Sub->getType();
+            unsigned FromWidth = Context->getIntWidth(From), ToWidth = Context->getIntWidth(T);
+            bool FromSigned = From->isSignedIntegerOrEnumerationType();
+            bool ToSigned = T->isSignedIntegerOrEnumerationType();
+            if (T->isBooleanType() || (FromSigned && !ToSigned) ||
+                ToWidth < FromWidth + (!FromSigned && ToSigned ? 1 : 0))
+                return false;
+            return buildExpression(Sub, FD, Locals, Out);
+        }
+        default:
+            return false;
+        }
+    }
+
+    if (const auto *UO = dyn_cast<UnaryOperator>(E)) {
+        if (UO->getOpcode() == UO_Plus)
+            return buildExpression(UO->getSubExpr(), FD, Locals, Out);
+        if (UO->getOpcode() == UO_Minus && T->isRealFloatingType())
+            return Operator("neg", {UO->getSubExpr()});
+        return false;
+    }
+
+    if (const auto *BO = dyn_cast<BinaryOperator>(E)) {
+        // Integer arithmetic may wrap around; it is left to the full
+        // analysis of the body.
+        if (!T->isRealFloatingType())
+            return false;
+        switch (BO->getOpcode()) {
+        case BO_Add: return Operator("add", {BO->getLHS(), BO->getRHS()});
+        case BO_Sub: return Operator("sub", {BO->getLHS(), BO->getRHS()});
+        case BO_Mul: return Operator("mul", {BO->getLHS(), BO->getRHS()});
+        case BO_Div: return Operator("div", {BO->getLHS(), BO->getRHS()});
+        default: return false;
+        }
+    }
+
+    if (const auto *CO = dyn_cast<ConditionalOperator>(E))
+        return Operator("join", {CO->getTrueExpr(), CO->getFalseExpr()});
+
+    if (const auto *Call = dyn_cast<CallExpr>(E)) {
+        const FunctionDecl *Callee = Call->getDirectCallee();
+        if (!Callee || isa<CXXMemberCallExpr>(Call) || isa<CXXOperatorCallExpr>(Call))
+            return false;
+        std::string Key;
+        if (isLibraryMathFunction(Callee)) {
+            Key = Callee->getName().str();
+        } else if (hasExternalSummary(Callee)) {
+            // Referenced by key so that the summary stays valid when the
+            // callee's own summary changes.
+            Key = summaryKey(Callee);
+            if (Callee->hasBody())
+                LocalKeys[Key] = Callee;
+        } else {
+            const FunctionSummary *Summary = getSummary(Callee);
+            return Summary && Number(Summary->Return.isEmpty() ? Interval::top() : Summary->Return);
+        }
+        std::string Text = "(call " + Key;
+        for (const Expr *Arg : Call->arguments()) {
+            std::string Sub;
+            if (!buildExpression(Arg, FD, Locals, Sub))
+                return false;
+            Text += " " + Sub;
+        }
+        Out = Text + ")";
+        return Out.size() <= MaxExpressionSize;
+    }
+
+    if (!E->isValueDependent()) {
+        Expr::EvalResult Result;
+        if (E->EvaluateAsRValue(Result, *Context) && !Result.HasSideEffects)
+            return Number(pointOf(Result.Val));
+    }
+    return false;
+}
+
+bool RangeAnalysis::deriveExpression(const FunctionDecl *FD, std::string &Out) {
+    const auto *Body = dyn_cast_or_null<CompoundStmt>(FD->getBody());
+    if (!Body || Body->body_empty() || !isArithmetic(FD->getReturnType()))
+        return false;
+
+    // Parameters and locals are substituted by their initial value, so none
+    // of them may change.
+    llvm::DenseSet<const VarDecl *> Modified;
+    collectStores(Body, Modified);
+    collectEscapes(Body, Modified);
+    for (const ParmVarDecl *P : FD->parameters())
+        if (Modified.count(P->getCanonicalDecl()))
+            return false;
+
+    llvm::DenseMap<const VarDecl *, std::string> Locals;
+    for (auto It = Body->body_begin(), End = Body->body_end(); It != End; ++It) {
+        if (const auto *DS = dyn_cast<DeclStmt>(*It)) {
+            for (const Decl *D : DS->decls()) {
+                const auto *VD = dyn_cast<VarDecl>(D);
+                if (!VD || !VD->hasLocalStorage() || !VD->getInit() ||
+                    Modified.count(VD->getCanonicalDecl()))
+                    return false;
+                std::string Init;
+                if (!buildExpression(VD->getInit(), FD, Locals, Init))
+                    return false;
+                Locals[VD] = Init;
+            }
+            continue;
+        }
+        const auto *RS = dyn_cast<ReturnStmt>(*It);
+        if (!RS || !RS->getRetValue() || std::next(It) != End)
+            return false;
+        return buildExpression(RS->getRetValue(), FD, Locals, Out);
+    }
+    return false;
+}
+
+const FunctionSummary *RangeAnalysis::getSummary(const FunctionDecl *FD) {
+    FD = FD->getCanonicalDecl();
+    auto Known = Summaries.find(FD);
+    if (Known != Summaries.end())
+        return Known->second.get();
+
+    const FunctionDecl *Def = nullptr;
+    std::unique_ptr<FunctionSummary> Summary;
+    if (FD->hasBody(Def)) {
+        // A recursive call: unknown until the summary is complete. Not
+        // cached, the outer computation has the final word.
+        if (Summarizing.count(FD) || InProgress.count(Def))
+            return nullptr;
+        if (!Def->isDependentContext()) {
+            Summarizing.insert(FD);
+            auto Derived = std::make_unique<FunctionSummary>();
+            if (deriveExpression(Def, Derived->Expr)) {
+                std::vector<Interval> Params;
+                for (const ParmVarDecl *P : Def->parameters())
+                    Params.push_back(typeRange(*Context, P->getType()));
+                Derived->Return = fitToType(
+                    *Context,
+                    evaluateSummaryExpr(Derived->Expr, Params,
+                                        [this](llvm::StringRef Key, llvm::ArrayRef<Interval> Args) {
+                                            return resolveCall(Key, Args);
+                                        }),
+                    Def->getReturnType());
+                Summary = std::move(Derived);
+            } else if (analyzeBody(Def)) {
+                Derived->Expr.clear();
+                Derived->Return = ReturnValues.lookup(Def);
+                Summary = std::move(Derived);
+            }
+            Summarizing.erase(FD);
+        }
+    } else if (hasExternalSummary(FD)) {
+        if (const FunctionSummary *External = lookupDatabase(summaryKey(FD)))
+            Summary = std::make_unique<FunctionSummary>(*External);
+    }
+
+    const FunctionSummary *Result = Summary.get();
+    Summaries[FD] = std::move(Summary);
+    return Result;
+}
+
+void RangeAnalysis::addReturnValue(const Decl *Body, const Interval &Value) {
+    Interval &All = ReturnValues[Body];
+    All = All.join(Value);
+}
+
+bool RangeAnalysis::hasSummary(const FunctionDecl *FD) {
+    return isLibraryMathFunction(FD) || getSummary(FD);
+}
+
+Interval RangeAnalysis::evaluateCall(const FunctionDecl *FD, llvm::ArrayRef<Interval> Args) {
+    Interval Result;
+    if (isLibraryMathFunction(FD) && evaluateMathFunction(FD->getName(), Args, Result))
+        return Result;
+    const FunctionSummary *Summary = getSummary(FD);
+    if (!Summary)
+        return Interval::top();
+    if (Summary->Expr.empty() || ResolveDepth >= MaxResolveDepth)
+        return Summary->Return;
+    ++ResolveDepth;
+    Result = evaluateSummaryExpr(Summary->Expr, Args,
+                                 [this](llvm::StringRef Key, llvm::ArrayRef<Interval> CalleeArgs) {
+                                     return resolveCall(Key, CalleeArgs);
+                                 });
+    --ResolveDepth;
+    return Result.meet(Summary->Return);
+}
+
+std::vector<NamedSummary> RangeAnalysis::exportSummaries() {
+    SourceManager &SM = Context->getSourceManager();
+    BodyCollector Collector;
+    for (Decl *D : Context->getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Collector.TraverseDecl(D);
+
+    // Callees are summarized on demand, so this walks the call graph
+    // bottom-up.
+    std::vector<NamedSummary> Exported;
+    for (const Decl *D : Collector.Bodies) {
+        const auto *FD = dyn_cast<FunctionDecl>(D);
+        if (!FD || !hasExternalSummary(FD))
+            continue;
+        if (const FunctionSummary *Summary = getSummary(FD))
+            Exported.emplace_back(summaryKey(FD), *Summary);
+    }
+    llvm::sort(Exported, [](const NamedSummary &A, const NamedSummary &B) {
+        return A.first < B.first;
+    });
+    return Exported;
+}
+
+} // namespace fp16demotion
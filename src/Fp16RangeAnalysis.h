@@ -0,0 +1,174 @@
+//===- Fp16RangeAnalysis.h - Value ranges of variables ---------*- C++ -*-===//
+//
+// Flow-sensitive interval analysis over the CFG of each function. For every
+// arithmetic variable it computes the range of all values the variable can
+// hold over its lifetime: its initializer and every assignment, compound
+// assignment and increment. Loops are made to converge by widening; branch
+// conditions that compare a variable against a bound narrow its range on
+// each edge. Calls are evaluated through function summaries
+// (Fp16FunctionSummaries.h), which are computed bottom-up over the call graph
+// as callees are reached.
+//
+// Variables whose address escapes, parameters and globals that other
+// translation units may write have no known range. Fields are tracked per
+// declaration, joining the values stored to them through any object, and
+// arrays by a single range for all of their elements.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_RANGE_ANALYSIS_H
+#define FP16_RANGE_ANALYSIS_H
+
+#include "Fp16FunctionSummaries.h"
+#include "Fp16Incremental.h"
+#include "Fp16Interval.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Mangle.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fp16demotion {
+
+// Value ranges for the variables of one translation unit. Functions are
+// analyzed lazily, the first time one of their variables or their summary
+// is needed.
+class RangeAnalysis {
+public:
+    explicit RangeAnalysis(clang::ASTContext *Context) : Context(Context) {}
+
+    // Summaries of functions defined in other translation units are looked
+    // up here.
+    void setSummaryDatabase(SummaryDatabase *DB) { Database = DB; }
+
+    // Bodies whose effects State has from an earlier analysis are not
+    // interpreted again; the effects of the others are recorded into it.
+    void setIncrementalState(IncrementalState *State) { Incremental = State; }
+
+    // Sets Range to the join of all values VD may hold (empty if it is never
+    // given a value). Returns false and sets *Reason if the range cannot be
+    // determined.
+    bool getRange(const clang::VarDecl *VD, Interval &Range, std::string *Reason = nullptr);
+
+    // Sets Range to the join of all values stored to FD anywhere in the
+    // translation unit: assignments, initializer lists and constructor
+    // initializers. Returns false and sets *Reason if the range cannot be
+    // determined.
+    bool getFieldRange(const clang::FieldDecl *FD, Interval &Range,
+                       std::string *Reason = nullptr);
+
+    // Sets Range to the join of all values the elements of Array (a
+    // variable or field of array type) may hold. An array is only followed
+    // through direct element accesses; decaying it to a pointer makes its
+    // range unknown.
+    bool getElementRange(const clang::ValueDecl *Array, Interval &Range,
+                         std::string *Reason = nullptr);
+
+    // True if calls to FD have a summary, i.e. are not assumed to return an
+    // arbitrary value.
+    bool hasSummary(const clang::FunctionDecl *FD);
+
+    // Range of FD's return value for the given argument ranges.
+    Interval evaluateCall(const clang::FunctionDecl *FD, llvm::ArrayRef<Interval> Args);
+
+    // Summaries of the externally visible functions defined in the main file.
+    std::vector<NamedSummary> exportSummaries();
+
+    // Every summary database lookup made so far: the key and the summary
+    // found (FunctionSummary::str(), empty if none).
+    std::vector<std::pair<std::string, std::string>> summaryDependencies() const;
+
+    // Used by the interpreter when it reaches a return statement.
+    void addReturnValue(const clang::Decl *Body, const Interval &Value);
+
+    // Used by the interpreter when it stores to a variable.
+    void addStoredValue(const clang::VarDecl *VD, const Interval &Value);
+
+    // Used by the interpreter when it stores to a field.
+    void addFieldValue(const clang::FieldDecl *FD, const Interval &Value);
+
+    // Used by the interpreter when it stores to an array element.
+    void addElementValue(const clang::ValueDecl *Array, const Interval &Value);
+
+private:
+    bool analyzeBody(const clang::Decl *D);
+    void analyzeTranslationUnit();
+    void markStoresUnknown(const clang::Stmt *S);
+    void addEscapes(const clang::Stmt *S);
+    bool replayEffects(const clang::Decl *D, const BodyEffects &Effects);
+    bool effectsName(const clang::VarDecl *VD, std::string &Out);
+    const std::vector<const clang::VarDecl *> &localsOf(const clang::Decl *Body);
+    llvm::ArrayRef<const clang::ValueDecl *> lookupStableName(llvm::StringRef Key);
+    void addConstantFieldInits(const clang::Expr *E);
+    void addConstantElementInits(const clang::FieldDecl *FD, const clang::Expr *Init);
+
+    const FunctionSummary *getSummary(const clang::FunctionDecl *FD);
+    bool deriveExpression(const clang::FunctionDecl *FD, std::string &Out);
+    bool buildExpression(const clang::Expr *E, const clang::FunctionDecl *FD,
+                         const llvm::DenseMap<const clang::VarDecl *, std::string> &Locals,
+                         std::string &Out);
+    std::string summaryKey(const clang::FunctionDecl *FD);
+    const FunctionSummary *lookupDatabase(llvm::StringRef Key);
+    Interval resolveCall(llvm::StringRef Key, llvm::ArrayRef<Interval> Args);
+
+    clang::ASTContext *Context;
+    SummaryDatabase *Database = nullptr;
+    std::unique_ptr<clang::MangleContext> Mangler;
+
+    // Canonical declaration -> join of every value stored to it
+    llvm::DenseMap<const clang::VarDecl *, Interval> Stored;
+    llvm::DenseSet<const clang::VarDecl *> Escaped;
+    llvm::DenseMap<const clang::FieldDecl *, Interval> FieldStored;
+    llvm::DenseSet<const clang::FieldDecl *> FieldEscaped;
+    // Array variable (canonical) or field -> join of every element value
+    llvm::DenseMap<const clang::ValueDecl *, Interval> ElementStored;
+    llvm::DenseMap<const clang::Decl *, bool> Analyzed; // Body -> succeeded
+    llvm::DenseSet<const clang::Decl *> InProgress;
+    llvm::DenseMap<const clang::Decl *, Interval> ReturnValues;
+    bool AnalyzedTranslationUnit = false;
+
+    IncrementalState *Incremental = nullptr;
+    struct BodyRecording {
+        const clang::Decl *Body;
+        BodyEffects Effects;
+        bool Complete = true; // Every store could be named
+    };
+    // With incremental state: the bodies being analyzed, innermost last
+    std::vector<BodyRecording> Recording;
+    // Body -> canonical parameters and locals, in order
+    llvm::DenseMap<const clang::Decl *, std::vector<const clang::VarDecl *>> Locals;
+    // "v" or "f" + stableDeclName -> canonical variables or fields
+    llvm::StringMap<llvm::SmallVector<const clang::ValueDecl *, 1>> StableNames;
+    bool IndexedStableNames = false;
+
+    // Canonical function -> summary; null if the function has none
+    llvm::DenseMap<const clang::FunctionDecl *, std::unique_ptr<FunctionSummary>> Summaries;
+    llvm::DenseSet<const clang::FunctionDecl *> Summarizing;
+    llvm::StringMap<const clang::FunctionDecl *> LocalKeys;
+    llvm::StringMap<std::unique_ptr<FunctionSummary>> DatabaseSummaries;
+    unsigned ResolveDepth = 0;
+};
+
+// The array variable (canonical declaration) or field an element access
+// indexes, through any number of subscripts: a[i], m[i][j], s.a[i]. Null
+// for anything else, such as indexing through a pointer.
+const clang::ValueDecl *indexedArray(const clang::Expr *E);
+
+// Calls Fn with the initializer of each element of an array initializer
+// list, nested lists flattened, and with null for elements initialized to
+// zero implicitly (once per run of them).
+void forEachElementInit(const clang::InitListExpr *ILE,
+                        llvm::function_ref<void(const clang::Expr *)> Fn);
+
+} // namespace fp16demotion
+
+#endif // FP16_RANGE_ANALYSIS_H
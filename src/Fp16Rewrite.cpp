@@ -0,0 +1,140 @@
+#include "Fp16Rewrite.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include <algorithm>
+#include <map>
+#include <set>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+std::string applyReplacements(llvm::StringRef Buffer, const tooling::Replacements &Replaces) {
+    std::string Out;
+    Out.reserve(Buffer.size());
+    unsigned Copied = 0;
+    // Sorted by offset, insertions before a replacement at the same one
+    for (const tooling::Replacement &R : Replaces) {
+        Out.append(Buffer.data() + Copied, R.getOffset() - Copied);
+        Out += R.getReplacementText();
+        Copied = R.getOffset() + R.getLength();
+    }
+    Out.append(Buffer.data() + Copied, Buffer.size() - Copied);
+    return Out;
+}
+
+bool SourceEdits::resolve(SourceLocation Loc, size_t Length, FileID &FID, unsigned &Offset,
+                          std::string &Why) const {
+    if (Loc.isInvalid()) {
+        Why = "no source location";
+        return false;
+    }
+    while (Loc.isMacroID()) {
+        if (!SM.isMacroArgExpansion(Loc)) {
+            Why = ("inside the definition of macro '" +
+                   Lexer::getImmediateMacroName(Loc, SM, LangOpts) + "'").str();
+            return false;
+        }
+        Loc = SM.getImmediateSpellingLoc(Loc);
+    }
+    if (SM.isInSystemHeader(Loc)) {
+        Why = "in a system header";
+        return false;
+    }
+    std::tie(FID, Offset) = SM.getDecomposedLoc(Loc);
+    if (!SM.getFileEntryRefForID(FID)) {
+        Why = "not in a source file";
+        return false;
+    }
+    if (Offset + Length > SM.getBufferData(FID).size()) {
+        Why = "extends past the end of the file";
+        return false;
+    }
+    return true;
+}
+
+SourceEdits::FileEdits &SourceEdits::edits(FileID FID) {
+    auto Inserted = FileIndex.try_emplace(FID, Files.size());
+    if (Inserted.second) {
+        llvm::SmallString<256> Path(SM.getFileEntryRefForID(FID)->getName());
+        llvm::sys::fs::make_absolute(Path);
+        llvm::sys::path::remove_dots(Path, /*remove_dot_dot=*/true);
+        Files.push_back({FID, std::string(Path), tooling::Replacements()});
+    }
+    return Files[Inserted.first->second];
+}
+
+std::vector<SourceEdits::Refused> SourceEdits::add(llvm::ArrayRef<Transformation> Queue) {
+    std::vector<Refused> Out;
+    // Queued at one file location, each with where it was queued. The same
+    // text queued twice at one offset, directly or through another
+    // expansion of a macro argument, is one insertion.
+    struct Insertion {
+        SourceLocation Loc;
+        std::string Text;
+    };
+    std::map<std::pair<FileID, unsigned>, std::vector<Insertion>> Insertions;
+    std::set<tooling::Replacement> Seen;
+
+    for (const Transformation &T : Queue) {
+        FileID FID;
+        unsigned Offset;
+        std::string Why;
+        if (!resolve(T.Loc, T.OriginalLength, FID, Offset, Why)) {
+            Out.push_back({T.Loc, std::move(Why)});
+            continue;
+        }
+        if (T.OriginalLength == 0) {
+            std::vector<Insertion> &At = Insertions[{FID, Offset}];
+            bool Duplicate = llvm::any_of(
+                At, [&](const Insertion &I) { return I.Text == T.ReplacementText; });
+            if (!Duplicate)
+                At.push_back({T.Loc, T.ReplacementText});
+            continue;
+        }
+        FileEdits &F = edits(FID);
+        tooling::Replacement R(F.Path, Offset, T.OriginalLength, T.ReplacementText);
+        if (!Seen.insert(R).second)
+            continue;
+        if (llvm::Error Err = F.Replaces.add(R))
+            Out.push_back({T.Loc, "overlaps another edit: " + llvm::toString(std::move(Err))});
+    }
+
+    for (const auto &[Key, At] : Insertions) {
+        std::string Text;
+        for (const Insertion &I : At)
+            Text.insert(0, I.Text);
+        FileEdits &F = edits(Key.first);
+        if (llvm::Error Err = F.Replaces.add(tooling::Replacement(F.Path, Key.second, 0, Text)))
+            Out.push_back({At.front().Loc,
+                           "falls inside another edit: " + llvm::toString(std::move(Err))});
+    }
+    return Out;
+}
+
+std::vector<const SourceEdits::FileEdits *> SourceEdits::files() const {
+    std::vector<const FileEdits *> Sorted;
+    for (const FileEdits &F : Files)
+        Sorted.push_back(&F);
+    FileID Main = SM.getMainFileID();
+    std::sort(Sorted.begin(), Sorted.end(), [&](const FileEdits *A, const FileEdits *B) {
+        if ((A->FID == Main) != (B->FID == Main))
+            return A->FID == Main;
+        return A->Path < B->Path;
+    });
+    return Sorted;
+}
+
+std::string SourceEdits::apply(FileID FID) const {
+    llvm::StringRef Buffer = SM.getBufferData(FID);
+    auto It = FileIndex.find(FID);
+    if (It == FileIndex.end())
+        return Buffer.str();
+    return applyReplacements(Buffer, Files[It->second].Replaces);
+}
+
+} // namespace fp16demotion
@@ -0,0 +1,83 @@
+//===- Fp16Rewrite.h - Source edits as tooling replacements ----*- C++ -*-===//
+//
+// The visitor queues its edits as Transformations at source locations, and
+// SourceEdits turns them into one tooling::Replacements per file. An edit in
+// a macro argument moves to where the argument is spelled, in a header if
+// need be; one inside a macro definition would change every expansion and
+// is refused, as is one in a system header. Identical edits collapse, also
+// when made through different expansions of one argument, so an edit that
+// needs the same text inserted twice at one offset queues it as one
+// insertion. At one location the insertions go in front of a replacement,
+// the one queued last first. Of two overlapping replacements the one queued
+// first stays; an insertion inside a replacement is refused, whichever was
+// queued first. Each file's text is then built in one forward pass over its
+// buffer.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_REWRITE_H
+#define FP16_REWRITE_H
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Tooling/Core/Replacement.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace fp16demotion {
+
+struct Transformation {
+    clang::SourceLocation Loc;
+    std::string ReplacementText;
+    size_t OriginalLength; // 0 for an insertion
+};
+
+// Buffer with Replaces applied, built front to back
+std::string applyReplacements(llvm::StringRef Buffer,
+                              const clang::tooling::Replacements &Replaces);
+
+class SourceEdits {
+public:
+    SourceEdits(const clang::SourceManager &SM, const clang::LangOptions &LangOpts)
+        : SM(SM), LangOpts(LangOpts) {}
+
+    // An edit that was not kept, and why
+    struct Refused {
+        clang::SourceLocation Loc;
+        std::string Why;
+    };
+
+    // Adds Queue in order and returns the edits that cannot be applied
+    std::vector<Refused> add(llvm::ArrayRef<Transformation> Queue);
+
+    struct FileEdits {
+        clang::FileID FID;
+        std::string Path; // Absolute
+        clang::tooling::Replacements Replaces;
+    };
+
+    // The files with edits, the main file first and the others by path
+    std::vector<const FileEdits *> files() const;
+
+    // The text of FID with its edits applied
+    std::string apply(clang::FileID FID) const;
+
+private:
+    // The file and offset an edit at Loc changes; sets Why if there is none
+    bool resolve(clang::SourceLocation Loc, size_t Length, clang::FileID &FID, unsigned &Offset,
+                 std::string &Why) const;
+    FileEdits &edits(clang::FileID FID);
+
+    const clang::SourceManager &SM;
+    const clang::LangOptions &LangOpts;
+    std::vector<FileEdits> Files;
+    llvm::DenseMap<clang::FileID, unsigned> FileIndex;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_REWRITE_H
@@ -0,0 +1,142 @@
+#include "Fp16StructLayout.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+uint64_t layoutSize(const std::vector<FieldSlot> &Fields, const std::vector<unsigned> &Order,
+                    uint64_t MinAlign) {
+    uint64_t Offset = 0, Align = std::max<uint64_t>(1, MinAlign);
+    for (unsigned Index : Order) {
+        Offset = llvm::alignTo(Offset, Fields[Index].Align) + Fields[Index].Size;
+        Align = std::max(Align, Fields[Index].Align);
+    }
+    return llvm::alignTo(Offset, Align);
+}
+
+unsigned cacheLinesPerElement(uint64_t Size) {
+    if (Size == 0)
+        return 0;
+    // Element K starts at K * Size; the offsets within a line repeat after
+    // CacheLineBytes elements.
+    unsigned Worst = 0;
+    for (uint64_t K = 0; K < CacheLineBytes; ++K) {
+        uint64_t Start = (K * Size) % CacheLineBytes;
+        Worst = std::max(Worst, unsigned((Start + Size + CacheLineBytes - 1) / CacheLineBytes));
+    }
+    return Worst;
+}
+
+std::vector<unsigned> suggestFieldOrder(const std::vector<FieldSlot> &Fields,
+                                        std::vector<bool> *Hot) {
+    std::vector<unsigned> Order(Fields.size());
+    std::iota(Order.begin(), Order.end(), 0);
+    auto ByAlign = [&](unsigned A, unsigned B) { return Fields[A].Align > Fields[B].Align; };
+
+    std::vector<bool> IsHot(Fields.size());
+    std::vector<unsigned> ByAlignOnly = Order;
+    std::stable_sort(ByAlignOnly.begin(), ByAlignOnly.end(), ByAlign);
+    if (layoutSize(Fields, ByAlignOnly) > CacheLineBytes) {
+        std::vector<unsigned> ByWeight = Order;
+        std::stable_sort(ByWeight.begin(), ByWeight.end(), [&](unsigned A, unsigned B) {
+            return Fields[A].Weight > Fields[B].Weight;
+        });
+        uint64_t HotBytes = 0;
+        for (unsigned Index : ByWeight) {
+            if (Fields[Index].Weight <= 0 || HotBytes + Fields[Index].Size > CacheLineBytes)
+                break;
+            IsHot[Index] = true;
+            HotBytes += Fields[Index].Size;
+        }
+    }
+
+    std::stable_sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+        if (IsHot[A] != IsHot[B])
+            return bool(IsHot[A]);
+        return ByAlign(A, B);
+    });
+    if (Hot)
+        *Hot = IsHot;
+    return Order;
+}
+
+namespace {
+
+class AccessVisitor : public RecursiveASTVisitor<AccessVisitor> {
+public:
+    AccessVisitor(llvm::DenseMap<const FieldDecl *, double> &Weights,
+                  llvm::DenseSet<const RecordDecl *> &PositionalInits)
+        : Weights(Weights), PositionalInits(PositionalInits) {}
+
+    bool VisitMemberExpr(MemberExpr *ME) {
+        if (const auto *FD = dyn_cast<FieldDecl>(ME->getMemberDecl()))
+            Weights[FD] += std::pow(8.0, std::min(LoopDepth, 8u));
+        return true;
+    }
+
+    // Initializer lists are visited in both their written and their semantic
+    // form; the written one shows whether designators were used.
+    bool VisitInitListExpr(InitListExpr *ILE) {
+        if (!ILE->isSyntacticForm())
+            return true;
+        bool Positional = llvm::any_of(ILE->inits(), [](const Expr *Init) {
+            return !isa<DesignatedInitExpr>(Init);
+        });
+        if (Positional)
+            markRecords(ILE->isSemanticForm() ? ILE : ILE->getSemanticForm());
+        return true;
+    }
+
+    bool TraverseForStmt(ForStmt *S) { return traverseLoop([&] { return Base::TraverseForStmt(S); }); }
+    bool TraverseWhileStmt(WhileStmt *S) {
+        return traverseLoop([&] { return Base::TraverseWhileStmt(S); });
+    }
+    bool TraverseDoStmt(DoStmt *S) { return traverseLoop([&] { return Base::TraverseDoStmt(S); }); }
+    bool TraverseCXXForRangeStmt(CXXForRangeStmt *S) {
+        return traverseLoop([&] { return Base::TraverseCXXForRangeStmt(S); });
+    }
+
+private:
+    using Base = RecursiveASTVisitor<AccessVisitor>;
+
+    template <typename Fn> bool traverseLoop(Fn Traverse) {
+        ++LoopDepth;
+        bool Continue = Traverse();
+        --LoopDepth;
+        return Continue;
+    }
+
+    // Every record in the list, including the ones whose braces were elided
+    void markRecords(const InitListExpr *ILE) {
+        if (!ILE)
+            return;
+        if (const auto *RT = ILE->getType()->getAs<RecordType>())
+            PositionalInits.insert(RT->getDecl()->getCanonicalDecl());
+        for (const Expr *Init : ILE->inits())
+            if (Init)
+                markRecords(dyn_cast<InitListExpr>(Init->IgnoreImplicit()));
+    }
+
+    llvm::DenseMap<const FieldDecl *, double> &Weights;
+    llvm::DenseSet<const RecordDecl *> &PositionalInits;
+    unsigned LoopDepth = 0;
+};
+
+} // namespace
+
+FieldAccessCounter::FieldAccessCounter(ASTContext &Context) {
+    SourceManager &SM = Context.getSourceManager();
+    AccessVisitor Visitor(Weights, PositionalInits);
+    for (Decl *D : Context.getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Visitor.TraverseDecl(D);
+}
+
+} // namespace fp16demotion
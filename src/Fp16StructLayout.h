@@ -0,0 +1,67 @@
+//===- Fp16StructLayout.h - Field order suggestions ------------*- C++ -*-===//
+//
+// Once some float fields of a struct are stored in __fp16, its declared
+// field order is rarely the best one. This suggests an order that removes
+// padding and keeps the fields the translation unit accesses most within as
+// few 64-byte cache lines as possible.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_STRUCT_LAYOUT_H
+#define FP16_STRUCT_LAYOUT_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include <cstdint>
+#include <vector>
+
+namespace fp16demotion {
+
+const unsigned CacheLineBytes = 64;
+
+// One field as laid out after demotion.
+struct FieldSlot {
+    uint64_t Size = 0;
+    uint64_t Align = 1;
+    double Weight = 0; // How often the field is accessed, see FieldAccessCounter
+};
+
+// Size of a struct with the fields placed in Order.
+uint64_t layoutSize(const std::vector<FieldSlot> &Fields, const std::vector<unsigned> &Order,
+                    uint64_t MinAlign = 1);
+
+// Most cache lines one element of an array of Size-byte elements can
+// touch, for an array starting on a cache line boundary.
+unsigned cacheLinesPerElement(uint64_t Size);
+
+// Suggested field order (indices into Fields). The hottest fields that fit
+// in one cache line go first, set in *Hot; within the hot and the cold
+// group fields are sorted by decreasing alignment, which leaves no padding
+// between them. Structs that fit a cache line anyway are only sorted.
+std::vector<unsigned> suggestFieldOrder(const std::vector<FieldSlot> &Fields,
+                                        std::vector<bool> *Hot = nullptr);
+
+// Counts accesses to each field in the main file's function bodies. An
+// access inside a loop weighs 8 times as much as one outside of it. Also
+// notes the records initialized by position, whose field order cannot
+// change without rewriting the initializers.
+class FieldAccessCounter {
+public:
+    explicit FieldAccessCounter(clang::ASTContext &Context);
+
+    double weight(const clang::FieldDecl *FD) const { return Weights.lookup(FD); }
+
+    bool initializedByPosition(const clang::RecordDecl *RD) const {
+        return PositionalInits.count(RD->getCanonicalDecl());
+    }
+
+private:
+    llvm::DenseMap<const clang::FieldDecl *, double> Weights;
+    llvm::DenseSet<const clang::RecordDecl *> PositionalInits;
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_STRUCT_LAYOUT_H
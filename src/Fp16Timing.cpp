@@ -0,0 +1,69 @@
+#include "Fp16Timing.h"
+#include "llvm/Support/Format.h"
+
+namespace fp16demotion {
+
+namespace {
+
+struct PhaseInfo {
+    const char *Name;        // Timer name
+    const char *Description; // Timer report line
+    const char *Event;       // Time-trace event
+};
+
+const PhaseInfo Phases[NumPhases] = {
+    {"parse", "Parsing", "Fp16Parse"},
+    {"traversal", "AST traversal (includes verdicts)", "Fp16Traversal"},
+    {"verdicts", "Verdicts", "Fp16Verdict"},
+    {"records", "Arrays and struct layouts", "Fp16Records"},
+    {"demoted-code", "Demoted code", "Fp16DemotedCode"},
+    {"summaries", "Memory totals and function summaries", "Fp16Summaries"},
+    {"output", "Output files", "Fp16Output"},
+};
+
+} // namespace
+
+const char *phaseEventName(Phase P) { return Phases[unsigned(P)].Event; }
+
+PhaseTimers::PhaseTimers() : Group("fp16-demotion", "FP16 demotion phases") {
+    for (unsigned I = 0; I < NumPhases; ++I)
+        Timers[I].init(Phases[I].Name, Phases[I].Description, Group);
+}
+
+bool PhaseTimers::start(Phase P) {
+    llvm::Timer &T = Timers[unsigned(P)];
+    if (T.isRunning())
+        return false;
+    T.startTimer();
+    return true;
+}
+
+void PhaseTimers::stop(Phase P) {
+    llvm::Timer &T = Timers[unsigned(P)];
+    if (T.isRunning())
+        T.stopTimer();
+}
+
+void PhaseTimers::print(llvm::raw_ostream &OS) {
+    for (llvm::Timer &T : Timers)
+        if (T.isRunning())
+            T.stopTimer();
+    Group.print(OS, /*ResetAfterPrint=*/true);
+    OS << "FP16 demotion work: " << Counters.NodesVisited << " AST nodes visited, "
+       << Counters.ExprsEvaluated << " expressions evaluated, " << Counters.BytesWritten
+       << " bytes written\n";
+}
+
+PhaseScope::PhaseScope(PhaseTimers *Timers, Phase P)
+    : Timers(Timers), P(P), Trace(phaseEventName(P)) {
+    // Nested scopes of the same phase leave it to the outermost.
+    if (Timers && !Timers->start(P))
+        this->Timers = nullptr;
+}
+
+PhaseScope::~PhaseScope() {
+    if (Timers)
+        Timers->stop(P);
+}
+
+} // namespace fp16demotion
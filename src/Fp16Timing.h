@@ -0,0 +1,77 @@
+//===- Fp16Timing.h - Phase timers and work counters -----------*- C++ -*-===//
+//
+// Where the time of an analysis goes. Every phase has an llvm::Timer in one
+// TimerGroup, printed with the work counters by -fprecision-demote-timing,
+// and is a time-trace event whenever a time-trace profiler is running: under
+// clang's -ftime-trace, which then holds both clang's events and ours, or
+// under -fprecision-demote-time-trace=FILE.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_TIMING_H
+#define FP16_TIMING_H
+
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+namespace fp16demotion {
+
+enum class Phase {
+    Parse,       // Until the translation unit is complete
+    Traversal,   // The visitor's walk, verdicts included
+    Verdicts,    // Deciding whether a variable or literal fits __fp16
+    Records,     // Arrays and struct layouts
+    DemotedCode, // Rendering the demoted source
+    Summaries,   // Memory totals and function summaries
+    Output,      // Formatting and writing the output files
+};
+const unsigned NumPhases = unsigned(Phase::Output) + 1;
+
+struct PhaseCounters {
+    uint64_t NodesVisited = 0;   // Declarations and statements walked
+    uint64_t ExprsEvaluated = 0; // Expressions given a verdict
+    uint64_t BytesWritten = 0;   // Output files
+};
+
+// The timers of one analysis. Not thread-safe.
+class PhaseTimers {
+public:
+    PhaseTimers();
+
+    // Returns false, doing nothing, if P is already running.
+    bool start(Phase P);
+    void stop(Phase P);
+
+    // Prints the phase times and the counters, and resets the times.
+    void print(llvm::raw_ostream &OS);
+
+    PhaseCounters Counters;
+
+private:
+    llvm::TimerGroup Group;
+    llvm::Timer Timers[NumPhases]; // After Group, which they unregister from
+};
+
+// Times a phase and makes it a time-trace event for the scope's lifetime.
+// Timers may be null; the trace event is still recorded.
+class PhaseScope {
+public:
+    PhaseScope(PhaseTimers *Timers, Phase P);
+    ~PhaseScope();
+    PhaseScope(const PhaseScope &) = delete;
+    PhaseScope &operator=(const PhaseScope &) = delete;
+
+private:
+    PhaseTimers *Timers; // Null unless this scope started the timer
+    Phase P;
+    llvm::TimeTraceScope Trace;
+};
+
+// The name of P's time-trace events
+const char *phaseEventName(Phase P);
+
+} // namespace fp16demotion
+
+#endif // FP16_TIMING_H
@@ -0,0 +1,340 @@
+#include "Fp16ValueProfile.h"
+#include "Fp16Demotion.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <algorithm>
+#include <optional>
+
+using namespace clang;
+
+namespace fp16demotion {
+
+//===----------------------------------------------------------------------===//
+// ValueProfile
+//===----------------------------------------------------------------------===//
+
+static bool decodeSite(const llvm::json::Object &O, SiteProfile &Out) {
+    auto Count = O.getInteger("count");
+    auto NaNs = O.getInteger("nan");
+    auto Infinities = O.getInteger("inf");
+    auto Subnormals = O.getInteger("subnormal");
+    if (!Count || !NaNs || !Infinities || !Subnormals || *Count < 0 || *NaNs < 0 ||
+        *Infinities < 0 || *Subnormals < 0 || *NaNs + *Infinities > *Count)
+        return false;
+    Out.Count = *Count;
+    Out.NaNs = *NaNs;
+    Out.Infinities = *Infinities;
+    Out.Subnormals = *Subnormals;
+    if (Out.finite()) {
+        auto Min = O.getNumber("min");
+        auto Max = O.getNumber("max");
+        if (!Min || !Max || *Min > *Max)
+            return false;
+        Out.Min = *Min;
+        Out.Max = *Max;
+    }
+    return true;
+}
+
+static void merge(SiteProfile &Into, const SiteProfile &P) {
+    if (P.finite()) {
+        Into.Min = Into.finite() ? std::min(Into.Min, P.Min) : P.Min;
+        Into.Max = Into.finite() ? std::max(Into.Max, P.Max) : P.Max;
+    }
+    Into.Count += P.Count;
+    Into.NaNs += P.NaNs;
+    Into.Infinities += P.Infinities;
+    Into.Subnormals += P.Subnormals;
+}
+
+std::shared_ptr<const ValueProfile> ValueProfile::load(llvm::StringRef Path,
+                                                       std::string &Error) {
+    auto Buffer = llvm::MemoryBuffer::getFile(Path);
+    if (!Buffer) {
+        Error = Buffer.getError().message();
+        return nullptr;
+    }
+
+    auto Profile = std::make_shared<ValueProfile>();
+    llvm::SmallVector<llvm::StringRef, 0> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+    for (size_t I = 0; I < Lines.size(); ++I) {
+        llvm::StringRef Line = Lines[I].trim();
+        if (Line.empty())
+            continue;
+        llvm::Expected<llvm::json::Value> V = llvm::json::parse(Line);
+        if (!V) {
+            Error = "line " + std::to_string(I + 1) + ": " + llvm::toString(V.takeError());
+            return nullptr;
+        }
+        const llvm::json::Object *O = V->getAsObject();
+        std::optional<llvm::StringRef> Site = O ? O->getString("site") : std::nullopt;
+        SiteProfile P;
+        if (!Site || !decodeSite(*O, P)) {
+            Error = "line " + std::to_string(I + 1) + ": not a site profile";
+            return nullptr;
+        }
+        merge(Profile->Sites[*Site], P);
+    }
+
+    // Of the merged sites in name order, so the order of runs does not matter
+    std::vector<llvm::StringRef> Names;
+    for (const auto &Entry : Profile->Sites)
+        Names.push_back(Entry.getKey());
+    llvm::sort(Names);
+    std::string Canonical;
+    llvm::raw_string_ostream OS(Canonical);
+    for (llvm::StringRef Name : Names) {
+        const SiteProfile &P = Profile->Sites.find(Name)->second;
+        OS << Name << ' ' << P.Count << ' ' << P.NaNs << ' ' << P.Infinities << ' '
+           << P.Subnormals << ' ' << llvm::format("%a %a", P.Min, P.Max) << '\n';
+    }
+    OS.flush();
+    Profile->Digest = llvm::utohexstr(llvm::xxh3_64bits(llvm::arrayRefFromStringRef(Canonical)));
+    return Profile;
+}
+
+const SiteProfile *ValueProfile::find(llvm::StringRef Site) const {
+    auto It = Sites.find(Site);
+    return It == Sites.end() ? nullptr : &It->second;
+}
+
+std::string profileSiteName(const VarDecl *VD, const SourceManager &SM) {
+    PresumedLoc PLoc = SM.getPresumedLoc(SM.getExpansionLoc(VD->getLocation()));
+    if (PLoc.isInvalid())
+        return VD->getName().str();
+    return (llvm::Twine(PLoc.getFilename()) + ":" + llvm::Twine(PLoc.getLine()) + ":" +
+            llvm::Twine(PLoc.getColumn()) + ":" + VD->getName())
+        .str();
+}
+
+//===----------------------------------------------------------------------===//
+// ValueSites
+//===----------------------------------------------------------------------===//
+
+// Finds the stores to the float variables of the main file, and what keeps
+// a variable from being observed.
+class SiteCollector : public RecursiveASTVisitor<SiteCollector> {
+public:
+    explicit SiteCollector(ValueSites &Sites)
+        : Sites(Sites), Context(Sites.Context), SM(Context.getSourceManager()) {}
+
+    // Keeps the statements around the current one
+    bool TraverseStmt(Stmt *S, DataRecursionQueue * = nullptr) {
+        if (!S)
+            return true;
+        Parents.push_back(S);
+        bool Continue = RecursiveASTVisitor::TraverseStmt(S);
+        Parents.pop_back();
+        return Continue;
+    }
+
+    bool VisitVarDecl(VarDecl *VD) {
+        if (!isCandidate(VD))
+            return true;
+        Sites.Variables[VD];
+        if (VD->getStorageClass() == SC_Register || VD->hasAttr<BlocksAttr>())
+            return unobservable(VD);
+        if (auto *P = dyn_cast<ParmVarDecl>(VD))
+            return recordOnEntry(P);
+        if (VD->hasGlobalStorage())
+            return VD->isExternallyVisible() ? unobservable(VD) : true;
+        if (VD->hasInit() && !Sites.InitRecorded.count(VD))
+            return unobservable(VD);
+        return true;
+    }
+
+    // Locals declared in a block are recorded after their declaration.
+    bool VisitDeclStmt(DeclStmt *DS) {
+        bool InBlock = Parents.size() >= 2 && isa<CompoundStmt>(Parents[Parents.size() - 2]);
+        SourceLocation Semi = DS->getEndLoc();
+        if (!InBlock || !isWritable(Semi) || *SM.getCharacterData(Semi) != ';')
+            return true;
+        for (Decl *D : DS->decls()) {
+            auto *VD = dyn_cast<VarDecl>(D);
+            if (!VD || !isCandidate(VD) || VD->hasGlobalStorage() || !VD->hasInit() ||
+                VD->getName().empty())
+                continue;
+            Sites.InitRecorded.insert(VD);
+            Sites.add(VD, {ValueSites::Insertion::Record, SM.getFileOffset(Semi) + 1,
+                           VD->getName().str()});
+        }
+        return true;
+    }
+
+    bool VisitDeclRefExpr(DeclRefExpr *DRE) {
+        auto *VD = dyn_cast<VarDecl>(DRE->getDecl());
+        if (!VD || !isCandidate(VD))
+            return true;
+
+        // The innermost enclosing statement other than parentheses
+        const Stmt *Child = DRE;
+        size_t I = Parents.size() - 1;
+        while (I > 0 && isa<ParenExpr>(Parents[I - 1]))
+            Child = Parents[--I];
+        const Stmt *Parent = I > 0 ? Parents[I - 1] : nullptr;
+
+        if (auto *Cast = dyn_cast_or_null<ImplicitCastExpr>(Parent))
+            if (Cast->getCastKind() == CK_LValueToRValue)
+                return true;
+        if (isa_and_nonnull<UnaryExprOrTypeTraitExpr>(Parent))
+            return true;
+        if (auto *BO = dyn_cast_or_null<BinaryOperator>(Parent))
+            if (BO->isAssignmentOp() && BO->getLHS() == Child)
+                return recordStore(VD, BO, nullptr);
+        if (auto *UO = dyn_cast_or_null<UnaryOperator>(Parent))
+            if (UO->isIncrementDecrementOp())
+                return recordStore(VD, UO, UO->isPostfix() ? DRE : nullptr);
+        // Address taken, bound to a reference, or something else that may
+        // store behind our back
+        return unobservable(VD);
+    }
+
+private:
+    bool isCandidate(const VarDecl *VD) const {
+        return Fp16TypeChecker::canDemoteType(VD->getType(), &Context) &&
+               SM.isInMainFile(SM.getExpansionLoc(VD->getLocation()));
+    }
+
+    bool isWritable(SourceLocation Loc) const {
+        return Loc.isValid() && Loc.isFileID() && SM.isInMainFile(Loc);
+    }
+
+    bool unobservable(const VarDecl *VD) {
+        Sites.Variables[VD].Observable = false;
+        return true;
+    }
+
+    bool recordOnEntry(const ParmVarDecl *P) {
+        auto *FD = dyn_cast_or_null<FunctionDecl>(P->getDeclContext());
+        const CompoundStmt *Body =
+            FD && FD->doesThisDeclarationHaveABody() ? dyn_cast_or_null<CompoundStmt>(FD->getBody())
+                                                     : nullptr;
+        if (!Body || P->getName().empty() || !isWritable(Body->getLBracLoc()))
+            return unobservable(P);
+        Sites.add(P, {ValueSites::Insertion::Record, SM.getFileOffset(Body->getLBracLoc()) + 1,
+                      P->getName().str()});
+        return true;
+    }
+
+    // Wraps the store E so it records the new value. A postfix ++ or --
+    // yields the old value, so the variable, spelled as Operand, is read
+    // after it instead.
+    bool recordStore(const VarDecl *VD, const Expr *E, const DeclRefExpr *Operand) {
+        const LangOptions &LangOpts = Context.getLangOpts();
+        SourceLocation Begin = E->getBeginLoc();
+        SourceLocation End = Lexer::getLocForEndOfToken(E->getEndLoc(), 0, SM, LangOpts);
+        if (!isWritable(Begin) || !isWritable(End))
+            return unobservable(VD);
+        std::string Spelling;
+        if (Operand) {
+            if (!isWritable(Operand->getBeginLoc()) || !isWritable(Operand->getEndLoc()))
+                return unobservable(VD);
+            Spelling = Lexer::getSourceText(
+                CharSourceRange::getTokenRange(Operand->getSourceRange()), SM, LangOpts).str();
+        }
+        Sites.add(VD, {Operand ? ValueSites::Insertion::After : ValueSites::Insertion::Value,
+                       SM.getFileOffset(Begin), std::move(Spelling)});
+        Sites.add(VD, {ValueSites::Insertion::Close, SM.getFileOffset(End), ""});
+        return true;
+    }
+
+    ValueSites &Sites;
+    ASTContext &Context;
+    const SourceManager &SM;
+    std::vector<const Stmt *> Parents;
+};
+
+ValueSites::ValueSites(ASTContext &Context) : Context(Context) {
+    SiteCollector Collector(*this);
+    SourceManager &SM = Context.getSourceManager();
+    for (Decl *D : Context.getTranslationUnitDecl()->decls())
+        if (SM.isInMainFile(SM.getExpansionLoc(D->getLocation())))
+            Collector.TraverseDecl(D);
+}
+
+void ValueSites::add(const VarDecl *VD, Insertion I) {
+    Variables[VD].Insertions.push_back(Insertions.size());
+    Insertions.push_back(std::move(I));
+}
+
+bool ValueSites::isObservable(const VarDecl *VD) const {
+    auto It = Variables.find(VD);
+    return It != Variables.end() && It->second.Observable;
+}
+
+// Escapes Text for a C string literal
+static std::string quoted(llvm::StringRef Text) {
+    std::string Out = "\"";
+    for (char C : Text) {
+        if (C == '"' || C == '\\')
+            Out += '\\';
+        Out += C;
+    }
+    return Out + "\"";
+}
+
+std::string ValueSites::instrument(llvm::ArrayRef<const VarDecl *> Vars) const {
+    SourceManager &SM = Context.getSourceManager();
+    llvm::StringRef Source = SM.getBufferData(SM.getMainFileID());
+    if (Vars.empty())
+        return Source.str();
+
+    // (index into Insertions, site)
+    std::vector<std::pair<unsigned, unsigned>> Order;
+    std::string Header = "#include \"fp16_profile.h\"\n"
+                         "static const char *const fp16_prof_sites_[] = {\n";
+    for (unsigned Site = 0; Site < Vars.size(); ++Site) {
+        Header += "    " + quoted(profileSiteName(Vars[Site], SM)) + ",\n";
+        auto It = Variables.find(Vars[Site]);
+        assert(It != Variables.end() && It->second.Observable && "variable is not observable");
+        for (unsigned Index : It->second.Insertions)
+            Order.emplace_back(Index, Site);
+    }
+    Header += "};\nFP16_PROFILE_UNIT(fp16_prof_sites_)\n";
+    // Diagnostics point into the original file; insertions add no lines.
+    PresumedLoc Start = SM.getPresumedLoc(SM.getLocForStartOfFile(SM.getMainFileID()));
+    if (Start.isValid())
+        Header += "#line 1 " + quoted(Start.getFilename()) + "\n";
+
+    // In traversal order at the same offset: an enclosing store opens first.
+    llvm::sort(Order, [&](const auto &A, const auto &B) {
+        unsigned OffsetA = Insertions[A.first].Offset, OffsetB = Insertions[B.first].Offset;
+        return OffsetA != OffsetB ? OffsetA < OffsetB : A.first < B.first;
+    });
+
+    std::string Out = std::move(Header);
+    Out.reserve(Out.size() + Source.size() + Order.size() * 24);
+    unsigned Copied = 0;
+    for (const auto &[Index, Site] : Order) {
+        const Insertion &I = Insertions[Index];
+        Out.append(Source.data() + Copied, I.Offset - Copied);
+        Copied = I.Offset;
+        std::string K = std::to_string(Site);
+        switch (I.Kind) {
+        case Insertion::Value:
+            Out += "fp16_prof_value_(" + K + ", ";
+            break;
+        case Insertion::After:
+            Out += "fp16_prof_after_(" + K + ", &" + I.Operand + ", ";
+            break;
+        case Insertion::Close:
+            Out += ")";
+            break;
+        case Insertion::Record:
+            Out += " fp16_prof_value_(" + K + ", " + I.Operand + ");";
+            break;
+        }
+    }
+    Out.append(Source.data() + Copied, Source.size() - Copied);
+    return Out;
+}
+
+} // namespace fp16demotion
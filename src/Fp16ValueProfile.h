@@ -0,0 +1,116 @@
+//===- Fp16ValueProfile.h - Profile-guided demotion ------------*- C++ -*-===//
+//
+// Float variables the static analysis cannot prove safe can be demoted on
+// the ranges they take at run time. -fprecision-demote-instrument writes
+// instrumented.c, a copy of the main file that records every value those
+// variables take through runtime/fp16_profile.h. Running it appends the
+// observed ranges to a profile, and -fprecision-demote-profile=FILE demotes
+// the variables whose ranges, widened by a margin, fit __fp16.
+//
+// A variable is observable only if every value it takes passes through a
+// recording call: every store names it directly (outside macros) and its
+// address is never taken. Parameters are recorded on function entry and
+// locals after their declaration; the initializers of statics and of locals
+// declared outside a block are checked statically instead. Globals visible
+// to other translation units are never observable.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FP16_VALUE_PROFILE_H
+#define FP16_VALUE_PROFILE_H
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fp16demotion {
+
+// What the profile says about one variable, merged over all runs
+struct SiteProfile {
+    uint64_t Count = 0;
+    uint64_t NaNs = 0;
+    uint64_t Infinities = 0;
+    uint64_t Subnormals = 0; // Nonzero values below the __fp16 normal range
+    double Min = 0;          // Of the finite values
+    double Max = 0;
+
+    uint64_t finite() const { return Count - NaNs - Infinities; }
+};
+
+// A profile written by instrumented programs (see runtime/fp16_profile.h)
+class ValueProfile {
+public:
+    // Reads and merges the lines of Path. Returns null and sets Error if it
+    // cannot be read or a line is malformed.
+    static std::shared_ptr<const ValueProfile> load(llvm::StringRef Path, std::string &Error);
+
+    // The profile of the variable with the given site name, or null
+    const SiteProfile *find(llvm::StringRef Site) const;
+
+    // A hash of the merged contents, for cache keys
+    const std::string &digest() const { return Digest; }
+
+    size_t size() const { return Sites.size(); }
+
+private:
+    llvm::StringMap<SiteProfile> Sites;
+    std::string Digest;
+};
+
+// The name of VD's site: file, line and column of its declaration and its
+// name. The same in the instrumented copy and in later analyses of the
+// unchanged file.
+std::string profileSiteName(const clang::VarDecl *VD, const clang::SourceManager &SM);
+
+// Which float variables of the main file are observable, and the recording
+// calls that observe them
+class ValueSites {
+public:
+    explicit ValueSites(clang::ASTContext &Context);
+
+    bool isObservable(const clang::VarDecl *VD) const;
+
+    // True if the value VD is initialized with is recorded at run time
+    bool recordsInit(const clang::VarDecl *VD) const { return InitRecorded.count(VD); }
+
+    // The main file with the recording calls for Vars, all observable, and
+    // a table of their sites in front
+    std::string instrument(llvm::ArrayRef<const clang::VarDecl *> Vars) const;
+
+private:
+    friend class SiteCollector;
+
+    struct Insertion {
+        enum KindType {
+            Value, // "fp16_prof_value_(K, " before a store
+            After, // "fp16_prof_after_(K, &Operand, " before a postfix ++ or --
+            Close, // ")" after a store
+            Record // " fp16_prof_value_(K, Operand);" after '{' or a declaration
+        } Kind;
+        unsigned Offset;
+        std::string Operand;
+    };
+    struct Variable {
+        bool Observable = true;
+        std::vector<unsigned> Insertions; // Indices into Insertions
+    };
+
+    void add(const clang::VarDecl *VD, Insertion I);
+
+    clang::ASTContext &Context;
+    llvm::DenseMap<const clang::VarDecl *, Variable> Variables;
+    llvm::DenseSet<const clang::VarDecl *> InitRecorded;
+    std::vector<Insertion> Insertions; // In traversal order
+};
+
+} // namespace fp16demotion
+
+#endif // FP16_VALUE_PROFILE_H
@@ -0,0 +1,1155 @@
+//===- Fp16DemotionTest.cpp - End-to-end checks of the analysis -----------===//
+//
+// Runs clang with the plugin and fp16-demote over the sources in
+// test/fixtures and checks the reports they write:
+//
+//   fp16-demotion-test [CASE...]
+//
+// Without arguments every case runs. Each case works in its own directory
+// under fp16-demotion-test/ in the working directory, emptied first, and
+// keeps the logs of the programs it ran there.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using llvm::StringRef;
+
+static unsigned Failures = 0;
+
+static void check(bool OK, const llvm::Twine &What) {
+    if (OK)
+        return;
+    ++Failures;
+    std::printf("  FAILED: %s\n", What.str().c_str());
+}
+
+static std::string pathJoin(StringRef Dir, StringRef Name) {
+    llvm::SmallString<256> Path(Dir);
+    llvm::sys::path::append(Path, Name);
+    return std::string(Path);
+}
+
+static std::string readFile(StringRef Path) {
+    auto Buffer = llvm::MemoryBuffer::getFile(Path);
+    return Buffer ? (*Buffer)->getBuffer().str() : std::string();
+}
+
+static void writeFile(StringRef Path, StringRef Text) {
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Path));
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC);
+    if (EC) {
+        check(false, "cannot write " + Path + ": " + EC.message());
+        return;
+    }
+    OS << Text;
+}
+
+// The source of test/fixtures/Name.
+static std::string fixture(StringRef Name) {
+    std::string Path = pathJoin(FP16_TEST_FIXTURES, Name);
+    std::string Text = readFile(Path);
+    check(!Text.empty(), "missing fixture " + Path);
+    return Text;
+}
+
+// The name fp16-demote files a per-TU artifact of Path under.
+static std::string flattenName(StringRef Path) {
+    std::string Flat = Path.str();
+    for (char &C : Flat)
+        if (llvm::sys::path::is_separator(C) || C == ':')
+            C = '_';
+    return Flat;
+}
+
+// The names in Dir, sorted.
+static std::vector<std::string> listDir(StringRef Dir) {
+    std::vector<std::string> Names;
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC; It.increment(EC))
+        Names.push_back(llvm::sys::path::filename(It->path()).str());
+    llvm::sort(Names);
+    return Names;
+}
+
+static llvm::json::Value readJson(StringRef Path) {
+    llvm::Expected<llvm::json::Value> Value = llvm::json::parse(readFile(Path));
+    if (!Value) {
+        check(false, Path + " is not JSON: " + llvm::toString(Value.takeError()));
+        return nullptr;
+    }
+    return std::move(*Value);
+}
+
+static bool contains(StringRef Text, StringRef Needle) {
+    return Text.find(Needle) != StringRef::npos;
+}
+
+// The first object of the array Records whose string Key contains Needle.
+static const llvm::json::Object *findRecord(const llvm::json::Value &Records, StringRef Key,
+                                            StringRef Needle) {
+    if (const llvm::json::Array *Array = Records.getAsArray())
+        for (const llvm::json::Value &V : *Array)
+            if (const llvm::json::Object *Record = V.getAsObject())
+                if (std::optional<StringRef> Str = Record->getString(Key))
+                    if (contains(*Str, Needle))
+                        return Record;
+    return nullptr;
+}
+
+struct Output {
+    bool Success = false;
+    std::string Text; // stdout and stderr
+};
+
+// Runs Program with Args, collecting its output in Log. A non-empty Env
+// replaces the environment.
+static Output run(StringRef Program, const std::vector<std::string> &Args, StringRef Log,
+                  const std::vector<std::string> &Env = {}) {
+    std::vector<StringRef> ArgRefs = {Program};
+    ArgRefs.insert(ArgRefs.end(), Args.begin(), Args.end());
+    std::vector<StringRef> EnvRefs(Env.begin(), Env.end());
+    std::optional<llvm::ArrayRef<StringRef>> Environment;
+    if (!Env.empty())
+        Environment = EnvRefs;
+    std::optional<StringRef> Redirects[] = {std::nullopt, Log, Log};
+    std::string Error;
+    int Status = llvm::sys::ExecuteAndWait(Program, ArgRefs, Environment, Redirects,
+                                           /*SecondsToWait=*/120, /*MemoryLimit=*/0, &Error);
+    Output Result;
+    Result.Success = Status == 0;
+    Result.Text = readFile(Log);
+    if (!Result.Success) {
+        std::string Command = Program.str();
+        for (const std::string &Arg : Args)
+            Command += " " + Arg;
+        std::printf("  %s exited with %d%s%s; see %s\n", Command.c_str(), Status,
+                    Error.empty() ? "" : ": ", Error.c_str(), Log.str().c_str());
+    }
+    return Result;
+}
+
+// Runs clang with the plugin on Source, writing the reports to OutputDir.
+static Output runPlugin(StringRef Source, StringRef OutputDir,
+                        std::vector<std::string> PluginArgs,
+                        const std::vector<std::string> &ClangArgs = {}) {
+    llvm::sys::fs::create_directories(OutputDir);
+    PluginArgs.insert(PluginArgs.begin(), "-fprecision-demote-output-dir=" + OutputDir.str());
+    if (!llvm::is_contained(PluginArgs, "-fprecision-demote=fp16"))
+        PluginArgs.insert(PluginArgs.begin(), "-fprecision-demote=fp16");
+    std::vector<std::string> Args = {"-fsyntax-only", "-fplugin=" FP16_TEST_PLUGIN};
+    for (const std::string &Arg : PluginArgs)
+        Args.insert(Args.end(), {"-Xclang", "-plugin-arg-fp16-demotion", "-Xclang", Arg});
+    Args.insert(Args.end(), ClangArgs.begin(), ClangArgs.end());
+    Args.push_back(Source.str());
+    return run(FP16_TEST_CLANG, Args, OutputDir.str() + ".log");
+}
+
+// Runs fp16-demote on Files without a compilation database.
+static Output runDemote(const std::vector<std::string> &Files, StringRef OutputDir,
+                        const std::vector<std::string> &ToolArgs,
+                        const std::vector<std::string> &ClangArgs = {}) {
+    std::vector<std::string> Args = {"--output-dir=" + OutputDir.str()};
+    Args.insert(Args.end(), ToolArgs.begin(), ToolArgs.end());
+    Args.insert(Args.end(), Files.begin(), Files.end());
+    Args.push_back("--");
+    Args.insert(Args.end(), ClangArgs.begin(), ClangArgs.end());
+    return run(FP16_TEST_DEMOTE, Args, OutputDir.str() + ".log");
+}
+
+// An fp16-demote-server logging to Dir, stopped on destruction. Its socket
+// is in the temporary directory, as socket paths are short.
+class Server {
+public:
+    Server(StringRef Dir, const std::vector<std::string> &ServerArgs) {
+        llvm::SmallString<128> Path;
+        llvm::sys::fs::getPotentiallyUniqueTempFileName("fp16-demotion-test", "sock", Path);
+        Socket = std::string(Path);
+        std::vector<StringRef> Args = {FP16_TEST_SERVER, "--socket", Socket, "-j", "1"};
+        Args.insert(Args.end(), ServerArgs.begin(), ServerArgs.end());
+        std::string Log = pathJoin(Dir, "server.log");
+        std::optional<StringRef> Redirects[] = {std::nullopt, StringRef(Log), StringRef(Log)};
+        Process = llvm::sys::ExecuteNoWait(FP16_TEST_SERVER, Args, std::nullopt, Redirects);
+        for (int I = 0; I < 100 && !llvm::sys::fs::exists(Socket); ++I)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        check(llvm::sys::fs::exists(Socket), "fp16-demote-server did not start; see " + Log);
+    }
+
+    ~Server() {
+        if (Process.Pid != llvm::sys::ProcessInfo::InvalidPid) {
+            ::kill(Process.Pid, SIGTERM);
+            ::waitpid(Process.Pid, nullptr, 0);
+        }
+        llvm::sys::fs::remove(Socket);
+    }
+
+    // Sends one request and returns the parsed response, or null.
+    llvm::json::Value request(const llvm::json::Value &Request) {
+        sockaddr_un Addr = {};
+        Addr.sun_family = AF_UNIX;
+        std::strncpy(Addr.sun_path, Socket.c_str(), sizeof(Addr.sun_path) - 1);
+        int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (FD < 0 || ::connect(FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0) {
+            check(false, "cannot connect to " + Socket);
+            if (FD >= 0)
+                ::close(FD);
+            return nullptr;
+        }
+        std::string Body;
+        llvm::raw_string_ostream(Body) << Request;
+        for (StringRef Rest = Body; !Rest.empty();) {
+            ssize_t N = ::write(FD, Rest.data(), Rest.size());
+            if (N <= 0)
+                break;
+            Rest = Rest.drop_front(size_t(N));
+        }
+        ::shutdown(FD, SHUT_WR);
+        std::string Response;
+        char Buffer[4096];
+        for (ssize_t N; (N = ::read(FD, Buffer, sizeof(Buffer))) > 0;)
+            Response.append(Buffer, size_t(N));
+        ::close(FD);
+        llvm::Expected<llvm::json::Value> Value = llvm::json::parse(Response);
+        if (!Value) {
+            check(false, "server response is not JSON: " + llvm::toString(Value.takeError()));
+            return nullptr;
+        }
+        return std::move(*Value);
+    }
+
+private:
+    std::string Socket;
+    llvm::sys::ProcessInfo Process;
+};
+
+//===----------------------------------------------------------------------===//
+// Cases
+//===----------------------------------------------------------------------===//
+
+// Two identical files under different names must not share a cache entry:
+// every report of the second names it, not the first.
+static void testCache(const std::string &Dir) {
+    std::string Source = fixture("cache.c");
+    std::string First = pathJoin(Dir, "a/x.c"), Second = pathJoin(Dir, "b/y.c");
+    writeFile(First, Source);
+    writeFile(Second, Source);
+    std::string Cache = "--plugin-arg=-fprecision-demote-cache=" + pathJoin(Dir, "cache");
+
+    runDemote({First}, pathJoin(Dir, "tool-x"), {Cache, "--emit-demoted"});
+    Output Tool = runDemote({Second}, pathJoin(Dir, "tool-y"), {Cache, "--emit-demoted"});
+    check(contains(Tool.Text, "Analysis cache: 0 hits, 1 misses"),
+          "fp16-demote reused the analysis of a/x.c for b/y.c");
+    std::string FloatMap = readFile(pathJoin(Dir, "tool-y/float_map.json"));
+    check(contains(FloatMap, Second + ":2, col 18"), "float map of b/y.c does not name it");
+    check(!contains(FloatMap, First), "float map of b/y.c names a/x.c");
+    std::string Demoted = pathJoin(Dir, "tool-y/demoted");
+    check(llvm::sys::fs::exists(pathJoin(Demoted, flattenName(Second))),
+          "demoted source of b/y.c is not under its own name");
+    check(!llvm::sys::fs::exists(pathJoin(Demoted, flattenName(First))),
+          "demoted source of b/y.c is filed under a/x.c");
+
+    // Warm for both names now.
+    Tool = runDemote({Second}, pathJoin(Dir, "tool-y2"), {Cache});
+    check(contains(Tool.Text, "Analysis cache: 1 hits, 0 misses"),
+          "fp16-demote did not reuse the analysis of b/y.c");
+    check(contains(readFile(pathJoin(Dir, "tool-y2/float_map.json")), Second + ":2, col 18"),
+          "cached float map of b/y.c does not name it");
+
+    std::vector<std::string> PluginArgs = {"-fprecision-demote-cache=" + pathJoin(Dir, "plugin-cache"),
+                                           "-fprecision-demote-combined"};
+    runPlugin(First, pathJoin(Dir, "plugin-x"), PluginArgs);
+    Output Plugin = runPlugin(Second, pathJoin(Dir, "plugin-y"), PluginArgs);
+    check(contains(Plugin.Text, "Analysis cache: 0 hits, 1 misses"),
+          "the plugin reused the analysis of a/x.c for b/y.c");
+    llvm::json::Value Report = readJson(pathJoin(Dir, "plugin-y/fp16_report.json"));
+    const llvm::json::Object *Fields = Report.getAsObject();
+    check(Fields && Fields->getString("main_file") == StringRef(Second),
+          "combined report of b/y.c has another main_file");
+}
+
+// The same main file finding an identical header in another directory must
+// not reuse the entry made with the first header.
+static void testCacheHeaders(const std::string &Dir) {
+    std::string Main = pathJoin(Dir, "main.c");
+    writeFile(Main, "#include \"gain.h\"\nfloat scale(float x) { return x * gain(); }\n");
+    std::string Header = fixture("gain.h");
+    writeFile(pathJoin(Dir, "a/gain.h"), Header);
+    writeFile(pathJoin(Dir, "b/gain.h"), Header);
+    std::string Cache = "--plugin-arg=-fprecision-demote-cache=" + pathJoin(Dir, "cache");
+
+    runDemote({Main}, pathJoin(Dir, "tool-a"), {Cache}, {"-I" + pathJoin(Dir, "a")});
+    Output Tool = runDemote({Main}, pathJoin(Dir, "tool-b"), {Cache}, {"-I" + pathJoin(Dir, "b")});
+    check(contains(Tool.Text, "Analysis cache: 0 hits, 1 misses"),
+          "fp16-demote reused the analysis that found a/gain.h");
+    Tool = runDemote({Main}, pathJoin(Dir, "tool-b2"), {Cache}, {"-I" + pathJoin(Dir, "b")});
+    check(contains(Tool.Text, "Analysis cache: 1 hits, 0 misses"),
+          "fp16-demote did not reuse the analysis that found b/gain.h");
+}
+
+// The NDJSON float map holds the records of the JSON one, one per line, in
+// the same order.
+static void testFloatMap(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "float_map.c");
+    writeFile(Source, fixture("float_map.c"));
+    check(runPlugin(Source, pathJoin(Dir, "json"), {}).Success, "clang failed on float_map.c");
+    check(runPlugin(Source, pathJoin(Dir, "ndjson"), {"-fprecision-demote-ndjson"}).Success,
+          "clang failed on float_map.c with -fprecision-demote-ndjson");
+
+    llvm::json::Value Json = readJson(pathJoin(Dir, "json/float_map.json"));
+    const llvm::json::Array *Records = Json.getAsArray();
+    check(Records && Records->size() == 7, "float_map.json does not hold the 7 literals");
+    check(!llvm::sys::fs::exists(pathJoin(Dir, "ndjson/float_map.json")),
+          "-fprecision-demote-ndjson also wrote float_map.json");
+
+    std::string NDJson = readFile(pathJoin(Dir, "ndjson/float_map.ndjson"));
+    llvm::SmallVector<StringRef, 8> Lines;
+    StringRef(NDJson).split(Lines, '\n', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+    check(Records && Lines.size() == Records->size(),
+          "float_map.ndjson does not hold one line per record");
+    for (size_t I = 0; Records && I < Lines.size() && I < Records->size(); ++I) {
+        llvm::Expected<llvm::json::Value> Line = llvm::json::parse(Lines[I]);
+        if (!Line) {
+            check(false, "float_map.ndjson line " + llvm::Twine(I + 1) + " is not JSON: " +
+                             llvm::toString(Line.takeError()));
+            continue;
+        }
+        check(*Line == (*Records)[I],
+              "float_map.ndjson line " + llvm::Twine(I + 1) + " differs from float_map.json");
+    }
+    const llvm::json::Object *Overflow = findRecord(Json, "location", Source + ":3,");
+    check(Overflow && Overflow->getBoolean("safe") == false &&
+              contains(Overflow->getString("reason").value_or(""), "out of"),
+          "1.0e6f is not out of fp16 range");
+}
+
+// fp16-map2json turns float_map.bin back into the records of
+// float_map.json, and refuses a truncated file.
+static void testBinaryMap(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "float_map.c");
+    writeFile(Source, fixture("float_map.c"));
+    check(runPlugin(Source, pathJoin(Dir, "json"), {}).Success, "clang failed on float_map.c");
+    check(runPlugin(Source, pathJoin(Dir, "binary"), {"-fprecision-demote-format=binary"}).Success,
+          "clang failed on float_map.c with -fprecision-demote-format=binary");
+
+    std::string Binary = pathJoin(Dir, "binary/float_map.bin");
+    Output Map = run(FP16_TEST_MAP2JSON, {Binary}, pathJoin(Dir, "map2json.json"));
+    check(Map.Success, "fp16-map2json failed on float_map.bin");
+    llvm::json::Value Json = readJson(pathJoin(Dir, "json/float_map.json"));
+    llvm::json::Value RoundTrip = readJson(pathJoin(Dir, "map2json.json"));
+    const llvm::json::Array *Records = Json.getAsArray();
+    const llvm::json::Array *Decoded = RoundTrip.getAsArray();
+    check(Records && Decoded && Records->size() == Decoded->size(),
+          "fp16-map2json does not return every record of float_map.json");
+    if (Records && Decoded)
+        for (const llvm::json::Value &Record : *Records)
+            check(llvm::is_contained(*Decoded, Record),
+                  "fp16-map2json lost or changed the record at " +
+                      Record.getAsObject()->getString("location").value_or(""));
+
+    Output Only = run(FP16_TEST_MAP2JSON, {Binary, "--file", Source}, pathJoin(Dir, "only.json"));
+    llvm::json::Value OnlySource = readJson(pathJoin(Dir, "only.json"));
+    check(Only.Success && OnlySource == RoundTrip, "--file drops records of float_map.c");
+    Output None = run(FP16_TEST_MAP2JSON, {Binary, "--file", "missing.c"}, pathJoin(Dir, "none.json"));
+    llvm::json::Value NoneJson = readJson(pathJoin(Dir, "none.json"));
+    const llvm::json::Array *NoRecords = NoneJson.getAsArray();
+    check(None.Success && NoRecords && NoRecords->empty(), "--file missing.c returns records");
+
+    std::string Bytes = readFile(Binary);
+    std::string Truncated = pathJoin(Dir, "truncated.bin");
+    writeFile(Truncated, StringRef(Bytes).drop_back(Bytes.size() / 2));
+    check(!run(FP16_TEST_MAP2JSON, {Truncated}, pathJoin(Dir, "truncated.log")).Success,
+          "fp16-map2json accepted a truncated float_map.bin");
+}
+
+// A variable is demoted only if every value stored to it fits: loops are
+// widened, loop conditions bound them again, and variables the analysis
+// cannot see all stores to are refused.
+static void testRanges(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "ranges.c");
+    writeFile(Source, fixture("ranges.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "plugin"), {});
+    check(Plugin.Success, "clang failed on ranges.c");
+
+    check(contains(Plugin.Text, "Variable 'step' has been safely demoted"),
+          "step < 10.0f does not bound step after widening");
+    check(contains(Plugin.Text, "Variable 'doubled' has been safely demoted"),
+          "doubled < 100.0f does not bound the stores in its loop");
+    check(contains(Plugin.Text, "Variable 'bias' has been safely demoted"),
+          "static bias is refused although every store to it fits");
+    check(contains(Plugin.Text, "Cannot demote variable 'grows' to __fp16: value range "
+                                "[1, 70000] exceeds __fp16 range"),
+          "grows = 70000.0f after its initializer is not refused");
+    check(contains(Plugin.Text, "Cannot demote variable 'sum' to __fp16: value range "
+                                "[0, inf] is unbounded"),
+          "the accumulator sum is not widened to an unbounded range");
+    check(contains(Plugin.Text, "Cannot demote variable 'escaped' to __fp16: address escapes"),
+          "escaped is demoted although its address is passed on");
+    check(contains(Plugin.Text, "Cannot demote variable 'x' to __fp16: parameter value range "
+                                "depends on the callers"),
+          "the parameter x is demoted");
+    check(contains(Plugin.Text, "Cannot demote variable 'external_gain' to __fp16: externally "
+                                "visible"),
+          "the external global external_gain is demoted");
+
+    std::string Demoted = readFile(pathJoin(Dir, "plugin/demoted.c"));
+    for (StringRef Decl : {"__fp16 step", "__fp16 doubled", "static __fp16 bias", "float grows",
+                           "float sum", "float escaped", "float x", "float external_gain"})
+        check(contains(Demoted, Decl), "demoted.c does not declare " + Decl);
+}
+
+// Calls to functions of another translation unit are evaluated through the
+// summaries it exported: by its return range, or by its return expression
+// applied to the actual arguments.
+static void testSummaries(const std::string &Dir) {
+    std::string Callee = pathJoin(Dir, "summary_callee.c");
+    std::string Caller = pathJoin(Dir, "summary_caller.c");
+    writeFile(Callee, fixture("summary_callee.c"));
+    writeFile(Caller, fixture("summary_caller.c"));
+
+    Output Plugin = runPlugin(Caller, pathJoin(Dir, "none"), {});
+    check(contains(Plugin.Text, "Cannot demote variable 'gain' to __fp16: call to function "
+                                "without a summary"),
+          "gain is demoted without a summary of attenuation");
+
+    std::string Database = "-fprecision-demote-summaries=" + pathJoin(Dir, "summaries");
+    check(runPlugin(Callee, pathJoin(Dir, "callee"), {Database}).Success,
+          "clang failed on summary_callee.c");
+    Plugin = runPlugin(Caller, pathJoin(Dir, "caller"), {Database});
+    check(Plugin.Success, "clang failed on summary_caller.c");
+    check(contains(Plugin.Text, "Variable 'gain' has been safely demoted"),
+          "the return range [0, 1] of attenuation does not reach gain");
+    check(contains(Plugin.Text, "Variable 'small' has been safely demoted"),
+          "scaled(2.0f) is not evaluated through the summary of scaled");
+    check(contains(Plugin.Text, "Cannot demote variable 'big' to __fp16: value range "
+                                "[100000, 100000] exceeds __fp16 range"),
+          "scaled(100.0f) is not evaluated with its argument");
+
+    std::string Exported;
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator It(pathJoin(Dir, "summaries"), EC), End;
+         It != End && !EC; It.increment(EC)) {
+        llvm::json::Value File = readJson(It->path());
+        if (const llvm::json::Object *Fields = File.getAsObject())
+            if (Fields->getString("file") == StringRef(Callee))
+                if (const llvm::json::Object *Functions = Fields->getObject("functions"))
+                    Exported = Functions->getString("scaled").value_or("").str();
+    }
+    check(contains(Exported, "(mul (arg 0) (num 1000))"),
+          "the summary database does not hold the return expression of scaled");
+}
+
+// memory_analysis.txt sizes arrays, structs and padding as the target lays
+// them out, per storage class.
+static void testLayout(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "layout.c");
+    writeFile(Source, fixture("layout.c"));
+    check(runPlugin(Source, pathJoin(Dir, "x86_64"), {}, {"--target=x86_64-linux-gnu"}).Success,
+          "clang failed on layout.c for x86_64");
+    std::string Memory = readFile(pathJoin(Dir, "x86_64/memory_analysis.txt"));
+    check(contains(Memory, "Global: 3 variables, 72 -> 68 bytes (72 bytes of float data)"),
+          "table[16] is not counted in full next to the demoted offset and gain");
+    check(contains(Memory, "Static: 1 variables, 4 -> 2 bytes (4 bytes of float data)"),
+          "the static local peak is not counted on its own");
+    check(contains(Memory, "Stack : 4 variables, 64 -> 60 bytes (16 bytes of float data)"),
+          "the frames of record and history are not laid out with padding");
+    check(contains(Memory, "Largest stack frame: 56 -> 56 bytes"),
+          "recent[2] of 24-byte samples and flag do not make a 56-byte frame");
+    check(contains(Memory, "Original memory usage: 140 bytes") &&
+              contains(Memory, "After demotion: 130 bytes"),
+          "the totals are not the sums over the storage classes");
+
+    // On i386 a double in a struct is only 4-byte aligned.
+    check(runPlugin(Source, pathJoin(Dir, "i386"), {}, {"--target=i386-linux-gnu"}).Success,
+          "clang failed on layout.c for i386");
+    Memory = readFile(pathJoin(Dir, "i386/memory_analysis.txt"));
+    check(contains(Memory, "Stack : 4 variables, 44 -> 40 bytes (16 bytes of float data)") &&
+              contains(Memory, "Largest stack frame: 36 -> 36 bytes"),
+          "the i386 layout of struct sample is not used");
+}
+
+// Float fields whose every store fits are demoted, and a field order
+// without padding is suggested, or written with
+// -fprecision-demote-reorder-fields.
+static void testFields(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "fields.c");
+    writeFile(Source, fixture("fields.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "suggest"), {}, {"--target=x86_64-linux-gnu"});
+    check(Plugin.Success, "clang failed on fields.c");
+    check(contains(Plugin.Text, "Variable 'particle.x' has been safely demoted") &&
+              contains(Plugin.Text, "Variable 'particle.y' has been safely demoted"),
+          "particle.x and particle.y are not demoted");
+    check(contains(Plugin.Text, "Cannot demote variable 'particle.energy' to __fp16: value range "
+                                "[0, 1e+06] exceeds __fp16 range"),
+          "particle.energy = 1.0e6f is demoted");
+
+    std::string Memory = readFile(pathJoin(Dir, "suggest/memory_analysis.txt"));
+    check(contains(Memory, "Total float struct fields found: 3\n  Successfully demoted: 2"),
+          "memory_analysis.txt does not count 2 of 3 float fields as demoted");
+    check(contains(Memory, "struct particle (" + Source + ":1): sizeof 32 -> 32 bytes, 24 reordered"),
+          "the demoted and reordered sizes of struct particle are wrong");
+    check(contains(Memory, "Demoted fields: x, y\n"), "the demoted fields are not listed");
+    check(contains(Memory, "Suggested order: mass, energy, x, y, alive, kind\n"),
+          "the fields are not sorted by alignment");
+    std::string Demoted = readFile(pathJoin(Dir, "suggest/demoted.c"));
+    check(contains(Demoted, "    double mass;\n    __fp16 x;\n    char kind;\n    float energy;\n"
+                            "    __fp16 y;\n"),
+          "demoted.c does not demote x and y in place");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "reorder"), {"-fprecision-demote-reorder-fields"},
+                       {"--target=x86_64-linux-gnu"});
+    check(Plugin.Success, "clang failed on fields.c with -fprecision-demote-reorder-fields");
+    Memory = readFile(pathJoin(Dir, "reorder/memory_analysis.txt"));
+    check(contains(Memory, "Reordered in demoted.c: mass, energy, x, y, alive, kind\n"),
+          "memory_analysis.txt does not report the rewritten order");
+    Demoted = readFile(pathJoin(Dir, "reorder/demoted.c"));
+    check(contains(Demoted, "struct particle {\n    double mass;\n    float energy;\n"
+                            "    __fp16 x;\n    __fp16 y;\n    char alive;\n    char kind;\n};"),
+          "demoted.c does not declare the fields of particle in the suggested order");
+}
+
+// With -fprecision-demote-arrays, arrays whose elements all fit binary16
+// hold bit patterns and are accessed through fp16_load and fp16_store.
+static void testArrays(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "arrays.c");
+    writeFile(Source, fixture("arrays.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "report"), {});
+    check(Plugin.Success, "clang failed on arrays.c");
+    std::string Memory = readFile(pathJoin(Dir, "report/memory_analysis.txt"));
+    check(contains(Memory, "weights (" + Source + ":1): 4 elements, 16 -> 8 bytes; convertible "
+                           "(-fprecision-demote-arrays)"),
+          "weights is not reported as convertible without -fprecision-demote-arrays");
+    check(contains(readFile(pathJoin(Dir, "report/demoted.c")), "static const float weights[4]"),
+          "weights is converted without -fprecision-demote-arrays");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "convert"), {"-fprecision-demote-arrays"});
+    check(Plugin.Success, "clang failed on arrays.c with -fprecision-demote-arrays");
+    check(contains(Plugin.Text, "Array 'weights' is now stored as binary16") &&
+              contains(Plugin.Text, "Array 'samples' is now stored as binary16"),
+          "weights and samples are not converted");
+    check(contains(Plugin.Text, "Cannot demote variable 'big' to __fp16: value range "
+                                "[0, 1e+06] exceeds __fp16 range"),
+          "big is converted although 1.0e6f does not fit binary16");
+
+    Memory = readFile(pathJoin(Dir, "convert/memory_analysis.txt"));
+    check(contains(Memory, "Total float arrays found: 3\n  Stored as binary16: 2\n"),
+          "memory_analysis.txt does not count 2 of 3 arrays as converted");
+    check(contains(Memory, "weights (" + Source + ":1): 4 elements, 16 -> 8 bytes; converted\n"
+                           "    1 reads, 0 writes; traffic 32 -> 16 bytes\n"),
+          "the 8 reads of weights in fill are not weighted by the trip count");
+    check(contains(Memory, "samples (" + Source + ":2): 8 elements, 32 -> 16 bytes; converted\n"
+                           "    1 reads, 1 writes; traffic 36 -> 18 bytes\n"),
+          "the traffic of samples is not 8 stores and one read");
+    check(contains(Memory, "big (" + Source + ":3): 2 elements, 8 -> 4 bytes; kept: value range"),
+          "big is not reported as kept");
+
+    std::string Demoted = readFile(pathJoin(Dir, "convert/demoted.c"));
+    check(StringRef(Demoted).starts_with("/* binary16 array storage, added by FP16 demotion */\n"
+                                         "typedef unsigned short fp16_storage_t;\n"),
+          "demoted.c does not start with the fp16_load/fp16_store prelude");
+    check(contains(Demoted, "static inline float fp16_load(fp16_storage_t bits)") &&
+              contains(Demoted, "static inline fp16_storage_t fp16_store(float value)"),
+          "the prelude does not define fp16_load and fp16_store");
+    check(contains(Demoted, "static const fp16_storage_t weights[4] = {0x3800, 0x3400, 0x3c00, 0x4000};"),
+          "the initializer of weights is not written as binary16 bit patterns");
+    check(contains(Demoted, "static fp16_storage_t samples[8];"), "samples is not converted");
+    check(contains(Demoted, "static float big[2]"), "big is converted");
+    check(contains(Demoted, "samples[i] = fp16_store(fp16_load(weights[i % 4]));"),
+          "the copy in fill does not go through fp16_load and fp16_store");
+    check(contains(Demoted, "return fp16_load(samples[0]) + big[1];"),
+          "the read of samples in first does not go through fp16_load");
+}
+
+// Constant initializers are judged by their folded value, not by the
+// literals they are written with.
+static void testVerdicts(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "verdicts.c");
+    writeFile(Source, fixture("verdicts.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "plugin"), {});
+    check(Plugin.Success, "clang failed on verdicts.c");
+    check(!contains(Plugin.Text, "Cannot demote variable 'a' to __fp16: literal value"),
+          "1.0e5f / 10.0f is judged by its literals, not its value");
+    check(contains(Plugin.Text, "Cannot demote variable 'b' to __fp16: constant value loses "
+                                "precision when converted to __fp16"),
+          "1.0f / 3.0f is not judged by its value");
+}
+
+// Outputs go where the output arguments say, appear only once written in
+// full, and -fprecision-demote-combined puts all of them in one report.
+static void testOutputs(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "outputs.c");
+    writeFile(Source, fixture("outputs.c"));
+
+    std::string Separate = pathJoin(Dir, "separate");
+    Output Plugin = runPlugin(Source, Separate, {"-fprecision-demote-output-prefix=run-"});
+    check(Plugin.Success, "clang failed on outputs.c");
+    check(listDir(Separate) == std::vector<std::string>{"run-demoted.c", "run-float_map.json",
+                                                        "run-memory_analysis.txt"},
+          "the prefixed outputs are not the only files in the output directory");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "nested"), {"-fprecision-demote-output-prefix=runs/42/"});
+    check(Plugin.Success, "clang failed on outputs.c with a directory prefix");
+    check(llvm::sys::fs::exists(pathJoin(Dir, "nested/runs/42/demoted.c")),
+          "the directory part of the prefix is not created");
+
+    std::string Combined = pathJoin(Dir, "combined");
+    Plugin = runPlugin(Source, Combined, {"-fprecision-demote-combined"});
+    check(Plugin.Success, "clang failed on outputs.c with -fprecision-demote-combined");
+    check(listDir(Combined) == std::vector<std::string>{"fp16_report.json"},
+          "-fprecision-demote-combined writes more than fp16_report.json");
+    llvm::json::Value Report = readJson(pathJoin(Combined, "fp16_report.json"));
+    const llvm::json::Object *Fields = Report.getAsObject();
+    check(Fields && Fields->getString("version"), "fp16_report.json has no version");
+    check(Fields && Fields->getString("main_file") == StringRef(Source),
+          "fp16_report.json does not name outputs.c as its main file");
+    const llvm::json::Value *FloatMap = Fields ? Fields->get("float_map") : nullptr;
+    check(FloatMap && *FloatMap == readJson(pathJoin(Separate, "run-float_map.json")),
+          "the float map in fp16_report.json differs from float_map.json");
+    check(Fields && Fields->getString("demoted_code") ==
+                        StringRef(readFile(pathJoin(Separate, "run-demoted.c"))),
+          "the demoted code in fp16_report.json differs from demoted.c");
+    check(Fields && Fields->getString("memory_analysis") ==
+                        StringRef(readFile(pathJoin(Separate, "run-memory_analysis.txt"))),
+          "the memory analysis in fp16_report.json differs from memory_analysis.txt");
+
+    // fp16-demote names its merged report with the same prefix.
+    std::string Tool = pathJoin(Dir, "tool");
+    check(runDemote({Source}, Tool, {"--plugin-arg=-fprecision-demote-output-prefix=merged-"}).Success,
+          "fp16-demote failed on outputs.c");
+    check(llvm::sys::fs::exists(pathJoin(Tool, "merged-float_map.json")) &&
+              llvm::sys::fs::exists(pathJoin(Tool, "merged-memory_analysis.txt")),
+          "fp16-demote does not prefix its merged report");
+}
+
+static bool succeeded(const llvm::json::Value &Response) {
+    const llvm::json::Object *Fields = Response.getAsObject();
+    return Fields && Fields->getBoolean("success") == true;
+}
+
+// The server refuses flags that load code or name files, reads headers only
+// below its include roots, and only adds named requests to its summary
+// store.
+static void testServer(const std::string &Dir) {
+    std::string Summaries = pathJoin(Dir, "summaries");
+    std::string Roots = pathJoin(Dir, "roots");
+    std::string Outside = pathJoin(Dir, "outside");
+    writeFile(pathJoin(Roots, "gain.h"), "static const float gain = 0.5f;\n");
+    writeFile(pathJoin(Outside, "secret.h"), "secret_token_8317 = 1;\n");
+    llvm::sys::fs::create_link(pathJoin(Outside, "secret.h"), pathJoin(Roots, "link.h"));
+    Server S(Dir, {"--plugin-arg=-fprecision-demote-summaries=" + Summaries,
+                   "--include-root=" + Roots});
+    std::string Source = fixture("server.c");
+
+    auto Request = [&](const std::vector<std::string> &CompileArgs,
+                       const std::vector<std::string> &Args) {
+        return S.request(llvm::json::Object{{"source", Source},
+                                            {"file", "server.c"},
+                                            {"compile_args", llvm::json::Array(CompileArgs)},
+                                            {"args", llvm::json::Array(Args)}});
+    };
+    for (const char *Flag : {"-fplugin=evil.so", "-o", "-MF", "-mllvm", "-Wp,-MD,dep",
+                             "-fpass-plugin=evil.so", "-working-directory",
+                             "-fsanitize-ignorelist=/etc/passwd", "-include"})
+        check(!succeeded(Request({Flag}, {})), llvm::Twine("server accepted ") + Flag);
+    check(!succeeded(Request({"-Xclang", "-load", "-Xclang", "evil.so"}, {})),
+          "server accepted -Xclang -load");
+    check(!succeeded(Request({"-I"}, {})), "server accepted -I without a directory");
+    check(!succeeded(Request({}, {"-fprecision-demote-output-dir=/tmp"})),
+          "server accepted an output directory");
+    check(!succeeded(Request({}, {"-fprecision-demote-cache=/tmp"})),
+          "server accepted a cache directory");
+    check(!succeeded(Request({"-I", Outside}, {})) && !succeeded(Request({"-I" + Outside}, {})) &&
+              !succeeded(Request({"-isystem", pathJoin(Roots, "../outside")}, {})),
+          "server accepted an include directory outside its include roots");
+
+    // Neither an absolute path, ".." nor a symlink reaches a file outside
+    // the roots, so its text never shows up in the diagnostics.
+    for (const std::string &Include : {pathJoin(Outside, "secret.h"),
+                                       pathJoin(Roots, "../outside/secret.h"),
+                                       pathJoin(Roots, "link.h")}) {
+        llvm::json::Value Response = S.request(llvm::json::Object{
+            {"source", "#include \"" + Include + "\"\n"}, {"file", "leak.c"}});
+        const llvm::json::Object *Fields = Response.getAsObject();
+        std::optional<StringRef> Diagnostics =
+            Fields ? Fields->getString("diagnostics") : std::nullopt;
+        check(!succeeded(Response) && Diagnostics && !contains(*Diagnostics, "secret_token"),
+              "the server read " + Include);
+    }
+
+    Source = "#include \"gain.h\"\n" + Source;
+    llvm::json::Value Allowed = Request({"-DSCALE=gain", "-std=c11", "-I", Roots, "-Wall", "-O2"},
+                                        {"-fprecision-demote-arrays"});
+    check(succeeded(Allowed), "server refused allowed flags or a header below its include root");
+    check(listDir(Summaries).size() == 1, "named request was not added to the summary store");
+
+    llvm::sys::fs::remove_directories(Summaries);
+    check(succeeded(S.request(llvm::json::Object{{"source", Source},
+                                                 {"compile_args", {"-DSCALE=gain", "-I" + Roots}}})),
+          "anonymous request failed");
+    check(listDir(Summaries).empty(), "anonymous request was added to the summary store");
+}
+
+// Two copies of one file next to different config.h files must not share
+// a preamble: each sees its own SCALE. A third copy next to a/config.h
+// reuses the preamble of a/main.c.
+static void testPreamble(const std::string &Dir) {
+    std::string Main = fixture("preamble/main.c");
+    std::vector<std::string> Files;
+    for (std::string Name : {"a/main.c", "a/other.c", "b/main.c"}) {
+        Files.push_back(pathJoin(Dir, Name));
+        writeFile(Files.back(), Main);
+    }
+    for (std::string Sub : {"a", "b"})
+        writeFile(pathJoin(Dir, Sub + "/config.h"), fixture("preamble/" + Sub + "/config.h"));
+    Output Tool = runDemote(Files, pathJoin(Dir, "tool"), {"--reuse-preambles", "-j=1"});
+    check(contains(Tool.Text, "Preamble cache: 1 hits, 2 builds"),
+          "fp16-demote did not share exactly the preamble of a/main.c and a/other.c");
+    llvm::json::Value FloatMap = readJson(pathJoin(Dir, "tool/float_map.json"));
+    const llvm::json::Object *A = findRecord(FloatMap, "location", Files[0] + ":4,");
+    const llvm::json::Object *Other = findRecord(FloatMap, "location", Files[1] + ":4,");
+    const llvm::json::Object *B = findRecord(FloatMap, "location", Files[2] + ":4,");
+    check(A && A->getNumber("value") == 1.0, "a/main.c does not see SCALE 1.0f");
+    check(Other && Other->getNumber("value") == 1.0,
+          "a/other.c does not see SCALE 1.0f through the reused preamble");
+    check(B && B->getNumber("value") == 100000.0, "b/main.c does not see SCALE 100000.0f");
+    check(B && B->getBoolean("safe") == false, "SCALE 100000.0f is demoted to fp16");
+}
+
+// An unchanged file reuses every function; editing a body reanalyzes it
+// and its callers, and the reports follow the edit. The server uses the
+// store for named requests only.
+static void testIncremental(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "incremental.c");
+    std::string Text = fixture("incremental.c");
+    writeFile(Source, Text);
+    std::string Store = "-fprecision-demote-incremental=" + pathJoin(Dir, "store");
+
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "first"), {Store});
+    check(contains(Plugin.Text, "Incremental analysis: 0 functions reused, 3 analyzed"),
+          "the first analysis of incremental.c reused functions");
+    Plugin = runPlugin(Source, pathJoin(Dir, "unchanged"), {Store});
+    check(contains(Plugin.Text, "Incremental analysis: 3 functions reused, 0 analyzed"),
+          "the unchanged incremental.c was analyzed again");
+    check(readFile(pathJoin(Dir, "unchanged/float_map.json")) ==
+              readFile(pathJoin(Dir, "first/float_map.json")),
+          "the reused analysis changed the float map");
+
+    // Same length, so only the body of helper changes.
+    std::string Edited = Text;
+    Edited.replace(Edited.find("0.5f"), 4, "1e9f");
+    writeFile(Source, Edited);
+    Plugin = runPlugin(Source, pathJoin(Dir, "edited"), {Store});
+    check(contains(Plugin.Text, "Incremental analysis: 1 functions reused, 2 analyzed"),
+          "editing helper did not reanalyze exactly helper and uses_helper");
+    llvm::json::Value FloatMap = readJson(pathJoin(Dir, "edited/float_map.json"));
+    const llvm::json::Object *Changed = findRecord(FloatMap, "location", Source + ":1,");
+    check(Changed && Changed->getNumber("value") == 1e9 && Changed->getBoolean("safe") == false,
+          "the float map does not show the edited literal 1e9f");
+    const llvm::json::Object *Kept = findRecord(FloatMap, "location", Source + ":4,");
+    check(Kept && Kept->getNumber("value") == 2.0 && Kept->getBoolean("safe") == true,
+          "the reused literal 2.0f of independent is missing");
+
+    Server S(Dir, {"--plugin-arg=" + Store});
+    auto Counters = [&]() {
+        llvm::json::Value Stats = S.request(llvm::json::Object{{"command", "stats"}});
+        const llvm::json::Object *Fields = Stats.getAsObject();
+        return std::make_pair(Fields ? Fields->getInteger("incremental_reused") : std::nullopt,
+                              Fields ? Fields->getInteger("incremental_analyzed") : std::nullopt);
+    };
+    for (int I = 0; I < 2; ++I)
+        check(succeeded(S.request(llvm::json::Object{{"source", Text}})),
+              "anonymous request failed");
+    check(Counters() == std::make_pair(std::optional<int64_t>(0), std::optional<int64_t>(0)),
+          "anonymous requests used the incremental store");
+    for (int I = 0; I < 2; ++I)
+        check(succeeded(S.request(llvm::json::Object{{"source", Text}, {"file", "incremental.c"}})),
+              "named request failed");
+    check(Counters() == std::make_pair(std::optional<int64_t>(3), std::optional<int64_t>(3)),
+          "the second named request did not reuse the functions of the first");
+}
+
+// The analyze action compiles nothing and skips the bodies of headers
+// outside the project; the regular action warns that it ignores
+// -fprecision-demote-analysis-only.
+static void testAnalyze(const std::string &Dir) {
+    std::string Main = pathJoin(Dir, "main.c");
+    writeFile(Main, fixture("analyze/main.c"));
+    for (const char *Header : {"include/project.h", "vendor/vendor.h"})
+        writeFile(pathJoin(Dir, Header), fixture(std::string("analyze/") + Header));
+    std::string ProjectHeaders = "-fprecision-demote-project-header=" + pathJoin(Dir, "include");
+    std::vector<std::string> Includes = {"-I" + pathJoin(Dir, "include"),
+                                         "-I" + pathJoin(Dir, "vendor")};
+
+    std::string Object = pathJoin(Dir, "main.o");
+    std::vector<std::string> Args = {"-c", "-o", Object, "-fplugin=" FP16_TEST_PLUGIN,
+                                     "-Xclang", "-plugin", "-Xclang", "fp16-demotion-analyze"};
+    for (const std::string &Arg :
+         {"-fprecision-demote-output-dir=" + pathJoin(Dir, "analyze"), ProjectHeaders})
+        Args.insert(Args.end(), {"-Xclang", "-plugin-arg-fp16-demotion-analyze", "-Xclang", Arg});
+    Args.insert(Args.end(), Includes.begin(), Includes.end());
+    Args.push_back(Main);
+    llvm::sys::fs::create_directories(pathJoin(Dir, "analyze"));
+    Output Analyze = run(FP16_TEST_CLANG, Args, pathJoin(Dir, "analyze.log"));
+    check(Analyze.Success, "clang failed with the fp16-demotion-analyze action");
+    check(!llvm::sys::fs::exists(Object), "the fp16-demotion-analyze action compiled main.c");
+    check(contains(Analyze.Text, "Variable 'project' has been safely demoted"),
+          "the body of project_gain in a project header was skipped");
+    check(contains(Analyze.Text, "Cannot demote variable 'vendor' to __fp16: call to function "
+                                 "without a summary"),
+          "the body of vendor_gain outside the project headers was parsed");
+
+    Output Plugin = runPlugin(Main, pathJoin(Dir, "plugin"),
+                              {"-fprecision-demote-analysis-only", ProjectHeaders}, Includes);
+    check(contains(Plugin.Text, "Warning: -fprecision-demote-analysis-only has no effect while "
+                                "compiling"),
+          "the fp16-demotion action took -fprecision-demote-analysis-only silently");
+    check(contains(Plugin.Text, "Variable 'vendor' has been safely demoted"),
+          "the fp16-demotion action skipped the body of vendor_gain");
+}
+
+// -fprecision-demote-timing prints the phases and counters, and
+// -fprecision-demote-time-trace writes a Chrome trace holding the phases
+// unless clang's -ftime-trace already records them.
+static void testTimeTrace(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "timing.c");
+    writeFile(Source, fixture("timing.c"));
+    std::string Trace = pathJoin(Dir, "trace.json");
+    std::string TraceArg = "-fprecision-demote-time-trace=" + Trace;
+
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "timed"), {"-fprecision-demote-timing", TraceArg});
+    check(Plugin.Success, "clang failed with timing and a time trace");
+    check(contains(Plugin.Text, "FP16 demotion phases") &&
+              contains(Plugin.Text, "AST traversal (includes verdicts)"),
+          "-fprecision-demote-timing printed no phase times");
+    check(contains(Plugin.Text, "FP16 demotion work: ") &&
+              !contains(Plugin.Text, "FP16 demotion work: 0 AST nodes"),
+          "-fprecision-demote-timing printed no work counters");
+    // Short events fall under the trace granularity; the totals always stay.
+    llvm::json::Value Events = readJson(Trace);
+    const llvm::json::Object *Fields = Events.getAsObject();
+    const llvm::json::Value *TraceEvents = Fields ? Fields->get("traceEvents") : nullptr;
+    for (const char *Name : {"Total Fp16Traversal", "Total Fp16Verdict", "Total Fp16Output"})
+        check(TraceEvents && findRecord(*TraceEvents, "name", Name),
+              llvm::Twine("the time trace has no ") + Name + " event");
+
+    std::string Unused = pathJoin(Dir, "unused.json");
+    Plugin = runPlugin(Source, pathJoin(Dir, "ftime-trace"),
+                       {"-fprecision-demote-time-trace=" + Unused}, {"-ftime-trace"});
+    check(contains(Plugin.Text, "Time trace events go to the -ftime-trace output") &&
+              !llvm::sys::fs::exists(Unused),
+          "the plugin started its own profiler under -ftime-trace");
+}
+
+// An instrumented copy records the values of the variables the static
+// analysis cannot bound; with its profile, those whose recorded range fits
+// are demoted and the others keep float.
+static void testProfile(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "profile.c");
+    writeFile(Source, fixture("profile.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "instrument"), {"-fprecision-demote-instrument"});
+    std::string Instrumented = pathJoin(Dir, "instrument/instrumented.c");
+    check(Plugin.Success && llvm::sys::fs::exists(Instrumented), "no instrumented.c was written");
+    check(contains(Plugin.Text, "Cannot demote variable 'y' to __fp16"),
+          "y is demoted without a profile");
+
+    std::string Program = pathJoin(Dir, "profiled");
+    check(run(FP16_TEST_CLANG, {"-I" FP16_TEST_RUNTIME, Instrumented, "-o", Program, "-lpthread"},
+              pathJoin(Dir, "build.log"))
+              .Success,
+          "instrumented.c does not build against runtime/fp16_profile.h");
+    std::string Profile = pathJoin(Dir, "profile.ndjson");
+    check(run(Program, {}, pathJoin(Dir, "profiled.log"), {"FP16_PROFILE_FILE=" + Profile}).Success,
+          "the instrumented program failed");
+    std::string Lines = readFile(Profile);
+    check(contains(Lines, "{\"site\":\"" + Source + ":2:11:y\",\"count\":100,") &&
+              contains(Lines, "\"min\":0,\"max\":49.5}"),
+          "the profile does not hold the 100 values of y");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "profiled"), {"-fprecision-demote-profile=" + Profile});
+    check(contains(Plugin.Text, "Variable 'y' has been safely demoted"),
+          "y is not demoted with its recorded range [0, 49.5]");
+    check(contains(Plugin.Text, "Cannot demote variable 'big' to __fp16") &&
+              contains(Plugin.Text, "; profile: observed"),
+          "big is demoted although it recorded 99000");
+}
+
+// Every literal gets the narrowest listed format with a C type it fits;
+// fp8 is only reported. demoted.c must still compile.
+static void testFormats(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "formats.c");
+    writeFile(Source, fixture("formats.c"));
+    Output Plugin =
+        runPlugin(Source, pathJoin(Dir, "plugin"), {"-fprecision-demote=fp16,bf16,fp8-e4m3"});
+    check(Plugin.Success, "clang failed on formats.c");
+
+    llvm::json::Value FloatMap = readJson(pathJoin(Dir, "plugin/float_map.json"));
+    const llvm::json::Object *Half = findRecord(FloatMap, "location", Source + ":1,");
+    const llvm::json::Object *Wide = findRecord(FloatMap, "location", Source + ":2,");
+    const llvm::json::Object *Tenth = findRecord(FloatMap, "location", Source + ":3,");
+    check(Half && Half->getString("mode") == StringRef("fp16") && Half->getBoolean("safe") == true,
+          "0.5f is not demoted to fp16, the narrowest format with a C type");
+    check(Wide && Wide->getString("mode") == StringRef("bf16") && Wide->getBoolean("safe") == true,
+          "262144.0f is not demoted to bf16");
+    check(Tenth && Tenth->getBoolean("safe") == false, "0.1f is demoted");
+
+    std::string DemotedPath = pathJoin(Dir, "plugin/demoted.c");
+    std::string Demoted = readFile(DemotedPath);
+    check(contains(Demoted, "return ((__fp16)0x1p-1f);"),
+          "demoted.c does not cast 0.5f to __fp16 as a hex float");
+    check(contains(Demoted, "return ((__bf16)0x1p+18f);"),
+          "demoted.c does not cast 262144.0f to __bf16 as a hex float");
+    check(contains(Demoted, "return 0.1f;"), "demoted.c rewrote 0.1f");
+    check(run(FP16_TEST_CLANG, {"-fsyntax-only", DemotedPath}, pathJoin(Dir, "demoted.log")).Success,
+          "demoted.c does not compile");
+
+    std::string Memory = readFile(pathJoin(Dir, "plugin/memory_analysis.txt"));
+    check(contains(Memory, "fp8-e4m3 (8 bits, report only): 0 variables, 0 fields, 0 arrays, "
+                           "1 literals fit"),
+          "memory_analysis.txt does not report 0.5f as fitting fp8-e4m3");
+    check(contains(Memory, "bf16 (16 bits): 0 variables, 0 fields, 0 arrays, 2 literals fit"),
+          "memory_analysis.txt does not report 0.5f and 262144.0f as fitting bf16");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "unknown"), {"-fprecision-demote=fp12"});
+    check(contains(Plugin.Text, "unknown FP16 demotion argument '-fprecision-demote=fp12'"),
+          "an unknown format is not reported");
+}
+
+// With -fprecision-demote-double, doubles whose values fit float become
+// float; a shared declaration changes only if all its declarators do.
+static void testDouble(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "double.c");
+    writeFile(Source, fixture("double.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "plugin"), {"-fprecision-demote-double"});
+    check(Plugin.Success, "clang failed on double.c");
+    check(contains(Plugin.Text, "Variable 'scale' has been safely demoted from double to float"),
+          "scale = 0.5 is not demoted to float");
+    check(contains(Plugin.Text, "Cannot demote variable 'tiny' to float"),
+          "tiny = 1e-300 is demoted to float");
+    check(contains(Plugin.Text, "Cannot demote variable 'b' to float"),
+          "b = 1e300 is demoted to float");
+    check(contains(Plugin.Text, "Cannot demote variable 'a' to float: its declaration is shared"),
+          "a is demoted although b shares its declaration");
+
+    std::string Demoted = readFile(pathJoin(Dir, "plugin/demoted.c"));
+    check(contains(Demoted, "float scale"), "demoted.c does not declare scale as float");
+    check(contains(Demoted, "double tiny"), "demoted.c changed the type of tiny");
+    check(contains(Demoted, "double a"), "demoted.c changed the shared declaration of a and b");
+    check(run(FP16_TEST_CLANG, {"-fsyntax-only", pathJoin(Dir, "plugin/demoted.c")},
+              pathJoin(Dir, "demoted.log"))
+              .Success,
+          "demoted.c does not compile");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "off"), {});
+    check(!contains(Plugin.Text, "from double to float"),
+          "doubles are demoted without -fprecision-demote-double");
+}
+
+// A variable stays float if the error bound of a value stored to it exceeds
+// its budget: from an annotation, then by name, then the default.
+static void testBudget(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "budget.c");
+    writeFile(Source, fixture("budget.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "none"), {});
+    check(contains(Plugin.Text, "Variable 'rounded' has been safely demoted"),
+          "rounded is not demoted without a budget");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "default"), {"-fprecision-demote-error-budget=1e-6"});
+    check(Plugin.Success, "clang failed on budget.c");
+    check(contains(Plugin.Text, "Variable 'exact' has been safely demoted"),
+          "exact = 0.5f does not fit a budget of 1e-6");
+    check(contains(Plugin.Text, "Cannot demote variable 'rounded' to __fp16: relative error "
+                                "bound"),
+          "rounded * 3.0f + 0.25f fits a budget of 1e-6");
+    check(contains(Plugin.Text, "exceeds the budget of 1e-06"),
+          "the refusal does not name the budget");
+    check(contains(Plugin.Text, "Variable 'loose' has been safely demoted"),
+          "the annotated budget of loose does not override the default");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "named"),
+                       {"-fprecision-demote-error-budget=1e-6",
+                        "-fprecision-demote-error-budget=budget:rounded=0.1"});
+    check(contains(Plugin.Text, "Variable 'rounded' has been safely demoted"),
+          "the budget named budget:rounded does not override the default");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "absolute"), {"-fprecision-demote-abs-error-budget=1e-9"});
+    check(contains(Plugin.Text, "Cannot demote variable 'rounded' to __fp16: absolute error "
+                                "bound"),
+          "rounded fits an absolute budget of 1e-9");
+}
+
+// The LOOP VECTORIZATION section classifies each loop, counts its
+// iterations and reports lanes for the requested register widths only.
+static void testLoops(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "loops.c");
+    writeFile(Source, fixture("loops.c"));
+    Output Plugin =
+        runPlugin(Source, pathJoin(Dir, "plugin"), {"-fprecision-demote-vector-width=128"});
+    check(Plugin.Success, "clang failed on loops.c");
+
+    std::string Memory = readFile(pathJoin(Dir, "plugin/memory_analysis.txt"));
+    check(contains(Memory, "LOOP VECTORIZATION:"), "memory_analysis.txt has no loop section");
+    check(contains(Memory, "map in scale (" + Source + ":5)"), "the loop of scale is not a map");
+    check(contains(Memory, "reduction in total (" + Source + ":11)"),
+          "the loop of total is not a reduction");
+    check(contains(Memory, "Accumulators: sum\n"), "sum is not reported as the accumulator");
+    check(contains(Memory, "recurrence in smooth (" + Source + ":17)"),
+          "the loop of smooth is not a recurrence");
+    check(contains(Memory, "Not vectorized: out is carried between iterations"),
+          "out[i - 1] is not reported as carried");
+    check(contains(Memory, "64 iterations") && contains(Memory, "63 iterations"),
+          "the trip counts of the loops are missing");
+    check(contains(Memory, "Lanes: 128-bit"), "no lanes are reported for 128-bit registers");
+    check(!contains(Memory, "256-bit"), "lanes are reported for a width that was not requested");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "invalid"), {"-fprecision-demote-vector-width=100"});
+    check(contains(Plugin.Text, "unknown FP16 demotion argument"),
+          "a width that is not a power of two is accepted");
+}
+
+// A register local read in a hot loop costs more in conversions than it
+// saves; a global written once costs none.
+static void testCost(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "cost.c");
+    writeFile(Source, fixture("cost.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "reject"),
+                              {"-fprecision-demote-cost-model=reject",
+                               "-fprecision-demote-cost-target=x86-soft"});
+    check(Plugin.Success, "clang failed on cost.c");
+    check(contains(Plugin.Text, "Cannot demote variable 'hot_scale' to __fp16: its half/float "
+                                "conversions cost about 10000 cycles on x86-soft"),
+          "hot_scale is not rejected for its 1000 conversions");
+    check(contains(Plugin.Text, "Variable 'cold' has been safely demoted"),
+          "cold is rejected although it is never converted");
+
+    llvm::json::Value Costs = readJson(pathJoin(Dir, "reject/conversion_costs.json"));
+    const llvm::json::Object *Hot = findRecord(Costs, "name", "hot_scale");
+    check(Hot && Hot->getString("decision") == StringRef("rejected") &&
+              Hot->getString("target") == StringRef("x86-soft") &&
+              Hot->getNumber("reads") == 1000.0 && Hot->getNumber("half_to_float") == 1000.0 &&
+              Hot->getBoolean("memory_resident") == false &&
+              Hot->getBoolean("trip_counts_exact") == true,
+          "conversion_costs.json does not weight the reads of hot_scale by the trip count");
+    const llvm::json::Object *Cold = findRecord(Costs, "name", "cold");
+    check(Cold && Cold->getString("decision") == StringRef("demoted") &&
+              Cold->getNumber("conversion_cycles") == 0.0 &&
+              Cold->getBoolean("memory_resident") == true,
+          "conversion_costs.json does not show cold as free to demote");
+
+    Plugin = runPlugin(Source, pathJoin(Dir, "flag"),
+                       {"-fprecision-demote-cost-model=flag",
+                        "-fprecision-demote-cost-target=x86-soft"});
+    check(contains(Plugin.Text, "Demoting variable 'hot_scale' may be slower"),
+          "-fprecision-demote-cost-model=flag does not warn about hot_scale");
+    check(contains(Plugin.Text, "Variable 'hot_scale' has been safely demoted"),
+          "-fprecision-demote-cost-model=flag keeps hot_scale float");
+    Costs = readJson(pathJoin(Dir, "flag/conversion_costs.json"));
+    Hot = findRecord(Costs, "name", "hot_scale");
+    check(Hot && Hot->getString("decision") == StringRef("flagged"),
+          "conversion_costs.json does not record hot_scale as flagged");
+}
+
+// Converted arrays: a copied element is loaded and stored through one pair
+// of insertions, and an argument used twice by a macro is wrapped once.
+// The YAML edits are those of demoted.c.
+static void testRewrite(const std::string &Dir) {
+    std::string Source = pathJoin(Dir, "rewrite.c");
+    writeFile(Source, fixture("rewrite.c"));
+    Output Plugin = runPlugin(Source, pathJoin(Dir, "plugin"),
+                              {"-fprecision-demote-arrays", "-fprecision-demote-replacements"});
+    check(Plugin.Success, "clang failed on rewrite.c");
+    std::string Demoted = readFile(pathJoin(Dir, "plugin/demoted.c"));
+    check(contains(Demoted, "dst[i] = fp16_store(fp16_load(src[i]));"),
+          "copied element is not fp16_store(fp16_load(...))");
+    check(contains(Demoted, "TWICE(fp16_load(src[i]))"),
+          "macro argument is not wrapped exactly once");
+    check(llvm::count(Demoted, '(') == llvm::count(Demoted, ')'),
+          "demoted.c has unbalanced parentheses");
+
+    std::string Yaml = readFile(pathJoin(Dir, "plugin/replacements/" + flattenName(Source) + ".yaml"));
+    check(contains(Yaml, "MainSourceFile:") && contains(Yaml, "rewrite.c"),
+          "replacements YAML does not name rewrite.c");
+    check(contains(Yaml, "fp16_store(fp16_load("), "replacements YAML lacks the merged insertion");
+    check(!contains(Yaml, "fp16_load(fp16_load("), "replacements YAML repeats an insertion");
+}
+
+struct TestCase {
+    const char *Name;
+    void (*Run)(const std::string &Dir);
+};
+
+static const TestCase Cases[] = {
+    {"cache", testCache},
+    {"cache-headers", testCacheHeaders},
+    {"float-map", testFloatMap},
+    {"binary-map", testBinaryMap},
+    {"ranges", testRanges},
+    {"summaries", testSummaries},
+    {"layout", testLayout},
+    {"fields", testFields},
+    {"arrays", testArrays},
+    {"verdicts", testVerdicts},
+    {"outputs", testOutputs},
+    {"server", testServer},
+    {"preamble", testPreamble},
+    {"incremental", testIncremental},
+    {"analyze", testAnalyze},
+    {"time-trace", testTimeTrace},
+    {"profile", testProfile},
+    {"formats", testFormats},
+    {"double", testDouble},
+    {"budget", testBudget},
+    {"loops", testLoops},
+    {"cost", testCost},
+    {"rewrite", testRewrite},
+};
+
+int main(int argc, char **argv) {
+    llvm::SmallString<256> Root("fp16-demotion-test");
+    llvm::sys::fs::make_absolute(Root);
+    unsigned Failed = 0, Ran = 0;
+    for (const TestCase &Case : Cases) {
+        bool Selected = argc < 2;
+        for (int I = 1; I < argc; ++I)
+            Selected |= StringRef(argv[I]) == Case.Name;
+        if (!Selected)
+            continue;
+        ++Ran;
+        std::string Dir = pathJoin(Root, Case.Name);
+        llvm::sys::fs::remove_directories(Dir);
+        llvm::sys::fs::create_directories(Dir);
+        unsigned Before = Failures;
+        std::printf("%s\n", Case.Name);
+        Case.Run(Dir);
+        if (Failures != Before)
+            ++Failed;
+    }
+    if (!Ran) {
+        std::printf("no such case\n");
+        return 1;
+    }
+    std::printf("%u of %u cases failed\n", Failed, Ran);
+    return Failed ? 1 : 0;
+}
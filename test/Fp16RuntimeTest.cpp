@@ -0,0 +1,125 @@
+//===- Fp16RuntimeTest.cpp - Exhaustive checks of fp16_runtime.h ----------===//
+//
+// Checks every conversion kernel the CPU supports against llvm::APFloat,
+// bit for bit:
+//  - half to float for all 65,536 half values;
+//  - float to half for every float that is a half value, the midpoints
+//    between neighbouring halves (ties to even), the floats just either side
+//    of each midpoint, and values beyond the half range.
+// NaNs only have to stay NaNs of the same sign: APFloat and the hardware
+// agree on quieting but not necessarily on the payload.
+//
+//===----------------------------------------------------------------------===//
+
+#include "fp16_runtime.h"
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/APInt.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using llvm::APFloat;
+
+static uint32_t floatBits(float F) {
+    uint32_t Bits;
+    std::memcpy(&Bits, &F, sizeof Bits);
+    return Bits;
+}
+
+static float bitsFloat(uint32_t Bits) {
+    float F;
+    std::memcpy(&F, &Bits, sizeof F);
+    return F;
+}
+
+static bool isHalfNaN(uint16_t H) { return (H & 0x7c00) == 0x7c00 && (H & 0x3ff); }
+
+static uint32_t expectedFloat(uint16_t H) {
+    APFloat V(APFloat::IEEEhalf(), llvm::APInt(16, H));
+    bool LosesInfo;
+    V.convert(APFloat::IEEEsingle(), APFloat::rmNearestTiesToEven, &LosesInfo);
+    return uint32_t(V.bitcastToAPInt().getZExtValue());
+}
+
+static uint16_t expectedHalf(float F) {
+    APFloat V(F);
+    bool LosesInfo;
+    V.convert(APFloat::IEEEhalf(), APFloat::rmNearestTiesToEven, &LosesInfo);
+    return uint16_t(V.bitcastToAPInt().getZExtValue());
+}
+
+// Floats to convert to half: see the file comment.
+static std::vector<float> halfBoundaryInputs() {
+    std::vector<float> Inputs;
+    for (uint32_t H = 0; H < 0x7c00; ++H) {
+        for (uint32_t Sign : {0u, 0x8000u}) {
+            float Value = fp16_to_float(uint16_t(H | Sign));
+            float Next = fp16_to_float(uint16_t((H + 1) | Sign));
+            if (std::isinf(Next)) // Where the next binade would start
+                Next = Sign ? -65536.0f : 65536.0f;
+            Inputs.push_back(Value);
+            // Exact: a half midpoint needs at most 12 significant bits.
+            uint32_t Mid = floatBits((Value + Next) / 2);
+            Inputs.push_back(bitsFloat(Mid));
+            Inputs.push_back(bitsFloat(Mid - 1));
+            Inputs.push_back(bitsFloat(Mid + 1));
+        }
+    }
+    for (float Special : {65519.99f, 65520.0f, 1.0e5f, 3.0e38f, INFINITY, -INFINITY, NAN,
+                          -NAN, 1.0e-10f, -1.0e-10f, 1.4e-45f})
+        Inputs.push_back(Special);
+    return Inputs;
+}
+
+static unsigned checkKernel(enum fp16_isa Isa, const std::vector<float> &Inputs) {
+    unsigned Failures = 0;
+    auto Fail = [&](const char *What, uint32_t In, uint32_t Got, uint32_t Want) {
+        if (++Failures <= 10)
+            std::printf("  %s %s: input 0x%08x gave 0x%08x, expected 0x%08x\n",
+                        fp16_isa_name(Isa), What, In, Got, Want);
+    };
+
+    std::vector<uint16_t> Halves(65536);
+    for (uint32_t H = 0; H < Halves.size(); ++H)
+        Halves[H] = uint16_t(H);
+    std::vector<float> Floats(Halves.size());
+    fp16_to_float_array_isa(Isa, Floats.data(), Halves.data(), Halves.size());
+    for (uint32_t H = 0; H < Halves.size(); ++H) {
+        uint32_t Got = floatBits(Floats[H]), Want = expectedFloat(uint16_t(H));
+        bool Match = isHalfNaN(uint16_t(H))
+                         ? std::isnan(Floats[H]) && (Got >> 31) == (Want >> 31)
+                         : Got == Want;
+        if (!Match)
+            Fail("half->float", H, Got, Want);
+    }
+
+    std::vector<uint16_t> Converted(Inputs.size());
+    fp16_from_float_array_isa(Isa, Converted.data(), Inputs.data(), Inputs.size());
+    for (size_t I = 0; I < Inputs.size(); ++I) {
+        uint16_t Want = expectedHalf(Inputs[I]);
+        bool Match = std::isnan(Inputs[I])
+                         ? isHalfNaN(Converted[I]) && (Converted[I] >> 15) == (Want >> 15)
+                         : Converted[I] == Want;
+        if (!Match)
+            Fail("float->half", floatBits(Inputs[I]), Converted[I], Want);
+    }
+    return Failures;
+}
+
+int main() {
+    std::vector<float> Inputs = halfBoundaryInputs();
+    unsigned Failures = 0;
+    for (int Isa = FP16_ISA_SCALAR; Isa < FP16_ISA_COUNT; ++Isa) {
+        if (!fp16_isa_supported(fp16_isa(Isa))) {
+            std::printf("%-8s skipped: not supported by this CPU\n", fp16_isa_name(fp16_isa(Isa)));
+            continue;
+        }
+        unsigned KernelFailures = checkKernel(fp16_isa(Isa), Inputs);
+        std::printf("%-8s %s (65536 halves, %zu floats)\n", fp16_isa_name(fp16_isa(Isa)),
+                    KernelFailures ? "FAILED" : "ok", Inputs.size());
+        Failures += KernelFailures;
+    }
+    return Failures ? 1 : 0;
+}
@@ -87,6 +87,119 @@ void test_type_qualifiers() {
     printf("Type qualifier test completed\n");
 }
 
+// Test case 6: Values assigned after initialization
+void test_live_ranges() {
+    printf("=== Testing Live Ranges ===\n");
+    
+    // Later stores must fit as well as the initializer
+    float grows = 1.0f;
+    grows = 70000.0f;                   // Out of range after reassignment
+    
+    float scaled = 2.0f;
+    scaled *= 50000.0f;                 // Compound assignment overflows FP16
+    
+    // Loop bounded by its condition
+    float step = 0.0f;
+    for (step = 0.0f; step < 10.0f; step += 0.5f) { } // Should convert
+    
+    // Accumulator without a bound
+    float sum = 0.0f;
+    for (int i = 0; i < 1000000; i++)
+        sum += 1.0f;                    // Widened to an unbounded range
+    
+    // Address escapes
+    float escaped = 1.0f;
+    scanf("%f", &escaped);              // Value range unknown
+    
+    printf("Live range test completed\n");
+}
+
+// Storage accounting: arrays and structs count in full, with padding
+struct sample {
+    char tag;                           // 3 bytes of padding follow
+    float value;
+    double scale;
+};
+
+static float lookup_table[256];         // 1024 bytes of static storage
+struct sample samples[16];              // 16 * 16 bytes, global
+
+static float half_of(float x) {
+    return x / 2.0f;
+}
+
+void test_function_calls() {
+    printf("=== Testing Function Calls ===\n");
+    
+    // Built-in summaries for <math.h>
+    float wave = sinf(1.0f);            // Should convert: always in [-1, 1]
+    float grow = expf(20.0f);           // exp(20) exceeds FP16 range
+    
+    // Summaries of functions in this file
+    float half = half_of(3.0f);         // Should convert: 1.5
+    float big = half_of(200000.0f);     // Still out of range after halving
+    
+    printf("Function call test completed\n");
+}
+
+// Struct fields: every store in the file decides the field's range
+struct particle {
+    char alive;
+    double mass;                        // Not a float field
+    float x;                            // Should convert: kept in [0, 100]
+    char kind;
+    float energy;                       // 1e6 exceeds FP16 range
+    float y;                            // Should convert: kept in [0, 100]
+};
+
+static struct particle particles[64];
+
+void test_struct_fields() {
+    printf("=== Testing Struct Fields ===\n");
+    
+    for (int i = 0; i < 64; i++) {
+        particles[i].alive = 1;
+        particles[i].mass = 1.0e40;
+        particles[i].x = 10.0f;
+        particles[i].y = 100.0f;
+        particles[i].energy = 1.0e6f;
+    }
+    // The hot loop reads x and y most often
+    for (int step = 0; step < 100; step++)
+        for (int i = 0; i < 64; i++)
+            if (particles[i].x > 50.0f)
+                particles[i].x = particles[i].y / 2.0f;
+    
+    printf("Struct field test completed\n");
+}
+
+// Float arrays: stored as 16-bit patterns with -fprecision-demote-arrays
+static const float weights[4] = {0.25f, 0.5f, 0.75f, 1.0f}; // Should convert: hex initializers
+static float spectrum[8] = {1.0e5f};    // 1e5 exceeds FP16 range
+float exported_table[4];                // Externally visible: kept
+
+struct filter {
+    int taps;
+    float coeffs[4];                    // Should convert: kept in [0, 1]
+};
+
+static struct filter lowpass = {4, {0.25f, 0.25f, 0.25f, 0.25f}};
+
+void test_float_arrays() {
+    printf("=== Testing Float Arrays ===\n");
+    
+    float buffer[16];                   // Should convert: stack buffer in [0, 1]
+    for (int i = 0; i < 16; i++)
+        buffer[i] = weights[i % 4];
+    
+    float acc = 0.0f;
+    for (int i = 0; i < 16; i++)
+        acc += buffer[i] * lowpass.coeffs[i % 4];
+    spectrum[0] = acc;
+    
+    printf("Float array test completed: %f\n", acc);
+}
+
 int main() {
     printf("Starting FP16 Demotion Plugin Tests\n");
     printf("====================================\n");
@@ -96,6 +209,10 @@ int main() {
     test_edge_cases();
     test_variable_usage();
     test_type_qualifiers();
+    test_live_ranges();
+    test_function_calls();
+    test_struct_fields();
+    test_float_arrays();
     
     printf("\nAll tests completed!\n");
     return 0;
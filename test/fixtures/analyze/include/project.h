@@ -0,0 +1 @@
+static inline float project_gain(void) { return 0.5f; }
@@ -0,0 +1,8 @@
+#include "project.h"
+#include "vendor.h"
+
+float gains(void) {
+    float project = project_gain();
+    float vendor = vendor_gain();
+    return project + vendor;
+}
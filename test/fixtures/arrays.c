@@ -0,0 +1,12 @@
+static const float weights[4] = {0.5f, 0.25f, 1.0f, 2.0f};
+static float samples[8];
+static float big[2] = {1.0e6f, 0.0f};
+
+void fill(void) {
+    for (int i = 0; i < 8; i++)
+        samples[i] = weights[i % 4];
+}
+
+float first(void) {
+    return samples[0] + big[1];
+}
@@ -0,0 +1,8 @@
+float budget(void) {
+    float exact = 0.5f;
+    float rounded = 0.5f;
+    rounded = rounded * 3.0f + 0.25f;
+    __attribute__((annotate("fp16_error_budget=0.5"))) float loose = 0.5f;
+    loose = loose * 3.0f;
+    return exact + rounded + loose;
+}
@@ -0,0 +1,4 @@
+float scale(float x) {
+    float gain = 2.5f;
+    return x * gain + 0.125f;
+}
@@ -0,0 +1,9 @@
+static float cold = 0.5f;
+
+float hot(const float *x) {
+    float hot_scale = 0.5f;
+    float sum = 0.0f;
+    for (int i = 0; i < 1000; ++i)
+        sum += x[i] * hot_scale;
+    return sum;
+}
@@ -0,0 +1,6 @@
+double tier(void) {
+    double scale = 0.5;
+    double tiny = 1e-300;
+    double a = 3.0, b = 1e300;
+    return scale + tiny + a + b;
+}
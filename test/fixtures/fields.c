@@ -0,0 +1,21 @@
+struct particle {
+    char alive;
+    double mass;
+    float x;
+    char kind;
+    float energy;
+    float y;
+};
+
+static struct particle particles[64];
+
+void init(void) {
+    for (int i = 0; i < 64; i++) {
+        particles[i].alive = 1;
+        particles[i].mass = 1.0e40;
+        particles[i].x = 10.0f;
+        particles[i].kind = 0;
+        particles[i].energy = 1.0e6f;
+        particles[i].y = 100.0f;
+    }
+}
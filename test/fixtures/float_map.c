@@ -0,0 +1,5 @@
+float exact(void) { return 0.5f; }
+float inexact(void) { return 0.1f; }
+float overflow(void) { return 1.0e6f; }
+float underflow(void) { return 1.0e-10f; }
+float several(float x) { return x * 0.25f + 3.0f - 65504.0f; }
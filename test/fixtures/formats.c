@@ -0,0 +1,3 @@
+float half(void) { return 0.5f; }
+float wide(void) { return 262144.0f; }
+float tenth(void) { return 0.1f; }
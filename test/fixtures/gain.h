@@ -0,0 +1 @@
+static inline float gain(void) { return 1.5f; }
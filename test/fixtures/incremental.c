@@ -0,0 +1,6 @@
+static float helper(float x) { return x * 0.5f; }
+float uses_helper(float x) { return helper(x) + 1.0f; }
+float independent(void) {
+    float k = 2.0f;
+    return k;
+}
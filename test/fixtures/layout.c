@@ -0,0 +1,21 @@
+struct sample {
+    char tag;
+    double when;
+    float value;
+};
+
+static float table[16];
+static float offset = 0.5f;
+static float gain = 0.25f;
+
+void record(void) {
+    static float peak = 1.0f;
+    float scale = 2.0f;
+    float bias = 0.5f;
+    peak = 2.0f;
+}
+
+void history(void) {
+    struct sample recent[2];
+    char flag = 0;
+}
@@ -0,0 +1,19 @@
+float data[64];
+float out[64];
+
+void scale(void) {
+    for (int i = 0; i < 64; ++i)
+        out[i] = data[i] * 0.5f;
+}
+
+float total(void) {
+    float sum = 0.0f;
+    for (int i = 0; i < 64; ++i)
+        sum += data[i];
+    return sum;
+}
+
+void smooth(void) {
+    for (int i = 1; i < 64; ++i)
+        out[i] = out[i - 1] * 0.5f + data[i];
+}
@@ -0,0 +1,6 @@
+static float gain = 0.5f;
+
+float scale(float x) {
+    float scaled = x * gain;
+    return scaled + 0.25f;
+}
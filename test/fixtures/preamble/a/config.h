@@ -0,0 +1 @@
+#define SCALE 1.0f
@@ -0,0 +1 @@
+#define SCALE 100000.0f
@@ -0,0 +1,6 @@
+#include "config.h"
+
+float scale(float x) {
+    float s = SCALE;
+    return x * s;
+}
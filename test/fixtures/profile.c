@@ -0,0 +1,12 @@
+float attenuate(float x) {
+    float y = x * 0.5f;
+    float big = x * 1000.0f;
+    return y + big * 0.0f;
+}
+
+int main(void) {
+    float sum = 0.0f;
+    for (int i = 0; i < 100; ++i)
+        sum += attenuate((float)i);
+    return sum > 0.0f ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+void consume(float *p);
+
+float external_gain = 2.0f;
+static float bias = 0.5f;
+
+float scale(float x) {
+    return x * external_gain + bias;
+}
+
+void set_bias(void) {
+    bias = 0.25f;
+}
+
+void ranges(void) {
+    float grows = 1.0f;
+    grows = 70000.0f;
+
+    float step = 0.0f;
+    for (step = 0.0f; step < 10.0f; step += 0.5f) {
+    }
+
+    float doubled = 1.0f;
+    while (doubled < 100.0f)
+        doubled = doubled * 2.0f + 1.0f;
+
+    float sum = 0.0f;
+    for (int i = 0; i < 1000; i++)
+        sum += 1.0f;
+
+    float escaped = 1.0f;
+    consume(&escaped);
+}
@@ -0,0 +1,12 @@
+#define TWICE(v) ((v) + (v))
+
+static float src[4] = {1.0f, 2.0f, 0.5f, 0.25f};
+static float dst[4];
+static float sum[4];
+
+void copy(void) {
+    for (int i = 0; i < 4; ++i) {
+        dst[i] = src[i];
+        sum[i] = TWICE(src[i]);
+    }
+}
@@ -0,0 +1,4 @@
+float scale(float x) {
+    float s = SCALE;
+    return x * s;
+}
@@ -0,0 +1,11 @@
+float attenuation(int level) {
+    if (level < 0)
+        return 0.0f;
+    if (level > 10)
+        return 1.0f;
+    return level * 0.1f;
+}
+
+float scaled(float x) {
+    return x * 1000.0f;
+}
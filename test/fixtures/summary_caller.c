@@ -0,0 +1,8 @@
+float attenuation(int level);
+float scaled(float x);
+
+void mix(int level) {
+    float gain = attenuation(level);
+    float small = scaled(2.0f);
+    float big = scaled(100.0f);
+}
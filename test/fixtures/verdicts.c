@@ -0,0 +1,5 @@
+float scaled(void) {
+    float a = 1.0e5f / 10.0f;
+    float b = 1.0f / 3.0f;
+    return a + b;
+}